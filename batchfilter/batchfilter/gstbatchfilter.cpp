@@ -0,0 +1,1012 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob 
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+* Boston, MA 02110-1335, USA.
+*/
+/**
+* SECTION:element-gstbatchfilter
+*
+* The batchfilter element blurs, sharpens or bilateral filters the frames
+* of several grayscale video streams as one batch. Every sink_N pad
+* requested gets a src_N pad its filtered frames leave on. The element
+* waits for a frame from every stream and batches those due first, by
+* running time, within half a frame of each other, leaving the frames of
+* streams that are ahead for a later batch. It runs each pass of the engine
+* over the frames of all streams at once, with one kernel and one set of
+* scratch images for the batch. The always src pad of the aggregator
+* carries no frames.
+*
+* gst-launch-1.0 batchfilter name=b filter=bilateral filtering=1
+*   v4l2src device=/dev/video0 ! videoconvert ! b.sink_0  b.src_0 ! autovideosink
+*   v4l2src device=/dev/video1 ! videoconvert ! b.sink_1  b.src_1 ! autovideosink
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/base/gstaggregator.h>
+#include <gst/base/gstflowcombiner.h>
+#include <gst/video/video.h>
+#include "gstbatchfilter.h"
+#include "cvallocation.h"
+#include "cvblur.h"
+#include "cvbilateral.h"
+#include "cvscheduler.h"
+#include "cvstats.h"
+#include "cvstore.h"
+#include <cstdlib>
+#include <cstring>
+
+
+GST_DEBUG_CATEGORY_STATIC(gst_batch_filter_debug_category);
+#define GST_CAT_DEFAULT gst_batch_filter_debug_category
+
+/* Quick fix to make GParamFlags enums cooperate with | */
+inline GParamFlags operator | (GParamFlags lhs, GParamFlags rhs)
+{
+	return static_cast<GParamFlags>(static_cast<int>(lhs) | static_cast<int>(rhs));
+}
+
+
+static void gst_batch_filter_set_property(GObject * object,
+	guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_batch_filter_get_property(GObject * object,
+	guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_batch_filter_finalize(GObject * object);
+static GstPad *gst_batch_filter_request_new_pad(GstElement * element,
+	GstPadTemplate * templ, const gchar * req_name, const GstCaps * caps);
+static void gst_batch_filter_release_pad(GstElement * element, GstPad * pad);
+static gboolean gst_batch_filter_sink_event(GstAggregator * aggregator,
+	GstAggregatorPad * aggpad, GstEvent * event);
+static gboolean gst_batch_filter_sink_query(GstAggregator * aggregator,
+	GstAggregatorPad * aggpad, GstQuery * query);
+static gboolean gst_batch_filter_start(GstAggregator * aggregator);
+static gboolean gst_batch_filter_stop(GstAggregator * aggregator);
+static GstFlowReturn gst_batch_filter_aggregate(GstAggregator * aggregator,
+	gboolean timeout);
+
+enum
+{
+	PROP_0,
+	PROP_FILTER,
+	PROP_SIGMA,
+	PROP_FILTERING,
+	PROP_ENGINE,
+	PROP_SIGMAD,
+	PROP_SIGMAR,
+	PROP_FLAT_TOLERANCE,
+	PROP_SHARPEN,
+	PROP_PARALLEL,
+	PROP_STATS,
+	PROP_STATS_INTERVAL
+};
+
+/* Only designed and properly tested for I420 */
+#define VIDEO_SRC_CAPS \
+    GST_VIDEO_CAPS_MAKE("{ I420 }")
+
+#define VIDEO_SINK_CAPS \
+    GST_VIDEO_CAPS_MAKE("{ I420 }")
+
+static GstStaticPadTemplate gst_batch_filter_src_stream_template =
+GST_STATIC_PAD_TEMPLATE("src_%u", GST_PAD_SRC, GST_PAD_SOMETIMES,
+	GST_STATIC_CAPS(VIDEO_SRC_CAPS));
+
+
+GType
+gst_batch_filter_mode_get_type(void)
+{
+	static GType mode_type = 0;
+	static const GEnumValue modes[] = {
+		{ GST_BATCH_FILTER_MODE_BLUR, "Gaussian blur or sharpening, like blurfilter", "blur" },
+		{ GST_BATCH_FILTER_MODE_BILATERAL, "Bilateral filter and sharpening, like bilateralfilter", "bilateral" },
+		{ 0, NULL, NULL }
+	};
+
+	if (!mode_type)
+		mode_type = g_enum_register_static("GstBatchFilterMode", modes);
+	return mode_type;
+}
+
+GType
+gst_batch_filter_engine_get_type(void)
+{
+	static GType engine_type = 0;
+	static const GEnumValue engines[] = {
+		{ GST_BATCH_FILTER_ENGINE_DIRECT, "Full resolution separable convolution", "direct" },
+		{ GST_BATCH_FILTER_ENGINE_PYRAMID, "Decimate, convolve and upsample for large sigma", "pyramid" },
+		{ 0, NULL, NULL }
+	};
+
+	if (!engine_type)
+		engine_type = g_enum_register_static("GstBatchFilterEngine", engines);
+	return engine_type;
+}
+
+
+G_DEFINE_TYPE(GstBatchFilterPad, gst_batch_filter_pad, GST_TYPE_AGGREGATOR_PAD);
+
+static void
+gst_batch_filter_pad_class_init(GstBatchFilterPadClass * klass)
+{
+}
+
+static void
+gst_batch_filter_pad_init(GstBatchFilterPad * pad)
+{
+	gst_video_info_init(&pad->info);
+	pad->negotiated = FALSE;
+	pad->srcpad = NULL;
+	pad->eos_sent = FALSE;
+	pad->pool = NULL;
+}
+
+/* Returns a reference to the src pad of the stream, NULL once it is released */
+static GstPad *
+gst_batch_filter_pad_get_srcpad(GstBatchFilterPad * pad)
+{
+	GstElement *element = gst_pad_get_parent_element(GST_PAD(pad));
+	GstPad *srcpad = NULL;
+
+	if (element == NULL)
+		return NULL;
+	GST_OBJECT_LOCK(element);
+	if (pad->srcpad != NULL)
+		srcpad = GST_PAD(gst_object_ref(pad->srcpad));
+	GST_OBJECT_UNLOCK(element);
+	gst_object_unref(element);
+	return srcpad;
+}
+
+/* Deactivates and drops the pool of the stream, the next frame sets up a new one */
+static void
+gst_batch_filter_pad_clear_pool(GstBatchFilterPad * pad)
+{
+	GstBufferPool *pool;
+
+	GST_OBJECT_LOCK(pad);
+	pool = pad->pool;
+	pad->pool = NULL;
+	GST_OBJECT_UNLOCK(pad);
+
+	if (pool != NULL)
+	{
+		gst_buffer_pool_set_active(pool, FALSE);
+		gst_object_unref(pool);
+	}
+}
+
+/*
+ *	Makes the pool of the filtered frames of a stream: the one downstream of
+ *	its src pad offers, made to hand out aligned frames when downstream
+ *	understands video meta, or else a video buffer pool of its own.
+ */
+static GstBufferPool *
+gst_batch_filter_pad_decide_pool(GstBatchFilterPad * pad, GstPad * srcpad)
+{
+	GstCaps *caps = gst_video_info_to_caps(&pad->info);
+	GstQuery *query = gst_query_new_allocation(caps, TRUE);
+	GstBufferPool *pool = NULL;
+	GstStructure *config;
+	guint size = 0, min = 0, max = 0;
+
+	if (gst_pad_peer_query(srcpad, query))
+		cv_decide_aligned_pool(query, 0);
+	if (gst_query_get_n_allocation_pools(query) > 0)
+		gst_query_parse_nth_allocation_pool(query, 0, &pool, &size, &min, &max);
+	gst_query_unref(query);
+
+	if (pool != NULL)
+	{
+		config = gst_buffer_pool_get_config(pool);
+		gst_buffer_pool_config_set_params(config, caps, MAX(size, (guint)GST_VIDEO_INFO_SIZE(&pad->info)), min, max);
+		if (!gst_buffer_pool_set_config(pool, config))
+		{
+			gst_object_unref(pool);
+			pool = NULL;
+		}
+	}
+	if (pool == NULL)
+	{
+		pool = gst_video_buffer_pool_new();
+		config = gst_buffer_pool_get_config(pool);
+		gst_buffer_pool_config_set_params(config, caps, GST_VIDEO_INFO_SIZE(&pad->info), 0, 0);
+		gst_buffer_pool_set_config(pool, config);
+	}
+	gst_caps_unref(caps);
+
+	if (!gst_buffer_pool_set_active(pool, TRUE))
+	{
+		gst_object_unref(pool);
+		return NULL;
+	}
+	return pool;
+}
+
+/* Returns a reference to the pool of the stream, setting it up first if it has none */
+static GstBufferPool *
+gst_batch_filter_pad_get_pool(GstBatchFilterPad * pad, GstPad * srcpad)
+{
+	GstBufferPool *pool = NULL;
+
+	GST_OBJECT_LOCK(pad);
+	if (pad->pool != NULL)
+		pool = GST_BUFFER_POOL(gst_object_ref(pad->pool));
+	GST_OBJECT_UNLOCK(pad);
+	if (pool != NULL)
+		return pool;
+
+	pool = gst_batch_filter_pad_decide_pool(pad, srcpad);
+	if (pool == NULL)
+		return NULL;
+	GST_OBJECT_LOCK(pad);
+	if (pad->pool == NULL)
+		pad->pool = GST_BUFFER_POOL(gst_object_ref(pool));
+	GST_OBJECT_UNLOCK(pad);
+	return pool;
+}
+
+/* Running time of a frame of the stream, GST_CLOCK_TIME_NONE without a timestamp */
+static GstClockTime
+gst_batch_filter_pad_running_time(GstBatchFilterPad * pad, GstBuffer * buffer)
+{
+	GstAggregatorPad *aggpad = GST_AGGREGATOR_PAD(pad);
+	GstClockTime time = GST_CLOCK_TIME_NONE;
+
+	if (!GST_BUFFER_PTS_IS_VALID(buffer))
+		return GST_CLOCK_TIME_NONE;
+	GST_OBJECT_LOCK(aggpad);
+	if (aggpad->segment.format == GST_FORMAT_TIME)
+		time = gst_segment_to_running_time(&aggpad->segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+	GST_OBJECT_UNLOCK(aggpad);
+	return time;
+}
+
+/* Half the duration of a frame of the stream, 0 when neither the frame nor the caps tell it */
+static GstClockTime
+gst_batch_filter_pad_half_frame(GstBatchFilterPad * pad, GstBuffer * buffer)
+{
+	if (GST_BUFFER_DURATION_IS_VALID(buffer))
+		return GST_BUFFER_DURATION(buffer) / 2;
+	if (pad->negotiated && GST_VIDEO_INFO_FPS_N(&pad->info) > 0)
+		return gst_util_uint64_scale_int(GST_SECOND, GST_VIDEO_INFO_FPS_D(&pad->info),
+			2 * GST_VIDEO_INFO_FPS_N(&pad->info));
+	return 0;
+}
+
+
+/* class initialization */
+G_DEFINE_TYPE_WITH_CODE(GstBatchFilter, gst_batch_filter, GST_TYPE_AGGREGATOR,
+	GST_DEBUG_CATEGORY_INIT(gst_batch_filter_debug_category, "batchfilter", 0,
+		"debug category for batchfilter filter"));
+
+
+/* Filter class initialization */
+static void
+gst_batch_filter_class_init(GstBatchFilterClass * klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	GstElementClass *element_class = GST_ELEMENT_CLASS(klass);
+	GstAggregatorClass *aggregator_class = GST_AGGREGATOR_CLASS(klass);
+
+	gst_element_class_add_pad_template(element_class,
+		gst_pad_template_new("src", GST_PAD_SRC, GST_PAD_ALWAYS,
+			gst_caps_from_string(VIDEO_SRC_CAPS)));
+	gst_element_class_add_pad_template(element_class,
+		gst_pad_template_new_with_gtype("sink_%u", GST_PAD_SINK, GST_PAD_REQUEST,
+			gst_caps_from_string(VIDEO_SINK_CAPS), GST_TYPE_BATCH_FILTER_PAD));
+	gst_element_class_add_static_pad_template(element_class, &gst_batch_filter_src_stream_template);
+
+	gst_element_class_set_static_metadata(element_class,
+		"Batch filter", "Generic", "Blur or bilateral filter over the frames of many streams at once",
+		"Jakob");
+
+	gobject_class->set_property = gst_batch_filter_set_property;
+	gobject_class->get_property = gst_batch_filter_get_property;
+	gobject_class->finalize = gst_batch_filter_finalize;
+	element_class->request_new_pad = GST_DEBUG_FUNCPTR(gst_batch_filter_request_new_pad);
+	element_class->release_pad = GST_DEBUG_FUNCPTR(gst_batch_filter_release_pad);
+	aggregator_class->sink_event = GST_DEBUG_FUNCPTR(gst_batch_filter_sink_event);
+	aggregator_class->sink_query = GST_DEBUG_FUNCPTR(gst_batch_filter_sink_query);
+	aggregator_class->start = GST_DEBUG_FUNCPTR(gst_batch_filter_start);
+	aggregator_class->stop = GST_DEBUG_FUNCPTR(gst_batch_filter_stop);
+	aggregator_class->aggregate = GST_DEBUG_FUNCPTR(gst_batch_filter_aggregate);
+
+	/* Install class properties */
+	g_object_class_install_property(gobject_class, PROP_FILTER,
+		g_param_spec_enum("filter", "Filter", "Filter run on every stream",
+			GST_TYPE_BATCH_FILTER_MODE, GST_BATCH_FILTER_MODE_BLUR,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_SIGMA,
+		g_param_spec_double("sigma", "Sigma", "Sigma value of gaussian kernel",
+			0.0, 100.0, 0.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_FILTERING,
+		g_param_spec_int("filtering", "Filtering",
+			"1 for high pass, -1 for low pass, for the bilateral filter any other value than 0 enables it",
+			-1, 1, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_ENGINE,
+		g_param_spec_enum("engine", "Engine", "Method used to compute the gaussian",
+			GST_TYPE_BATCH_FILTER_ENGINE, GST_BATCH_FILTER_ENGINE_DIRECT,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_SIGMAD,
+		g_param_spec_double("sigmad", "Domain sigma", "Sigma of the domain kernel of the bilateral filter",
+			0.0, 100.0, 2.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_SIGMAR,
+		g_param_spec_double("sigmar", "Range sigma", "Sigma of the range kernel of the bilateral filter",
+			0.0, 255.0, 25.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_FLAT_TOLERANCE,
+		g_param_spec_double("flat-tolerance", "Flat tolerance",
+			"Largest deviation of the range weights from 1 for which a block is filtered as flat, 0 disables it",
+			0.0, 0.5, 0.01, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_SHARPEN,
+		g_param_spec_double("sharpen", "Sharpen",
+			"Sigma of the unsharp mask after the bilateral filter, 0 disables it",
+			0.0, 100.0, 0.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_PARALLEL,
+		g_param_spec_boolean("parallel", "Parallel",
+			"Filter each batch on the worker threads shared by all filter elements",
+			TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_STATS,
+		g_param_spec_boxed("stats", "Statistics",
+			"Batches processed, time per stage, latency histogram, engine and memory use",
+			GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_STATS_INTERVAL,
+		g_param_spec_uint("stats-interval", "Statistics interval",
+			"Milliseconds between element messages with the statistics, 0 disables them",
+			0, G_MAXUINT, 1000, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+
+/* Initialize start values for the filter parameters */
+static void
+gst_batch_filter_init(GstBatchFilter *batchfilter)
+{
+	batchfilter->filter = GST_BATCH_FILTER_MODE_BLUR;
+	batchfilter->sigma = 0.0;
+	batchfilter->filtering = 0;
+	batchfilter->engine = GST_BATCH_FILTER_ENGINE_DIRECT;
+	batchfilter->sigmad = 2.0;
+	batchfilter->sigmar = 25.0;
+	batchfilter->flat_tolerance = 0.01;
+	batchfilter->sharpen = 0.0;
+	batchfilter->parallel = TRUE;
+	batchfilter->scheduler = cv_scheduler_get();
+	batchfilter->stream = cv_scheduler_stream_new(batchfilter->scheduler);
+	batchfilter->scratch.data = NULL;
+	batchfilter->scratch.size = 0;
+	batchfilter->flow_combiner = gst_flow_combiner_new();
+	batchfilter->stats = cv_stats_new();
+	batchfilter->stats_interval = 1000;
+}
+
+void
+gst_batch_filter_set_property(GObject * object, guint property_id,
+	const GValue * value, GParamSpec * pspec)
+{
+	GstBatchFilter *batchfilter = GST_BATCH_FILTER(object);
+
+	GST_OBJECT_LOCK(batchfilter);
+	switch (property_id) {
+	case PROP_FILTER:
+		batchfilter->filter = (GstBatchFilterMode)g_value_get_enum(value);
+		break;
+	case PROP_SIGMA:
+		batchfilter->sigma = g_value_get_double(value);
+		break;
+	case PROP_FILTERING:
+		batchfilter->filtering = g_value_get_int(value);
+		break;
+	case PROP_ENGINE:
+		batchfilter->engine = (GstBatchFilterEngine)g_value_get_enum(value);
+		break;
+	case PROP_SIGMAD:
+		batchfilter->sigmad = g_value_get_double(value);
+		break;
+	case PROP_SIGMAR:
+		batchfilter->sigmar = g_value_get_double(value);
+		break;
+	case PROP_FLAT_TOLERANCE:
+		batchfilter->flat_tolerance = g_value_get_double(value);
+		break;
+	case PROP_SHARPEN:
+		batchfilter->sharpen = g_value_get_double(value);
+		break;
+	case PROP_PARALLEL:
+		batchfilter->parallel = g_value_get_boolean(value);
+		break;
+	case PROP_STATS_INTERVAL:
+		batchfilter->stats_interval = g_value_get_uint(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+		break;
+	}
+	GST_OBJECT_UNLOCK(batchfilter);
+}
+
+/* Property getters for external access */
+void
+gst_batch_filter_get_property(GObject * object, guint property_id,
+	GValue * value, GParamSpec * pspec)
+{
+	GstBatchFilter *batchfilter = GST_BATCH_FILTER(object);
+
+	switch (property_id) {
+	case PROP_FILTER:
+		g_value_set_enum(value, batchfilter->filter);
+		break;
+	case PROP_SIGMA:
+		g_value_set_double(value, batchfilter->sigma);
+		break;
+	case PROP_FILTERING:
+		g_value_set_int(value, batchfilter->filtering);
+		break;
+	case PROP_ENGINE:
+		g_value_set_enum(value, batchfilter->engine);
+		break;
+	case PROP_SIGMAD:
+		g_value_set_double(value, batchfilter->sigmad);
+		break;
+	case PROP_SIGMAR:
+		g_value_set_double(value, batchfilter->sigmar);
+		break;
+	case PROP_FLAT_TOLERANCE:
+		g_value_set_double(value, batchfilter->flat_tolerance);
+		break;
+	case PROP_SHARPEN:
+		g_value_set_double(value, batchfilter->sharpen);
+		break;
+	case PROP_PARALLEL:
+		g_value_set_boolean(value, batchfilter->parallel);
+		break;
+	case PROP_STATS:
+		g_value_take_boxed(value, cv_stats_get_structure(batchfilter->stats, "batchfilter-stats"));
+		break;
+	case PROP_STATS_INTERVAL:
+		g_value_set_uint(value, batchfilter->stats_interval);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+		break;
+	}
+}
+
+static void
+gst_batch_filter_finalize(GObject * object)
+{
+	GstBatchFilter *batchfilter = GST_BATCH_FILTER(object);
+
+	cv_stats_free(batchfilter->stats);
+	cv_scheduler_stream_free(batchfilter->stream);
+	cv_batch_scratch_clear(&batchfilter->scratch);
+	gst_flow_combiner_free(batchfilter->flow_combiner);
+
+	G_OBJECT_CLASS(gst_batch_filter_parent_class)->finalize(object);
+}
+
+/* Upstream events of a stream go to its own upstream, e.g. a seek of one camera */
+static gboolean
+gst_batch_filter_src_event(GstPad * pad, GstObject * parent, GstEvent * event)
+{
+	GstPad *sinkpad = GST_PAD(gst_pad_get_element_private(pad));
+
+	return gst_pad_push_event(sinkpad, event);
+}
+
+/* Frames keep their caps, timing and position, so the upstream of the stream answers */
+static gboolean
+gst_batch_filter_src_query(GstPad * pad, GstObject * parent, GstQuery * query)
+{
+	GstPad *sinkpad = GST_PAD(gst_pad_get_element_private(pad));
+
+	return gst_pad_peer_query(sinkpad, query);
+}
+
+/* Adds the src pad of the same number to every sink pad requested */
+static GstPad *
+gst_batch_filter_request_new_pad(GstElement * element, GstPadTemplate * templ,
+	const gchar * req_name, const GstCaps * caps)
+{
+	GstBatchFilter *batchfilter = GST_BATCH_FILTER(element);
+	GstBatchFilterPad *pad;
+	GstPad *srcpad;
+	gchar *name;
+
+	pad = (GstBatchFilterPad *)GST_ELEMENT_CLASS(gst_batch_filter_parent_class)->request_new_pad(element,
+		templ, req_name, caps);
+	if (pad == NULL)
+		return NULL;
+
+	/* The aggregator names its sink pads sink_N */
+	name = g_strdup_printf("src_%s", GST_PAD_NAME(pad) + strlen("sink_"));
+	srcpad = gst_pad_new_from_static_template(&gst_batch_filter_src_stream_template, name);
+	g_free(name);
+	gst_pad_set_element_private(srcpad, pad);
+	gst_pad_set_event_function(srcpad, GST_DEBUG_FUNCPTR(gst_batch_filter_src_event));
+	gst_pad_set_query_function(srcpad, GST_DEBUG_FUNCPTR(gst_batch_filter_src_query));
+	gst_pad_use_fixed_caps(srcpad);
+
+	GST_OBJECT_LOCK(batchfilter);
+	pad->srcpad = srcpad;
+	gst_flow_combiner_add_pad(batchfilter->flow_combiner, srcpad);
+	GST_OBJECT_UNLOCK(batchfilter);
+
+	if (GST_STATE(element) > GST_STATE_READY)
+		gst_pad_set_active(srcpad, TRUE);
+	gst_element_add_pad(element, srcpad);
+
+	return GST_PAD(pad);
+}
+
+static void
+gst_batch_filter_release_pad(GstElement * element, GstPad * pad)
+{
+	GstBatchFilter *batchfilter = GST_BATCH_FILTER(element);
+	GstBatchFilterPad *batchpad = GST_BATCH_FILTER_PAD(pad);
+	GstPad *srcpad;
+
+	GST_OBJECT_LOCK(batchfilter);
+	srcpad = batchpad->srcpad;
+	batchpad->srcpad = NULL;
+	if (srcpad != NULL)
+		gst_flow_combiner_remove_pad(batchfilter->flow_combiner, srcpad);
+	GST_OBJECT_UNLOCK(batchfilter);
+
+	if (srcpad != NULL)
+	{
+		gst_pad_set_active(srcpad, FALSE);
+		gst_element_remove_pad(element, srcpad);
+	}
+	gst_batch_filter_pad_clear_pool(batchpad);
+
+	GST_ELEMENT_CLASS(gst_batch_filter_parent_class)->release_pad(element, pad);
+}
+
+/*
+ *	Passes the events of a stream on to its own src pad. The aggregator
+ *	still sees the ones it keeps track of, the EOS leaves once the last
+ *	frame of the stream has been filtered.
+ */
+static gboolean
+gst_batch_filter_sink_event(GstAggregator * aggregator, GstAggregatorPad * aggpad, GstEvent * event)
+{
+	GstBatchFilterPad *pad = GST_BATCH_FILTER_PAD(aggpad);
+	GstPad *srcpad;
+	gboolean ret = TRUE;
+
+	if (GST_EVENT_TYPE(event) == GST_EVENT_EOS)
+		return GST_AGGREGATOR_CLASS(gst_batch_filter_parent_class)->sink_event(aggregator, aggpad, event);
+
+	srcpad = gst_batch_filter_pad_get_srcpad(pad);
+	switch (GST_EVENT_TYPE(event))
+	{
+	case GST_EVENT_CAPS:
+	{
+		GstCaps *caps;
+
+		gst_event_parse_caps(event, &caps);
+		pad->negotiated = gst_video_info_from_caps(&pad->info, caps);
+		gst_batch_filter_pad_clear_pool(pad);
+		if (srcpad != NULL && pad->negotiated)
+			ret = gst_pad_push_event(srcpad, event);
+		else
+		{
+			ret = pad->negotiated;
+			gst_event_unref(event);
+		}
+		break;
+	}
+	case GST_EVENT_STREAM_START:
+	case GST_EVENT_SEGMENT:
+	case GST_EVENT_GAP:
+	case GST_EVENT_FLUSH_START:
+	case GST_EVENT_FLUSH_STOP:
+		if (GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP)
+		{
+			pad->eos_sent = FALSE;
+			GST_OBJECT_LOCK(aggregator);
+			gst_flow_combiner_reset(GST_BATCH_FILTER(aggregator)->flow_combiner);
+			GST_OBJECT_UNLOCK(aggregator);
+		}
+		if (srcpad != NULL)
+			gst_pad_push_event(srcpad, gst_event_ref(event));
+		ret = GST_AGGREGATOR_CLASS(gst_batch_filter_parent_class)->sink_event(aggregator, aggpad, event);
+		break;
+	default:
+		if (srcpad != NULL)
+			ret = gst_pad_push_event(srcpad, event);
+		else
+			gst_event_unref(event);
+		break;
+	}
+
+	if (srcpad != NULL)
+		gst_object_unref(srcpad);
+	return ret;
+}
+
+/* Each stream accepts the caps downstream of its own src pad accepts */
+static gboolean
+gst_batch_filter_sink_query(GstAggregator * aggregator, GstAggregatorPad * aggpad, GstQuery * query)
+{
+	GstBatchFilterPad *pad = GST_BATCH_FILTER_PAD(aggpad);
+	GstPad *srcpad;
+
+	if (GST_QUERY_TYPE(query) != GST_QUERY_CAPS)
+		return GST_AGGREGATOR_CLASS(gst_batch_filter_parent_class)->sink_query(aggregator, aggpad, query);
+
+	srcpad = gst_batch_filter_pad_get_srcpad(pad);
+	if (srcpad != NULL)
+	{
+		GstCaps *filter;
+		GstCaps *templ = gst_pad_get_pad_template_caps(GST_PAD(pad));
+		GstCaps *peercaps;
+		GstCaps *caps;
+
+		gst_query_parse_caps(query, &filter);
+		peercaps = gst_pad_peer_query_caps(srcpad, filter);
+		caps = gst_caps_intersect(peercaps, templ);
+		gst_query_set_caps_result(query, caps);
+		gst_caps_unref(caps);
+		gst_caps_unref(peercaps);
+		gst_caps_unref(templ);
+		gst_object_unref(srcpad);
+		return TRUE;
+	}
+	return GST_AGGREGATOR_CLASS(gst_batch_filter_parent_class)->sink_query(aggregator, aggpad, query);
+}
+
+static gboolean
+gst_batch_filter_start(GstAggregator * aggregator)
+{
+	GstBatchFilter *batchfilter = GST_BATCH_FILTER(aggregator);
+
+	GST_OBJECT_LOCK(batchfilter);
+	gst_flow_combiner_reset(batchfilter->flow_combiner);
+	GST_OBJECT_UNLOCK(batchfilter);
+	return TRUE;
+}
+
+static gboolean
+gst_batch_filter_stop(GstAggregator * aggregator)
+{
+	GstBatchFilter *batchfilter = GST_BATCH_FILTER(aggregator);
+	GList *l;
+
+	GST_OBJECT_LOCK(batchfilter);
+	l = g_list_copy_deep(GST_ELEMENT(batchfilter)->sinkpads, (GCopyFunc)gst_object_ref, NULL);
+	GST_OBJECT_UNLOCK(batchfilter);
+
+	for (GList *p = l; p != NULL; p = p->next)
+		gst_batch_filter_pad_clear_pool(GST_BATCH_FILTER_PAD(p->data));
+	g_list_free_full(l, gst_object_unref);
+
+	cv_batch_scratch_clear(&batchfilter->scratch);
+	return TRUE;
+}
+
+/*
+ *	Filters the luma of one frame of every stream as a batch and fills the
+ *	chroma grey. Must hold the object lock.
+ */
+static void
+gst_batch_filter_convolution(GstBatchFilter * batchfilter, GstVideoFrame * dest, const GstVideoFrame * src,
+	gint n_frames)
+{
+	CvPlane *planes = g_new(CvPlane, n_frames);
+	float sigma = batchfilter->sigma;
+	int filtering = batchfilter->filtering;
+	const gchar *engine_name;
+	gint i;
+
+	for (i = 0; i < n_frames; i++)
+	{
+		planes[i].src = (const guint8 *)GST_VIDEO_FRAME_COMP_DATA(&src[i], 0);
+		planes[i].src_stride = GST_VIDEO_FRAME_PLANE_STRIDE(&src[i], 0);
+		planes[i].dest = (guint8 *)GST_VIDEO_FRAME_COMP_DATA(&dest[i], 0);
+		planes[i].dest_stride = GST_VIDEO_FRAME_PLANE_STRIDE(&dest[i], 0);
+		planes[i].width = GST_VIDEO_FRAME_COMP_WIDTH(&dest[i], 0);
+		planes[i].height = GST_VIDEO_FRAME_COMP_HEIGHT(&dest[i], 0);
+	}
+
+	if (batchfilter->filter == GST_BATCH_FILTER_MODE_BILATERAL)
+		engine_name = cv_bilateral_engine_name(filtering != 0, batchfilter->sharpen, batchfilter->flat_tolerance);
+	else
+		engine_name = filtering == 0 ? "copy" : cv_blur_engine_name((CvBlurEngine)batchfilter->engine, sigma);
+	cv_stats_set_engine(batchfilter->stats, engine_name,
+		batchfilter->parallel ? cv_scheduler_get_n_workers(batchfilter->scheduler) : 1);
+
+	/* Each pass runs over the bands of all frames on the shared workers */
+	if (batchfilter->parallel)
+		cv_parallel_set_runner(cv_scheduler_stream_get_runner(batchfilter->stream));
+	if (batchfilter->filter == GST_BATCH_FILTER_MODE_BILATERAL)
+		cv_bilateral_planes(planes, n_frames, batchfilter->sigmad, batchfilter->sigmar, filtering != 0,
+			batchfilter->flat_tolerance, batchfilter->sharpen, &batchfilter->scratch);
+	else
+		cv_blur_planes(planes, n_frames, sigma, filtering, (CvBlurEngine)batchfilter->engine,
+			&batchfilter->scratch);
+	cv_parallel_set_runner(NULL);
+	g_free(planes);
+
+	/* Each pixel in the UV-colour planes is set to 128 to ensure greyscale */
+	for (i = 0; i < n_frames; i++)
+	{
+		cv_fill_plane((guint8 *)GST_VIDEO_FRAME_COMP_DATA(&dest[i], 1), GST_VIDEO_FRAME_PLANE_STRIDE(&dest[i], 1),
+			GST_VIDEO_FRAME_COMP_WIDTH(&dest[i], 1), GST_VIDEO_FRAME_COMP_HEIGHT(&dest[i], 1),
+			1 << (GST_VIDEO_FRAME_COMP_DEPTH(&src[i], 1) - 1));
+		cv_fill_plane((guint8 *)GST_VIDEO_FRAME_COMP_DATA(&dest[i], 2), GST_VIDEO_FRAME_PLANE_STRIDE(&dest[i], 2),
+			GST_VIDEO_FRAME_COMP_WIDTH(&dest[i], 2), GST_VIDEO_FRAME_COMP_HEIGHT(&dest[i], 2),
+			1 << (GST_VIDEO_FRAME_COMP_DEPTH(&src[i], 2) - 1));
+	}
+	cv_store_fence();
+	cv_stats_mark(CV_STAGE_CHROMA);
+}
+
+
+/*
+ *	Filters the frames due first of the streams as a batch and pushes each
+ *	on the src pad of its stream. The frame of every stream that has one
+ *	queued is looked at, and those whose running time is within half a
+ *	frame of the earliest one are taken, so streams that started later or
+ *	run at another frame rate stay aligned in time, and the streams ahead
+ *	keep their frame for a later batch. Frames without a timestamp are
+ *	always taken. Gap frames leave as gap events, and streams that ended get
+ *	their EOS here, once their last frame has left.
+ */
+static GstFlowReturn
+gst_batch_filter_aggregate(GstAggregator * aggregator, gboolean timeout)
+{
+	GstBatchFilter *batchfilter = GST_BATCH_FILTER(aggregator);
+	GPtrArray *pads = g_ptr_array_new_with_free_func(gst_object_unref);
+	GstVideoFrame *inframes, *outframes;
+	GstBuffer **inbufs, **outbufs;
+	GstPad **srcpads;
+	/* The frame each stream has queued, and its running time */
+	GstBuffer **heads;
+	GstClockTime *times;
+	GstClockTime earliest = GST_CLOCK_TIME_NONE;
+	GstClockTime window = 0;
+	GstFlowReturn ret = GST_FLOW_OK;
+	GstClockTime interval;
+	GstMessage *msg;
+	gsize frame_bytes = 0;
+	gint n_frames = 0;
+	gint n_eos = 0;
+	GList *l;
+	guint i;
+
+	GST_OBJECT_LOCK(batchfilter);
+	for (l = GST_ELEMENT(batchfilter)->sinkpads; l != NULL; l = l->next)
+		g_ptr_array_add(pads, gst_object_ref(l->data));
+	GST_OBJECT_UNLOCK(batchfilter);
+
+	inframes = g_new(GstVideoFrame, pads->len);
+	outframes = g_new(GstVideoFrame, pads->len);
+	inbufs = g_new0(GstBuffer *, pads->len);
+	outbufs = g_new0(GstBuffer *, pads->len);
+	srcpads = g_new0(GstPad *, pads->len);
+	heads = g_new0(GstBuffer *, pads->len);
+	times = g_new(GstClockTime, pads->len);
+
+	/* Find when the earliest queued frame is due, and which streams have ended */
+	for (i = 0; i < pads->len; i++)
+	{
+		GstBatchFilterPad *pad = GST_BATCH_FILTER_PAD(g_ptr_array_index(pads, i));
+		GstBuffer *buffer = gst_aggregator_pad_peek_buffer(GST_AGGREGATOR_PAD(pad));
+
+		heads[i] = buffer;
+		times[i] = GST_CLOCK_TIME_NONE;
+		if (buffer == NULL)
+		{
+			if (gst_aggregator_pad_is_eos(GST_AGGREGATOR_PAD(pad)))
+			{
+				GstPad *srcpad = gst_batch_filter_pad_get_srcpad(pad);
+
+				if (srcpad != NULL && !pad->eos_sent)
+				{
+					gst_pad_push_event(srcpad, gst_event_new_eos());
+					pad->eos_sent = TRUE;
+				}
+				if (srcpad != NULL)
+					gst_object_unref(srcpad);
+				n_eos++;
+			}
+			continue;
+		}
+
+		times[i] = gst_batch_filter_pad_running_time(pad, buffer);
+		if (GST_CLOCK_TIME_IS_VALID(times[i]) && (!GST_CLOCK_TIME_IS_VALID(earliest) || times[i] < earliest))
+		{
+			earliest = times[i];
+			window = gst_batch_filter_pad_half_frame(pad, buffer);
+		}
+	}
+
+	for (i = 0; i < pads->len; i++)
+	{
+		GstBatchFilterPad *pad = GST_BATCH_FILTER_PAD(g_ptr_array_index(pads, i));
+		GstPad *srcpad;
+		GstBufferPool *pool;
+		GstBuffer *inbuf;
+		GstFlowReturn flow;
+
+		/* Streams without a frame, or whose frame is due later */
+		if (heads[i] == NULL)
+			continue;
+		if (GST_CLOCK_TIME_IS_VALID(times[i]) && times[i] > earliest + window)
+			continue;
+
+		/* Only this thread takes frames, so it is the one looked at */
+		inbuf = gst_aggregator_pad_pop_buffer(GST_AGGREGATOR_PAD(pad));
+		if (inbuf == NULL)
+			continue;
+		srcpad = gst_batch_filter_pad_get_srcpad(pad);
+		if (srcpad == NULL)
+		{
+			gst_buffer_unref(inbuf);
+			continue;
+		}
+
+		/* Gaps are passed on as such, frames before the caps have nothing to filter */
+		if (GST_BUFFER_FLAG_IS_SET(inbuf, GST_BUFFER_FLAG_GAP))
+		{
+			if (GST_BUFFER_PTS_IS_VALID(inbuf))
+				gst_pad_push_event(srcpad, gst_event_new_gap(GST_BUFFER_PTS(inbuf), GST_BUFFER_DURATION(inbuf)));
+			gst_buffer_unref(inbuf);
+			gst_object_unref(srcpad);
+			continue;
+		}
+		if (!pad->negotiated || gst_buffer_get_size(inbuf) == 0)
+		{
+			gst_buffer_unref(inbuf);
+			gst_object_unref(srcpad);
+			continue;
+		}
+
+		pool = gst_batch_filter_pad_get_pool(pad, srcpad);
+		if (pool == NULL)
+		{
+			gst_buffer_unref(inbuf);
+			gst_object_unref(srcpad);
+			GST_ELEMENT_ERROR(batchfilter, RESOURCE, SETTINGS, (NULL), ("could not set up the output buffer pool"));
+			ret = GST_FLOW_ERROR;
+			break;
+		}
+		flow = gst_buffer_pool_acquire_buffer(pool, &outbufs[n_frames], NULL);
+		gst_object_unref(pool);
+		if (flow != GST_FLOW_OK)
+		{
+			gst_buffer_unref(inbuf);
+			gst_object_unref(srcpad);
+			ret = flow;
+			break;
+		}
+		gst_buffer_copy_into(outbufs[n_frames], inbuf, GST_BUFFER_COPY_METADATA, 0, -1);
+		if (!gst_video_frame_map(&inframes[n_frames], &pad->info, inbuf, GST_MAP_READ))
+		{
+			gst_buffer_unref(outbufs[n_frames]);
+			gst_buffer_unref(inbuf);
+			gst_object_unref(srcpad);
+			GST_ELEMENT_ERROR(batchfilter, STREAM, FAILED, (NULL), ("could not map the input frame"));
+			ret = GST_FLOW_ERROR;
+			break;
+		}
+		if (!gst_video_frame_map(&outframes[n_frames], &pad->info, outbufs[n_frames], GST_MAP_WRITE))
+		{
+			gst_video_frame_unmap(&inframes[n_frames]);
+			gst_buffer_unref(outbufs[n_frames]);
+			gst_buffer_unref(inbuf);
+			gst_object_unref(srcpad);
+			GST_ELEMENT_ERROR(batchfilter, STREAM, FAILED, (NULL), ("could not map the output frame"));
+			ret = GST_FLOW_ERROR;
+			break;
+		}
+		inbufs[n_frames] = inbuf;
+		srcpads[n_frames] = srcpad;
+		frame_bytes += 2 * GST_VIDEO_INFO_SIZE(&pad->info);
+		n_frames++;
+	}
+
+	if (n_frames > 0 && ret == GST_FLOW_OK)
+	{
+		/* Mutex lock the filter */
+		GST_OBJECT_LOCK(batchfilter);
+		cv_stats_frame_begin(batchfilter->stats);
+		gst_batch_filter_convolution(batchfilter, outframes, inframes, n_frames);
+		cv_stats_frame_end(batchfilter->stats, frame_bytes);
+		interval = batchfilter->stats_interval * GST_MSECOND;
+		GST_OBJECT_UNLOCK(batchfilter);
+
+		/* Post the statistics periodically for monitoring */
+		msg = cv_stats_poll_message(batchfilter->stats, GST_OBJECT(batchfilter), "batchfilter-stats", interval);
+		if (msg != NULL)
+			gst_element_post_message(GST_ELEMENT(batchfilter), msg);
+	}
+
+	for (i = 0; i < (guint)n_frames; i++)
+	{
+		gst_video_frame_unmap(&inframes[i]);
+		gst_video_frame_unmap(&outframes[i]);
+		gst_buffer_unref(inbufs[i]);
+		if (ret == GST_FLOW_OK)
+		{
+			GstFlowReturn flow = gst_pad_push(srcpads[i], outbufs[i]);
+
+			GST_OBJECT_LOCK(batchfilter);
+			flow = gst_flow_combiner_update_pad_flow(batchfilter->flow_combiner, srcpads[i], flow);
+			GST_OBJECT_UNLOCK(batchfilter);
+			if (flow != GST_FLOW_OK)
+				ret = flow;
+		}
+		else
+			gst_buffer_unref(outbufs[i]);
+		gst_object_unref(srcpads[i]);
+	}
+
+	/* Done once every stream has ended */
+	if (ret == GST_FLOW_OK && pads->len > 0 && (guint)n_eos == pads->len)
+		ret = GST_FLOW_EOS;
+
+	for (i = 0; i < pads->len; i++)
+	{
+		if (heads[i] != NULL)
+			gst_buffer_unref(heads[i]);
+	}
+	g_free(heads);
+	g_free(times);
+	g_free(srcpads);
+	g_free(outbufs);
+	g_free(inbufs);
+	g_free(outframes);
+	g_free(inframes);
+	g_ptr_array_unref(pads);
+	return ret;
+}
+
+
+/* Boilerplate plugin initialization */
+static gboolean
+plugin_init(GstPlugin * plugin)
+{
+	/* Starts the workers shared with the other filter plugins, unless one of them already did */
+	cv_scheduler_get();
+
+	return gst_element_register(plugin, "batchfilter", GST_RANK_NONE,
+		GST_TYPE_BATCH_FILTER);
+}
+
+
+/* Plugin definitions */
+#ifndef VERSION
+#define VERSION "0.1.0"
+#endif
+#ifndef PACKAGE
+#define PACKAGE "SimplePackage"
+#endif
+#ifndef PACKAGE_NAME
+#define PACKAGE_NAME "Package name"
+#endif
+#ifndef GST_PACKAGE_ORIGIN
+#define GST_PACKAGE_ORIGIN "http://origin.org/"
+#endif
+
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR,
+	GST_VERSION_MINOR,
+	batchfilter,
+	"Blur and bilateral filters over batches of video streams",
+	plugin_init, VERSION, "LGPL", PACKAGE_NAME, GST_PACKAGE_ORIGIN)
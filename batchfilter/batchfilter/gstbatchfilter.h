@@ -0,0 +1,118 @@
+/* GStreamer
+* Copyright (C) 2019 FIXME <fixme@example.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _GST_BATCH_FILTER_H_
+#define _GST_BATCH_FILTER_H_
+
+#include <gst/gst.h>
+#include <gst/base/gstaggregator.h>
+#include <gst/base/gstflowcombiner.h>
+#include <gst/video/video.h>
+#include "cvbatch.h"
+#include "cvscheduler.h"
+#include "cvstats.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_BATCH_FILTER   (gst_batch_filter_get_type())
+#define GST_BATCH_FILTER(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_BATCH_FILTER,GstBatchFilter))
+#define GST_BATCH_FILTER_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_BATCH_FILTER,GstBatchFilterClass))
+#define GST_IS_BATCH_FILTER(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_BATCH_FILTER))
+#define GST_IS_BATCH_FILTER_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_BATCH_FILTER))
+
+#define GST_TYPE_BATCH_FILTER_PAD   (gst_batch_filter_pad_get_type())
+#define GST_BATCH_FILTER_PAD(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_BATCH_FILTER_PAD,GstBatchFilterPad))
+
+#define GST_TYPE_BATCH_FILTER_MODE   (gst_batch_filter_mode_get_type())
+#define GST_TYPE_BATCH_FILTER_ENGINE   (gst_batch_filter_engine_get_type())
+
+typedef struct _GstBatchFilter GstBatchFilter;
+typedef struct _GstBatchFilterClass GstBatchFilterClass;
+typedef struct _GstBatchFilterPad GstBatchFilterPad;
+typedef struct _GstBatchFilterPadClass GstBatchFilterPadClass;
+
+/* Filter run on every stream, selected with the filter property */
+typedef enum
+{
+	GST_BATCH_FILTER_MODE_BLUR,
+	GST_BATCH_FILTER_MODE_BILATERAL
+} GstBatchFilterMode;
+
+/* Ways of computing the gaussian of the blur, the same values as CvBlurEngine */
+typedef enum
+{
+	GST_BATCH_FILTER_ENGINE_DIRECT,
+	GST_BATCH_FILTER_ENGINE_PYRAMID
+} GstBatchFilterEngine;
+
+/* Sink pad of a stream, whose filtered frames leave on srcpad */
+struct _GstBatchFilterPad
+{
+	GstAggregatorPad base_batchfilterpad;
+	GstVideoInfo info;
+	gboolean negotiated;
+	/* src_N for sink_N, NULL once the pad is released */
+	GstPad *srcpad;
+	gboolean eos_sent;
+	/* Pool of the filtered frames, set up for the caps on the first frame, under the pad's object lock */
+	GstBufferPool *pool;
+};
+
+struct _GstBatchFilterPadClass
+{
+	GstAggregatorPadClass base_batchfilterpad_class;
+};
+
+struct _GstBatchFilter
+{
+	GstAggregator base_batchfilter;
+	GstBatchFilterMode filter;
+	/* Blur settings */
+	double sigma;
+	int filtering;
+	GstBatchFilterEngine engine;
+	/* Bilateral settings, the bilateral filter is on while filtering is not 0 */
+	double sigmad;
+	double sigmar;
+	double flat_tolerance;
+	double sharpen;
+	gboolean parallel;
+	CvScheduler *scheduler;
+	CvSchedulerStream *stream;
+	/* Images of the planes of a batch, kept for the next one */
+	CvBatchScratch scratch;
+	/* Flow of the src pads, under the object lock */
+	GstFlowCombiner *flow_combiner;
+	CvStats *stats;
+	guint stats_interval;
+};
+
+struct _GstBatchFilterClass
+{
+	GstAggregatorClass base_batchfilter_class;
+};
+
+GType gst_batch_filter_get_type(void);
+GType gst_batch_filter_pad_get_type(void);
+GType gst_batch_filter_mode_get_type(void);
+GType gst_batch_filter_engine_get_type(void);
+
+G_END_DECLS
+
+#endif
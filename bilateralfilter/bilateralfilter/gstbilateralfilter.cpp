@@ -33,7 +33,12 @@
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
 #include "gstbilateralfilter.h"
+#include "cvallocation.h"
+#include "cvbilateral.h"
+#include "cvscheduler.h"
+#include "cvstats.h"
 #include <cmath>
+#include <cstring>
 
 
 GST_DEBUG_CATEGORY_STATIC(gst_bilateral_filter_debug_category);
@@ -50,22 +55,37 @@ static void gst_bilateral_filter_set_property(GObject * object,
 	guint property_id, const GValue * value, GParamSpec * pspec);
 static void gst_bilateral_filter_get_property(GObject * object,
 	guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_bilateral_filter_finalize(GObject * object);
 static gboolean gst_bilateral_filter_src_event(GstBaseTransform * trans,
 	GstEvent * event);
+static gboolean gst_bilateral_filter_sink_event(GstBaseTransform * trans,
+	GstEvent * event);
+static gboolean gst_bilateral_filter_propose_allocation(GstBaseTransform * trans,
+	GstQuery * decide_query, GstQuery * query);
+static gboolean gst_bilateral_filter_decide_allocation(GstBaseTransform * trans,
+	GstQuery * query);
 static GstFlowReturn gst_bilateral_filter_transform_frame(GstVideoFilter * filter,
 	GstVideoFrame * inframe, GstVideoFrame * outframe);
-float gaussian1d(float sigma, float x);
-static void xyconvolution(float * preimage, float * postimage, float * kernel,
-	float sigmar, int kernelsize, int width, int height);
-static void gst_bilateral_filter_convolution(GstBilateralFilter * bilateralfilter,
-	GstVideoFrame * dest, const GstVideoFrame * src);
 
 enum
 {
 	PROP_0,
 	PROP_SIGMAD,
 	PROP_SIGMAR,
-	PROP_FILTERING
+	PROP_FILTERING,
+	PROP_FLAT_TOLERANCE,
+	PROP_SHARPEN,
+	PROP_SCALE,
+	PROP_TEMPORAL,
+	PROP_MOTION_THRESHOLD,
+	PROP_POOL_PADDING,
+	PROP_STATS,
+	PROP_STATS_INTERVAL,
+	PROP_CACHE_SIZE,
+	PROP_CACHE_SPILL_LOCATION,
+	PROP_CACHE_SPILL_SIZE,
+	PROP_PARALLEL,
+	PROP_TRICKMODE
 };
 
 
@@ -104,9 +124,13 @@ gst_bilateral_filter_class_init(GstBilateralFilterClass * klass)
 
 	gobject_class->set_property = gst_bilateral_filter_set_property;
 	gobject_class->get_property = gst_bilateral_filter_get_property;
+	gobject_class->finalize = gst_bilateral_filter_finalize;
 
 	video_filter_class->transform_frame = GST_DEBUG_FUNCPTR(gst_bilateral_filter_transform_frame);
 	base_transform_class->src_event = GST_DEBUG_FUNCPTR(gst_bilateral_filter_src_event);
+	base_transform_class->sink_event = GST_DEBUG_FUNCPTR(gst_bilateral_filter_sink_event);
+	base_transform_class->propose_allocation = GST_DEBUG_FUNCPTR(gst_bilateral_filter_propose_allocation);
+	base_transform_class->decide_allocation = GST_DEBUG_FUNCPTR(gst_bilateral_filter_decide_allocation);
 
 	/* Install class properties */
 	g_object_class_install_property(gobject_class, PROP_SIGMAD,
@@ -120,6 +144,67 @@ gst_bilateral_filter_class_init(GstBilateralFilterClass * klass)
 	g_object_class_install_property(gobject_class, PROP_FILTERING,
 		g_param_spec_boolean("filtering", "Filtering", "True for filtering, false for no filter",
 			FALSE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property(gobject_class, PROP_FLAT_TOLERANCE,
+		g_param_spec_double("flat-tolerance", "Flat tolerance",
+			"Largest deviation of the range weight from 1 for which a block is treated as flat "
+			"and filtered with the plain gaussian, 0 disables the early-out",
+			0.0, 0.5, 0.01, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property(gobject_class, PROP_SHARPEN,
+		g_param_spec_double("sharpen", "Sharpen",
+			"Sigma of the unsharp mask applied to the filtered frame in the same pass, "
+			"as blurfilter with filtering 1 would, 0 disables sharpening",
+			0.0, 100.0, 0.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+
+	g_object_class_install_property(gobject_class, PROP_SCALE,
+		g_param_spec_int("scale", "Scale",
+			"Runs the bilateral filter at 1/scale of the width and height and upsamples the result "
+			"guided by the full size frame, 1 filters at full size",
+			1, 4, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_TEMPORAL,
+		g_param_spec_double("temporal", "Temporal",
+			"Weight of the previous output blended into still pixels, only moving pixels are filtered "
+			"spatially, 0 filters each frame on its own",
+			0.0, 0.95, 0.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_MOTION_THRESHOLD,
+		g_param_spec_uint("motion-threshold", "Motion threshold",
+			"Grey levels a pixel may differ from the previous output and still count as still, "
+			"twice as much counts as moving",
+			1, 127, 12, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_POOL_PADDING,
+		g_param_spec_uint("pool-padding", "Pool padding",
+			"Pixels of padding around the planes of the buffers proposed to upstream",
+			0, 256, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_STATS,
+		g_param_spec_boxed("stats", "Statistics",
+			"Frames processed, time per stage, latency histogram, engine and memory use",
+			GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_STATS_INTERVAL,
+		g_param_spec_uint("stats-interval", "Statistics interval",
+			"Milliseconds between element messages with the statistics, 0 disables them",
+			0, G_MAXUINT, 1000, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_CACHE_SIZE,
+		g_param_spec_uint("cache-size", "Cache size",
+			"Megabytes of filtered frames kept in memory and reused for the same input, 0 disables the cache",
+			0, 65536, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_CACHE_SPILL_LOCATION,
+		g_param_spec_string("cache-spill-location", "Cache spill location",
+			"File the cache maps to keep frames that no longer fit in memory, NULL drops them",
+			NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_CACHE_SPILL_SIZE,
+		g_param_spec_uint("cache-spill-size", "Cache spill size",
+			"Megabytes of frames kept in the spill file",
+			0, G_MAXUINT, 1024, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_PARALLEL,
+		g_param_spec_boolean("parallel", "Parallel",
+			"Filter each frame on the worker threads shared by all filter elements",
+			TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_TRICKMODE,
+		g_param_spec_enum("trickmode", "Trick mode",
+			"What frames get while scrubbing, fast forward or reverse playback",
+			CV_TYPE_TRICKMODE_ACTION, CV_TRICKMODE_PREVIEW,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 
@@ -130,6 +215,25 @@ gst_bilateral_filter_init(GstBilateralFilter *bilateralfilter)
 	bilateralfilter->sigmad = 2.0;
 	bilateralfilter->sigmar = 25.0;
 	bilateralfilter->filtering = FALSE;
+	bilateralfilter->flat_tolerance = 0.01;
+	bilateralfilter->sharpen = 0.0;
+	bilateralfilter->scale = 1;
+	bilateralfilter->temporal = 0.0;
+	bilateralfilter->motion_threshold = 12;
+	bilateralfilter->temporal_state = cv_temporal_new();
+	bilateralfilter->pool_padding = 0;
+	bilateralfilter->stats = cv_stats_new();
+	bilateralfilter->stats_interval = 1000;
+	bilateralfilter->cache = NULL;
+	bilateralfilter->cache_size = 0;
+	bilateralfilter->cache_spill_location = NULL;
+	bilateralfilter->cache_spill_size = 1024;
+	bilateralfilter->parallel = TRUE;
+	bilateralfilter->scheduler = cv_scheduler_get();
+	bilateralfilter->stream = cv_scheduler_stream_new(bilateralfilter->scheduler);
+	bilateralfilter->trickmode = CV_TRICKMODE_PREVIEW;
+	cv_trickmode_init(&bilateralfilter->trickmode_state);
+	bilateralfilter->frame_action = CV_TRICKMODE_FULL;
 	g_print("Separable bilateral filter for grayscale video\n");
 	g_print("Press '+' to activate filter, '-' to deactivate filter");
 	g_print("Domain sigma = %.1f\nRange sigma = %.1f\nKernel size = 5x5\n",
@@ -144,6 +248,14 @@ gst_bilateral_filter_src_event(GstBaseTransform * trans, GstEvent * event)
 	const gchar *type;
 	const gchar *key;
 
+	/* Seeks tell key unit seeks, whose first frame is only a preview */
+	if (GST_EVENT_TYPE(event) == GST_EVENT_SEEK)
+	{
+		GST_OBJECT_LOCK(bilateralfilter);
+		cv_trickmode_seek(&bilateralfilter->trickmode_state, event);
+		GST_OBJECT_UNLOCK(bilateralfilter);
+	}
+
 	/* If a navigation event happens */
 	if (GST_EVENT_TYPE(event) == GST_EVENT_NAVIGATION)
 	{
@@ -178,6 +290,33 @@ gst_bilateral_filter_src_event(GstBaseTransform * trans, GstEvent * event)
 
 }
 
+/* Event function for the segments, to follow trick modes */
+static gboolean
+gst_bilateral_filter_sink_event(GstBaseTransform * trans, GstEvent * event)
+{
+	GstBilateralFilter *bilateralfilter = GST_BILATERAL_FILTER(trans);
+
+	if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT)
+	{
+		GST_OBJECT_LOCK(bilateralfilter);
+		cv_trickmode_segment(&bilateralfilter->trickmode_state, event);
+		if (bilateralfilter->trickmode_state.segment)
+			GST_INFO_OBJECT(bilateralfilter, "trick mode segment, frames get %s",
+				cv_trickmode_action_name(bilateralfilter->trickmode));
+		GST_OBJECT_UNLOCK(bilateralfilter);
+	}
+
+	/* The previous output is no longer the frame before the next one after a seek or new segment */
+	if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT || GST_EVENT_TYPE(event) == GST_EVENT_FLUSH_STOP)
+	{
+		GST_OBJECT_LOCK(bilateralfilter);
+		cv_temporal_reset(bilateralfilter->temporal_state);
+		GST_OBJECT_UNLOCK(bilateralfilter);
+	}
+
+	return GST_BASE_TRANSFORM_CLASS(gst_bilateral_filter_parent_class)->sink_event(trans, event);
+}
+
 /* Property setter for external access */
 void
 gst_bilateral_filter_set_property(GObject * object, guint property_id,
@@ -199,6 +338,63 @@ gst_bilateral_filter_set_property(GObject * object, guint property_id,
 		g_print("%s", bilateralfilter->filtering ? 
 			"Activated filtering\n" : "Deactivated filtering\n");
 		break;
+	case PROP_FLAT_TOLERANCE:
+		bilateralfilter->flat_tolerance = g_value_get_double(value);
+		g_print("Flat tolerance set to %.3f\n", bilateralfilter->flat_tolerance);
+		break;
+	case PROP_SHARPEN:
+		bilateralfilter->sharpen = g_value_get_double(value);
+		g_print("Sharpening sigma set to %.1f\n", bilateralfilter->sharpen);
+		break;
+	case PROP_SCALE:
+		bilateralfilter->scale = g_value_get_int(value);
+		g_print("Filtering at 1/%d size\n", bilateralfilter->scale);
+		break;
+	case PROP_TEMPORAL:
+		bilateralfilter->temporal = g_value_get_double(value);
+		g_print("Temporal weight set to %.2f\n", bilateralfilter->temporal);
+		break;
+	case PROP_MOTION_THRESHOLD:
+		bilateralfilter->motion_threshold = g_value_get_uint(value);
+		g_print("Motion threshold set to %u\n", bilateralfilter->motion_threshold);
+		break;
+	case PROP_POOL_PADDING:
+		bilateralfilter->pool_padding = g_value_get_uint(value);
+		break;
+	case PROP_STATS_INTERVAL:
+		bilateralfilter->stats_interval = g_value_get_uint(value);
+		break;
+	case PROP_CACHE_SIZE:
+	case PROP_CACHE_SPILL_LOCATION:
+	case PROP_CACHE_SPILL_SIZE:
+		/* The cache is created again with the new settings on the next frame */
+		GST_OBJECT_LOCK(bilateralfilter);
+		if (property_id == PROP_CACHE_SIZE)
+			bilateralfilter->cache_size = g_value_get_uint(value);
+		else if (property_id == PROP_CACHE_SPILL_SIZE)
+			bilateralfilter->cache_spill_size = g_value_get_uint(value);
+		else
+		{
+			g_free(bilateralfilter->cache_spill_location);
+			bilateralfilter->cache_spill_location = g_value_dup_string(value);
+		}
+		if (bilateralfilter->cache != NULL)
+		{
+			cv_cache_free(bilateralfilter->cache);
+			bilateralfilter->cache = NULL;
+		}
+		GST_OBJECT_UNLOCK(bilateralfilter);
+		break;
+	case PROP_PARALLEL:
+		GST_OBJECT_LOCK(bilateralfilter);
+		bilateralfilter->parallel = g_value_get_boolean(value);
+		GST_OBJECT_UNLOCK(bilateralfilter);
+		break;
+	case PROP_TRICKMODE:
+		GST_OBJECT_LOCK(bilateralfilter);
+		bilateralfilter->trickmode = (CvTrickmodeAction)g_value_get_enum(value);
+		GST_OBJECT_UNLOCK(bilateralfilter);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
 		break;
@@ -218,84 +414,107 @@ gst_bilateral_filter_get_property(GObject * object, guint property_id,
 		break;
 	case PROP_SIGMAR:
 		g_value_set_double(value, bilateralfilter->sigmar);
+		break;
 	case PROP_FILTERING:
 		g_value_set_boolean(value, bilateralfilter->filtering);
+		break;
+	case PROP_FLAT_TOLERANCE:
+		g_value_set_double(value, bilateralfilter->flat_tolerance);
+		break;
+	case PROP_SHARPEN:
+		g_value_set_double(value, bilateralfilter->sharpen);
+		break;
+	case PROP_SCALE:
+		g_value_set_int(value, bilateralfilter->scale);
+		break;
+	case PROP_TEMPORAL:
+		g_value_set_double(value, bilateralfilter->temporal);
+		break;
+	case PROP_MOTION_THRESHOLD:
+		g_value_set_uint(value, bilateralfilter->motion_threshold);
+		break;
+	case PROP_POOL_PADDING:
+		g_value_set_uint(value, bilateralfilter->pool_padding);
+		break;
+	case PROP_STATS:
+		g_value_take_boxed(value, cv_stats_get_structure(bilateralfilter->stats, "bilateralfilter-stats"));
+		break;
+	case PROP_STATS_INTERVAL:
+		g_value_set_uint(value, bilateralfilter->stats_interval);
+		break;
+	case PROP_CACHE_SIZE:
+		g_value_set_uint(value, bilateralfilter->cache_size);
+		break;
+	case PROP_CACHE_SPILL_LOCATION:
+		g_value_set_string(value, bilateralfilter->cache_spill_location);
+		break;
+	case PROP_CACHE_SPILL_SIZE:
+		g_value_set_uint(value, bilateralfilter->cache_spill_size);
+		break;
+	case PROP_PARALLEL:
+		g_value_set_boolean(value, bilateralfilter->parallel);
+		break;
+	case PROP_TRICKMODE:
+		g_value_set_enum(value, bilateralfilter->trickmode);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
 		break;
 	}
 }
 
-/* Computes the 1-dimensional gaussian function, given distance x and StDev sigma*/
-float gaussian1d(float sigma, float x)
+static void
+gst_bilateral_filter_finalize(GObject * object)
 {
-	return exp(-(pow(x, 2) / (2 * pow(sigma, 2))));
-}
+	GstBilateralFilter *bilateralfilter = GST_BILATERAL_FILTER(object);
 
+	cv_stats_free(bilateralfilter->stats);
+	cv_scheduler_stream_free(bilateralfilter->stream);
+	cv_temporal_free(bilateralfilter->temporal_state);
+	if (bilateralfilter->cache != NULL)
+		cv_cache_free(bilateralfilter->cache);
+	g_free(bilateralfilter->cache_spill_location);
 
-/*
- *	Computes the 2D convolution of the image and the bilateral kernel. 
- *	Calculates the bilateral kernel as separable instead of 
- *	proper bilateral kernel convolution
- */
-static void xyconvolution(float * preimage, float * postimage, float * kernel, float sigmar, int kernelsize, int width, int height)
+	G_OBJECT_CLASS(gst_bilateral_filter_parent_class)->finalize(object);
+}
+
+/* Offers upstream a pool of frames with aligned planes and strides */
+static gboolean
+gst_bilateral_filter_propose_allocation(GstBaseTransform * trans, GstQuery * decide_query,
+	GstQuery * query)
 {
-	float tmp;
-	float w;
-	float wp;
-	float *tempimage = new float[height*width];
-	float pixa;
-	float pixb;
-	int kernelradius = (kernelsize - 1) / 2;
-
-	/* Computes the convolution between image and kernel in the x-dim first */
-	for (int y = 0; y < height; ++y)
-	{
-		for (int x = kernelradius; x < width - kernelradius; ++x)
-		{
-			tmp = 0;
-			wp = 0;
-			pixa = preimage[y*width + x];
-			for (int k = -kernelradius; k <= kernelradius; ++k)
-			{
-				pixb = preimage[y*width + x + k];
-				w = kernel[k+kernelradius]*gaussian1d(sigmar, pixa - pixb);
-				wp += w;
-				tmp += pixb * w;
-			}
-			tempimage[y*width + x] = tmp / wp;
-		}
-	}
+	GstBilateralFilter *bilateralfilter = GST_BILATERAL_FILTER(trans);
+	guint padding;
 
-	/* Computes the convolution between the intermediate image previously
-	created and the kernel in the y-dim */
-	for (int y = kernelradius; y < height - kernelradius; ++y)
-	{
-		for (int x = kernelradius; x < width - kernelradius; ++x)
-		{
-			tmp = 0;
-			wp = 0;
-			pixa = tempimage[y*width + x];
-			for (int k = -kernelradius; k <= kernelradius; ++k)
-			{
-				pixb = tempimage[(y+k)*width + x];
-				w = kernel[k+kernelradius]*gaussian1d(sigmar, pixa - pixb);
-				wp += w;
-				tmp += pixb * w;
-			}
-			postimage[y*width + x] = tmp / wp;
-		}
-	}
+	/* Nothing to propose in passthrough */
+	if (decide_query == NULL)
+		return GST_BASE_TRANSFORM_CLASS(gst_bilateral_filter_parent_class)->propose_allocation(trans,
+			decide_query, query);
+
+	GST_OBJECT_LOCK(bilateralfilter);
+	padding = bilateralfilter->pool_padding;
+	GST_OBJECT_UNLOCK(bilateralfilter);
 
-	/* Clear allocated memory */
-	delete[] tempimage;
+	if (cv_propose_aligned_pool(query, padding))
+		return TRUE;
+	return GST_BASE_TRANSFORM_CLASS(gst_bilateral_filter_parent_class)->propose_allocation(trans,
+		decide_query, query);
+}
+
+/* Makes the output frames come from a pool with aligned planes and strides */
+static gboolean
+gst_bilateral_filter_decide_allocation(GstBaseTransform * trans, GstQuery * query)
+{
+	if (!cv_decide_aligned_pool(query, 0))
+		GST_DEBUG_OBJECT(trans, "downstream pool kept, output strides are not aligned");
+
+	return GST_BASE_TRANSFORM_CLASS(gst_bilateral_filter_parent_class)->decide_allocation(trans, query);
 }
 
 /* Main function for the actual filtering */
-static void gst_bilateral_filter_convolution(GstBilateralFilter * bilateralfilter, GstVideoFrame * dest, const GstVideoFrame * src)
+void gst_bilateral_filter_convolution(GstBilateralFilter * bilateralfilter, GstVideoFrame * dest, const GstVideoFrame * src)
 {
 	/* Initialize base values for the frame */
-	gint x, y;
 	guint8 const *s;
 	guint8 *d;
 	gint src_y_stride, src_y_width, src_y_height;
@@ -324,96 +543,58 @@ static void gst_bilateral_filter_convolution(GstBilateralFilter * bilateralfilte
 	src_u_depth = GST_VIDEO_FRAME_COMP_DEPTH(src, 1);
 	src_v_depth = GST_VIDEO_FRAME_COMP_DEPTH(src, 2);
 
-	/* Get sigma values for the gaussian function */
+	/* Get sigma values for the gaussian function, trick mode frames may be passed on unfiltered */
+	gboolean skip = bilateralfilter->frame_action == CV_TRICKMODE_SKIP;
+	gboolean preview = bilateralfilter->frame_action == CV_TRICKMODE_PREVIEW;
 	float sigmad = bilateralfilter->sigmad;
 	float sigmar = bilateralfilter->sigmar;
-	gboolean filtering = bilateralfilter->filtering;
-	/* The kernel size is set to five */
-	int kernelradius = 2;
-	int kernelsize = 2 * kernelradius + 1;
-
-	float *kernel;
-	float *preimage;
-	float *postimage;
+	gboolean filtering = bilateralfilter->filtering && !skip;
+	float flat_tolerance = bilateralfilter->flat_tolerance;
+	float sharpen = skip ? 0 : bilateralfilter->sharpen;
+	int scale = bilateralfilter->scale;
+	/* Trick mode frames do not follow each other, they are filtered alone and start the history over */
+	float temporal = bilateralfilter->frame_action == CV_TRICKMODE_FULL ? bilateralfilter->temporal : 0;
+	int threshold = bilateralfilter->motion_threshold;
 
-	/* Allocate memory for arrays of kernel and images */
-	kernel = new float[kernelsize];
-	preimage = new float[(src_y_height + kernelsize - 1)*(src_y_width + kernelsize - 1)];
-	postimage = new float[(src_y_height + kernelsize - 1)*(src_y_width + kernelsize - 1)];
+	if (temporal <= 0)
+		cv_temporal_reset(bilateralfilter->temporal_state);
 
 	/* Get pointers to Y-values for the in- and outframe */
 	s = GST_VIDEO_FRAME_COMP_DATA(src, 0);
 	d = GST_VIDEO_FRAME_COMP_DATA(dest, 0);
 
-	if (!filtering)
-	{
-		gst_video_frame_copy_plane(dest, src, 0);
-		goto UVframe;
-	}
+	cv_stats_set_engine(bilateralfilter->stats, preview && (filtering || sharpen > 0) ? "preview" :
+		temporal > 0 ? "temporal" : filtering && scale > 1 ? "bilateral-scaled" : cv_bilateral_engine_name(filtering, sharpen, flat_tolerance),
+		bilateralfilter->parallel ? cv_scheduler_get_n_workers(bilateralfilter->scheduler) : 1);
+
+	/* The block rows or bands run on the shared workers, with the other streams' */
+	if (bilateralfilter->parallel)
+		cv_parallel_set_runner(cv_scheduler_stream_get_runner(bilateralfilter->stream));
+	if (preview)
+		cv_bilateral_preview_plane(s, src_y_stride, d, dest_y_stride, dest_y_width, dest_y_height, sigmad, sigmar,
+			filtering, flat_tolerance, sharpen);
+	else if (temporal > 0)
+		cv_bilateral_temporal_plane(bilateralfilter->temporal_state, s, src_y_stride, d, dest_y_stride,
+			dest_y_width, dest_y_height, sigmad, sigmar, filtering, flat_tolerance, sharpen, temporal, threshold);
+	else
+		cv_bilateral_scaled_plane(s, src_y_stride, d, dest_y_stride, dest_y_width, dest_y_height, sigmad, sigmar,
+			filtering, flat_tolerance, sharpen, scale);
+	cv_parallel_set_runner(NULL);
 
-	/* Compute and save the 1-dim kernel */
-	for (int i = 0; i < kernelsize; ++i)
-	{
-		kernel[i] = gaussian1d(sigmad, (float)i - kernelradius);
-	}
-
-	/* Copy the inframe to preimage and zero-pad it with kernelradius
-	* in each direction */
-	for (y = 0; y < src_y_height + kernelsize - 1; ++y)
-	{
-		for (x = 0; x < src_y_width + kernelsize - 1; ++x)
-		{
-			if (x >= kernelradius && x < src_y_width + kernelradius && y >= kernelradius && y < src_y_height + kernelradius)
-				preimage[y*(src_y_width + kernelsize - 1) + x] = s[(y - kernelradius)*src_y_stride + x - kernelradius];
-			else
-			{
-				preimage[y*(src_y_width + kernelsize - 1) + x] = 0;
-			}
-		}
-	}
-
-	/* Compute the 2d convolution */
-	xyconvolution(preimage, postimage, kernel, sigmar, kernelsize, src_y_width + kernelsize - 1, src_y_height + kernelsize - 1);
-
-	for (y = 0; y < dest_y_height; ++y)
-	{
-		for (x = 0; x < dest_y_width; ++x)
-		{
-			/* Set the convoluted image as the outframe */
-			d[y*dest_y_stride + x] = postimage[(y + kernelradius)*(src_y_width + kernelsize - 1) + x + kernelradius];
-		}
-	}
-
-UVframe:
 	s = GST_VIDEO_FRAME_COMP_DATA(src, 1);
 	d = GST_VIDEO_FRAME_COMP_DATA(dest, 1);
 
 	/* Each pixel in the UV-colour plane is set to 128 to ensure greyscale.
 	 * If greyscale is assumed, this can be changed to gst_video_frame_copy_plane
 	 * as well for simplicity */
-	for (y = 0; y < dest_u_height; ++y)
-	{
-		for (x = 0; x < dest_u_width; ++x)
-		{
-			d[y*dest_u_stride + x] = pow(2, src_u_depth - 1);
-		}
-	}
+	cv_fill_plane(d, dest_u_stride, dest_u_width, dest_u_height, 1 << (src_u_depth - 1));
 
 	s = GST_VIDEO_FRAME_COMP_DATA(src, 2);
 	d = GST_VIDEO_FRAME_COMP_DATA(dest, 2);
 
-	for (y = 0; y < dest_v_height; ++y)
-	{
-		for (x = 0; x < dest_v_width; ++x)
-		{
-			d[y*dest_v_stride + x] = pow(2, src_v_depth - 1);
-		}
-	}
-
-	/* Free allocated memory */
-	delete[] kernel;
-	delete[] preimage;
-	delete[] postimage;
+	cv_fill_plane(d, dest_v_stride, dest_v_width, dest_v_height, 1 << (src_v_depth - 1));
+	cv_store_fence();
+	cv_stats_mark(CV_STAGE_CHROMA);
 }
 
 
@@ -424,12 +605,51 @@ gst_bilateral_filter_transform_frame(GstVideoFilter * filter, GstVideoFrame * in
 {
 
 	GstBilateralFilter *bilateralfilter = GST_BILATERAL_FILTER(filter);
+	GstClockTime interval;
+	GstMessage *msg;
+	CvCacheKey key;
+	gboolean hit = FALSE;
 
 	/* Mutex lock the filter */
 	GST_OBJECT_LOCK(bilateralfilter);
-	gst_bilateral_filter_convolution(bilateralfilter, outframe, inframe);
+	cv_stats_frame_begin(bilateralfilter->stats);
+	bilateralfilter->frame_action = cv_trickmode_next_frame(&bilateralfilter->trickmode_state) ?
+		bilateralfilter->trickmode : CV_TRICKMODE_FULL;
+
+	/* Reuse the output of the same input filtered with the same parameters, the temporal
+	 * mode's output also depends on the frames before so it is never reused */
+	if (bilateralfilter->cache_size > 0 && bilateralfilter->temporal <= 0)
+	{
+		double params[] = { bilateralfilter->sigmad, bilateralfilter->sigmar,
+			(double)bilateralfilter->filtering, bilateralfilter->flat_tolerance, bilateralfilter->sharpen,
+			(double)bilateralfilter->scale };
+
+		if (bilateralfilter->cache == NULL)
+			bilateralfilter->cache = cv_cache_new((gsize)bilateralfilter->cache_size << 20,
+				bilateralfilter->cache_spill_location, (gsize)bilateralfilter->cache_spill_size << 20);
+		cv_cache_key_init(&key, inframe, outframe, cv_cache_hash(params, sizeof(params), 0));
+		hit = cv_cache_load_frame(bilateralfilter->cache, &key, outframe);
+		cv_stats_cache_lookup(bilateralfilter->stats, hit);
+	}
+	if (!hit)
+	{
+		gst_bilateral_filter_convolution(bilateralfilter, outframe, inframe);
+		/* Previews and skipped frames are not what the parameters promise */
+		if (bilateralfilter->cache != NULL && bilateralfilter->frame_action == CV_TRICKMODE_FULL &&
+			bilateralfilter->temporal <= 0)
+			cv_cache_store_frame(bilateralfilter->cache, &key, outframe);
+	}
+	cv_stats_frame_end(bilateralfilter->stats,
+		GST_VIDEO_FRAME_SIZE(inframe) + GST_VIDEO_FRAME_SIZE(outframe));
+	interval = bilateralfilter->stats_interval * GST_MSECOND;
 	GST_OBJECT_UNLOCK(bilateralfilter);
 
+	/* Post the statistics periodically for monitoring */
+	msg = cv_stats_poll_message(bilateralfilter->stats, GST_OBJECT(bilateralfilter),
+		"bilateralfilter-stats", interval);
+	if (msg != NULL)
+		gst_element_post_message(GST_ELEMENT(bilateralfilter), msg);
+
 	return GST_FLOW_OK;
 }
 
@@ -438,6 +658,9 @@ gst_bilateral_filter_transform_frame(GstVideoFilter * filter, GstVideoFrame * in
 static gboolean
 plugin_init(GstPlugin * plugin)
 {
+	/* Starts the workers shared with the other filter plugins, unless one of them already did */
+	cv_scheduler_get();
+
 	return gst_element_register(plugin, "bilateralfilter", GST_RANK_NONE,
 		GST_TYPE_BILATERAL_FILTER);
 }
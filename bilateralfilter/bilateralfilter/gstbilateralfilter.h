@@ -22,6 +22,11 @@
 
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
+#include "cvstats.h"
+#include "cvcache.h"
+#include "cvscheduler.h"
+#include "cvtrickmode.h"
+#include "cvtemporal.h"
 
 G_BEGIN_DECLS
 
@@ -40,6 +45,30 @@ struct _GstBilateralFilter
 	double sigmad;
 	double sigmar;
 	gboolean filtering;
+	double flat_tolerance;
+	double sharpen;
+	/* Divides the width and height the bilateral filter runs at, 1 filters at full size */
+	gint scale;
+	/* Weight of the previous output for still pixels and how far they may differ, 0 filters each frame alone */
+	double temporal;
+	guint motion_threshold;
+	CvTemporal *temporal_state;
+	guint pool_padding;
+	CvStats *stats;
+	guint stats_interval;
+	/* Filtered frames, created on the first frame while cache_size is not 0 */
+	CvCache *cache;
+	guint cache_size;
+	gchar *cache_spill_location;
+	guint cache_spill_size;
+	/* Splits the frames into tasks for the shared scheduler when parallel is TRUE */
+	gboolean parallel;
+	CvScheduler *scheduler;
+	CvSchedulerStream *stream;
+	/* What trick mode frames get, whether the segment is one, and what the frame being filtered gets */
+	CvTrickmodeAction trickmode;
+	CvTrickmode trickmode_state;
+	CvTrickmodeAction frame_action;
 
 };
 
@@ -50,6 +79,10 @@ struct _GstBilateralFilterClass
 
 GType gst_bilateral_filter_get_type(void);
 
+/* Filters a whole frame, exported so the kernel benchmark can call it directly */
+void gst_bilateral_filter_convolution(GstBilateralFilter * bilateralfilter,
+	GstVideoFrame * dest, const GstVideoFrame * src);
+
 G_END_DECLS
 
 #endif
@@ -33,7 +33,12 @@
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
 #include "gstblurfilter.h"
+#include "cvallocation.h"
+#include "cvblur.h"
+#include "cvscheduler.h"
+#include "cvstats.h"
 #include <cmath>
+#include <cstring>
 
 
 GST_DEBUG_CATEGORY_STATIC(gst_blur_filter_debug_category);
@@ -50,24 +55,39 @@ static void gst_blur_filter_set_property(GObject * object,
 	guint property_id, const GValue * value, GParamSpec * pspec);
 static void gst_blur_filter_get_property(GObject * object,
 	guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_blur_filter_finalize(GObject * object);
 static gboolean gst_blur_filter_src_event(GstBaseTransform * trans,
 	GstEvent * event);
+static gboolean gst_blur_filter_sink_event(GstBaseTransform * trans,
+	GstEvent * event);
+static gboolean gst_blur_filter_propose_allocation(GstBaseTransform * trans,
+	GstQuery * decide_query, GstQuery * query);
+static gboolean gst_blur_filter_decide_allocation(GstBaseTransform * trans,
+	GstQuery * query);
+static gboolean gst_blur_filter_set_info(GstVideoFilter * filter, GstCaps * incaps,
+	GstVideoInfo * in_info, GstCaps * outcaps, GstVideoInfo * out_info);
 static GstFlowReturn gst_blur_filter_transform_frame(GstVideoFilter * filter,
 	GstVideoFrame * inframe, GstVideoFrame * outframe);
-float gaussian1d(float sigma, int x);
-static void xyconvolution(float * preimage, float * postimage, float * kernel,
-	int kernelsize, int width, int height, float weight);
-static void gst_blur_filter_convolution(GstBlurFilter * blurfilter,
-	GstVideoFrame * dest, const GstVideoFrame * src);
+static void gst_blur_filter_plan(GstBlurFilter * blurfilter,
+	int width, int height);
 
 enum
 {
 	PROP_0,
 	PROP_SIGMA,
-	PROP_FILTERING
+	PROP_FILTERING,
+	PROP_ENGINE,
+	PROP_POOL_PADDING,
+	PROP_TOLERANCE,
+	PROP_STATS,
+	PROP_STATS_INTERVAL,
+	PROP_CACHE_SIZE,
+	PROP_CACHE_SPILL_LOCATION,
+	PROP_CACHE_SPILL_SIZE,
+	PROP_PARALLEL,
+	PROP_TRICKMODE
 };
 
-
 /* Only designed and properly tested for I420 */
 #define VIDEO_SRC_CAPS \
     GST_VIDEO_CAPS_MAKE("{ I420 }")
@@ -76,6 +96,23 @@ enum
     GST_VIDEO_CAPS_MAKE("{ I420 }")
 
 
+GType
+gst_blur_filter_engine_get_type(void)
+{
+	static GType engine_type = 0;
+	static const GEnumValue engines[] = {
+		{ GST_BLUR_FILTER_ENGINE_DIRECT, "Full resolution separable convolution", "direct" },
+		{ GST_BLUR_FILTER_ENGINE_PYRAMID, "Decimate, convolve and upsample for large sigma", "pyramid" },
+		{ GST_BLUR_FILTER_ENGINE_AUTO, "Fastest engine within tolerance on this host", "auto" },
+		{ 0, NULL, NULL }
+	};
+
+	if (!engine_type)
+		engine_type = g_enum_register_static("GstBlurFilterEngine", engines);
+	return engine_type;
+}
+
+
 /* class initialization */
 G_DEFINE_TYPE_WITH_CODE(GstBlurFilter, gst_blur_filter, GST_TYPE_VIDEO_FILTER,
 	GST_DEBUG_CATEGORY_INIT(gst_blur_filter_debug_category, "blurfilter", 0,
@@ -103,9 +140,14 @@ gst_blur_filter_class_init(GstBlurFilterClass * klass)
 
 	gobject_class->set_property = gst_blur_filter_set_property;
 	gobject_class->get_property = gst_blur_filter_get_property;
+	gobject_class->finalize = gst_blur_filter_finalize;
 	
+	video_filter_class->set_info = GST_DEBUG_FUNCPTR(gst_blur_filter_set_info);
 	video_filter_class->transform_frame = GST_DEBUG_FUNCPTR(gst_blur_filter_transform_frame);
 	base_transform_class->src_event = GST_DEBUG_FUNCPTR(gst_blur_filter_src_event);
+	base_transform_class->sink_event = GST_DEBUG_FUNCPTR(gst_blur_filter_sink_event);
+	base_transform_class->propose_allocation = GST_DEBUG_FUNCPTR(gst_blur_filter_propose_allocation);
+	base_transform_class->decide_allocation = GST_DEBUG_FUNCPTR(gst_blur_filter_decide_allocation);
 
 	/* Install class properties */
 	g_object_class_install_property(gobject_class, PROP_SIGMA,
@@ -114,6 +156,47 @@ gst_blur_filter_class_init(GstBlurFilterClass * klass)
 	g_object_class_install_property(gobject_class, PROP_FILTERING,
 		g_param_spec_int("filtering", "Filtering", "1 for high pass, -1 for low pass",
 			-1, 1, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_ENGINE,
+		g_param_spec_enum("engine", "Engine", "Method used to compute the gaussian",
+			GST_TYPE_BLUR_FILTER_ENGINE, GST_BLUR_FILTER_ENGINE_DIRECT,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_POOL_PADDING,
+		g_param_spec_uint("pool-padding", "Pool padding",
+			"Pixels of padding around the planes of the buffers proposed to upstream",
+			0, 256, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_TOLERANCE,
+		g_param_spec_double("tolerance", "Tolerance",
+			"Largest difference in grey levels from the direct engine the auto engine accepts",
+			0.0, 255.0, 5.0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_STATS,
+		g_param_spec_boxed("stats", "Statistics",
+			"Frames processed, time per stage, latency histogram, engine and memory use",
+			GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_STATS_INTERVAL,
+		g_param_spec_uint("stats-interval", "Statistics interval",
+			"Milliseconds between element messages with the statistics, 0 disables them",
+			0, G_MAXUINT, 1000, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_CACHE_SIZE,
+		g_param_spec_uint("cache-size", "Cache size",
+			"Megabytes of filtered frames kept in memory and reused for the same input, 0 disables the cache",
+			0, 65536, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_CACHE_SPILL_LOCATION,
+		g_param_spec_string("cache-spill-location", "Cache spill location",
+			"File the cache maps to keep frames that no longer fit in memory, NULL drops them",
+			NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_CACHE_SPILL_SIZE,
+		g_param_spec_uint("cache-spill-size", "Cache spill size",
+			"Megabytes of frames kept in the spill file",
+			0, G_MAXUINT, 1024, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_PARALLEL,
+		g_param_spec_boolean("parallel", "Parallel",
+			"Filter each frame on the worker threads shared by all filter elements",
+			TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_TRICKMODE,
+		g_param_spec_enum("trickmode", "Trick mode",
+			"What frames get while scrubbing, fast forward or reverse playback",
+			CV_TYPE_TRICKMODE_ACTION, CV_TRICKMODE_PREVIEW,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
 }
 
 
@@ -123,6 +206,23 @@ gst_blur_filter_init(GstBlurFilter *blurfilter)
 {
 	blurfilter->filtering = 0;
 	blurfilter->sigma = 0.0;
+	blurfilter->engine = GST_BLUR_FILTER_ENGINE_DIRECT;
+	blurfilter->pool_padding = 0;
+	blurfilter->tolerance = 5.0;
+	blurfilter->planned_engine = GST_BLUR_FILTER_ENGINE_DIRECT;
+	blurfilter->planned_sigma = -1.0;
+	blurfilter->stats = cv_stats_new();
+	blurfilter->stats_interval = 1000;
+	blurfilter->cache = NULL;
+	blurfilter->cache_size = 0;
+	blurfilter->cache_spill_location = NULL;
+	blurfilter->cache_spill_size = 1024;
+	blurfilter->parallel = TRUE;
+	blurfilter->scheduler = cv_scheduler_get();
+	blurfilter->stream = cv_scheduler_stream_new(blurfilter->scheduler);
+	blurfilter->trickmode = CV_TRICKMODE_PREVIEW;
+	cv_trickmode_init(&blurfilter->trickmode_state);
+	blurfilter->frame_action = CV_TRICKMODE_FULL;
 	g_print("Blur- and sharpening filter for grayscale video\n");
 	g_print("Press '+' for high pass filtering and '-' for low pass filtering\n");
 }
@@ -192,6 +292,14 @@ gst_blur_filter_src_event(GstBaseTransform * trans, GstEvent * event)
 	const gchar *type;
 	const gchar *key;
 
+	/* Seeks tell key unit seeks, whose first frame is only a preview */
+	if (GST_EVENT_TYPE(event) == GST_EVENT_SEEK)
+	{
+		GST_OBJECT_LOCK(blurfilter);
+		cv_trickmode_seek(&blurfilter->trickmode_state, event);
+		GST_OBJECT_UNLOCK(blurfilter);
+	}
+
 	/* If a navigation event happens */
 	if (GST_EVENT_TYPE(event) == GST_EVENT_NAVIGATION)
 	{
@@ -217,6 +325,25 @@ gst_blur_filter_src_event(GstBaseTransform * trans, GstEvent * event)
 
 }
 
+/* Event function for the segments, to follow trick modes */
+static gboolean
+gst_blur_filter_sink_event(GstBaseTransform * trans, GstEvent * event)
+{
+	GstBlurFilter *blurfilter = GST_BLUR_FILTER(trans);
+
+	if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT)
+	{
+		GST_OBJECT_LOCK(blurfilter);
+		cv_trickmode_segment(&blurfilter->trickmode_state, event);
+		if (blurfilter->trickmode_state.segment)
+			GST_INFO_OBJECT(blurfilter, "trick mode segment, frames get %s",
+				cv_trickmode_action_name(blurfilter->trickmode));
+		GST_OBJECT_UNLOCK(blurfilter);
+	}
+
+	return GST_BASE_TRANSFORM_CLASS(gst_blur_filter_parent_class)->sink_event(trans, event);
+}
+
 /* Property setter for external access */
 void
 gst_blur_filter_set_property(GObject * object, guint property_id,
@@ -238,6 +365,52 @@ gst_blur_filter_set_property(GObject * object, guint property_id,
 		else
 			g_print("Low-pass filtering\n");
 		break;
+	case PROP_ENGINE:
+		blurfilter->engine = (GstBlurFilterEngine)g_value_get_enum(value);
+		g_print("%s engine\n", blurfilter->engine == GST_BLUR_FILTER_ENGINE_AUTO ? "Auto" :
+			blurfilter->engine == GST_BLUR_FILTER_ENGINE_PYRAMID ? "Pyramid" : "Direct");
+		break;
+	case PROP_POOL_PADDING:
+		blurfilter->pool_padding = g_value_get_uint(value);
+		break;
+	case PROP_TOLERANCE:
+		blurfilter->tolerance = g_value_get_double(value);
+		blurfilter->planned_sigma = -1.0;
+		break;
+	case PROP_STATS_INTERVAL:
+		blurfilter->stats_interval = g_value_get_uint(value);
+		break;
+	case PROP_CACHE_SIZE:
+	case PROP_CACHE_SPILL_LOCATION:
+	case PROP_CACHE_SPILL_SIZE:
+		/* The cache is created again with the new settings on the next frame */
+		GST_OBJECT_LOCK(blurfilter);
+		if (property_id == PROP_CACHE_SIZE)
+			blurfilter->cache_size = g_value_get_uint(value);
+		else if (property_id == PROP_CACHE_SPILL_SIZE)
+			blurfilter->cache_spill_size = g_value_get_uint(value);
+		else
+		{
+			g_free(blurfilter->cache_spill_location);
+			blurfilter->cache_spill_location = g_value_dup_string(value);
+		}
+		if (blurfilter->cache != NULL)
+		{
+			cv_cache_free(blurfilter->cache);
+			blurfilter->cache = NULL;
+		}
+		GST_OBJECT_UNLOCK(blurfilter);
+		break;
+	case PROP_PARALLEL:
+		GST_OBJECT_LOCK(blurfilter);
+		blurfilter->parallel = g_value_get_boolean(value);
+		GST_OBJECT_UNLOCK(blurfilter);
+		break;
+	case PROP_TRICKMODE:
+		GST_OBJECT_LOCK(blurfilter);
+		blurfilter->trickmode = (CvTrickmodeAction)g_value_get_enum(value);
+		GST_OBJECT_UNLOCK(blurfilter);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
 		break;
@@ -257,67 +430,136 @@ gst_blur_filter_get_property(GObject * object, guint property_id,
 		break;
 	case PROP_FILTERING:
 		g_value_set_int(value, blurfilter->filtering);
+		break;
+	case PROP_ENGINE:
+		g_value_set_enum(value, blurfilter->engine);
+		break;
+	case PROP_POOL_PADDING:
+		g_value_set_uint(value, blurfilter->pool_padding);
+		break;
+	case PROP_TOLERANCE:
+		g_value_set_double(value, blurfilter->tolerance);
+		break;
+	case PROP_STATS:
+		g_value_take_boxed(value, cv_stats_get_structure(blurfilter->stats, "blurfilter-stats"));
+		break;
+	case PROP_STATS_INTERVAL:
+		g_value_set_uint(value, blurfilter->stats_interval);
+		break;
+	case PROP_CACHE_SIZE:
+		g_value_set_uint(value, blurfilter->cache_size);
+		break;
+	case PROP_CACHE_SPILL_LOCATION:
+		g_value_set_string(value, blurfilter->cache_spill_location);
+		break;
+	case PROP_CACHE_SPILL_SIZE:
+		g_value_set_uint(value, blurfilter->cache_spill_size);
+		break;
+	case PROP_PARALLEL:
+		g_value_set_boolean(value, blurfilter->parallel);
+		break;
+	case PROP_TRICKMODE:
+		g_value_set_enum(value, blurfilter->trickmode);
+		break;
 	default:
 		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
 		break;
 	}
 }
 
-/* Computes the 1-dimensional gaussian function, given distance x and StDev sigma*/
-float gaussian1d(float sigma, int x)
+static void
+gst_blur_filter_finalize(GObject * object)
+{
+	GstBlurFilter *blurfilter = GST_BLUR_FILTER(object);
+
+	cv_stats_free(blurfilter->stats);
+	cv_scheduler_stream_free(blurfilter->stream);
+	if (blurfilter->cache != NULL)
+		cv_cache_free(blurfilter->cache);
+	g_free(blurfilter->cache_spill_location);
+
+	G_OBJECT_CLASS(gst_blur_filter_parent_class)->finalize(object);
+}
+
+/* Offers upstream a pool of frames with aligned planes and strides */
+static gboolean
+gst_blur_filter_propose_allocation(GstBaseTransform * trans, GstQuery * decide_query,
+	GstQuery * query)
+{
+	GstBlurFilter *blurfilter = GST_BLUR_FILTER(trans);
+	guint padding;
+
+	/* Nothing to propose in passthrough */
+	if (decide_query == NULL)
+		return GST_BASE_TRANSFORM_CLASS(gst_blur_filter_parent_class)->propose_allocation(trans,
+			decide_query, query);
+
+	GST_OBJECT_LOCK(blurfilter);
+	padding = blurfilter->pool_padding;
+	GST_OBJECT_UNLOCK(blurfilter);
+
+	if (cv_propose_aligned_pool(query, padding))
+		return TRUE;
+	return GST_BASE_TRANSFORM_CLASS(gst_blur_filter_parent_class)->propose_allocation(trans,
+		decide_query, query);
+}
+
+/* Makes the output frames come from a pool with aligned planes and strides */
+static gboolean
+gst_blur_filter_decide_allocation(GstBaseTransform * trans, GstQuery * query)
+{
+	if (!cv_decide_aligned_pool(query, 0))
+		GST_DEBUG_OBJECT(trans, "downstream pool kept, output strides are not aligned");
+
+	return GST_BASE_TRANSFORM_CLASS(gst_blur_filter_parent_class)->decide_allocation(trans, query);
+}
+
+/* Planner callback, logs the benchmark of one engine */
+static void gst_blur_filter_plan_report(const gchar * name, gdouble ms, gdouble maxerror, gpointer user_data)
 {
-	float e = 1 / (sqrt(2 * M_PI)*sigma)*exp(-(pow(x, 2)) / (2 * pow(sigma,2)));
-	return e;
+	GST_INFO_OBJECT(user_data, "planner: %s engine %.2f ms, max error %.2f", name, ms, maxerror);
 }
 
-/* 
- *	Computes the 2D convolution of the image and the kernel. This function only
- *	works for separable kernels, as is the case with the gaussian kernel.
+/*
+ *	Picks the engine for the current sigma and a frame size when the engine
+ *	property is auto, see cv_blur_plan. Must not hold the object lock: it
+ *	is only taken to read and store the plan, so properties can be read and
+ *	set while the planner benchmarks the engines.
  */
-static void xyconvolution(float * preimage, float * postimage, float * kernel, int kernelsize, int width, int height, float weight)
+static void gst_blur_filter_plan(GstBlurFilter * blurfilter, int width, int height)
 {
-	float tmp;
-	float *tempimage = new float[height*width];
-	int kernelradius = (kernelsize - 1) / 2;
+	float sigma;
+	double tolerance;
+	CvBlurEngine engine;
 
-	/* Computes the convolution between image and kernel in the x-dim first */
-	for (int y = 0; y < height; ++y)
+	GST_OBJECT_LOCK(blurfilter);
+	sigma = blurfilter->sigma;
+	tolerance = blurfilter->tolerance;
+	if (blurfilter->engine != GST_BLUR_FILTER_ENGINE_AUTO || blurfilter->filtering == 0 ||
+		sigma == blurfilter->planned_sigma)
 	{
-		for (int x = kernelradius; x < width - kernelradius; ++x)
-		{
-			tmp = 0;
-			for (int k = 0; k < kernelsize; ++k)
-			{
-				tmp += (preimage[y*width + x + k - kernelradius] * kernel[k]);
-			}
-			tempimage[y*width + x] = tmp / weight;
-		}
+		GST_OBJECT_UNLOCK(blurfilter);
+		return;
 	}
+	GST_OBJECT_UNLOCK(blurfilter);
 
-	/* Computes the convolution between the intermediate image previously 
-	   created and the kernel in the y-dim */
-	for (int y = kernelradius; y < height - kernelradius; ++y)
+	engine = cv_blur_plan(sigma, tolerance, width, height, gst_blur_filter_plan_report, blurfilter);
+	GST_INFO_OBJECT(blurfilter, "sigma %.1f uses the %s engine", sigma, cv_blur_engine_name(engine, sigma));
+
+	/* A plan for parameters changed during the benchmark is dropped, the next frame plans again */
+	GST_OBJECT_LOCK(blurfilter);
+	if ((float)blurfilter->sigma == sigma && blurfilter->tolerance == tolerance)
 	{
-		for (int x = kernelradius; x < width - kernelradius; ++x)
-		{
-			tmp = 0;
-			for (int k = 0; k < kernelsize; ++k)
-			{
-				tmp += (tempimage[(y + k - kernelradius)*width + x] * kernel[k]);
-			}
-			postimage[y*width + x] = tmp / weight;
-		}
+		blurfilter->planned_engine = (GstBlurFilterEngine)engine;
+		blurfilter->planned_sigma = sigma;
 	}
-	
-	/* Clear allocated memory */
-	delete[] tempimage;
+	GST_OBJECT_UNLOCK(blurfilter);
 }
 
 /* Main function for the actual filtering */
-static void gst_blur_filter_convolution(GstBlurFilter * blurfilter, GstVideoFrame * dest, const GstVideoFrame * src)
+void gst_blur_filter_convolution(GstBlurFilter * blurfilter, GstVideoFrame * dest, const GstVideoFrame * src)
 {
 	/* Initialize base values for the frame */
-	gint x, y;
 	guint8 const *s;
 	guint8 *d;
 	gint src_y_stride, src_y_width, src_y_height;
@@ -349,99 +591,65 @@ static void gst_blur_filter_convolution(GstBlurFilter * blurfilter, GstVideoFram
 	src_u_depth = GST_VIDEO_FRAME_COMP_DEPTH(src, 1);
 	src_v_depth = GST_VIDEO_FRAME_COMP_DEPTH(src, 2);
 
-	/* Get sigma value for the gaussian function */
+	/* Get sigma value for the gaussian function, trick mode frames may be passed on unfiltered */
 	float sigma = blurfilter->sigma;
-	int filtering = blurfilter->filtering;
-	/* The kernel size is set to four times sigma plus one */
-	int kernelradius = 2 * sigma;
-	int kernelsize = 2 * kernelradius + 1;
-	float kernelweight = 0;
-
-	float *kernel;
-	float *preimage;
-	float *postimage;
-
-	/* Allocate memory for arrays of kernel and images */
-	kernel = new float[kernelsize];
-	preimage = new float[(src_y_height + kernelsize - 1)*(src_y_width + kernelsize - 1)];
-	postimage = new float[(src_y_height + kernelsize - 1)*(src_y_width + kernelsize - 1)];
+	int filtering = blurfilter->frame_action == CV_TRICKMODE_SKIP ? 0 : blurfilter->filtering;
+	gboolean preview = blurfilter->frame_action == CV_TRICKMODE_PREVIEW;
+	GstBlurFilterEngine engine;
 
 	/* Get pointers to Y-values for the in- and outframe */
 	s = GST_VIDEO_FRAME_COMP_DATA(src, 0);
 	d = GST_VIDEO_FRAME_COMP_DATA(dest, 0);
 
-	/* Copy the Y-plane directly if filtering is disabled */
-	if (filtering == 0)
-	{
-		gst_video_frame_copy_plane(dest, src, 0);
-		goto UVframe;
-	}
-	
-	/* Compute and save the 1-dim kernel and its normalizing weight */
-	for (int i = 0; i < kernelsize; i++)
-	{
-		kernel[i] = gaussian1d(sigma, i - kernelradius);
-		kernelweight += kernel[i];
-	}
-
-	/* Copy the inframe to preimage and zero-pad it with kernelradius 
-	 * in each direction */
-	for (y = 0; y < src_y_height + kernelsize - 1; ++y)
-	{
-		for (x = 0; x < src_y_width + kernelsize - 1; ++x)
-		{
-			if (x >= kernelradius && x < src_y_width + kernelradius && y >= kernelradius && y < src_y_height + kernelradius)
-				preimage[y*(src_y_width + kernelsize - 1) + x] = s[(y - kernelradius)*src_y_stride + x - kernelradius];
-			else
-			{
-				preimage[y*(src_y_width + kernelsize - 1) + x] = 0;
-			}
-		}
-	}
-
-	/* Compute the 2d convolution */
-	xyconvolution(preimage, postimage, kernel, kernelsize, src_y_width + kernelsize - 1, src_y_height + kernelsize - 1, kernelweight);
+	/* The plan is made before the frame, until it is the direct engine stands in */
+	engine = blurfilter->engine;
+	if (filtering != 0 && engine == GST_BLUR_FILTER_ENGINE_AUTO)
+		engine = sigma == blurfilter->planned_sigma ? blurfilter->planned_engine : GST_BLUR_FILTER_ENGINE_DIRECT;
+	cv_stats_set_engine(blurfilter->stats,
+		filtering == 0 ? "copy" : preview ? "preview" : cv_blur_engine_name((CvBlurEngine)engine, sigma),
+		blurfilter->parallel ? cv_scheduler_get_n_workers(blurfilter->scheduler) : 1);
+
+	/* The bands of the passes run on the shared workers, with the other streams' */
+	if (blurfilter->parallel)
+		cv_parallel_set_runner(cv_scheduler_stream_get_runner(blurfilter->stream));
+	if (preview)
+		cv_blur_preview_plane(s, src_y_stride, d, dest_y_stride, dest_y_width, dest_y_height, sigma, filtering,
+			(CvBlurEngine)engine);
+	else
+		cv_blur_plane(s, src_y_stride, d, dest_y_stride, dest_y_width, dest_y_height, sigma, filtering,
+			(CvBlurEngine)engine);
+	cv_parallel_set_runner(NULL);
 
-	for (y = 0; y < dest_y_height; ++y)
-	{
-		for (x = 0; x < dest_y_width; ++x)
-		{
-			/* Set the convoluted image as the outframe if low pass filtering, remove it from the inframe 
-			 * and add the difference as well as the inframe to the outframe if high pass filtering */
-			d[y*dest_y_stride + x] = s[y*src_y_stride + x] + filtering * (s[y*src_y_stride + x] - postimage[(y + kernelradius)*(src_y_width + kernelsize - 1) + x + kernelradius]);
-		}
-	}
-
-UVframe:
 	s = GST_VIDEO_FRAME_COMP_DATA(src, 1);
 	d = GST_VIDEO_FRAME_COMP_DATA(dest, 1);
 
 	/* Each pixel in the UV-colour plane is set to 128 to ensure greyscale.
-	 * If greyscale is assumed, this can be changed to gst_video_frame_copy_plane 
+	 * If greyscale is assumed, this can be changed to gst_video_frame_copy_plane
 	 * as well for simplicity */
-	for (y = 0; y < dest_u_height; y++)
-	{
-		for (x = 0; x < dest_u_width; x++)
-		{
-			d[y*dest_u_stride + x] = pow(2,src_u_depth - 1);
-		}
-	}
+	cv_fill_plane(d, dest_u_stride, dest_u_width, dest_u_height, 1 << (src_u_depth - 1));
 
 	s = GST_VIDEO_FRAME_COMP_DATA(src, 2);
 	d = GST_VIDEO_FRAME_COMP_DATA(dest, 2);
 
-	for (y = 0; y < dest_v_height; y++)
-	{
-		for (x = 0; x < dest_v_width; x++)
-		{
-			d[y*dest_v_stride + x] = pow(2,src_v_depth - 1);
-		}
-	}
+	cv_fill_plane(d, dest_v_stride, dest_v_width, dest_v_height, 1 << (src_v_depth - 1));
+	cv_store_fence();
+	cv_stats_mark(CV_STAGE_CHROMA);
+}
+
 
-	/* Free allocated memory */
-	delete[] kernel;
-	delete[] preimage;
-	delete[] postimage;
+/* Caps negotiation, plans the engine for the negotiated frame size */
+static gboolean
+gst_blur_filter_set_info(GstVideoFilter * filter, GstCaps * incaps, GstVideoInfo * in_info,
+	GstCaps * outcaps, GstVideoInfo * out_info)
+{
+	GstBlurFilter *blurfilter = GST_BLUR_FILTER(filter);
+
+	GST_OBJECT_LOCK(blurfilter);
+	blurfilter->planned_sigma = -1.0;
+	GST_OBJECT_UNLOCK(blurfilter);
+	gst_blur_filter_plan(blurfilter, GST_VIDEO_INFO_WIDTH(in_info), GST_VIDEO_INFO_HEIGHT(in_info));
+
+	return TRUE;
 }
 
 
@@ -452,12 +660,51 @@ gst_blur_filter_transform_frame(GstVideoFilter * filter, GstVideoFrame * inframe
 {
 
 	GstBlurFilter *blurfilter = GST_BLUR_FILTER(filter);
+	GstClockTime interval;
+	GstMessage *msg;
+	CvCacheKey key;
+	gboolean hit = FALSE;
+
+	/* Sigma or the engine may have changed since the last frame */
+	gst_blur_filter_plan(blurfilter, GST_VIDEO_FRAME_COMP_WIDTH(inframe, 0),
+		GST_VIDEO_FRAME_COMP_HEIGHT(inframe, 0));
 
 	/* Mutex lock the filter */
 	GST_OBJECT_LOCK(blurfilter);
-	gst_blur_filter_convolution(blurfilter, outframe, inframe);
+	cv_stats_frame_begin(blurfilter->stats);
+	blurfilter->frame_action = cv_trickmode_next_frame(&blurfilter->trickmode_state) ?
+		blurfilter->trickmode : CV_TRICKMODE_FULL;
+
+	/* Reuse the output of the same input filtered with the same parameters */
+	if (blurfilter->cache_size > 0)
+	{
+		double params[] = { blurfilter->sigma, (double)blurfilter->filtering,
+			(double)blurfilter->engine, blurfilter->tolerance };
+
+		if (blurfilter->cache == NULL)
+			blurfilter->cache = cv_cache_new((gsize)blurfilter->cache_size << 20,
+				blurfilter->cache_spill_location, (gsize)blurfilter->cache_spill_size << 20);
+		cv_cache_key_init(&key, inframe, outframe, cv_cache_hash(params, sizeof(params), 0));
+		hit = cv_cache_load_frame(blurfilter->cache, &key, outframe);
+		cv_stats_cache_lookup(blurfilter->stats, hit);
+	}
+	if (!hit)
+	{
+		gst_blur_filter_convolution(blurfilter, outframe, inframe);
+		/* Previews and skipped frames are not what the parameters promise */
+		if (blurfilter->cache != NULL && blurfilter->frame_action == CV_TRICKMODE_FULL)
+			cv_cache_store_frame(blurfilter->cache, &key, outframe);
+	}
+	cv_stats_frame_end(blurfilter->stats,
+		GST_VIDEO_FRAME_SIZE(inframe) + GST_VIDEO_FRAME_SIZE(outframe));
+	interval = blurfilter->stats_interval * GST_MSECOND;
 	GST_OBJECT_UNLOCK(blurfilter);
 
+	/* Post the statistics periodically for monitoring */
+	msg = cv_stats_poll_message(blurfilter->stats, GST_OBJECT(blurfilter), "blurfilter-stats", interval);
+	if (msg != NULL)
+		gst_element_post_message(GST_ELEMENT(blurfilter), msg);
+
 	return GST_FLOW_OK;
 }
 
@@ -466,6 +713,9 @@ gst_blur_filter_transform_frame(GstVideoFilter * filter, GstVideoFrame * inframe
 static gboolean
 plugin_init(GstPlugin * plugin)
 {
+	/* Starts the workers shared with the other filter plugins, unless one of them already did */
+	cv_scheduler_get();
+
 	return gst_element_register(plugin, "blurfilter", GST_RANK_NONE,
 		GST_TYPE_BLUR_FILTER);
 }
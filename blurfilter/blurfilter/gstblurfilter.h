@@ -22,6 +22,10 @@
 
 #include <gst/video/video.h>
 #include <gst/video/gstvideofilter.h>
+#include "cvstats.h"
+#include "cvcache.h"
+#include "cvscheduler.h"
+#include "cvtrickmode.h"
 
 G_BEGIN_DECLS
 
@@ -31,14 +35,45 @@ G_BEGIN_DECLS
 #define GST_IS_BLUR_FILTER(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_BLUR_FILTER))
 #define GST_IS_BLUR_FILTER_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_BLUR_FILTER))
 
+#define GST_TYPE_BLUR_FILTER_ENGINE   (gst_blur_filter_engine_get_type())
+
 typedef struct _GstBlurFilter GstBlurFilter;
 typedef struct _GstBlurFilterClass GstBlurFilterClass;
 
+/* Ways of computing the gaussian, selected with the engine property, the same values as CvBlurEngine */
+typedef enum
+{
+	GST_BLUR_FILTER_ENGINE_DIRECT,
+	GST_BLUR_FILTER_ENGINE_PYRAMID,
+	GST_BLUR_FILTER_ENGINE_AUTO
+} GstBlurFilterEngine;
+
 struct _GstBlurFilter
 {
 	GstVideoFilter base_blurfilter;
 	double sigma;
 	int filtering;
+	GstBlurFilterEngine engine;
+	double tolerance;
+	/* Engine picked by the planner for planned_sigma, when engine is auto */
+	GstBlurFilterEngine planned_engine;
+	double planned_sigma;
+	guint pool_padding;
+	CvStats *stats;
+	guint stats_interval;
+	/* Filtered frames, created on the first frame while cache_size is not 0 */
+	CvCache *cache;
+	guint cache_size;
+	gchar *cache_spill_location;
+	guint cache_spill_size;
+	/* Splits the frames into tasks for the shared scheduler when parallel is TRUE */
+	gboolean parallel;
+	CvScheduler *scheduler;
+	CvSchedulerStream *stream;
+	/* What trick mode frames get, whether the segment is one, and what the frame being filtered gets */
+	CvTrickmodeAction trickmode;
+	CvTrickmode trickmode_state;
+	CvTrickmodeAction frame_action;
 
 };
 
@@ -48,6 +83,11 @@ struct _GstBlurFilterClass
 };
 
 GType gst_blur_filter_get_type(void);
+GType gst_blur_filter_engine_get_type(void);
+
+/* Filters a whole frame, exported so the kernel benchmark can call it directly */
+void gst_blur_filter_convolution(GstBlurFilter * blurfilter,
+	GstVideoFrame * dest, const GstVideoFrame * src);
 
 G_END_DECLS
 
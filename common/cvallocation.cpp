@@ -0,0 +1,174 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+* Boston, MA 02110-1335, USA.
+*/
+/*
+ * Buffer pool negotiation shared by the filter elements. The pools hand out frames whose planes and strides are
+ * multiples of CV_PLANE_ALIGN, so that every row of a frame starts on a
+ * cache line and can be written with aligned non-temporal stores.
+ */
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include "cvallocation.h"
+
+
+/* Sets up an alignment with CV_PLANE_ALIGN strides and halo pixels of
+ * padding on every side of the planes */
+void cv_video_alignment_init(GstVideoAlignment * align, guint halo)
+{
+	gst_video_alignment_reset(align);
+	align->padding_top = halo;
+	align->padding_bottom = halo;
+	align->padding_left = halo;
+	align->padding_right = halo;
+	for (int i = 0; i < GST_VIDEO_MAX_PLANES; ++i)
+		align->stride_align[i] = CV_PLANE_ALIGN - 1;
+}
+
+/* Configures pool for caps with aligned planes, returns the resulting
+ * buffer size or 0 if the pool refused the configuration */
+static guint configure_pool(GstBufferPool * pool, GstCaps * caps, guint size,
+	guint min, guint max, guint halo)
+{
+	GstStructure *config = gst_buffer_pool_get_config(pool);
+	GstVideoAlignment align;
+	GstAllocationParams params;
+
+	cv_video_alignment_init(&align, halo);
+	gst_allocation_params_init(&params);
+	params.align = CV_PLANE_ALIGN - 1;
+
+	gst_buffer_pool_config_set_params(config, caps, size, min, max);
+	gst_buffer_pool_config_set_allocator(config, NULL, &params);
+	gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_META);
+	gst_buffer_pool_config_add_option(config, GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT);
+	gst_buffer_pool_config_set_video_alignment(config, &align);
+
+	if (!gst_buffer_pool_set_config(pool, config))
+	{
+		/* The pool may have adjusted the configuration, accept it if the
+		 * limits still hold */
+		config = gst_buffer_pool_get_config(pool);
+		if (!gst_buffer_pool_config_validate_params(config, caps, size, min, max) ||
+			!gst_buffer_pool_set_config(pool, config))
+			return 0;
+	}
+
+	/* The video pool grows the buffer size to fit the padded planes */
+	config = gst_buffer_pool_get_config(pool);
+	gst_buffer_pool_config_get_params(config, NULL, &size, NULL, NULL);
+	gst_structure_free(config);
+	return size;
+}
+
+/* Answers an upstream allocation query with a pool of aligned frames */
+gboolean cv_propose_aligned_pool(GstQuery * query, guint halo)
+{
+	GstCaps *caps;
+	gboolean need_pool;
+	GstVideoInfo info;
+	GstAllocationParams params;
+
+	gst_query_parse_allocation(query, &caps, &need_pool);
+	if (caps == NULL || !gst_video_info_from_caps(&info, caps))
+		return FALSE;
+
+	if (need_pool)
+	{
+		GstBufferPool *pool = gst_video_buffer_pool_new();
+		guint size = configure_pool(pool, caps, info.size, 0, 0, halo);
+
+		if (size == 0)
+		{
+			gst_object_unref(pool);
+			return FALSE;
+		}
+		gst_query_add_allocation_pool(query, pool, size, 0, 0);
+		gst_object_unref(pool);
+	}
+
+	gst_allocation_params_init(&params);
+	params.align = CV_PLANE_ALIGN - 1;
+	gst_query_add_allocation_param(query, NULL, &params);
+	gst_query_add_allocation_meta(query, GST_VIDEO_META_API_TYPE, NULL);
+
+	return TRUE;
+}
+
+/*
+ *	Makes the first pool of a downstream allocation query hand out aligned
+ *	frames, replacing it with a video buffer pool if it cannot align. Only
+ *	done if downstream understands video meta, as the aligned strides differ
+ *	from the default ones. Returns FALSE if the query was left untouched.
+ */
+gboolean cv_decide_aligned_pool(GstQuery * query, guint halo)
+{
+	GstCaps *caps;
+	GstVideoInfo info;
+	GstBufferPool *pool = NULL;
+	GstAllocator *allocator = NULL;
+	GstAllocationParams params;
+	guint size = 0, min = 0, max = 0;
+	gboolean update_pool = gst_query_get_n_allocation_pools(query) > 0;
+
+	gst_query_parse_allocation(query, &caps, NULL);
+	if (caps == NULL || !gst_video_info_from_caps(&info, caps))
+		return FALSE;
+	if (!gst_query_find_allocation_meta(query, GST_VIDEO_META_API_TYPE, NULL))
+		return FALSE;
+
+	if (update_pool)
+		gst_query_parse_nth_allocation_pool(query, 0, &pool, &size, &min, &max);
+	if (pool == NULL || !gst_buffer_pool_has_option(pool, GST_BUFFER_POOL_OPTION_VIDEO_ALIGNMENT))
+	{
+		if (pool != NULL)
+			gst_object_unref(pool);
+		pool = gst_video_buffer_pool_new();
+	}
+
+	size = configure_pool(pool, caps, MAX(size, (guint)info.size), min, max, halo);
+	if (size == 0)
+	{
+		gst_object_unref(pool);
+		return FALSE;
+	}
+
+	if (update_pool)
+		gst_query_set_nth_allocation_pool(query, 0, pool, size, min, max);
+	else
+		gst_query_add_allocation_pool(query, pool, size, min, max);
+	gst_object_unref(pool);
+
+	/* Make sure the allocator keeps the plane starts aligned as well */
+	if (gst_query_get_n_allocation_params(query) > 0)
+	{
+		gst_query_parse_nth_allocation_param(query, 0, &allocator, &params);
+		params.align = MAX(params.align, (gsize)(CV_PLANE_ALIGN - 1));
+		gst_query_set_nth_allocation_param(query, 0, allocator, &params);
+		if (allocator != NULL)
+			gst_object_unref(allocator);
+	}
+	else
+	{
+		gst_allocation_params_init(&params);
+		params.align = CV_PLANE_ALIGN - 1;
+		gst_query_add_allocation_param(query, NULL, &params);
+	}
+
+	return TRUE;
+}
@@ -0,0 +1,38 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _CV_ALLOCATION_H_
+#define _CV_ALLOCATION_H_
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include "cvstore.h"
+
+G_BEGIN_DECLS
+
+/* Alignment in bytes of every plane start and stride, one cache line */
+#define CV_PLANE_ALIGN 64
+
+void cv_video_alignment_init(GstVideoAlignment * align, guint halo);
+gboolean cv_propose_aligned_pool(GstQuery * query, guint halo);
+gboolean cv_decide_aligned_pool(GstQuery * query, guint halo);
+
+G_END_DECLS
+
+#endif
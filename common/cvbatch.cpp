@@ -0,0 +1,129 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+/*
+ * Batches of planes for the engines, filtered together by the batchfilter
+ * element. The engines share the kernel and the scratch memory between the
+ * planes of a batch and run each pass of all the planes as one parallel
+ * loop, so the workers move from one plane to the next without waiting at
+ * the end of every plane. Like the engines this only depends on glib.
+ */
+
+#include <glib.h>
+#include "cvbatch.h"
+#include "cvparallel.h"
+
+/* A loop over the tasks of every plane, flattened for cv_parallel_for */
+typedef struct
+{
+	/* first[p] is the number of the first task of plane p, first[n_planes] the total */
+	gint *first;
+	gint n_planes;
+	CvBatchTaskFunc func;
+	gpointer data;
+} BatchLoop;
+
+/*
+ *	Returns scratch memory of at least floats floats, its content undefined.
+ *	The memory is kept for the next batch and only grows, so batches of the
+ *	same frames allocate it once.
+ */
+float *cv_batch_scratch_reserve(CvBatchScratch * scratch, gsize floats)
+{
+	if (floats > scratch->size)
+	{
+		g_free(scratch->data);
+		scratch->data = g_new(float, floats);
+		scratch->size = floats;
+	}
+	return scratch->data;
+}
+
+void cv_batch_scratch_clear(CvBatchScratch * scratch)
+{
+	g_free(scratch->data);
+	scratch->data = NULL;
+	scratch->size = 0;
+}
+
+/*
+ *	Copies rows y0..y1-1 of the zero padded image of the plane, padded by
+ *	kernelradius pixels on every side, into preimage.
+ */
+void cv_batch_pad_rows(const CvPlane * plane, float * preimage, int kernelradius, int y0, int y1)
+{
+	int paddedwidth = plane->width + 2 * kernelradius;
+
+	for (int y = y0; y < y1; ++y)
+	{
+		float *row = preimage + y*paddedwidth;
+		int sy = y - kernelradius;
+
+		if (sy < 0 || sy >= plane->height)
+		{
+			for (int x = 0; x < paddedwidth; ++x)
+				row[x] = 0;
+			continue;
+		}
+		for (int x = 0; x < kernelradius; ++x)
+			row[x] = 0;
+		for (int x = 0; x < plane->width; ++x)
+			row[x + kernelradius] = plane->src[sy*plane->src_stride + x];
+		for (int x = plane->width + kernelradius; x < paddedwidth; ++x)
+			row[x] = 0;
+	}
+}
+
+static void batch_task(gint task, gpointer user_data)
+{
+	BatchLoop *loop = (BatchLoop *)user_data;
+	gint lo = 0;
+	gint hi = loop->n_planes;
+
+	/* The last plane whose first task is not after task */
+	while (hi - lo > 1)
+	{
+		gint mid = (lo + hi) / 2;
+		if (loop->first[mid] <= task)
+			lo = mid;
+		else
+			hi = mid;
+	}
+	loop->func(lo, task - loop->first[lo], loop->data);
+}
+
+/*
+ *	Runs func for tasks 0..n_tasks[p]-1 of every plane p of a batch, all in
+ *	one cv_parallel_for, and returns once all are done.
+ */
+void cv_batch_for(const gint * n_tasks, gint n_planes, CvBatchTaskFunc func, gpointer data)
+{
+	BatchLoop loop;
+
+	loop.first = g_new(gint, n_planes + 1);
+	loop.n_planes = n_planes;
+	loop.func = func;
+	loop.data = data;
+
+	loop.first[0] = 0;
+	for (gint p = 0; p < n_planes; ++p)
+		loop.first[p + 1] = loop.first[p] + n_tasks[p];
+
+	cv_parallel_for(loop.first[n_planes], batch_task, &loop);
+	g_free(loop.first);
+}
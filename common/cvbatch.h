@@ -0,0 +1,56 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _CV_BATCH_H_
+#define _CV_BATCH_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* An 8 bit plane of a frame of a batch and where its result goes */
+typedef struct _CvPlane
+{
+	const guint8 *src;
+	gint src_stride;
+	guint8 *dest;
+	gint dest_stride;
+	int width;
+	int height;
+} CvPlane;
+
+/* Float scratch memory of the batches, kept and reused from one batch to the next */
+typedef struct _CvBatchScratch
+{
+	float *data;
+	gsize size;
+} CvBatchScratch;
+
+/* Runs task number task of plane number plane of a batch loop */
+typedef void (*CvBatchTaskFunc)(gint plane, gint task, gpointer user_data);
+
+float *cv_batch_scratch_reserve(CvBatchScratch * scratch, gsize floats);
+void cv_batch_scratch_clear(CvBatchScratch * scratch);
+
+void cv_batch_pad_rows(const CvPlane * plane, float * preimage, int kernelradius, int y0, int y1);
+void cv_batch_for(const gint * n_tasks, gint n_planes, CvBatchTaskFunc func, gpointer data);
+
+G_END_DECLS
+
+#endif
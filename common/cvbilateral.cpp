@@ -0,0 +1,1262 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Bilateral filter engines of the bilateralfilter element, on planes of
+ * floats and 8 bit pixels. The core only depends on glib, so the element
+ * and the standalone cvfilter tool run the same code and produce the same
+ * pixels. The passes run in rows of blocks or bands with cv_parallel_for.
+ */
+
+#define _USE_MATH_DEFINES
+
+#include <glib.h>
+#include "cvbilateral.h"
+#include "cvbatch.h"
+#include "cvparallel.h"
+#include "cvpreview.h"
+#include "cvstage.h"
+#include "cvstore.h"
+#include "cvtemporal.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CV_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Number of output rows the fused sharpening pass produces per band, at least */
+#define FUSED_TILE_ROWS 32
+/* Bands of the fused pass span this many times the rows of their sharpening halo */
+#define FUSED_HALO_RATIO 4
+
+/* Side length in pixels of the square blocks used to find flat regions */
+#define FLAT_BLOCK_SIZE 32
+
+/* Rows of the full size plane each joint upsampling task writes */
+#define UPSAMPLE_BAND_ROWS 64
+
+/* Width and height in reduced size pixels of the joint upsampling window, one SSE2 vector wide */
+#define UPSAMPLE_TAPS 4
+
+/* Block classes, decides which path each block takes through xyconvolution */
+enum
+{
+	BLOCK_BILATERAL,
+	BLOCK_GAUSSIAN,
+	BLOCK_COPY
+};
+
+/* Computes the 1-dimensional gaussian function, given distance x and StDev sigma*/
+static float gaussian1d(float sigma, float x)
+{
+	return exp(-(pow(x, 2) / (2 * pow(sigma, 2))));
+}
+
+
+/*
+ *	Largest intensity span for which every range weight stays within
+ *	flat_tolerance of 1, i.e. gaussian1d(sigmar, flatspan) = 1 - flat_tolerance.
+ *	Returns -1, disabling the flat block early-out, for a tolerance of 0.
+ */
+float cv_bilateral_flatspan(float sigmar, float flat_tolerance)
+{
+	if (flat_tolerance <= 0)
+		return -1;
+	return sigmar * sqrt(-2 * log(1 - flat_tolerance));
+}
+
+/* Whether the rows of blocks by0 to by1 of column bx hold a block not 0 in active, always with no active */
+static gboolean column_active(const unsigned char * active, int blocksx, int blocksy, int bx, int by0, int by1)
+{
+	if (active == NULL)
+		return TRUE;
+	for (int by = MAX(by0, 0); by <= MIN(by1, blocksy - 1); ++by)
+		if (active[by*blocksx + bx])
+			return TRUE;
+	return FALSE;
+}
+
+/*
+ *	Sorts each FLAT_BLOCK_SIZE block of the padded image into a class by the
+ *	intensity span of the block and its kernel halo. The halo covers every
+ *	pixel either pass of xyconvolution reads for the block, so a block whose
+ *	span is at most flatspan has all its range weights close to 1 and the
+ *	bilateral kernel reduces to the plain gaussian. A block of constant
+ *	intensity is left unchanged by the filter and can simply be copied.
+ *	With active, see masked_active_blocks, only the blocks the horizontal
+ *	pass filters are sorted and only their pixels read.
+ */
+static void classify_blocks(const float * preimage, unsigned char * blockclass, float flatspan, int kernelradius,
+	int width, int height, const unsigned char * active)
+{
+	int blocksx = (width + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	int blocksy = (height + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+
+	for (int by = 0; by < blocksy; ++by)
+	{
+		int y0 = MAX(by*FLAT_BLOCK_SIZE - kernelradius, 0);
+		int y1 = MIN((by + 1)*FLAT_BLOCK_SIZE + kernelradius, height);
+
+		for (int bx = 0; bx < blocksx; ++bx)
+		{
+			int x0 = MAX(bx*FLAT_BLOCK_SIZE - kernelradius, 0);
+			int x1 = MIN((bx + 1)*FLAT_BLOCK_SIZE + kernelradius, width);
+			float lo;
+			float hi;
+
+			if (!column_active(active, blocksx, blocksy, bx, by - 1, by + 1))
+			{
+				blockclass[by*blocksx + bx] = BLOCK_BILATERAL;
+				continue;
+			}
+			lo = preimage[y0*width + x0];
+			hi = lo;
+
+			for (int y = y0; y < y1 && hi - lo <= flatspan; ++y)
+			{
+				for (int x = x0; x < x1; ++x)
+				{
+					float pix = preimage[y*width + x];
+					lo = MIN(lo, pix);
+					hi = MAX(hi, pix);
+				}
+			}
+
+			if (hi == lo)
+				blockclass[by*blocksx + bx] = BLOCK_COPY;
+			else if (hi - lo <= flatspan)
+				blockclass[by*blocksx + bx] = BLOCK_GAUSSIAN;
+			else
+				blockclass[by*blocksx + bx] = BLOCK_BILATERAL;
+		}
+	}
+}
+
+/* Arguments of the block rows of one bilateral xyconvolution */
+typedef struct
+{
+	float *preimage;
+	float *tempimage;
+	float *postimage;
+	float *kernel;
+	unsigned char *blockclass;
+	/* Blocks to filter, NULL for all of them */
+	const unsigned char *active;
+	float sigmar;
+	float kernelweight;
+	int kernelradius;
+	int width;
+	int height;
+	int blocksx;
+} BilateralPass;
+
+/* Whether the rows of blocks by0 to by1 of column bx hold an active block */
+static gboolean blocks_active(const BilateralPass * pass, int bx, int by0, int by1)
+{
+	int blocksy = (pass->height + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+
+	return column_active(pass->active, pass->blocksx, blocksy, bx, by0, by1);
+}
+
+/* Convolution in the x-dim of a row of blocks */
+static void bilateral_horizontal(gint by, gpointer user_data)
+{
+	BilateralPass *pass = (BilateralPass *)user_data;
+	float *preimage = pass->preimage;
+	float *tempimage = pass->tempimage;
+	float *kernel = pass->kernel;
+	float sigmar = pass->sigmar;
+	int kernelradius = pass->kernelradius;
+	int width = pass->width;
+	int y0 = by*FLAT_BLOCK_SIZE;
+	int y1 = MIN(y0 + FLAT_BLOCK_SIZE, pass->height);
+	float tmp;
+	float w;
+	float wp;
+	float pixa;
+	float pixb;
+
+	for (int bx = 0; bx < pass->blocksx; ++bx)
+	{
+		int x0 = MAX(bx*FLAT_BLOCK_SIZE, kernelradius);
+		int x1 = MIN((bx + 1)*FLAT_BLOCK_SIZE, width - kernelradius);
+
+		/* The vertical pass of an active block reads the rows of the blocks above and below */
+		if (!blocks_active(pass, bx, by - 1, by + 1))
+			continue;
+
+		switch (pass->blockclass[by*pass->blocksx + bx])
+		{
+		case BLOCK_COPY:
+			for (int y = y0; y < y1; ++y)
+				for (int x = x0; x < x1; ++x)
+					tempimage[y*width + x] = preimage[y*width + x];
+			break;
+		case BLOCK_GAUSSIAN:
+			for (int y = y0; y < y1; ++y)
+			{
+				for (int x = x0; x < x1; ++x)
+				{
+					tmp = 0;
+					for (int k = -kernelradius; k <= kernelradius; ++k)
+						tmp += preimage[y*width + x + k] * kernel[k + kernelradius];
+					tempimage[y*width + x] = tmp / pass->kernelweight;
+				}
+			}
+			break;
+		default:
+			for (int y = y0; y < y1; ++y)
+			{
+				for (int x = x0; x < x1; ++x)
+				{
+					tmp = 0;
+					wp = 0;
+					pixa = preimage[y*width + x];
+					for (int k = -kernelradius; k <= kernelradius; ++k)
+					{
+						pixb = preimage[y*width + x + k];
+						w = kernel[k + kernelradius] * gaussian1d(sigmar, pixa - pixb);
+						wp += w;
+						tmp += pixb * w;
+					}
+					tempimage[y*width + x] = tmp / wp;
+				}
+			}
+			break;
+		}
+	}
+}
+
+/* Convolution in the y-dim of a row of blocks */
+static void bilateral_vertical(gint by, gpointer user_data)
+{
+	BilateralPass *pass = (BilateralPass *)user_data;
+	float *tempimage = pass->tempimage;
+	float *postimage = pass->postimage;
+	float *kernel = pass->kernel;
+	float sigmar = pass->sigmar;
+	int kernelradius = pass->kernelradius;
+	int width = pass->width;
+	int y0 = MAX(by*FLAT_BLOCK_SIZE, kernelradius);
+	int y1 = MIN((by + 1)*FLAT_BLOCK_SIZE, pass->height - kernelradius);
+	float tmp;
+	float w;
+	float wp;
+	float pixa;
+	float pixb;
+
+	for (int bx = 0; bx < pass->blocksx; ++bx)
+	{
+		int x0 = MAX(bx*FLAT_BLOCK_SIZE, kernelradius);
+		int x1 = MIN((bx + 1)*FLAT_BLOCK_SIZE, width - kernelradius);
+
+		if (!blocks_active(pass, bx, by, by))
+			continue;
+
+		switch (pass->blockclass[by*pass->blocksx + bx])
+		{
+		case BLOCK_COPY:
+			for (int y = y0; y < y1; ++y)
+				for (int x = x0; x < x1; ++x)
+					postimage[y*width + x] = tempimage[y*width + x];
+			break;
+		case BLOCK_GAUSSIAN:
+			for (int y = y0; y < y1; ++y)
+			{
+				for (int x = x0; x < x1; ++x)
+				{
+					tmp = 0;
+					for (int k = -kernelradius; k <= kernelradius; ++k)
+						tmp += tempimage[(y + k)*width + x] * kernel[k + kernelradius];
+					postimage[y*width + x] = tmp / pass->kernelweight;
+				}
+			}
+			break;
+		default:
+			for (int y = y0; y < y1; ++y)
+			{
+				for (int x = x0; x < x1; ++x)
+				{
+					tmp = 0;
+					wp = 0;
+					pixa = tempimage[y*width + x];
+					for (int k = -kernelradius; k <= kernelradius; ++k)
+					{
+						pixb = tempimage[(y + k)*width + x];
+						w = kernel[k + kernelradius] * gaussian1d(sigmar, pixa - pixb);
+						wp += w;
+						tmp += pixb * w;
+					}
+					postimage[y*width + x] = tmp / wp;
+				}
+			}
+			break;
+		}
+	}
+}
+
+/*
+ *	Computes the 2D convolution of the image and the bilateral kernel. 
+ *	Calculates the bilateral kernel as separable instead of 
+ *	proper bilateral kernel convolution. Blocks found flat by classify_blocks
+ *	skip the range kernel, a negative flatspan disables the early-out.
+ *	Both passes run a row of blocks per task. With active, see
+ *	masked_active_blocks, only the blocks of the padded image not 0 in it
+ *	are filtered, the rest of postimage is left as it was, and only the
+ *	pixels of preimage around them are read.
+ */
+static void masked_xyconvolution(float * preimage, float * postimage, float * kernel, float sigmar,
+	float flatspan, int kernelsize, int width, int height, const unsigned char * active)
+{
+	BilateralPass pass;
+	int blocksx = (width + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	int blocksy = (height + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+
+	pass.preimage = preimage;
+	pass.tempimage = new float[height*width];
+	pass.postimage = postimage;
+	pass.kernel = kernel;
+	pass.blockclass = new unsigned char[blocksx*blocksy];
+	pass.active = active;
+	pass.sigmar = sigmar;
+	pass.kernelweight = 0;
+	pass.kernelradius = (kernelsize - 1) / 2;
+	pass.width = width;
+	pass.height = height;
+	pass.blocksx = blocksx;
+
+	cv_stats_scratch(height*width*sizeof(float) + blocksx*blocksy);
+
+	for (int k = 0; k < kernelsize; ++k)
+		pass.kernelweight += kernel[k];
+
+	/* The classification counts as padding in the statistics */
+	if (flatspan >= 0)
+		classify_blocks(preimage, pass.blockclass, flatspan, pass.kernelradius, width, height, active);
+	else
+		memset(pass.blockclass, BLOCK_BILATERAL, blocksx*blocksy);
+	cv_stats_mark(CV_STAGE_PAD);
+
+	/* Computes the convolution between image and kernel in the x-dim first */
+	cv_parallel_for(blocksy, bilateral_horizontal, &pass);
+	cv_stats_mark(CV_STAGE_HORIZONTAL);
+
+	/* Computes the convolution between the intermediate image previously
+	created and the kernel in the y-dim */
+	cv_parallel_for(blocksy, bilateral_vertical, &pass);
+	cv_stats_mark(CV_STAGE_VERTICAL);
+
+	/* Clear allocated memory */
+	cv_stats_scratch(-(gssize)(height*width*sizeof(float) + blocksx*blocksy));
+	delete[] pass.blockclass;
+	delete[] pass.tempimage;
+}
+
+void cv_bilateral_xyconvolution(float * preimage, float * postimage, float * kernel, float sigmar, float flatspan, int kernelsize, int width, int height)
+{
+	masked_xyconvolution(preimage, postimage, kernel, sigmar, flatspan, kernelsize, width, height, NULL);
+}
+
+/*
+ *	Computes the 2D convolution of the image and a normalized separable
+ *	gaussian kernel, the same way as blurfilter does
+ */
+static void gaussian_xyconvolution(float * preimage, float * postimage, float * kernel, int kernelsize, int width, int height, float weight)
+{
+	float tmp;
+	float *tempimage = new float[height*width];
+	int kernelradius = (kernelsize - 1) / 2;
+
+	cv_stats_scratch(height*width*sizeof(float));
+
+	for (int y = 0; y < height; ++y)
+	{
+		for (int x = kernelradius; x < width - kernelradius; ++x)
+		{
+			tmp = 0;
+			for (int k = 0; k < kernelsize; ++k)
+				tmp += preimage[y*width + x + k - kernelradius] * kernel[k];
+			tempimage[y*width + x] = tmp / weight;
+		}
+	}
+	cv_stats_mark(CV_STAGE_HORIZONTAL);
+
+	for (int y = kernelradius; y < height - kernelradius; ++y)
+	{
+		for (int x = kernelradius; x < width - kernelradius; ++x)
+		{
+			tmp = 0;
+			for (int k = 0; k < kernelsize; ++k)
+				tmp += tempimage[(y + k - kernelradius)*width + x] * kernel[k];
+			postimage[y*width + x] = tmp / weight;
+		}
+	}
+	cv_stats_mark(CV_STAGE_VERTICAL);
+
+	cv_stats_scratch(-(gssize)(height*width*sizeof(float)));
+	delete[] tempimage;
+}
+
+/* Arguments of the bands of one fused pass */
+typedef struct
+{
+	float *preimage;
+	guint8 *d;
+	gint dest_stride;
+	float *kernel;
+	float *sharpkernel;
+	float sigmar;
+	float flatspan;
+	float sharpweight;
+	int kernelsize;
+	int sharpradius;
+	int bandrows;
+	gboolean bilateral;
+	int width;
+	int height;
+} FusedPass;
+
+/* Smooths and sharpens the bandrows output rows of a band, in buffers of its own */
+static void fused_band(gint band, gpointer user_data)
+{
+	FusedPass *pass = (FusedPass *)user_data;
+	int width = pass->width;
+	int kernelsize = pass->kernelsize;
+	int kernelradius = (kernelsize - 1) / 2;
+	int sharpradius = pass->sharpradius;
+	int sharpsize = 2 * sharpradius + 1;
+	int prewidth = width + kernelsize - 1;
+	int tilewidth = width + sharpsize - 1;
+	int maxtileheight = MIN(pass->bandrows, pass->height) + sharpsize - 1;
+	int y0 = band*pass->bandrows;
+	int y1 = MIN(y0 + pass->bandrows, pass->height);
+	int tileheight = y1 - y0 + sharpsize - 1;
+	/* Frame rows of the band including the sharpening halo */
+	int b0 = MAX(y0 - sharpradius, 0);
+	int b1 = MIN(y1 + sharpradius, pass->height);
+	float *bandimage = pass->bilateral ? new float[prewidth*(maxtileheight + kernelsize - 1)] : NULL;
+	float *tile = new float[tilewidth*maxtileheight];
+	float *blurred = new float[tilewidth*maxtileheight];
+	gsize scratch = ((pass->bilateral ? prewidth*(maxtileheight + kernelsize - 1) : 0) + 2 * tilewidth*maxtileheight)*sizeof(float);
+
+	cv_stats_scratch(scratch);
+
+	if (pass->bilateral)
+		cv_bilateral_xyconvolution(pass->preimage + b0*prewidth, bandimage, pass->kernel, pass->sigmar, pass->flatspan, kernelsize, prewidth, b1 - b0 + kernelsize - 1);
+
+	/* Tile row t holds frame row y0 - sharpradius + t, zero outside the frame */
+	memset(tile, 0, tilewidth*tileheight*sizeof(float));
+	for (int y = b0; y < b1; ++y)
+	{
+		float *row = tile + (y - y0 + sharpradius)*tilewidth + sharpradius;
+		if (pass->bilateral)
+		{
+			float *src = bandimage + (y - b0 + kernelradius)*prewidth + kernelradius;
+			for (int x = 0; x < width; ++x)
+				row[x] = (float)(int)src[x];
+		}
+		else
+		{
+			memcpy(row, pass->preimage + (y + kernelradius)*prewidth + kernelradius, width*sizeof(float));
+		}
+	}
+	cv_stats_mark(CV_STAGE_PAD);
+
+	gaussian_xyconvolution(tile, blurred, pass->sharpkernel, sharpsize, tilewidth, tileheight, pass->sharpweight);
+
+	for (int y = y0; y < y1; ++y)
+	{
+		int t = (y - y0 + sharpradius)*tilewidth + sharpradius;
+		for (int x = 0; x < width; ++x)
+			blurred[t + x] = 2 * tile[t + x] - blurred[t + x];
+		cv_store_row(pass->d + y*pass->dest_stride, blurred + t, width);
+	}
+	cv_stats_mark(CV_STAGE_OUTPUT);
+
+	/* Clear allocated memory */
+	cv_stats_scratch(-(gssize)scratch);
+	delete[] bandimage;
+	delete[] tile;
+	delete[] blurred;
+}
+
+/*
+ *	Bilateral smoothing followed by unsharp mask sharpening in a single pass,
+ *	equivalent to bilateralfilter ! blurfilter filtering=1 sigma=sharpen.
+ *	The frame is processed in bands of output rows. For each band the
+ *	bilateral filter is evaluated on the band and the halo rows the
+ *	sharpening kernel needs, straight from the shared padded input, and the
+ *	sharpened result is written to the outframe while the band is still in
+ *	cache. The bilateral result is truncated to whole grey levels like the
+ *	8-bit handoff between the two elements, and it is zero-padded at the
+ *	frame border like blurfilter pads its input. With bilateral FALSE the
+ *	input is only sharpened. The halo rows are filtered by both bands they
+ *	border, so a band is at least FUSED_HALO_RATIO times as high as its
+ *	halo, which keeps the repeated bilateral work to at most a quarter of
+ *	the frame's whatever the sharpening sigma. The bands are the tasks of
+ *	cv_parallel_for, and the stages and scratch of bands run on a worker
+ *	are not recorded, the statistics then count the whole pass as output.
+ */
+static void fused_convolution(float * preimage, guint8 * d, gint dest_stride, float * kernel, float sigmar, float flatspan, int kernelsize, gboolean bilateral, float sharpen, int width, int height)
+{
+	FusedPass pass;
+	int sharpsize;
+
+	pass.preimage = preimage;
+	pass.d = d;
+	pass.dest_stride = dest_stride;
+	pass.kernel = kernel;
+	pass.sigmar = sigmar;
+	pass.flatspan = flatspan;
+	pass.kernelsize = kernelsize;
+	pass.sharpradius = 2 * sharpen;
+	pass.bilateral = bilateral;
+	pass.width = width;
+	pass.height = height;
+
+	sharpsize = 2 * pass.sharpradius + 1;
+	pass.bandrows = MAX(FUSED_TILE_ROWS, FUSED_HALO_RATIO * 2 * pass.sharpradius);
+	pass.bandrows = (pass.bandrows + FUSED_TILE_ROWS - 1) / FUSED_TILE_ROWS * FUSED_TILE_ROWS;
+	pass.sharpkernel = new float[sharpsize];
+	pass.sharpweight = 0;
+	for (int i = 0; i < sharpsize; ++i)
+	{
+		pass.sharpkernel[i] = gaussian1d(sharpen, (float)i - pass.sharpradius);
+		pass.sharpweight += pass.sharpkernel[i];
+	}
+
+	cv_parallel_for((height + pass.bandrows - 1) / pass.bandrows, fused_band, &pass);
+	cv_stats_mark(CV_STAGE_OUTPUT);
+
+	delete[] pass.sharpkernel;
+}
+
+/* Name of the engine the parameters select, as shown in the statistics */
+const gchar *cv_bilateral_engine_name(gboolean filtering, float sharpen, float flat_tolerance)
+{
+	if (!filtering && sharpen <= 0)
+		return "copy";
+	if (sharpen > 0)
+		return filtering ? "fused" : "sharpen";
+	return flat_tolerance > 0 ? "bilateral-early-out" : "bilateral";
+}
+
+/*
+ *	Fills the rectangle x0..x1-1, y0..y1-1 of the zero padded image of the
+ *	plane, padded by kernelradius pixels on every side, in preimage.
+ */
+static void pad_rect(const guint8 * s, gint src_stride, float * preimage, int kernelradius, int width, int height,
+	int x0, int y0, int x1, int y1)
+{
+	int paddedwidth = width + 2 * kernelradius;
+	/* The columns of the rectangle that lie on the plane */
+	int sx0 = CLAMP(x0, kernelradius, width + kernelradius);
+	int sx1 = CLAMP(x1, sx0, width + kernelradius);
+
+	for (int y = y0; y < y1; ++y)
+	{
+		float *row = preimage + y*paddedwidth;
+		int x = x0;
+
+		if (y < kernelradius || y >= height + kernelradius)
+		{
+			for (; x < x1; ++x)
+				row[x] = 0;
+			continue;
+		}
+		for (; x < sx0; ++x)
+			row[x] = 0;
+		for (const guint8 *src = s + (y - kernelradius)*src_stride - kernelradius; x < sx1; ++x)
+			row[x] = src[x];
+		for (; x < x1; ++x)
+			row[x] = 0;
+	}
+}
+
+/* Copies the plane to preimage and zero-pads it with kernelradius in each direction */
+static void pad_plane(const guint8 * s, gint src_stride, float * preimage, int kernelradius, int width, int height)
+{
+	pad_rect(s, src_stride, preimage, kernelradius, width, height,
+		0, 0, width + 2 * kernelradius, height + 2 * kernelradius);
+}
+
+/*
+ *	Filters an 8 bit plane of width x height pixels into dest with the
+ *	bilateral filter when filtering is TRUE, followed by unsharp masking
+ *	with a gaussian of sigma sharpen when sharpen is positive. Without
+ *	either the plane is copied.
+ */
+void cv_bilateral_plane(const guint8 * s, gint src_stride, guint8 * d, gint dest_stride,
+	int width, int height, float sigmad, float sigmar, gboolean filtering,
+	float flat_tolerance, float sharpen)
+{
+	gint y;
+	float flatspan = cv_bilateral_flatspan(sigmar, flat_tolerance);
+	/* The kernel size is set to five */
+	int kernelradius = 2;
+	int kernelsize = 2 * kernelradius + 1;
+	int paddedwidth = width + kernelsize - 1;
+	int paddedheight = height + kernelsize - 1;
+
+	float *kernel;
+	float *preimage;
+	float *postimage;
+
+	if (!filtering && sharpen <= 0)
+	{
+		for (y = 0; y < height; ++y)
+			memcpy(d + y*dest_stride, s + y*src_stride, width);
+		cv_stats_mark(CV_STAGE_PAD);
+		return;
+	}
+
+	/* Allocate memory for arrays of kernel and images */
+	kernel = new float[kernelsize];
+	preimage = new float[paddedheight*paddedwidth];
+	postimage = new float[paddedheight*paddedwidth];
+	cv_stats_scratch(2 * paddedheight*paddedwidth*sizeof(float));
+
+	/* Compute and save the 1-dim kernel */
+	for (int i = 0; i < kernelsize; ++i)
+	{
+		kernel[i] = gaussian1d(sigmad, (float)i - kernelradius);
+	}
+
+	pad_plane(s, src_stride, preimage, kernelradius, width, height);
+	cv_stats_mark(CV_STAGE_PAD);
+
+	/* Smooth and sharpen in one pass if sharpening is enabled */
+	if (sharpen > 0)
+	{
+		fused_convolution(preimage, d, dest_stride, kernel, sigmar, flatspan, kernelsize, filtering, sharpen, width, height);
+	}
+	else
+	{
+		/* Compute the 2d convolution */
+		cv_bilateral_xyconvolution(preimage, postimage, kernel, sigmar, flatspan, kernelsize, paddedwidth, paddedheight);
+
+		for (y = 0; y < height; ++y)
+		{
+			/* Set the convoluted image as the outframe */
+			cv_store_row(d + y*dest_stride, postimage + (y + kernelradius)*paddedwidth + kernelradius, width);
+		}
+		cv_stats_mark(CV_STAGE_OUTPUT);
+	}
+
+	/* Free allocated memory */
+	cv_stats_scratch(-(gssize)(2 * paddedheight*paddedwidth*sizeof(float)));
+	delete[] kernel;
+	delete[] preimage;
+	delete[] postimage;
+}
+
+/* Passes of the planes of one batch of the bilateral filter */
+typedef struct
+{
+	const CvPlane *planes;
+	BilateralPass *passes;
+	float flatspan;
+} BilateralBatch;
+
+/* Pads the rows of a row of blocks of the padded image */
+static void batch_pad(gint plane, gint by, gpointer user_data)
+{
+	BilateralBatch *batch = (BilateralBatch *)user_data;
+	BilateralPass *pass = &batch->passes[plane];
+	int y0 = by*FLAT_BLOCK_SIZE;
+
+	cv_batch_pad_rows(&batch->planes[plane], pass->preimage, pass->kernelradius,
+		y0, MIN(y0 + FLAT_BLOCK_SIZE, pass->height));
+}
+
+static void batch_classify(gint plane, gint task, gpointer user_data)
+{
+	BilateralBatch *batch = (BilateralBatch *)user_data;
+	BilateralPass *pass = &batch->passes[plane];
+	int blocksy = (pass->height + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+
+	if (batch->flatspan >= 0)
+		classify_blocks(pass->preimage, pass->blockclass, batch->flatspan, pass->kernelradius, pass->width, pass->height, NULL);
+	else
+		memset(pass->blockclass, BLOCK_BILATERAL, pass->blocksx*blocksy);
+}
+
+static void batch_horizontal(gint plane, gint by, gpointer user_data)
+{
+	bilateral_horizontal(by, &((BilateralBatch *)user_data)->passes[plane]);
+}
+
+static void batch_vertical(gint plane, gint by, gpointer user_data)
+{
+	bilateral_vertical(by, &((BilateralBatch *)user_data)->passes[plane]);
+}
+
+/* Stores the rows of a row of blocks of the plane */
+static void batch_output(gint plane, gint by, gpointer user_data)
+{
+	BilateralBatch *batch = (BilateralBatch *)user_data;
+	const CvPlane *dest = &batch->planes[plane];
+	BilateralPass *pass = &batch->passes[plane];
+	int y0 = by*FLAT_BLOCK_SIZE;
+	int y1 = MIN(y0 + FLAT_BLOCK_SIZE, dest->height);
+
+	for (int y = y0; y < y1; ++y)
+		cv_store_row(dest->dest + y*dest->dest_stride,
+			pass->postimage + (y + pass->kernelradius)*pass->width + pass->kernelradius, dest->width);
+}
+
+/* Settings of the bilateral filter a preview runs at half size */
+typedef struct
+{
+	float sigmad;
+	float sigmar;
+	gboolean filtering;
+	float flat_tolerance;
+	float sharpen;
+} BilateralPreview;
+
+/* Filters the decimated plane for cv_bilateral_preview_plane */
+static void bilateral_preview(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, gpointer user_data)
+{
+	BilateralPreview *preview = (BilateralPreview *)user_data;
+
+	cv_bilateral_plane(src, src_stride, dest, dest_stride, width, height, preview->sigmad, preview->sigmar,
+		preview->filtering, preview->flat_tolerance, preview->sharpen);
+}
+
+/*
+ *	Cheaper version of cv_bilateral_plane for trick modes, see
+ *	cv_preview_plane. The plane is filtered and sharpened at half the size,
+ *	with both spatial sigmas halved, and scaled up, so it looks softer than
+ *	the full filter. Without filtering or sharpening the plane is copied.
+ */
+void cv_bilateral_preview_plane(const guint8 * s, gint src_stride, guint8 * d, gint dest_stride,
+	int width, int height, float sigmad, float sigmar, gboolean filtering,
+	float flat_tolerance, float sharpen)
+{
+	BilateralPreview preview;
+
+	if (!filtering && sharpen <= 0)
+	{
+		cv_bilateral_plane(s, src_stride, d, dest_stride, width, height, sigmad, sigmar, filtering,
+			flat_tolerance, sharpen);
+		return;
+	}
+
+	preview.sigmad = sigmad / 2;
+	preview.sigmar = sigmar;
+	preview.filtering = filtering;
+	preview.flat_tolerance = flat_tolerance;
+	preview.sharpen = sharpen / 2;
+	cv_preview_plane(s, src_stride, d, dest_stride, width, height, bilateral_preview, &preview);
+}
+
+/*
+ *	Averages every scale x scale block of the plane into one pixel of dest,
+ *	which must hold the plane divided by scale, rounded up. Blocks cut by
+ *	the right or bottom border average the pixels they have.
+ */
+static void shrink_plane(const guint8 * s, gint src_stride, guint8 * d, gint dest_stride,
+	int width, int height, int scale)
+{
+	int small_width = (width + scale - 1) / scale;
+	int small_height = (height + scale - 1) / scale;
+
+	for (int y = 0; y < small_height; ++y)
+	{
+		int y0 = y*scale;
+		int y1 = MIN(y0 + scale, height);
+
+		for (int x = 0; x < small_width; ++x)
+		{
+			int x0 = x*scale;
+			int x1 = MIN(x0 + scale, width);
+			int n = (y1 - y0)*(x1 - x0);
+			int sum = 0;
+
+			for (int yy = y0; yy < y1; ++yy)
+				for (int xx = x0; xx < x1; ++xx)
+					sum += s[yy*src_stride + xx];
+			d[y*dest_stride + x] = (guint8)((sum + n / 2) / n);
+		}
+	}
+}
+
+/* Repeats the border pixels of a plane into the pad pixels around it */
+static void replicate_border(guint8 * plane, gint stride, int width, int height, int pad)
+{
+	for (int y = 0; y < height; ++y)
+	{
+		guint8 *row = plane + y*stride;
+		memset(row - pad, row[0], pad);
+		memset(row + width, row[width - 1], pad);
+	}
+	for (int y = 1; y <= pad; ++y)
+	{
+		memcpy(plane - y*stride - pad, plane - pad, width + 2 * pad);
+		memcpy(plane + (height - 1 + y)*stride - pad, plane + (height - 1)*stride - pad, width + 2 * pad);
+	}
+}
+
+/* Arguments of the bands of one joint bilateral upsampling */
+typedef struct
+{
+	/* The full size plane guiding the upsampling */
+	const guint8 *guide;
+	gint guide_stride;
+	/* The guide shrunk to the reduced size and the filtered plane, with borders of UPSAMPLE_TAPS / 2 pixels */
+	const guint8 *small_guide;
+	const float *small;
+	gint small_stride;
+	guint8 *dest;
+	gint dest_stride;
+	int width;
+	int height;
+	int scale;
+	/* First reduced size column of the window and its spatial weights, for every full size column */
+	int *columns;
+	float *column_weights;
+	/* Range weight of each difference in grey levels, from -255 to 255 */
+	float range[511];
+} JointUpsamplePass;
+
+/* Spatial weights of the UPSAMPLE_TAPS reduced size pixels around a full size pixel, and the first of them */
+static int upsample_taps(int x, int scale, float * weights)
+{
+	/* Pixel centres of both sizes line up */
+	float fx = (x + 0.5f) / scale - 0.5f;
+	int first = (int)floor(fx) - UPSAMPLE_TAPS / 2 + 1;
+
+	for (int i = 0; i < UPSAMPLE_TAPS; ++i)
+		weights[i] = gaussian1d(1.0f, fx - (first + i));
+	return first;
+}
+
+/* Writes the rows of a band of the full size plane */
+static void joint_upsample_band(gint band, gpointer user_data)
+{
+	JointUpsamplePass *pass = (JointUpsamplePass *)user_data;
+	int y0 = band*UPSAMPLE_BAND_ROWS;
+	int y1 = MIN(y0 + UPSAMPLE_BAND_ROWS, pass->height);
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const guint8 *guide = pass->guide + y*pass->guide_stride;
+		guint8 *d = pass->dest + y*pass->dest_stride;
+		float row_weights[UPSAMPLE_TAPS];
+		gint first = upsample_taps(y, pass->scale, row_weights)*pass->small_stride;
+		const guint8 *small_guide = pass->small_guide + first;
+		const float *small = pass->small + first;
+
+		for (int x = 0; x < pass->width; ++x)
+		{
+			const float *column_weights = pass->column_weights + x*UPSAMPLE_TAPS;
+			int column = pass->columns[x];
+			/* Range weights of the differences to this guide pixel */
+			const float *range = pass->range + 255 - guide[x];
+			/* The guide pixel itself, with a small weight, stands in where no reduced pixel is alike */
+			float weight = 1e-3f;
+			float sum = weight*guide[x];
+#ifdef CV_HAVE_SSE2
+			__m128 column_taps = _mm_loadu_ps(column_weights);
+			__m128 sums = _mm_setzero_ps();
+			__m128 weights = _mm_setzero_ps();
+			float lanes[4];
+
+			/* A row of the window at a time, its taps in the lanes */
+			for (int j = 0; j < UPSAMPLE_TAPS; ++j)
+			{
+				const guint8 *gq = small_guide + j*pass->small_stride + column;
+				__m128 w = _mm_mul_ps(_mm_mul_ps(column_taps, _mm_set1_ps(row_weights[j])),
+					_mm_setr_ps(range[gq[0]], range[gq[1]], range[gq[2]], range[gq[3]]));
+				sums = _mm_add_ps(sums, _mm_mul_ps(w, _mm_loadu_ps(small + j*pass->small_stride + column)));
+				weights = _mm_add_ps(weights, w);
+			}
+			_mm_storeu_ps(lanes, sums);
+			sum += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+			_mm_storeu_ps(lanes, weights);
+			weight += lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+			for (int j = 0; j < UPSAMPLE_TAPS; ++j)
+			{
+				const guint8 *gq = small_guide + j*pass->small_stride + column;
+				const float *q = small + j*pass->small_stride + column;
+
+				for (int i = 0; i < UPSAMPLE_TAPS; ++i)
+				{
+					float w = row_weights[j] * column_weights[i] * range[gq[i]];
+					sum += w*q[i];
+					weight += w;
+				}
+			}
+#endif
+			d[x] = (guint8)(sum / weight + 0.5f);
+		}
+	}
+}
+
+/*
+ *	Joint bilateral upsampling after Kopf et al. Every full size pixel is the
+ *	average of the filtered reduced size pixels around it, weighed by their
+ *	distance and by how close the guide pixel is to the shrunk guide there,
+ *	so pixels across an edge in the full size plane do not mix and the
+ *	edges stay as sharp as in the guide.
+ */
+static void joint_upsample(const guint8 * guide, gint guide_stride, const guint8 * small_guide,
+	const float * small, gint small_stride, guint8 * d, gint dest_stride,
+	int width, int height, int scale, float sigmar)
+{
+	JointUpsamplePass *pass = g_new(JointUpsamplePass, 1);
+	gsize scratch = width*(sizeof(int) + UPSAMPLE_TAPS*sizeof(float));
+
+	pass->guide = guide;
+	pass->guide_stride = guide_stride;
+	pass->small_guide = small_guide;
+	pass->small = small;
+	pass->small_stride = small_stride;
+	pass->dest = d;
+	pass->dest_stride = dest_stride;
+	pass->width = width;
+	pass->height = height;
+	pass->scale = scale;
+	pass->columns = g_new(int, width);
+	pass->column_weights = g_new(float, width*UPSAMPLE_TAPS);
+	cv_stats_scratch(scratch);
+
+	for (int x = 0; x < width; ++x)
+		pass->columns[x] = upsample_taps(x, scale, pass->column_weights + x*UPSAMPLE_TAPS);
+	for (int i = 0; i < 511; ++i)
+		pass->range[i] = gaussian1d(MAX(sigmar, 0.5f), (float)i - 255);
+
+	cv_parallel_for((height + UPSAMPLE_BAND_ROWS - 1) / UPSAMPLE_BAND_ROWS, joint_upsample_band, pass);
+
+	cv_stats_scratch(-(gssize)scratch);
+	g_free(pass->columns);
+	g_free(pass->column_weights);
+	g_free(pass);
+}
+
+/*
+ *	Filters an 8 bit plane like cv_bilateral_plane with the bilateral filter
+ *	run on the plane shrunk by scale in both directions, with sigmad scaled
+ *	down to match, which cuts the range weights evaluated by scale squared.
+ *	The result is brought back to full size by joint bilateral upsampling
+ *	guided by the plane itself, and sharpened at full size when sharpen is
+ *	positive. A scale of 1, or no filtering, is cv_bilateral_plane.
+ */
+void cv_bilateral_scaled_plane(const guint8 * s, gint src_stride, guint8 * d, gint dest_stride,
+	int width, int height, float sigmad, float sigmar, gboolean filtering,
+	float flat_tolerance, float sharpen, int scale)
+{
+	int pad = UPSAMPLE_TAPS / 2;
+	int small_width = (width + scale - 1) / scale;
+	int small_height = (height + scale - 1) / scale;
+	gint small_stride = small_width + 2 * pad;
+	gsize small_size = (gsize)small_stride*(small_height + 2 * pad);
+	gsize scratch = small_size*(2 + sizeof(float));
+	gsize origin = pad*small_stride + pad;
+	guint8 *small_guide;
+	guint8 *small;
+	float *small_float;
+
+	if (scale <= 1 || !filtering)
+	{
+		cv_bilateral_plane(s, src_stride, d, dest_stride, width, height, sigmad, sigmar, filtering,
+			flat_tolerance, sharpen);
+		return;
+	}
+
+	/* The upsampling window reads past the reduced planes, into borders repeating their edges */
+	small_guide = (guint8 *)g_malloc(small_size);
+	small = (guint8 *)g_malloc(small_size);
+	small_float = (float *)g_malloc(small_size*sizeof(float));
+	cv_stats_scratch(scratch);
+
+	shrink_plane(s, src_stride, small_guide + origin, small_stride, width, height, scale);
+	cv_stats_mark(CV_STAGE_PAD);
+	cv_bilateral_plane(small_guide + origin, small_stride, small + origin, small_stride,
+		small_width, small_height, sigmad / scale, sigmar, TRUE, flat_tolerance, 0);
+	replicate_border(small_guide + origin, small_stride, small_width, small_height, pad);
+	replicate_border(small + origin, small_stride, small_width, small_height, pad);
+	for (gsize i = 0; i < small_size; ++i)
+		small_float[i] = small[i];
+	joint_upsample(s, src_stride, small_guide + origin, small_float + origin, small_stride,
+		d, dest_stride, width, height, scale, sigmar);
+	cv_stats_mark(CV_STAGE_OUTPUT);
+
+	cv_stats_scratch(-(gssize)scratch);
+	g_free(small_guide);
+	g_free(small);
+	g_free(small_float);
+
+	/* The sharpening reads the plane into its own buffer first, so it can run in place */
+	if (sharpen > 0)
+		cv_bilateral_plane(d, dest_stride, d, dest_stride, width, height, sigmad, sigmar, FALSE,
+			flat_tolerance, sharpen);
+}
+
+/*
+ *	Marks the blocks of the padded image, of width x height with a kernel of
+ *	kernelsize, to filter for a mask of one byte per FLAT_BLOCK_SIZE block of
+ *	the unpadded image. Padding shifts the image by less than a block, so
+ *	each padded block covers up to 2x2 masked ones.
+ */
+static unsigned char *masked_active_blocks(const guint8 * mask, int kernelsize, int width, int height)
+{
+	int blocksx = (width + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	int blocksy = (height + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	int maskx = (width - kernelsize + FLAT_BLOCK_SIZE) / FLAT_BLOCK_SIZE;
+	int masky = (height - kernelsize + FLAT_BLOCK_SIZE) / FLAT_BLOCK_SIZE;
+	unsigned char *active = new unsigned char[blocksx*blocksy];
+
+	for (int by = 0; by < blocksy; ++by)
+	{
+		for (int bx = 0; bx < blocksx; ++bx)
+		{
+			unsigned char a = 0;
+			for (int my = MAX(by - 1, 0); my <= MIN(by, masky - 1); ++my)
+				for (int mx = MAX(bx - 1, 0); mx <= MIN(bx, maskx - 1); ++mx)
+					a |= mask[my*maskx + mx] != 0;
+			active[by*blocksx + bx] = a;
+		}
+	}
+	return active;
+}
+
+/*
+ *	Filters the blocks of an 8 bit plane not 0 in mask, one byte per
+ *	FLAT_BLOCK_SIZE block, into dest with the bilateral filter, the same
+ *	pixels cv_bilateral_plane gives them. The other pixels of dest are left
+ *	as they were. Only the blocks the filter reads for them, with the
+ *	kernel radius around, are converted to float, so a frame where little
+ *	moved costs little more than its moving blocks.
+ */
+static void masked_plane(const guint8 * s, gint src_stride, guint8 * d, gint dest_stride,
+	int width, int height, float sigmad, float sigmar, float flat_tolerance, const guint8 * mask)
+{
+	/* The kernel size is set to five */
+	int kernelradius = 2;
+	int kernelsize = 2 * kernelradius + 1;
+	int paddedwidth = width + kernelsize - 1;
+	int paddedheight = height + kernelsize - 1;
+	int maskx = (width + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	int blocksx = (paddedwidth + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	int blocksy = (paddedheight + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	float *kernel = new float[kernelsize];
+	float *preimage = new float[paddedheight*paddedwidth];
+	float *postimage = new float[paddedheight*paddedwidth];
+	unsigned char *active = masked_active_blocks(mask, kernelsize, paddedwidth, paddedheight);
+
+	cv_stats_scratch(2 * paddedheight*paddedwidth*sizeof(float) + blocksx*blocksy);
+	for (int i = 0; i < kernelsize; ++i)
+		kernel[i] = gaussian1d(sigmad, (float)i - kernelradius);
+
+	/* The blocks the horizontal pass filters, those of an active block and the ones above and below it */
+	for (int by = 0; by < blocksy; ++by)
+	{
+		int y0 = MAX(by*FLAT_BLOCK_SIZE - kernelradius, 0);
+		int y1 = MIN((by + 1)*FLAT_BLOCK_SIZE + kernelradius, paddedheight);
+
+		for (int bx = 0; bx < blocksx; ++bx)
+		{
+			int x0 = bx*FLAT_BLOCK_SIZE;
+			int x1;
+
+			if (!column_active(active, blocksx, blocksy, bx, by - 1, by + 1))
+				continue;
+			/* A run of such blocks in the row is converted at once */
+			while (bx + 1 < blocksx && column_active(active, blocksx, blocksy, bx + 1, by - 1, by + 1))
+				++bx;
+			x1 = MIN((bx + 1)*FLAT_BLOCK_SIZE + kernelradius, paddedwidth);
+			pad_rect(s, src_stride, preimage, kernelradius, width, height, MAX(x0 - kernelradius, 0), y0, x1, y1);
+		}
+	}
+	cv_stats_mark(CV_STAGE_PAD);
+
+	masked_xyconvolution(preimage, postimage, kernel, sigmar, cv_bilateral_flatspan(sigmar, flat_tolerance),
+		kernelsize, paddedwidth, paddedheight, active);
+
+	for (int y = 0; y < height; ++y)
+	{
+		const guint8 *row_mask = mask + (y / FLAT_BLOCK_SIZE)*maskx;
+		for (int bx = 0; bx < maskx; ++bx)
+		{
+			int x0 = bx*FLAT_BLOCK_SIZE;
+			if (row_mask[bx])
+				cv_store_row(d + y*dest_stride + x0, postimage + (y + kernelradius)*paddedwidth + kernelradius + x0,
+					MIN(FLAT_BLOCK_SIZE, width - x0));
+		}
+	}
+	cv_stats_mark(CV_STAGE_OUTPUT);
+
+	cv_stats_scratch(-(gssize)(2 * paddedheight*paddedwidth*sizeof(float) + blocksx*blocksy));
+	delete[] kernel;
+	delete[] preimage;
+	delete[] postimage;
+	delete[] active;
+}
+
+/*
+ *	Filters an 8 bit plane of a stream recursively over time, see
+ *	cvtemporal. Each pixel is blended with the previous output, by the
+ *	weight strength where it is within threshold grey levels of it. Only
+ *	the blocks that moved since, where the history does not help, go
+ *	through the bilateral filter first when filtering is TRUE, so the
+ *	noise of still parts is removed at the cost of the blend alone. The
+ *	first frame after a reset is filtered like cv_bilateral_plane and
+ *	starts the history. Sharpening with a positive sharpen follows on the
+ *	output, and is not fed back into the history.
+ */
+void cv_bilateral_temporal_plane(CvTemporal * temporal, const guint8 * s, gint src_stride,
+	guint8 * d, gint dest_stride, int width, int height, float sigmad, float sigmar,
+	gboolean filtering, float flat_tolerance, float sharpen, float strength, int threshold)
+{
+	const guint8 *moving = cv_temporal_motion(temporal, s, src_stride, width, height, threshold, FLAT_BLOCK_SIZE);
+
+	if (moving == NULL)
+	{
+		cv_bilateral_plane(s, src_stride, d, dest_stride, width, height, sigmad, sigmar, filtering,
+			flat_tolerance, 0);
+		cv_temporal_store(temporal, d, dest_stride, width, height);
+	}
+	else
+	{
+		if (filtering && memchr(moving, 1, ((width + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE)*
+			((height + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE)) != NULL)
+			masked_plane(s, src_stride, d, dest_stride, width, height, sigmad, sigmar, flat_tolerance, moving);
+		cv_temporal_blend(temporal, s, src_stride, d, dest_stride, strength, threshold, filtering);
+	}
+
+	/* The sharpening reads the plane into its own buffer first, so it can run in place */
+	if (sharpen > 0)
+		cv_bilateral_plane(d, dest_stride, d, dest_stride, width, height, sigmad, sigmar, FALSE,
+			flat_tolerance, sharpen);
+}
+
+/*
+ *	Filters the planes of a batch like cv_bilateral_plane does each of them,
+ *	to the same pixels. The bilateral filter computes the kernel once, takes
+ *	the images of all planes from scratch and runs each pass over the block
+ *	rows of every plane at once. Sharpening already runs the bands of a
+ *	plane in parallel with buffers of their own, so with sharpen the planes
+ *	are filtered one after the other.
+ */
+void cv_bilateral_planes(const CvPlane * planes, gint n_planes, float sigmad, float sigmar,
+	gboolean filtering, float flat_tolerance, float sharpen, CvBatchScratch * scratch)
+{
+	/* The kernel size is set to five */
+	int kernelradius = 2;
+	int kernelsize = 2 * kernelradius + 1;
+	float *kernel;
+	float *memory;
+	unsigned char *classes;
+	unsigned char *blockclass;
+	gsize floats = 0;
+	gsize blocks = 0;
+	gint *n_tasks;
+	BilateralBatch batch;
+
+	if (n_planes == 0)
+		return;
+	if (!filtering || sharpen > 0)
+	{
+		for (gint p = 0; p < n_planes; ++p)
+			cv_bilateral_plane(planes[p].src, planes[p].src_stride, planes[p].dest, planes[p].dest_stride,
+				planes[p].width, planes[p].height, sigmad, sigmar, filtering, flat_tolerance, sharpen);
+		return;
+	}
+
+	kernel = new float[kernelsize];
+	for (int i = 0; i < kernelsize; ++i)
+		kernel[i] = gaussian1d(sigmad, (float)i - kernelradius);
+
+	/* Padded image, intermediate image and result of every plane, and its block classes */
+	for (gint p = 0; p < n_planes; ++p)
+	{
+		int paddedwidth = planes[p].width + kernelsize - 1;
+		int paddedheight = planes[p].height + kernelsize - 1;
+
+		floats += 3 * (gsize)paddedwidth*paddedheight;
+		blocks += (gsize)((paddedwidth + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE) *
+			((paddedheight + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE);
+	}
+	memory = cv_batch_scratch_reserve(scratch, floats);
+	classes = new unsigned char[blocks];
+	blockclass = classes;
+	cv_stats_scratch(floats * sizeof(float) + blocks);
+
+	batch.planes = planes;
+	batch.passes = g_new(BilateralPass, n_planes);
+	batch.flatspan = cv_bilateral_flatspan(sigmar, flat_tolerance);
+	n_tasks = g_new(gint, n_planes);
+
+	for (gint p = 0; p < n_planes; ++p)
+	{
+		BilateralPass *pass = &batch.passes[p];
+		int paddedwidth = planes[p].width + kernelsize - 1;
+		int paddedheight = planes[p].height + kernelsize - 1;
+
+		pass->preimage = memory;
+		pass->tempimage = memory + paddedwidth*paddedheight;
+		pass->postimage = memory + 2 * paddedwidth*paddedheight;
+		pass->kernel = kernel;
+		pass->blockclass = blockclass;
+		pass->active = NULL;
+		pass->sigmar = sigmar;
+		pass->kernelweight = 0;
+		for (int k = 0; k < kernelsize; ++k)
+			pass->kernelweight += kernel[k];
+		pass->kernelradius = kernelradius;
+		pass->width = paddedwidth;
+		pass->height = paddedheight;
+		pass->blocksx = (paddedwidth + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+		memory += 3 * paddedwidth*paddedheight;
+		blockclass += pass->blocksx * ((paddedheight + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE);
+		n_tasks[p] = (paddedheight + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	}
+
+	/* The classification counts as padding in the statistics */
+	cv_batch_for(n_tasks, n_planes, batch_pad, &batch);
+	for (gint p = 0; p < n_planes; ++p)
+		n_tasks[p] = 1;
+	cv_batch_for(n_tasks, n_planes, batch_classify, &batch);
+	cv_stats_mark(CV_STAGE_PAD);
+
+	for (gint p = 0; p < n_planes; ++p)
+		n_tasks[p] = (batch.passes[p].height + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	cv_batch_for(n_tasks, n_planes, batch_horizontal, &batch);
+	cv_stats_mark(CV_STAGE_HORIZONTAL);
+
+	cv_batch_for(n_tasks, n_planes, batch_vertical, &batch);
+	cv_stats_mark(CV_STAGE_VERTICAL);
+
+	for (gint p = 0; p < n_planes; ++p)
+		n_tasks[p] = (planes[p].height + FLAT_BLOCK_SIZE - 1) / FLAT_BLOCK_SIZE;
+	cv_batch_for(n_tasks, n_planes, batch_output, &batch);
+	cv_stats_mark(CV_STAGE_OUTPUT);
+
+	cv_stats_scratch(-(gssize)(floats * sizeof(float) + blocks));
+	delete[] classes;
+	g_free(n_tasks);
+	g_free(batch.passes);
+	delete[] kernel;
+}
@@ -0,0 +1,53 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _CV_BILATERAL_H_
+#define _CV_BILATERAL_H_
+
+#include <glib.h>
+#include "cvbatch.h"
+#include "cvtemporal.h"
+
+G_BEGIN_DECLS
+
+/* Filtering stages, also called directly by the kernel benchmark */
+float cv_bilateral_flatspan(float sigmar, float flat_tolerance);
+void cv_bilateral_xyconvolution(float * preimage, float * postimage, float * kernel,
+	float sigmar, float flatspan, int kernelsize, int width, int height);
+
+const gchar *cv_bilateral_engine_name(gboolean filtering, float sharpen, float flat_tolerance);
+void cv_bilateral_plane(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, float sigmad, float sigmar, gboolean filtering,
+	float flat_tolerance, float sharpen);
+void cv_bilateral_scaled_plane(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, float sigmad, float sigmar, gboolean filtering,
+	float flat_tolerance, float sharpen, int scale);
+void cv_bilateral_temporal_plane(CvTemporal * temporal, const guint8 * src, gint src_stride,
+	guint8 * dest, gint dest_stride, int width, int height, float sigmad, float sigmar,
+	gboolean filtering, float flat_tolerance, float sharpen, float strength, int threshold);
+void cv_bilateral_preview_plane(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, float sigmad, float sigmar, gboolean filtering,
+	float flat_tolerance, float sharpen);
+void cv_bilateral_planes(const CvPlane * planes, gint n_planes, float sigmad, float sigmar,
+	gboolean filtering, float flat_tolerance, float sharpen, CvBatchScratch * scratch);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,717 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Gaussian blur engines of the blurfilter element, on planes of floats and
+ * 8 bit pixels. The core only depends on glib, so the element and the
+ * standalone cvfilter tool run the same code and produce the same pixels.
+ * The row loops run in bands with cv_parallel_for, every band computes its
+ * pixels exactly as the serial loop would.
+ */
+
+#define _USE_MATH_DEFINES
+
+#include <glib.h>
+#include "cvblur.h"
+#include "cvbatch.h"
+#include "cvparallel.h"
+#include "cvplanner.h"
+#include "cvpreview.h"
+#include "cvstage.h"
+#include "cvstore.h"
+#include <cmath>
+#include <cstring>
+
+/* The pyramid engine decimates until sigma at the coarsest level would drop
+ * below PYRAMID_MIN_SIGMA pixels, but never more than PYRAMID_MAX_LEVELS times */
+#define PYRAMID_MIN_SIGMA 3.0f
+#define PYRAMID_MAX_LEVELS 4
+
+/* The planner benchmarks the engines on frames of the given width but
+ * at most PLANNER_MAX_ROWS rows, to keep calibration short at large sigma */
+#define PLANNER_MAX_ROWS 270
+
+/* Computes the 1-dimensional gaussian function, given distance x and StDev sigma*/
+static float gaussian1d(float sigma, int x)
+{
+	float e = 1 / (sqrt(2 * M_PI)*sigma)*exp(-(pow(x, 2)) / (2 * pow(sigma,2)));
+	return e;
+}
+
+/* Rows of a band, the task the passes are split into for cv_parallel_for */
+#define BAND_ROWS 16
+
+/* Arguments of the bands of one xyconvolution */
+typedef struct
+{
+	float *preimage;
+	float *tempimage;
+	float *postimage;
+	float *kernel;
+	int kernelsize;
+	int width;
+	int height;
+	float weight;
+} XYPass;
+
+/* Arguments of the bands of the output of one plane */
+typedef struct
+{
+	const guint8 *s;
+	gint src_stride;
+	guint8 *d;
+	gint dest_stride;
+	float *postimage;
+	int width;
+	int height;
+	int paddedwidth;
+	int kernelradius;
+	int filtering;
+} OutputPass;
+
+static int band_count(int rows)
+{
+	return rows > 0 ? (rows + BAND_ROWS - 1) / BAND_ROWS : 0;
+}
+
+/* Convolution in the x-dim of the rows of a band */
+static void horizontal_band(gint band, gpointer user_data)
+{
+	XYPass *pass = (XYPass *)user_data;
+	int width = pass->width;
+	int kernelradius = (pass->kernelsize - 1) / 2;
+	int y0 = band * BAND_ROWS;
+	int y1 = MIN(y0 + BAND_ROWS, pass->height);
+	float tmp;
+
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = kernelradius; x < width - kernelradius; ++x)
+		{
+			tmp = 0;
+			for (int k = 0; k < pass->kernelsize; ++k)
+			{
+				tmp += (pass->preimage[y*width + x + k - kernelradius] * pass->kernel[k]);
+			}
+			pass->tempimage[y*width + x] = tmp / pass->weight;
+		}
+	}
+}
+
+/* Convolution in the y-dim of the rows of a band, the bands start below the padding */
+static void vertical_band(gint band, gpointer user_data)
+{
+	XYPass *pass = (XYPass *)user_data;
+	int width = pass->width;
+	int kernelradius = (pass->kernelsize - 1) / 2;
+	int y0 = kernelradius + band * BAND_ROWS;
+	int y1 = MIN(y0 + BAND_ROWS, pass->height - kernelradius);
+	float tmp;
+
+	for (int y = y0; y < y1; ++y)
+	{
+		for (int x = kernelradius; x < width - kernelradius; ++x)
+		{
+			tmp = 0;
+			for (int k = 0; k < pass->kernelsize; ++k)
+			{
+				tmp += (pass->tempimage[(y + k - kernelradius)*width + x] * pass->kernel[k]);
+			}
+			pass->postimage[y*width + x] = tmp / pass->weight;
+		}
+	}
+}
+
+/* 
+ *	Computes the 2D convolution of the image and the kernel. This function only
+ *	works for separable kernels, as is the case with the gaussian kernel.
+ *	Both passes run in bands of BAND_ROWS rows with cv_parallel_for.
+ */
+void cv_blur_xyconvolution(float * preimage, float * postimage, float * kernel, int kernelsize, int width, int height, float weight)
+{
+	XYPass pass;
+	int kernelradius = (kernelsize - 1) / 2;
+
+	pass.preimage = preimage;
+	pass.tempimage = new float[height*width];
+	pass.postimage = postimage;
+	pass.kernel = kernel;
+	pass.kernelsize = kernelsize;
+	pass.width = width;
+	pass.height = height;
+	pass.weight = weight;
+
+	cv_stats_scratch(height*width*sizeof(float));
+
+	/* Computes the convolution between image and kernel in the x-dim first */
+	cv_parallel_for(band_count(height), horizontal_band, &pass);
+	cv_stats_mark(CV_STAGE_HORIZONTAL);
+
+	/* Computes the convolution between the intermediate image previously 
+	   created and the kernel in the y-dim */
+	cv_parallel_for(band_count(height - 2 * kernelradius), vertical_band, &pass);
+	cv_stats_mark(CV_STAGE_VERTICAL);
+	
+	/* Clear allocated memory */
+	cv_stats_scratch(-(gssize)(height*width*sizeof(float)));
+	delete[] pass.tempimage;
+}
+
+/* Number of times the pyramid engine halves the image for a given sigma */
+int cv_blur_pyramid_levels(float sigma)
+{
+	int levels = 0;
+
+	while (levels < PYRAMID_MAX_LEVELS && sigma / (1 << (levels + 1)) >= PYRAMID_MIN_SIGMA)
+		++levels;
+	return levels;
+}
+
+/*
+ *	Approximates the gaussian blur for large sigma. The padded image is
+ *	halved levels times by 2x2 averaging, blurred at the coarsest level with
+ *	xyconvolution and brought back to full size by bilinear interpolation.
+ *	The averaging and the interpolation smooth the image by themselves, with
+ *	a variance of (4^levels - 1)/12 and 4^levels/6 full resolution pixels
+ *	respectively, so the coarse gaussian is narrowed to keep the total
+ *	variance at sigma^2.
+ *
+ *	With sigma at least PYRAMID_MIN_SIGMA at the coarsest level the result
+ *	stays within about 2.5 grey levels of the direct engine on natural video,
+ *	4.5 next to the frame border. Hard black/white edges differ by up to 10
+ *	for sigma below 24, where the cut-off of the direct kernel at two sigma
+ *	shows, and by less than 3.5 above. The zero padding around the frame is part of
+ *	the decimated image, so borders darken the same way as with the direct
+ *	engine. Only the region inside the padding of postimage is written.
+ *	In the statistics the decimation counts as padding and the upsampling
+ *	as output.
+ */
+static void pyramid_convolution(float * preimage, float * postimage, float sigma, int levels, int width, int height)
+{
+	int scale = 1 << levels;
+	int lw = width;
+	int lh = height;
+	float *level = preimage;
+	float *coarse;
+
+	/* Decimate, pixels outside an odd sized level count as zero padding */
+	for (int l = 0; l < levels; ++l)
+	{
+		int nw = (lw + 1) / 2;
+		int nh = (lh + 1) / 2;
+		coarse = new float[nw*nh];
+		cv_stats_scratch(nw*nh*sizeof(float));
+
+		for (int y = 0; y < nh; ++y)
+		{
+			for (int x = 0; x < nw; ++x)
+			{
+				float sum = level[2 * y*lw + 2 * x];
+				if (2 * x + 1 < lw)
+					sum += level[2 * y*lw + 2 * x + 1];
+				if (2 * y + 1 < lh)
+				{
+					sum += level[(2 * y + 1)*lw + 2 * x];
+					if (2 * x + 1 < lw)
+						sum += level[(2 * y + 1)*lw + 2 * x + 1];
+				}
+				coarse[y*nw + x] = sum / 4;
+			}
+		}
+
+		if (level != preimage)
+		{
+			cv_stats_scratch(-(gssize)(lw*lh*sizeof(float)));
+			delete[] level;
+		}
+		level = coarse;
+		lw = nw;
+		lh = nh;
+	}
+
+	/* Gaussian at the coarsest level, corrected for the resampling blur */
+	float variance = sigma * sigma - (scale*scale - 1) / 12.0f - scale * scale / 6.0f;
+	float coarsesigma = sqrt(MAX(variance, 0.25f)) / scale;
+	int kernelradius = 2 * coarsesigma;
+	int kernelsize = 2 * kernelradius + 1;
+	int pw = lw + kernelsize - 1;
+	int ph = lh + kernelsize - 1;
+	float kernelweight = 0;
+	float *kernel = new float[kernelsize];
+	float *padded = new float[pw*ph]();
+	float *blurred = new float[pw*ph];
+
+	for (int i = 0; i < kernelsize; ++i)
+	{
+		kernel[i] = gaussian1d(coarsesigma, i - kernelradius);
+		kernelweight += kernel[i];
+	}
+	cv_stats_scratch(2 * pw*ph*sizeof(float));
+	for (int y = 0; y < lh; ++y)
+		for (int x = 0; x < lw; ++x)
+			padded[(y + kernelradius)*pw + x + kernelradius] = level[y*lw + x];
+	cv_stats_mark(CV_STAGE_PAD);
+
+	cv_blur_xyconvolution(padded, blurred, kernel, kernelsize, pw, ph, kernelweight);
+
+	/* Bilinear upsampling, level pixel centres sit at (i + 0.5)*scale - 0.5 */
+	int outerradius = 2 * sigma;
+	for (int y = outerradius; y < height - outerradius; ++y)
+	{
+		float fy = CLAMP((y + 0.5f) / scale - 0.5f, 0.0f, (float)(lh - 1));
+		int y0 = (int)fy;
+		int y1 = MIN(y0 + 1, lh - 1);
+		float wy = fy - y0;
+		float *row0 = blurred + (y0 + kernelradius)*pw + kernelradius;
+		float *row1 = blurred + (y1 + kernelradius)*pw + kernelradius;
+
+		for (int x = outerradius; x < width - outerradius; ++x)
+		{
+			float fx = CLAMP((x + 0.5f) / scale - 0.5f, 0.0f, (float)(lw - 1));
+			int x0 = (int)fx;
+			int x1 = MIN(x0 + 1, lw - 1);
+			float wx = fx - x0;
+			float top = row0[x0] + wx * (row0[x1] - row0[x0]);
+			float bottom = row1[x0] + wx * (row1[x1] - row1[x0]);
+			postimage[y*width + x] = top + wy * (bottom - top);
+		}
+	}
+	cv_stats_mark(CV_STAGE_OUTPUT);
+
+	/* Clear allocated memory */
+	cv_stats_scratch(-(gssize)(2 * pw*ph*sizeof(float)));
+	if (level != preimage)
+	{
+		cv_stats_scratch(-(gssize)(lw*lh*sizeof(float)));
+		delete[] level;
+	}
+	delete[] kernel;
+	delete[] padded;
+	delete[] blurred;
+}
+
+/* Blurs the padded preimage into postimage with the given engine */
+void cv_blur_run_engine(CvBlurEngine engine, float * preimage, float * postimage, float sigma, int width, int height)
+{
+	int kernelradius = 2 * sigma;
+	int kernelsize = 2 * kernelradius + 1;
+	int levels = engine == CV_BLUR_ENGINE_PYRAMID ? cv_blur_pyramid_levels(sigma) : 0;
+	float kernelweight = 0;
+	float *kernel;
+
+	if (levels > 0)
+	{
+		pyramid_convolution(preimage, postimage, sigma, levels, width, height);
+		return;
+	}
+
+	/* Compute and save the 1-dim kernel and its normalizing weight */
+	kernel = new float[kernelsize];
+	for (int i = 0; i < kernelsize; i++)
+	{
+		kernel[i] = gaussian1d(sigma, i - kernelradius);
+		kernelweight += kernel[i];
+	}
+
+	cv_blur_xyconvolution(preimage, postimage, kernel, kernelsize, width, height, kernelweight);
+
+	delete[] kernel;
+}
+
+/* Synthetic frame the planner runs the engines on */
+typedef struct
+{
+	float *preimage;
+	float *postimage;
+	float sigma;
+	int width;
+	int height;
+	int kernelradius;
+} PlannerFrame;
+
+/* Builds the synthetic frame of smooth gradients, hard edges and noise, zero padded for the kernel */
+static void planner_frame_fill(PlannerFrame * frame)
+{
+	int paddedwidth = frame->width + 2 * frame->kernelradius;
+	int paddedheight = frame->height + 2 * frame->kernelradius;
+	guint32 noise = 1;
+
+	frame->preimage = new float[paddedwidth*paddedheight]();
+	frame->postimage = new float[paddedwidth*paddedheight];
+
+	for (int y = 0; y < frame->height; ++y)
+	{
+		for (int x = 0; x < frame->width; ++x)
+		{
+			noise = noise * 1664525 + 1013904223;
+			float pix = 128 + 60 * sin(x * 0.02f) * cos(y * 0.03f) + (noise >> 29);
+			if ((x / 64 + y / 64) % 4 == 0)
+				pix = 255;
+			frame->preimage[(y + frame->kernelradius)*paddedwidth + x + frame->kernelradius] = pix;
+		}
+	}
+}
+
+/* Planner callback, blurs the synthetic frame and returns its unpadded result */
+static void planner_run(gint engine, float * output, gpointer user_data)
+{
+	PlannerFrame *frame = (PlannerFrame *)user_data;
+	int paddedwidth = frame->width + 2 * frame->kernelradius;
+
+	/* Only a configuration missing from the cache gets this far, the frame is built on the first run */
+	if (frame->preimage == NULL)
+		planner_frame_fill(frame);
+
+	cv_blur_run_engine((CvBlurEngine)engine, frame->preimage, frame->postimage, frame->sigma,
+		paddedwidth, frame->height + 2 * frame->kernelradius);
+
+	for (int y = 0; y < frame->height; ++y)
+	{
+		memcpy(output + y*frame->width,
+			frame->postimage + (y + frame->kernelradius)*paddedwidth + frame->kernelradius,
+			frame->width * sizeof(float));
+	}
+}
+
+/*
+ *	Picks the engine for sigma and a frame size, for the auto engine. The
+ *	planner benchmarks the engines on a synthetic frame of smooth gradients,
+ *	hard edges and noise, unless this host has already calibrated the
+ *	configuration, and passes the time of each engine to report. A
+ *	calibrated configuration costs a lookup only.
+ */
+CvBlurEngine cv_blur_plan(float sigma, double tolerance, int width, int height,
+	CvPlannerReportFunc report, gpointer report_data)
+{
+	static const CvPlannerCandidate candidates[] = {
+		{ CV_BLUR_ENGINE_DIRECT, "direct" },
+		{ CV_BLUR_ENGINE_PYRAMID, "pyramid" }
+	};
+	PlannerFrame frame;
+	CvBlurEngine engine;
+	gchar *key;
+
+	/* Without any decimation both engines are the same */
+	if (cv_blur_pyramid_levels(sigma) == 0)
+		return CV_BLUR_ENGINE_DIRECT;
+
+	frame.sigma = sigma;
+	frame.width = width;
+	frame.height = MIN(height, PLANNER_MAX_ROWS);
+	frame.kernelradius = 2 * sigma;
+	frame.preimage = NULL;
+	frame.postimage = NULL;
+
+	/* The key holds the exact parameters, sigmas close together can decimate differently */
+	key = g_strdup_printf("blurfilter %dx%d sigma=%g tolerance=%g", width, height,
+		sigma, tolerance);
+	engine = (CvBlurEngine)cv_planner_choose(key, candidates, G_N_ELEMENTS(candidates),
+		frame.width * frame.height, tolerance, planner_run, &frame, report, report_data);
+
+	g_free(key);
+	delete[] frame.preimage;
+	delete[] frame.postimage;
+
+	return engine;
+}
+
+/* Name of the engine computing sigma, as shown in the statistics */
+const gchar *cv_blur_engine_name(CvBlurEngine engine, float sigma)
+{
+	return engine == CV_BLUR_ENGINE_PYRAMID && cv_blur_pyramid_levels(sigma) > 0 ? "pyramid" : "direct";
+}
+
+/* Writes the rows of a band of the plane, blurred or sharpened */
+static void output_band(gint band, gpointer user_data)
+{
+	OutputPass *pass = (OutputPass *)user_data;
+	const guint8 *s = pass->s;
+	int y0 = band * BAND_ROWS;
+	int y1 = MIN(y0 + BAND_ROWS, pass->height);
+	float *outrow = new float[pass->width];
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const float *blurred = pass->postimage + (y + pass->kernelradius)*pass->paddedwidth + pass->kernelradius;
+
+		for (int x = 0; x < pass->width; ++x)
+		{
+			/* Set the convoluted image as the outframe if low pass filtering, remove it from the inframe 
+			 * and add the difference as well as the inframe to the outframe if high pass filtering */
+			outrow[x] = s[y*pass->src_stride + x] + pass->filtering * (s[y*pass->src_stride + x] - blurred[x]);
+		}
+		cv_store_row(pass->d + y*pass->dest_stride, outrow, pass->width);
+	}
+	delete[] outrow;
+}
+
+/*
+ *	Blurs an 8 bit plane of width x height pixels into dest, or sharpens it
+ *	when filtering is positive by adding filtering times the difference of
+ *	the plane and its blur. A filtering of 0 copies the plane. The engine
+ *	must not be auto, the caller plans it first.
+ */
+void cv_blur_plane(const guint8 * s, gint src_stride, guint8 * d, gint dest_stride,
+	int width, int height, float sigma, int filtering, CvBlurEngine engine)
+{
+	gint x, y;
+	/* The kernel size is set to four times sigma plus one */
+	int kernelradius = 2 * sigma;
+	int kernelsize = 2 * kernelradius + 1;
+	int paddedwidth = width + kernelsize - 1;
+	int paddedheight = height + kernelsize - 1;
+
+	float *preimage;
+	float *postimage;
+	OutputPass output;
+
+	/* Copy the plane directly if filtering is disabled */
+	if (filtering == 0)
+	{
+		for (y = 0; y < height; ++y)
+			memcpy(d + y*dest_stride, s + y*src_stride, width);
+		cv_stats_mark(CV_STAGE_PAD);
+		return;
+	}
+
+	/* Allocate memory for arrays of images */
+	preimage = new float[paddedheight*paddedwidth];
+	postimage = new float[paddedheight*paddedwidth];
+	cv_stats_scratch(2 * paddedheight*paddedwidth*sizeof(float));
+
+	/* Copy the inframe to preimage and zero-pad it with kernelradius 
+	 * in each direction */
+	for (y = 0; y < paddedheight; ++y)
+	{
+		for (x = 0; x < paddedwidth; ++x)
+		{
+			if (x >= kernelradius && x < width + kernelradius && y >= kernelradius && y < height + kernelradius)
+				preimage[y*paddedwidth + x] = s[(y - kernelradius)*src_stride + x - kernelradius];
+			else
+			{
+				preimage[y*paddedwidth + x] = 0;
+			}
+		}
+	}
+	cv_stats_mark(CV_STAGE_PAD);
+
+	/* Compute the 2d convolution */
+	cv_blur_run_engine(engine, preimage, postimage, sigma, paddedwidth, paddedheight);
+
+	output.s = s;
+	output.src_stride = src_stride;
+	output.d = d;
+	output.dest_stride = dest_stride;
+	output.postimage = postimage;
+	output.width = width;
+	output.height = height;
+	output.paddedwidth = paddedwidth;
+	output.kernelradius = kernelradius;
+	output.filtering = filtering;
+	cv_parallel_for(band_count(height), output_band, &output);
+	cv_stats_mark(CV_STAGE_OUTPUT);
+
+	/* Free allocated memory */
+	cv_stats_scratch(-(gssize)(2 * paddedheight*paddedwidth*sizeof(float)));
+	delete[] preimage;
+	delete[] postimage;
+}
+
+/* Settings of the blur a preview runs at half size */
+typedef struct
+{
+	float sigma;
+	CvBlurEngine engine;
+} BlurPreview;
+
+/* Blurs the decimated plane for cv_blur_preview_plane */
+static void blur_preview(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, gpointer user_data)
+{
+	BlurPreview *preview = (BlurPreview *)user_data;
+
+	cv_blur_plane(src, src_stride, dest, dest_stride, width, height, preview->sigma, -1, preview->engine);
+}
+
+/*
+ *	Cheaper version of cv_blur_plane for trick modes, see cv_preview_plane.
+ *	The blur is computed at half the size with half the sigma, sharpening
+ *	then takes the difference to the full size plane like the output pass.
+ */
+void cv_blur_preview_plane(const guint8 * s, gint src_stride, guint8 * d, gint dest_stride,
+	int width, int height, float sigma, int filtering, CvBlurEngine engine)
+{
+	BlurPreview preview;
+
+	if (filtering == 0)
+	{
+		cv_blur_plane(s, src_stride, d, dest_stride, width, height, sigma, filtering, engine);
+		return;
+	}
+
+	preview.sigma = sigma / 2;
+	preview.engine = engine;
+	cv_preview_plane(s, src_stride, d, dest_stride, width, height, blur_preview, &preview);
+	if (filtering < 0)
+		return;
+
+	for (int y = 0; y < height; ++y)
+	{
+		const guint8 *srow = s + y*src_stride;
+		guint8 *drow = d + y*dest_stride;
+
+		for (int x = 0; x < width; ++x)
+			drow[x] = (guint8)CLAMP(srow[x] + filtering * (srow[x] - drow[x]), 0, 255);
+	}
+}
+
+/* Passes of the planes of one batch of the direct engine */
+typedef struct
+{
+	const CvPlane *planes;
+	XYPass *passes;
+	OutputPass *outputs;
+	int kernelradius;
+} BlurBatch;
+
+static void batch_pad(gint plane, gint band, gpointer user_data)
+{
+	BlurBatch *batch = (BlurBatch *)user_data;
+	int y0 = band * BAND_ROWS;
+
+	cv_batch_pad_rows(&batch->planes[plane], batch->passes[plane].preimage, batch->kernelradius,
+		y0, MIN(y0 + BAND_ROWS, batch->passes[plane].height));
+}
+
+static void batch_horizontal(gint plane, gint band, gpointer user_data)
+{
+	horizontal_band(band, &((BlurBatch *)user_data)->passes[plane]);
+}
+
+static void batch_vertical(gint plane, gint band, gpointer user_data)
+{
+	vertical_band(band, &((BlurBatch *)user_data)->passes[plane]);
+}
+
+static void batch_output(gint plane, gint band, gpointer user_data)
+{
+	output_band(band, &((BlurBatch *)user_data)->outputs[plane]);
+}
+
+/*
+ *	Filters the planes of a batch like cv_blur_plane does each of them, to
+ *	the same pixels. The direct engine computes the kernel once, takes the
+ *	images of all planes from scratch and runs each pass over the bands of
+ *	every plane at once. The pyramid resamples every plane level by level,
+ *	so its planes are filtered one after the other.
+ */
+void cv_blur_planes(const CvPlane * planes, gint n_planes, float sigma, int filtering,
+	CvBlurEngine engine, CvBatchScratch * scratch)
+{
+	int kernelradius = 2 * sigma;
+	int kernelsize = 2 * kernelradius + 1;
+	float kernelweight = 0;
+	float *kernel;
+	float *memory;
+	gsize floats = 0;
+	gint *n_tasks;
+	BlurBatch batch;
+
+	if (n_planes == 0)
+		return;
+	if (filtering == 0 || (engine == CV_BLUR_ENGINE_PYRAMID && cv_blur_pyramid_levels(sigma) > 0))
+	{
+		for (gint p = 0; p < n_planes; ++p)
+			cv_blur_plane(planes[p].src, planes[p].src_stride, planes[p].dest, planes[p].dest_stride,
+				planes[p].width, planes[p].height, sigma, filtering, engine);
+		return;
+	}
+
+	kernel = new float[kernelsize];
+	for (int i = 0; i < kernelsize; i++)
+	{
+		kernel[i] = gaussian1d(sigma, i - kernelradius);
+		kernelweight += kernel[i];
+	}
+
+	/* Padded image, intermediate image and result of every plane */
+	for (gint p = 0; p < n_planes; ++p)
+		floats += 3 * (gsize)(planes[p].width + kernelsize - 1) * (planes[p].height + kernelsize - 1);
+	memory = cv_batch_scratch_reserve(scratch, floats);
+	cv_stats_scratch(floats * sizeof(float));
+
+	batch.planes = planes;
+	batch.passes = g_new(XYPass, n_planes);
+	batch.outputs = g_new(OutputPass, n_planes);
+	batch.kernelradius = kernelradius;
+	n_tasks = g_new(gint, n_planes);
+
+	for (gint p = 0; p < n_planes; ++p)
+	{
+		XYPass *pass = &batch.passes[p];
+		OutputPass *output = &batch.outputs[p];
+		int paddedwidth = planes[p].width + kernelsize - 1;
+		int paddedheight = planes[p].height + kernelsize - 1;
+
+		pass->preimage = memory;
+		pass->tempimage = memory + paddedwidth*paddedheight;
+		pass->postimage = memory + 2 * paddedwidth*paddedheight;
+		pass->kernel = kernel;
+		pass->kernelsize = kernelsize;
+		pass->width = paddedwidth;
+		pass->height = paddedheight;
+		pass->weight = kernelweight;
+		memory += 3 * paddedwidth*paddedheight;
+
+		output->s = planes[p].src;
+		output->src_stride = planes[p].src_stride;
+		output->d = planes[p].dest;
+		output->dest_stride = planes[p].dest_stride;
+		output->postimage = pass->postimage;
+		output->width = planes[p].width;
+		output->height = planes[p].height;
+		output->paddedwidth = paddedwidth;
+		output->kernelradius = kernelradius;
+		output->filtering = filtering;
+	}
+
+	for (gint p = 0; p < n_planes; ++p)
+		n_tasks[p] = band_count(batch.passes[p].height);
+	cv_batch_for(n_tasks, n_planes, batch_pad, &batch);
+	cv_stats_mark(CV_STAGE_PAD);
+
+	cv_batch_for(n_tasks, n_planes, batch_horizontal, &batch);
+	cv_stats_mark(CV_STAGE_HORIZONTAL);
+
+	for (gint p = 0; p < n_planes; ++p)
+		n_tasks[p] = band_count(batch.passes[p].height - 2 * kernelradius);
+	cv_batch_for(n_tasks, n_planes, batch_vertical, &batch);
+	cv_stats_mark(CV_STAGE_VERTICAL);
+
+	for (gint p = 0; p < n_planes; ++p)
+		n_tasks[p] = band_count(planes[p].height);
+	cv_batch_for(n_tasks, n_planes, batch_output, &batch);
+	cv_stats_mark(CV_STAGE_OUTPUT);
+
+	cv_stats_scratch(-(gssize)(floats * sizeof(float)));
+	g_free(n_tasks);
+	g_free(batch.passes);
+	g_free(batch.outputs);
+	delete[] kernel;
+}
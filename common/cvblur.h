@@ -0,0 +1,57 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _CV_BLUR_H_
+#define _CV_BLUR_H_
+
+#include <glib.h>
+#include "cvbatch.h"
+#include "cvplanner.h"
+
+G_BEGIN_DECLS
+
+/* Ways of computing the gaussian, the values of the element's engine property */
+typedef enum
+{
+	CV_BLUR_ENGINE_DIRECT,
+	CV_BLUR_ENGINE_PYRAMID,
+	CV_BLUR_ENGINE_AUTO
+} CvBlurEngine;
+
+/* Filtering stages, also called directly by the kernel benchmark */
+void cv_blur_xyconvolution(float * preimage, float * postimage, float * kernel,
+	int kernelsize, int width, int height, float weight);
+int cv_blur_pyramid_levels(float sigma);
+void cv_blur_run_engine(CvBlurEngine engine, float * preimage, float * postimage,
+	float sigma, int width, int height);
+
+CvBlurEngine cv_blur_plan(float sigma, double tolerance, int width, int height,
+	CvPlannerReportFunc report, gpointer report_data);
+const gchar *cv_blur_engine_name(CvBlurEngine engine, float sigma);
+void cv_blur_plane(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, float sigma, int filtering, CvBlurEngine engine);
+void cv_blur_preview_plane(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, float sigma, int filtering, CvBlurEngine engine);
+void cv_blur_planes(const CvPlane * planes, gint n_planes, float sigma, int filtering,
+	CvBlurEngine engine, CvBatchScratch * scratch);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,441 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+* Boston, MA 02110-1335, USA.
+*/
+/*
+ * Cache of filtered frames shared by the filter elements. A looping clip
+ * gives the filters the same input over and over, so the output of a frame
+ * is kept under its PTS, a hash of the input planes and a hash of the
+ * element's parameters, and the next time the same frame comes with the
+ * same parameters the output is copied instead of computed.
+ *
+ * Frames are kept in memory up to a byte limit, least recently used first
+ * out. With a spill location, frames pushed out of memory go to fixed size
+ * slots of a memory-mapped file instead, where the operating system pages
+ * them to disk as needed, and are brought back into memory on a hit. The
+ * file is removed as soon as it is mapped, so nothing is left behind.
+ *
+ * Frames are stored without the padding of their strides, plane by plane,
+ * for planar formats where plane i holds component i, like I420.
+ */
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include "cvcache.h"
+#include <cstring>
+
+#ifdef G_OS_WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define PRIME1 G_GUINT64_CONSTANT(0x9E3779B185EBCA87)
+#define PRIME2 G_GUINT64_CONSTANT(0xC2B2AE3D27D4EB4F)
+#define PRIME3 G_GUINT64_CONSTANT(0x165667B19E3779F9)
+
+typedef struct _CvCacheEntry
+{
+	CvCacheKey key;
+	/* Frame in memory, NULL when it is in slot of the spill file */
+	guint8 *data;
+	guint slot;
+	/* Position in the recently used queue of its tier */
+	GList link;
+} CvCacheEntry;
+
+struct _CvCache
+{
+	GHashTable *entries;
+	/* Most recently used first */
+	GQueue memory;
+	GQueue spilled;
+	gsize max_bytes;
+	gsize used_bytes;
+
+	/* Spill file, mapped when the first frame is spilled, with room for n_slots frames */
+	gchar *spill_location;
+	gsize spill_bytes;
+	guint8 *spill;
+	gsize slot_size;
+	guint n_slots;
+	GArray *free_slots;
+#ifdef G_OS_WIN32
+	HANDLE spill_file;
+	HANDLE spill_mapping;
+#endif
+};
+
+static inline guint64 rotl64(guint64 x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline guint64 hash_round(guint64 acc, guint64 word)
+{
+	acc += word * PRIME2;
+	return rotl64(acc, 31) * PRIME1;
+}
+
+static inline guint64 read64(const guint8 * p)
+{
+	guint64 word;
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+/*
+ *	64-bit hash of size bytes, chained through seed. Four independent lanes
+ *	keep several multiplies in flight, so hashing a frame costs little next
+ *	to reading it.
+ */
+guint64 cv_cache_hash(const void * data, gsize size, guint64 seed)
+{
+	const guint8 *p = (const guint8 *)data;
+	guint64 h;
+
+	if (size >= 32)
+	{
+		guint64 lane[4] = { seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 };
+
+		for (; size >= 32; size -= 32, p += 32)
+		{
+			lane[0] = hash_round(lane[0], read64(p));
+			lane[1] = hash_round(lane[1], read64(p + 8));
+			lane[2] = hash_round(lane[2], read64(p + 16));
+			lane[3] = hash_round(lane[3], read64(p + 24));
+		}
+		h = rotl64(lane[0], 1) + rotl64(lane[1], 7) + rotl64(lane[2], 12) + rotl64(lane[3], 18);
+	}
+	else
+	{
+		h = seed + PRIME3;
+	}
+
+	for (; size >= 8; size -= 8, p += 8)
+		h = rotl64(h ^ hash_round(0, read64(p)), 27) * PRIME1 + PRIME3;
+	if (size > 0)
+	{
+		guint64 tail = 0;
+		memcpy(&tail, p, size);
+		h = rotl64(h ^ hash_round(0, tail ^ size), 27) * PRIME1 + PRIME3;
+	}
+
+	/* Spread every input bit over the whole hash */
+	h ^= h >> 33;
+	h *= PRIME2;
+	h ^= h >> 29;
+	h *= PRIME3;
+	h ^= h >> 32;
+	return h;
+}
+
+static gsize plane_row_bytes(const GstVideoFrame * frame, guint plane)
+{
+	return (gsize)GST_VIDEO_FRAME_COMP_WIDTH(frame, plane) * GST_VIDEO_FRAME_COMP_PSTRIDE(frame, plane);
+}
+
+static gsize packed_size(const GstVideoFrame * frame)
+{
+	gsize size = 0;
+
+	for (guint p = 0; p < GST_VIDEO_FRAME_N_PLANES(frame); ++p)
+		size += plane_row_bytes(frame, p) * GST_VIDEO_FRAME_COMP_HEIGHT(frame, p);
+	return size;
+}
+
+/* Copies the planes of frame to data without the padding of the strides, or back */
+static void pack_frame(const GstVideoFrame * frame, guint8 * data, gboolean unpack)
+{
+	for (guint p = 0; p < GST_VIDEO_FRAME_N_PLANES(frame); ++p)
+	{
+		gsize row = plane_row_bytes(frame, p);
+		gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, p);
+		guint8 *plane = (guint8 *)GST_VIDEO_FRAME_PLANE_DATA(frame, p);
+
+		for (gint y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT(frame, p); ++y, data += row)
+		{
+			if (unpack)
+				memcpy(plane + (gsize)y * stride, data, row);
+			else
+				memcpy(data, plane + (gsize)y * stride, row);
+		}
+	}
+}
+
+/* Sets the key of the output of inframe, filtered with parameters hashing to params */
+void cv_cache_key_init(CvCacheKey * key, const GstVideoFrame * inframe,
+	const GstVideoFrame * outframe, guint64 params)
+{
+	guint64 content = 0;
+
+	for (guint p = 0; p < GST_VIDEO_FRAME_N_PLANES(inframe); ++p)
+	{
+		gsize row = plane_row_bytes(inframe, p);
+		gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(inframe, p);
+		const guint8 *plane = (const guint8 *)GST_VIDEO_FRAME_PLANE_DATA(inframe, p);
+
+		for (gint y = 0; y < GST_VIDEO_FRAME_COMP_HEIGHT(inframe, p); ++y)
+			content = cv_cache_hash(plane + (gsize)y * stride, row, content);
+	}
+
+	key->pts = GST_BUFFER_PTS(inframe->buffer);
+	key->content = content;
+	key->params = params;
+	key->size = packed_size(outframe);
+}
+
+static guint key_hash(gconstpointer data)
+{
+	const CvCacheKey *key = (const CvCacheKey *)data;
+	guint64 h = key->content ^ rotl64(key->params, 17) ^ rotl64(key->pts, 41) ^ key->size;
+
+	return (guint)(h ^ (h >> 32));
+}
+
+static gboolean key_equal(gconstpointer a, gconstpointer b)
+{
+	const CvCacheKey *x = (const CvCacheKey *)a;
+	const CvCacheKey *y = (const CvCacheKey *)b;
+
+	return x->pts == y->pts && x->content == y->content && x->params == y->params &&
+		x->size == y->size;
+}
+
+/*
+ *	Creates a cache holding up to max_bytes of frames in memory. When
+ *	spill_location is not NULL, frames leaving memory go to a file of up to
+ *	spill_bytes mapped from there.
+ */
+CvCache *cv_cache_new(gsize max_bytes, const gchar * spill_location, gsize spill_bytes)
+{
+	CvCache *cache = g_new0(CvCache, 1);
+
+	cache->entries = g_hash_table_new(key_hash, key_equal);
+	g_queue_init(&cache->memory);
+	g_queue_init(&cache->spilled);
+	cache->max_bytes = max_bytes;
+	cache->spill_location = g_strdup(spill_location);
+	cache->spill_bytes = spill_bytes;
+	cache->free_slots = g_array_new(FALSE, FALSE, sizeof(guint));
+	return cache;
+}
+
+/* Forgets an entry, whichever tier it is in */
+static void drop_entry(CvCache * cache, CvCacheEntry * entry)
+{
+	g_hash_table_remove(cache->entries, &entry->key);
+	if (entry->data != NULL)
+	{
+		g_queue_unlink(&cache->memory, &entry->link);
+		cache->used_bytes -= entry->key.size;
+		g_free(entry->data);
+	}
+	else
+	{
+		g_queue_unlink(&cache->spilled, &entry->link);
+		g_array_append_val(cache->free_slots, entry->slot);
+	}
+	g_free(entry);
+}
+
+static void unmap_spill(CvCache * cache)
+{
+	if (cache->spill == NULL)
+		return;
+
+	while (cache->spilled.tail != NULL)
+		drop_entry(cache, (CvCacheEntry *)cache->spilled.tail->data);
+	g_array_set_size(cache->free_slots, 0);
+
+#ifdef G_OS_WIN32
+	UnmapViewOfFile(cache->spill);
+	CloseHandle(cache->spill_mapping);
+	CloseHandle(cache->spill_file);
+#else
+	munmap(cache->spill, cache->slot_size * cache->n_slots);
+#endif
+	cache->spill = NULL;
+}
+
+/* Maps the spill file with slots of slot_size, dropping what was spilled at another size */
+static gboolean map_spill(CvCache * cache, gsize slot_size)
+{
+	guint n_slots;
+	gsize size;
+	void *map;
+
+	if (cache->spill != NULL && cache->slot_size == slot_size)
+		return TRUE;
+	unmap_spill(cache);
+
+	n_slots = (guint)MIN(cache->spill_bytes / slot_size, (gsize)G_MAXUINT);
+	if (cache->spill_location == NULL || n_slots == 0)
+		return FALSE;
+	size = slot_size * n_slots;
+
+#ifdef G_OS_WIN32
+	cache->spill_file = CreateFileA(cache->spill_location, GENERIC_READ | GENERIC_WRITE, 0, NULL,
+		CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (cache->spill_file == INVALID_HANDLE_VALUE)
+		map = NULL;
+	else
+	{
+		cache->spill_mapping = CreateFileMappingA(cache->spill_file, NULL, PAGE_READWRITE,
+			(DWORD)((guint64)size >> 32), (DWORD)size, NULL);
+		map = cache->spill_mapping != NULL ?
+			MapViewOfFile(cache->spill_mapping, FILE_MAP_ALL_ACCESS, 0, 0, size) : NULL;
+		if (map == NULL)
+		{
+			if (cache->spill_mapping != NULL)
+				CloseHandle(cache->spill_mapping);
+			CloseHandle(cache->spill_file);
+		}
+	}
+#else
+	{
+		int fd = open(cache->spill_location, O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+		map = NULL;
+		if (fd >= 0)
+		{
+			if (ftruncate(fd, (off_t)size) == 0)
+			{
+				map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+				if (map == MAP_FAILED)
+					map = NULL;
+			}
+			/* The mapping keeps the file alive until it is unmapped */
+			close(fd);
+			unlink(cache->spill_location);
+		}
+	}
+#endif
+
+	if (map == NULL)
+	{
+		GST_WARNING("Could not map %" G_GSIZE_FORMAT " bytes of %s, frames are no longer spilled",
+			size, cache->spill_location);
+		g_free(cache->spill_location);
+		cache->spill_location = NULL;
+		return FALSE;
+	}
+
+	cache->spill = (guint8 *)map;
+	cache->slot_size = slot_size;
+	cache->n_slots = n_slots;
+	for (guint i = 0; i < n_slots; ++i)
+		g_array_append_val(cache->free_slots, i);
+	return TRUE;
+}
+
+/* Moves an entry out of memory, to the spill file when there is one */
+static void spill_entry(CvCache * cache, CvCacheEntry * entry)
+{
+	guint slot;
+
+	if (!map_spill(cache, entry->key.size))
+	{
+		drop_entry(cache, entry);
+		return;
+	}
+
+	/* The least recently used spilled frame makes room */
+	if (cache->free_slots->len == 0)
+		drop_entry(cache, (CvCacheEntry *)cache->spilled.tail->data);
+	slot = g_array_index(cache->free_slots, guint, cache->free_slots->len - 1);
+	g_array_set_size(cache->free_slots, cache->free_slots->len - 1);
+
+	memcpy(cache->spill + (gsize)slot * cache->slot_size, entry->data, entry->key.size);
+	g_queue_unlink(&cache->memory, &entry->link);
+	cache->used_bytes -= entry->key.size;
+	g_free(entry->data);
+	entry->data = NULL;
+	entry->slot = slot;
+	g_queue_push_head_link(&cache->spilled, &entry->link);
+}
+
+/* Makes room in memory for size more bytes */
+static void make_room(CvCache * cache, gsize size)
+{
+	while (cache->used_bytes + size > cache->max_bytes && cache->memory.tail != NULL)
+		spill_entry(cache, (CvCacheEntry *)cache->memory.tail->data);
+}
+
+/* Copies the frame stored under key into frame, returns FALSE when there is none */
+gboolean cv_cache_load_frame(CvCache * cache, const CvCacheKey * key, GstVideoFrame * frame)
+{
+	CvCacheEntry *entry = (CvCacheEntry *)g_hash_table_lookup(cache->entries, key);
+
+	if (entry == NULL)
+		return FALSE;
+
+	if (entry->data == NULL)
+	{
+		/* Bring a spilled frame back into memory, ahead of the frames making room for it */
+		guint8 *data = (guint8 *)g_malloc(entry->key.size);
+
+		memcpy(data, cache->spill + (gsize)entry->slot * cache->slot_size, entry->key.size);
+		g_queue_unlink(&cache->spilled, &entry->link);
+		g_array_append_val(cache->free_slots, entry->slot);
+		make_room(cache, entry->key.size);
+		entry->data = data;
+		cache->used_bytes += entry->key.size;
+	}
+	else
+	{
+		g_queue_unlink(&cache->memory, &entry->link);
+	}
+	g_queue_push_head_link(&cache->memory, &entry->link);
+
+	pack_frame(frame, entry->data, TRUE);
+	return TRUE;
+}
+
+/* Keeps a copy of frame under key, frames larger than the whole cache are not kept */
+void cv_cache_store_frame(CvCache * cache, const CvCacheKey * key, const GstVideoFrame * frame)
+{
+	CvCacheEntry *entry;
+
+	if (key->size > cache->max_bytes || g_hash_table_contains(cache->entries, key))
+		return;
+
+	make_room(cache, key->size);
+	entry = g_new0(CvCacheEntry, 1);
+	entry->key = *key;
+	entry->data = (guint8 *)g_malloc(key->size);
+	entry->link.data = entry;
+	pack_frame(frame, entry->data, FALSE);
+
+	g_hash_table_insert(cache->entries, &entry->key, entry);
+	g_queue_push_head_link(&cache->memory, &entry->link);
+	cache->used_bytes += key->size;
+}
+
+void cv_cache_free(CvCache * cache)
+{
+	while (cache->memory.tail != NULL)
+		drop_entry(cache, (CvCacheEntry *)cache->memory.tail->data);
+	unmap_spill(cache);
+
+	g_hash_table_destroy(cache->entries);
+	g_array_free(cache->free_slots, TRUE);
+	g_free(cache->spill_location);
+	g_free(cache);
+}
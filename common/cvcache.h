@@ -0,0 +1,51 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _CV_CACHE_H_
+#define _CV_CACHE_H_
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+G_BEGIN_DECLS
+
+/* Identifies a filtered frame: the input it came from and how it was filtered */
+typedef struct _CvCacheKey
+{
+	GstClockTime pts;
+	guint64 content;
+	guint64 params;
+	gsize size;
+} CvCacheKey;
+
+typedef struct _CvCache CvCache;
+
+CvCache *cv_cache_new(gsize max_bytes, const gchar * spill_location, gsize spill_bytes);
+void cv_cache_free(CvCache * cache);
+
+guint64 cv_cache_hash(const void * data, gsize size, guint64 seed);
+void cv_cache_key_init(CvCacheKey * key, const GstVideoFrame * inframe,
+	const GstVideoFrame * outframe, guint64 params);
+
+gboolean cv_cache_load_frame(CvCache * cache, const CvCacheKey * key, GstVideoFrame * frame);
+void cv_cache_store_frame(CvCache * cache, const CvCacheKey * key, const GstVideoFrame * frame);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,268 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Median filter engine of the medianfilter element, in constant time per
+ * pixel whatever the radius, after Perreault and Hebert, "Median Filtering
+ * in Constant Time". Like the other engines it only depends on glib.
+ *
+ * Every column keeps a histogram of the 2r+1 pixels above and below the
+ * current row, which moves down a row by removing one pixel and adding one.
+ * The histogram of the window moves right a column by adding the column
+ * histogram entering it and subtracting the one leaving it, whatever the
+ * radius. The histograms have two levels, 16 coarse bins of 16 grey levels
+ * each over 256 fine bins: the coarse bins of the window are updated at
+ * every pixel and find the 16 levels the median lies in, and only the fine
+ * bins of those 16 levels are then brought up to the current column, from
+ * the column they were last used at, or summed anew when that is further
+ * away than the radius. The bins are added 8 at a time with SSE2.
+ *
+ * Pixels outside the plane repeat the border pixels. The plane is split
+ * into tiles of bands of rows and strips of columns, the tasks of
+ * cv_parallel_for, so the column histograms of a tile stay in cache. Each
+ * tile fills its column histograms from the 2r+1 rows around its first
+ * row, so the bands are at least as high as the window.
+ */
+
+#include <glib.h>
+#include "cvmedian.h"
+#include "cvparallel.h"
+#include "cvpreview.h"
+#include "cvstage.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CV_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+/* Rows of the smallest band and columns of a strip */
+#define BAND_ROWS 64
+#define STRIP_COLUMNS 256
+/* Coarse bins, and fine bins in each of them */
+#define COARSE_BINS 16
+#define FINE_BINS 16
+
+/* Counts of the grey levels of a column or a window, in both levels */
+typedef struct
+{
+	guint16 coarse[COARSE_BINS];
+	guint16 fine[COARSE_BINS * FINE_BINS];
+} Histogram;
+
+/* Arguments of the tiles of one plane */
+typedef struct
+{
+	const guint8 *s;
+	gint src_stride;
+	guint8 *d;
+	gint dest_stride;
+	int width;
+	int height;
+	int radius;
+	int band_rows;
+	int n_strips;
+} MedianPass;
+
+/* dest += add - sub over 16 bins */
+static inline void update_bins(guint16 * dest, const guint16 * add, const guint16 * sub)
+{
+#ifdef CV_HAVE_SSE2
+	for (int i = 0; i < 16; i += 8)
+	{
+		__m128i bins = _mm_loadu_si128((const __m128i *)(dest + i));
+		bins = _mm_add_epi16(bins, _mm_loadu_si128((const __m128i *)(add + i)));
+		bins = _mm_sub_epi16(bins, _mm_loadu_si128((const __m128i *)(sub + i)));
+		_mm_storeu_si128((__m128i *)(dest + i), bins);
+	}
+#else
+	for (int i = 0; i < 16; ++i)
+		dest[i] += add[i] - sub[i];
+#endif
+}
+
+/* dest += add over 16 bins */
+static inline void add_bins(guint16 * dest, const guint16 * add)
+{
+#ifdef CV_HAVE_SSE2
+	for (int i = 0; i < 16; i += 8)
+	{
+		__m128i bins = _mm_loadu_si128((const __m128i *)(dest + i));
+		bins = _mm_add_epi16(bins, _mm_loadu_si128((const __m128i *)(add + i)));
+		_mm_storeu_si128((__m128i *)(dest + i), bins);
+	}
+#else
+	for (int i = 0; i < 16; ++i)
+		dest[i] += add[i];
+#endif
+}
+
+/* Filters one tile, a band of rows of one strip of columns */
+static void median_tile(gint task, gpointer user_data)
+{
+	MedianPass *pass = (MedianPass *)user_data;
+	int r = pass->radius;
+	int width = pass->width;
+	int height = pass->height;
+	int y0 = task / pass->n_strips * pass->band_rows;
+	int y1 = MIN(y0 + pass->band_rows, height);
+	int x0 = task % pass->n_strips * STRIP_COLUMNS;
+	int x1 = MIN(x0 + STRIP_COLUMNS, width);
+	/* Columns the windows of the strip reach, and one more on the left for the first move */
+	int lo = MAX(0, x0 - r - 1);
+	int hi = MIN(width - 1, x1 + r);
+	Histogram *columns = g_new0(Histogram, hi - lo + 1);
+	Histogram window;
+	/* Column each fine segment of the window was last brought up to */
+	int updated[COARSE_BINS];
+	int rank = (2 * r + 1) * (2 * r + 1) / 2;
+
+#define COLUMN(x) (&columns[CLAMP((x), 0, width - 1) - lo])
+
+	/* Column histograms of the rows around the first row of the band */
+	for (int j = -r; j <= r; ++j)
+	{
+		const guint8 *row = pass->s + CLAMP(y0 + j, 0, height - 1)*pass->src_stride;
+
+		for (int x = lo; x <= hi; ++x)
+		{
+			columns[x - lo].coarse[row[x] / FINE_BINS]++;
+			columns[x - lo].fine[row[x]]++;
+		}
+	}
+
+	for (int y = y0; y < y1; ++y)
+	{
+		guint8 *d = pass->d + y*pass->dest_stride;
+
+		/* Move the column histograms down to the row */
+		if (y > y0)
+		{
+			const guint8 *leaving = pass->s + CLAMP(y - r - 1, 0, height - 1)*pass->src_stride;
+			const guint8 *entering = pass->s + CLAMP(y + r, 0, height - 1)*pass->src_stride;
+
+			for (int x = lo; x <= hi; ++x)
+			{
+				columns[x - lo].coarse[leaving[x] / FINE_BINS]--;
+				columns[x - lo].fine[leaving[x]]--;
+				columns[x - lo].coarse[entering[x] / FINE_BINS]++;
+				columns[x - lo].fine[entering[x]]++;
+			}
+		}
+
+		/* The coarse window of the first column, the fine segments are summed when first needed */
+		memset(&window, 0, sizeof(window));
+		for (int j = -r; j <= r; ++j)
+			add_bins(window.coarse, COLUMN(x0 + j)->coarse);
+		for (int c = 0; c < COARSE_BINS; ++c)
+			updated[c] = x0 - 2 * r - 2;
+
+		for (int x = x0; x < x1; ++x)
+		{
+			int sum = 0;
+			int c = 0;
+			int v = 0;
+			guint16 *fine;
+
+			if (x > x0)
+				update_bins(window.coarse, COLUMN(x + r)->coarse, COLUMN(x - r - 1)->coarse);
+
+			/* The coarse bin holding the median */
+			while (sum + window.coarse[c] <= rank)
+				sum += window.coarse[c++];
+
+			/* Its fine segment, moved along from where it was last used or summed anew */
+			fine = window.fine + c * FINE_BINS;
+			if (x - updated[c] > r)
+			{
+				memset(fine, 0, FINE_BINS * sizeof(guint16));
+				for (int j = -r; j <= r; ++j)
+					add_bins(fine, COLUMN(x + j)->fine + c * FINE_BINS);
+			}
+			else
+			{
+				for (int p = updated[c] + 1; p <= x; ++p)
+					update_bins(fine, COLUMN(p + r)->fine + c * FINE_BINS, COLUMN(p - r - 1)->fine + c * FINE_BINS);
+			}
+			updated[c] = x;
+
+			while (sum + fine[v] <= rank)
+				sum += fine[v++];
+			d[x] = (guint8)(c * FINE_BINS + v);
+		}
+	}
+
+#undef COLUMN
+	g_free(columns);
+}
+
+/*
+ *	Replaces every pixel of an 8 bit plane by the median of the square window
+ *	of (2 * radius + 1)^2 pixels around it, into dest. A radius of 0 copies
+ *	the plane. The whole filter is one pass and counts as the horizontal
+ *	stage in the statistics.
+ */
+void cv_median_plane(const guint8 * s, gint src_stride, guint8 * d, gint dest_stride,
+	int width, int height, int radius)
+{
+	MedianPass pass;
+	int n_bands;
+
+	radius = CLAMP(radius, 0, CV_MEDIAN_MAX_RADIUS);
+	if (radius == 0)
+	{
+		for (int y = 0; y < height; ++y)
+			memcpy(d + y*dest_stride, s + y*src_stride, width);
+		cv_stats_mark(CV_STAGE_PAD);
+		return;
+	}
+
+	pass.s = s;
+	pass.src_stride = src_stride;
+	pass.d = d;
+	pass.dest_stride = dest_stride;
+	pass.width = width;
+	pass.height = height;
+	pass.radius = radius;
+	pass.band_rows = MAX(BAND_ROWS, 2 * radius + 1);
+	pass.n_strips = (width + STRIP_COLUMNS - 1) / STRIP_COLUMNS;
+	n_bands = (height + pass.band_rows - 1) / pass.band_rows;
+	cv_parallel_for(n_bands * pass.n_strips, median_tile, &pass);
+	cv_stats_mark(CV_STAGE_HORIZONTAL);
+}
+
+/* Runs the median on the decimated plane for cv_median_preview_plane */
+static void median_preview(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, gpointer user_data)
+{
+	cv_median_plane(src, src_stride, dest, dest_stride, width, height, GPOINTER_TO_INT(user_data));
+}
+
+/* Cheaper version of cv_median_plane for trick modes, at half the size and radius, see cv_preview_plane */
+void cv_median_preview_plane(const guint8 * s, gint src_stride, guint8 * d, gint dest_stride,
+	int width, int height, int radius)
+{
+	if (radius <= 0)
+	{
+		cv_median_plane(s, src_stride, d, dest_stride, width, height, radius);
+		return;
+	}
+	cv_preview_plane(s, src_stride, d, dest_stride, width, height, median_preview,
+		GINT_TO_POINTER(MAX(radius / 2, 1)));
+}
@@ -0,0 +1,38 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _CV_MEDIAN_H_
+#define _CV_MEDIAN_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Largest radius, the (2 * radius + 1)^2 pixels of a window must fit the 16 bit histogram bins */
+#define CV_MEDIAN_MAX_RADIUS 127
+
+void cv_median_plane(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, int radius);
+void cv_median_preview_plane(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, int radius);
+
+G_END_DECLS
+
+#endif
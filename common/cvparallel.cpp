@@ -0,0 +1,56 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Parallel loops of the filter engines. Engine code splits a pass into
+ * independent tasks, usually bands of rows, and runs them with
+ * cv_parallel_for, which hands them to the runner set on the calling thread.
+ * The elements set the runner of their stream on the shared scheduler, see
+ * cvscheduler.cpp. Without a runner, e.g. in the cvfilter tool, the planner
+ * or on a worker thread running a task of an outer loop, the tasks run one
+ * after the other on the calling thread. Like the stage marks this only
+ * depends on glib.
+ */
+
+#include <glib.h>
+#include "cvparallel.h"
+
+/* Runner of the frame the calling thread is processing */
+static GPrivate current_runner;
+
+/* Sets the runner of the calling thread, NULL to run loops serially again */
+void cv_parallel_set_runner(const CvParallelRunner * runner)
+{
+	g_private_set(&current_runner, (gpointer)runner);
+}
+
+/* Runs func for every task in 0..n_tasks-1 and returns once all are done */
+void cv_parallel_for(gint n_tasks, CvTaskFunc func, gpointer data)
+{
+	const CvParallelRunner *runner = (const CvParallelRunner *)g_private_get(&current_runner);
+
+	if (runner == NULL || n_tasks <= 1)
+	{
+		for (gint task = 0; task < n_tasks; ++task)
+			func(task, data);
+		return;
+	}
+
+	runner->run(n_tasks, func, data, runner->user_data);
+}
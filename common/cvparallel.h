@@ -0,0 +1,43 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _CV_PARALLEL_H_
+#define _CV_PARALLEL_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Runs task number task of a parallel loop */
+typedef void (*CvTaskFunc)(gint task, gpointer user_data);
+
+/* Runs the n_tasks tasks of a loop, in any order and on any thread, and returns once all are done */
+typedef struct _CvParallelRunner
+{
+	void (*run)(gint n_tasks, CvTaskFunc func, gpointer data, gpointer user_data);
+	gpointer user_data;
+} CvParallelRunner;
+
+void cv_parallel_set_runner(const CvParallelRunner * runner);
+void cv_parallel_for(gint n_tasks, CvTaskFunc func, gpointer data);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,151 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+* Boston, MA 02110-1335, USA.
+*/
+/*
+ * Hardware performance counters of the calling thread, read through
+ * perf_event_open on Linux. Counters the CPU or the kernel does not offer,
+ * as in most virtual machines, are left out of the samples, and on other
+ * systems cv_perf_open always fails, so callers only have to handle a NULL
+ * CvPerf. Counts are user space only and scaled up when the kernel had to
+ * multiplex the counters.
+ */
+
+#include <glib.h>
+#include "cvperf.h"
+#include <cerrno>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#define CV_HAVE_PERF
+#endif
+
+static const gchar *counter_names[CV_PERF_N_COUNTERS] = {
+	"cycles", "instructions", "l1d-misses", "llc-misses", "stalled-frontend", "stalled-backend"
+};
+
+struct _CvPerf
+{
+	int fd[CV_PERF_N_COUNTERS];
+};
+
+#ifdef CV_HAVE_PERF
+static const struct
+{
+	guint32 type;
+	guint64 config;
+} counter_events[CV_PERF_N_COUNTERS] = {
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+	{ PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+	{ PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND }
+};
+#endif
+
+/* Opens the counters for the calling thread, NULL with error set when none is available */
+CvPerf *cv_perf_open(GError ** error)
+{
+#ifdef CV_HAVE_PERF
+	CvPerf *perf = g_new(CvPerf, 1);
+	int first_errno = 0;
+	guint opened = 0;
+
+	for (int i = 0; i < CV_PERF_N_COUNTERS; ++i)
+	{
+		struct perf_event_attr attr;
+
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = counter_events[i].type;
+		attr.config = counter_events[i].config;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+		perf->fd[i] = (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+		if (perf->fd[i] >= 0)
+			++opened;
+		else if (first_errno == 0)
+			first_errno = errno;
+	}
+
+	if (opened == 0)
+	{
+		g_set_error(error, G_FILE_ERROR, g_file_error_from_errno(first_errno),
+			"perf_event_open: %s", g_strerror(first_errno));
+		g_free(perf);
+		return NULL;
+	}
+	return perf;
+#else
+	g_set_error(error, G_FILE_ERROR, G_FILE_ERROR_NOSYS,
+		"Hardware performance counters are only read on Linux");
+	return NULL;
+#endif
+}
+
+void cv_perf_close(CvPerf * perf)
+{
+#ifdef CV_HAVE_PERF
+	for (int i = 0; i < CV_PERF_N_COUNTERS; ++i)
+		if (perf->fd[i] >= 0)
+			close(perf->fd[i]);
+#endif
+	g_free(perf);
+}
+
+/* Reads the running totals of all counters */
+void cv_perf_read(CvPerf * perf, CvPerfSample * sample)
+{
+	sample->valid = 0;
+#ifdef CV_HAVE_PERF
+	for (int i = 0; i < CV_PERF_N_COUNTERS; ++i)
+	{
+		/* Value, time enabled and time running */
+		guint64 data[3];
+
+		if (perf->fd[i] < 0 || read(perf->fd[i], data, sizeof(data)) != sizeof(data))
+			continue;
+
+		sample->value[i] = data[2] > 0 && data[2] < data[1] ?
+			(guint64)((double)data[0] * data[1] / data[2]) : data[0];
+		sample->valid |= 1u << i;
+	}
+#endif
+}
+
+const gchar *cv_perf_counter_name(CvPerfCounter counter)
+{
+	return counter_names[counter];
+}
+
+/* Adds the counts between two samples to sum for the counters valid in both */
+void cv_perf_sample_add_delta(CvPerfSample * sum, const CvPerfSample * from, const CvPerfSample * to)
+{
+	guint valid = from->valid & to->valid;
+
+	for (int i = 0; i < CV_PERF_N_COUNTERS; ++i)
+		if (valid & (1u << i))
+			sum->value[i] += to->value[i] - from->value[i];
+	sum->valid |= valid;
+}
@@ -0,0 +1,57 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _CV_PERF_H_
+#define _CV_PERF_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Hardware events counted for the calling thread */
+typedef enum
+{
+	CV_PERF_CYCLES,
+	CV_PERF_INSTRUCTIONS,
+	CV_PERF_L1D_MISSES,
+	CV_PERF_LLC_MISSES,
+	CV_PERF_STALLED_FRONTEND,
+	CV_PERF_STALLED_BACKEND,
+	CV_PERF_N_COUNTERS
+} CvPerfCounter;
+
+/* Counter values, bit i of valid is set when counter i could be read */
+typedef struct _CvPerfSample
+{
+	guint64 value[CV_PERF_N_COUNTERS];
+	guint valid;
+} CvPerfSample;
+
+typedef struct _CvPerf CvPerf;
+
+CvPerf *cv_perf_open(GError ** error);
+void cv_perf_close(CvPerf * perf);
+void cv_perf_read(CvPerf * perf, CvPerfSample * sample);
+
+const gchar *cv_perf_counter_name(CvPerfCounter counter);
+void cv_perf_sample_add_delta(CvPerfSample * sum, const CvPerfSample * from, const CvPerfSample * to);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,222 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+* Boston, MA 02110-1335, USA.
+*/
+/*
+ * Engine planner shared by the filter elements. Given a list of engines
+ * that compute the same filter, the planner times each of them on the
+ * element's benchmark frame and picks the fastest one whose output stays
+ * within a tolerance of the first, reference, engine. Choices are kept in
+ * memory and in a key file in the user cache directory, grouped by CPU
+ * model, so a given host only benchmarks each configuration once.
+ */
+
+#include <glib.h>
+#include "cvplanner.h"
+#include <cmath>
+#include <cstring>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define CV_HAVE_CPUID
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <cpuid.h>
+#define CV_HAVE_CPUID
+#endif
+
+/* Runs per engine, the fastest run counts */
+#define PLANNER_RUNS 3
+
+static GMutex planner_lock;
+static GKeyFile *planner_cache = NULL;
+static gchar *planner_cache_path = NULL;
+
+
+/*
+ *	Reads the processor brand string, e.g. "Intel(R) Core(TM) i7-8700 CPU @ 3.20GHz",
+ *	or the model in /proc/cpuinfo where cpuid has none. Without either the
+ *	host name keeps hosts from sharing calibrations made on other processors.
+ */
+static gchar * read_cpu_model(void)
+{
+	gchar *contents = NULL;
+#ifdef CV_HAVE_CPUID
+	unsigned int regs[12] = { 0 };
+	char brand[49];
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0x80000000);
+	if ((unsigned int)info[0] >= 0x80000004)
+	{
+		for (int i = 0; i < 3; ++i)
+		{
+			__cpuid(info, 0x80000002 + i);
+			memcpy(regs + 4 * i, info, sizeof(info));
+		}
+	}
+#else
+	if (__get_cpuid_max(0x80000000, NULL) >= 0x80000004)
+	{
+		for (unsigned int i = 0; i < 3; ++i)
+			__get_cpuid(0x80000002 + i, &regs[4 * i], &regs[4 * i + 1], &regs[4 * i + 2], &regs[4 * i + 3]);
+	}
+#endif
+	memcpy(brand, regs, 48);
+	brand[48] = '\0';
+	g_strstrip(brand);
+	if (brand[0] != '\0')
+		return g_strdup(brand);
+#endif
+	if (g_file_get_contents("/proc/cpuinfo", &contents, NULL, NULL))
+	{
+		gchar **lines = g_strsplit(contents, "\n", -1);
+		gchar *model = NULL;
+		for (gchar **line = lines; *line != NULL && model == NULL; ++line)
+		{
+			if (g_str_has_prefix(*line, "model name") || g_str_has_prefix(*line, "Hardware"))
+			{
+				gchar *colon = strchr(*line, ':');
+				if (colon != NULL)
+					model = g_strstrip(g_strdup(colon + 1));
+			}
+		}
+		g_strfreev(lines);
+		g_free(contents);
+		if (model != NULL && model[0] != '\0')
+			return model;
+		g_free(model);
+	}
+	return g_strdup(g_get_host_name());
+}
+
+/* CPU model the calibrations are stored under, with ']' removed to keep it
+ * usable as a key file group name */
+const gchar * cv_planner_cpu_model(void)
+{
+	static gchar *model = NULL;
+
+	g_mutex_lock(&planner_lock);
+	if (model == NULL)
+	{
+		model = read_cpu_model();
+		g_strdelimit(model, "[]", ' ');
+	}
+	g_mutex_unlock(&planner_lock);
+	return model;
+}
+
+/* Loads the calibration cache on first use, must hold planner_lock */
+static void load_cache(void)
+{
+	if (planner_cache != NULL)
+		return;
+
+	planner_cache = g_key_file_new();
+	planner_cache_path = g_build_filename(g_get_user_cache_dir(), "contextvision",
+		"planner.ini", NULL);
+	/* A missing or broken cache only means recalibrating */
+	g_key_file_load_from_file(planner_cache, planner_cache_path, G_KEY_FILE_NONE, NULL);
+}
+
+/* Looks up engine name in candidates, returns the index or -1 */
+static gint find_candidate(const CvPlannerCandidate * candidates, guint n_candidates,
+	const gchar * name)
+{
+	for (guint i = 0; i < n_candidates; ++i)
+	{
+		if (g_str_equal(candidates[i].name, name))
+			return i;
+	}
+	return -1;
+}
+
+/*
+ *	Returns the engine to use for the configuration described by key, which
+ *	must name the element, the frame size and every parameter that affects
+ *	the speed or the accuracy of the engines. candidates[0] is the reference
+ *	engine, the others are accepted if the largest absolute difference of
+ *	their n outputs from the reference output is at most tolerance. report,
+ *	when not NULL, is given the result of every engine benchmarked.
+ */
+gint cv_planner_choose(const gchar * key, const CvPlannerCandidate * candidates,
+	guint n_candidates, gsize n, gdouble tolerance, CvPlannerRunFunc run,
+	gpointer user_data, CvPlannerReportFunc report, gpointer report_data)
+{
+	const gchar *cpu = cv_planner_cpu_model();
+	gchar *cached;
+	gchar *cachedir;
+	gint best = 0;
+	gint64 besttime = G_MAXINT64;
+	float *reference;
+	float *output;
+
+	g_mutex_lock(&planner_lock);
+	load_cache();
+	cached = g_key_file_get_string(planner_cache, cpu, key, NULL);
+	g_mutex_unlock(&planner_lock);
+
+	if (cached != NULL)
+	{
+		gint index = find_candidate(candidates, n_candidates, cached);
+		g_free(cached);
+		if (index >= 0)
+			return candidates[index].engine;
+	}
+
+	reference = new float[n];
+	output = new float[n];
+
+	for (guint i = 0; i < n_candidates; ++i)
+	{
+		gint64 fastest = G_MAXINT64;
+		float maxerror = 0;
+
+		for (int r = 0; r < PLANNER_RUNS; ++r)
+		{
+			gint64 start = g_get_monotonic_time();
+			run(candidates[i].engine, i == 0 ? reference : output, user_data);
+			fastest = MIN(fastest, g_get_monotonic_time() - start);
+		}
+
+		if (i > 0)
+		{
+			for (gsize k = 0; k < n; ++k)
+				maxerror = MAX(maxerror, fabsf(output[k] - reference[k]));
+		}
+
+		if (report != NULL)
+			report(candidates[i].name, fastest / 1000.0, maxerror, report_data);
+		if (maxerror <= tolerance && fastest < besttime)
+		{
+			best = i;
+			besttime = fastest;
+		}
+	}
+
+	delete[] reference;
+	delete[] output;
+
+	g_mutex_lock(&planner_lock);
+	g_key_file_set_string(planner_cache, cpu, key, candidates[best].name);
+	cachedir = g_path_get_dirname(planner_cache_path);
+	if (g_mkdir_with_parents(cachedir, 0755) == 0)
+		g_key_file_save_to_file(planner_cache, planner_cache_path, NULL);
+	g_free(cachedir);
+	g_mutex_unlock(&planner_lock);
+
+	return candidates[best].engine;
+}
@@ -0,0 +1,48 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _CV_PLANNER_H_
+#define _CV_PLANNER_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* An engine the planner may choose, identified by the element's enum value */
+typedef struct _CvPlannerCandidate
+{
+	gint engine;
+	const gchar *name;
+} CvPlannerCandidate;
+
+/* Runs engine once on the element's benchmark frame, writing n floats to output */
+typedef void (*CvPlannerRunFunc)(gint engine, float * output, gpointer user_data);
+
+/* Tells the time of an engine's fastest run and the largest difference of its output from the reference */
+typedef void (*CvPlannerReportFunc)(const gchar * name, gdouble ms, gdouble maxerror,
+	gpointer user_data);
+
+const gchar * cv_planner_cpu_model(void);
+gint cv_planner_choose(const gchar * key, const CvPlannerCandidate * candidates,
+	guint n_candidates, gsize n, gdouble tolerance, CvPlannerRunFunc run,
+	gpointer user_data, CvPlannerReportFunc report, gpointer report_data);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,150 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Previews of the engines for trick modes. While scrubbing or playing fast
+ * forward most frames are only shown briefly, so instead of filtering the
+ * full frame the plane is decimated to half its width and height, filtered
+ * at that size and scaled back up bilinearly. That is a quarter of the
+ * pixels for every pass of the engine, and the engines get the sigma halved
+ * to cover the same part of the picture. Like the engines this only depends
+ * on glib.
+ */
+
+#include <glib.h>
+#include "cvpreview.h"
+#include "cvparallel.h"
+#include "cvstage.h"
+
+/* Rows of the full size plane each upsampling task writes */
+#define BAND_ROWS 64
+
+/* Arguments of the bands of one upsampling */
+typedef struct
+{
+	const guint8 *src;
+	gint src_stride;
+	int src_width;
+	int src_height;
+	guint8 *dest;
+	gint dest_stride;
+	int width;
+	int height;
+} UpsamplePass;
+
+/*
+ *	Averages every 2x2 block of the plane into one pixel of dest, which must
+ *	hold (width + 1) / 2 x (height + 1) / 2 pixels. An odd last row or column
+ *	is averaged with itself.
+ */
+void cv_preview_decimate(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height)
+{
+	int half_width = (width + 1) / 2;
+	int half_height = (height + 1) / 2;
+
+	for (int y = 0; y < half_height; ++y)
+	{
+		const guint8 *row0 = src + 2 * y*src_stride;
+		const guint8 *row1 = 2 * y + 1 < height ? row0 + src_stride : row0;
+		guint8 *d = dest + y*dest_stride;
+
+		for (int x = 0; x < half_width; ++x)
+		{
+			int x1 = 2 * x + 1 < width ? 2 * x + 1 : 2 * x;
+
+			d[x] = (guint8)((row0[2 * x] + row0[x1] + row1[2 * x] + row1[x1] + 2) >> 2);
+		}
+	}
+}
+
+/* Writes the rows of a band of the full size plane */
+static void upsample_band(gint band, gpointer user_data)
+{
+	UpsamplePass *pass = (UpsamplePass *)user_data;
+	int y0 = band * BAND_ROWS;
+	int y1 = MIN(y0 + BAND_ROWS, pass->height);
+	float scale_x = (float)pass->src_width / pass->width;
+	float scale_y = (float)pass->src_height / pass->height;
+
+	for (int y = y0; y < y1; ++y)
+	{
+		/* Pixel centres of both sizes line up, the border pixels repeat */
+		float fy = CLAMP((y + 0.5f) * scale_y - 0.5f, 0.0f, (float)(pass->src_height - 1));
+		int sy = MIN((int)fy, pass->src_height - 2 < 0 ? 0 : pass->src_height - 2);
+		float wy = pass->src_height > 1 ? fy - sy : 0.0f;
+		const guint8 *row0 = pass->src + sy*pass->src_stride;
+		const guint8 *row1 = pass->src_height > 1 ? row0 + pass->src_stride : row0;
+		guint8 *d = pass->dest + y*pass->dest_stride;
+
+		for (int x = 0; x < pass->width; ++x)
+		{
+			float fx = CLAMP((x + 0.5f) * scale_x - 0.5f, 0.0f, (float)(pass->src_width - 1));
+			int sx = MIN((int)fx, pass->src_width - 2 < 0 ? 0 : pass->src_width - 2);
+			int sx1 = pass->src_width > 1 ? sx + 1 : sx;
+			float wx = pass->src_width > 1 ? fx - sx : 0.0f;
+			float top = row0[sx] + wx * (row0[sx1] - row0[sx]);
+			float bottom = row1[sx] + wx * (row1[sx1] - row1[sx]);
+
+			d[x] = (guint8)(top + wy * (bottom - top) + 0.5f);
+		}
+	}
+}
+
+/* Scales a src_width x src_height plane bilinearly up to width x height */
+void cv_preview_upsample(const guint8 * src, gint src_stride, int src_width, int src_height,
+	guint8 * dest, gint dest_stride, int width, int height)
+{
+	UpsamplePass pass;
+
+	pass.src = src;
+	pass.src_stride = src_stride;
+	pass.src_width = src_width;
+	pass.src_height = src_height;
+	pass.dest = dest;
+	pass.dest_stride = dest_stride;
+	pass.width = width;
+	pass.height = height;
+	cv_parallel_for((height + BAND_ROWS - 1) / BAND_ROWS, upsample_band, &pass);
+}
+
+/*
+ *	Runs func on the plane decimated to half its size and scales the result
+ *	up into dest. The decimation is recorded as the padding stage and the
+ *	upsampling as the output stage, func records its own passes.
+ */
+void cv_preview_plane(const guint8 * src, gint src_stride, guint8 * dest, gint dest_stride,
+	int width, int height, CvPreviewFunc func, gpointer user_data)
+{
+	int half_width = (width + 1) / 2;
+	int half_height = (height + 1) / 2;
+	guint8 *small = (guint8 *)g_malloc((gsize)half_width * half_height);
+	guint8 *filtered = (guint8 *)g_malloc((gsize)half_width * half_height);
+
+	cv_stats_scratch(2 * (gssize)half_width * half_height);
+	cv_preview_decimate(src, src_stride, small, half_width, width, height);
+	cv_stats_mark(CV_STAGE_PAD);
+	func(small, half_width, filtered, half_width, half_width, half_height, user_data);
+	cv_preview_upsample(filtered, half_width, half_width, half_height, dest, dest_stride, width, height);
+	cv_stats_mark(CV_STAGE_OUTPUT);
+
+	cv_stats_scratch(-2 * (gssize)half_width * half_height);
+	g_free(small);
+	g_free(filtered);
+}
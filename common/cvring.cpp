@@ -0,0 +1,742 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Ring of filtered frames in shared memory, written by the ringsink element
+ * and read by other processes, like the ringreader tool, which map it and
+ * read the frames in place instead of receiving copies.
+ *
+ * The name the writer gives is a small anchor object that tells which
+ * generation of the ring is current, and the frames are in a second object,
+ * named after the ring, the writer's process and the generation:
+ *
+ *   NAME              magic, version, the writer's process and the current
+ *                     generation
+ *   NAME.PID.GEN      header   magic, version and the layout of the frames,
+ *                              the number of frames published, a wake counter
+ *                              and one descriptor per slot, each on a cache
+ *                              line of its own
+ *                     slots    n_slots I420 frames, each starting on a page
+ *
+ * When the frame size changes the writer creates the next generation
+ * beside the current one, makes it current in the anchor and closes the old
+ * one. Readers of the old generation find the next one through the anchor
+ * and move to it, while the old object stays mapped until the last of them
+ * has left, so no object is ever created under a name that is still in use.
+ * A second writer of a name that is in use is refused; on Linux a name left
+ * behind by a writer that died is taken over.
+ *
+ * There is one writer and any number of readers, and nobody locks. The
+ * writer puts frame n into slot n % n_slots, and the sequence in the slot's
+ * descriptor tells the readers what the slot holds: 2n + 1 while frame n is
+ * written, 2n + 2 once it is complete. A reader checks the sequence before
+ * and after it reads a frame, and drops the frame when the writer came round
+ * to the slot in between. A reader that falls more than a ring behind skips
+ * to the newest frame, so the writer never waits for a reader.
+ *
+ * Readers waiting for a frame sleep on the wake counter, which the writer
+ * bumps on every frame it publishes. On Linux it is a futex the writer
+ * wakes, elsewhere the readers poll it every millisecond.
+ */
+
+#include <glib.h>
+#include "cvring.h"
+#include <atomic>
+#include <climits>
+#include <cstring>
+
+#ifdef G_OS_WIN32
+#include <windows.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <time.h>
+#define CV_HAVE_FUTEX
+#endif
+
+#define CV_RING_MAGIC 0x474e4952u
+#define CV_RING_VERSION 2
+#define CV_RING_PAGE 4096
+/* How often readers look for a new frame where they cannot sleep on a futex */
+#define CV_RING_POLL_US 1000
+
+#define ROUND_UP(n, align) (((n) + (align) - 1) / (align) * (align))
+
+typedef struct _CvRingSlot
+{
+	/* 2n + 1 while frame n is written, 2n + 2 once published */
+	std::atomic<guint64> seq;
+	guint64 pts;
+	gint64 publish_time;
+} CvRingSlot;
+
+/* The object under the ring's name, one page */
+typedef struct _CvRingAnchor
+{
+	guint32 magic;
+	guint32 version;
+	guint32 pid;
+	/* Generation of the frames object readers should be on */
+	std::atomic<guint32> generation;
+} CvRingAnchor;
+
+typedef struct _CvRingHeader
+{
+	guint32 magic;
+	guint32 version;
+	guint32 generation;
+	guint32 n_slots;
+	gint32 width;
+	gint32 height;
+	gint32 strides[3];
+	guint64 offsets[3];
+	guint64 slot_size;
+	guint64 header_size;
+	/* Number of the first frame of this generation, frames count on across generations */
+	guint64 first;
+
+	/* Written on every frame, away from the layout the readers only read */
+	alignas(64) std::atomic<guint64> published;
+	std::atomic<guint32> wake;
+	std::atomic<guint32> closed;
+} CvRingHeader;
+
+/* Slot descriptors follow the header, one cache line each */
+#define SLOT_STRIDE 64
+
+/* A shared memory object mapped into the process */
+typedef struct _CvRingMap
+{
+	guint8 *map;
+	gsize size;
+#ifdef G_OS_WIN32
+	HANDLE mapping;
+#endif
+} CvRingMap;
+
+struct _CvRing
+{
+	/* Object name of the anchor, the frames objects add .PID.GEN to it */
+	gchar *name;
+	gboolean writer;
+	CvRingMap anchor_map;
+	CvRingAnchor *anchor;
+	/* The current generation, its frames object and header */
+	guint32 generation;
+	CvRingMap map;
+	CvRingHeader *header;
+	/* Layout of the frames of the next generation, writer only */
+	guint n_slots;
+	/* Next frame to write, or to read */
+	guint64 next;
+	guint64 skipped;
+};
+
+G_STATIC_ASSERT(sizeof(CvRingSlot) <= SLOT_STRIDE);
+G_STATIC_ASSERT(sizeof(CvRingAnchor) <= CV_RING_PAGE);
+G_STATIC_ASSERT(sizeof(std::atomic<guint32>) == sizeof(guint32));
+
+static CvRingSlot *ring_slot(CvRing * ring, guint64 number)
+{
+	return (CvRingSlot *)(ring->map.map + sizeof(CvRingHeader) + (number % ring->header->n_slots) * SLOT_STRIDE);
+}
+
+static guint8 *ring_slot_data(CvRing * ring, guint64 number)
+{
+	return ring->map.map + ring->header->header_size + (number % ring->header->n_slots) * ring->header->slot_size;
+}
+
+/* Name of the shared memory object, in the session's namespace on Windows */
+static gchar *ring_object_name(const gchar * name)
+{
+#ifdef G_OS_WIN32
+	return g_strdup_printf("Local\\%s", name);
+#else
+	return g_strdup_printf("/%s", name);
+#endif
+}
+
+/* Name of the frames object of a generation */
+static gchar *ring_frames_name(const gchar * object_name, guint32 pid, guint32 generation)
+{
+	return g_strdup_printf("%s.%u.%u", object_name, pid, generation);
+}
+
+static guint32 ring_current_pid(void)
+{
+#ifdef G_OS_WIN32
+	return (guint32)GetCurrentProcessId();
+#else
+	return (guint32)getpid();
+#endif
+}
+
+/* Sleeps until the wake counter moves away from value, the timeout passes or a signal comes */
+static void ring_wait(std::atomic<guint32> * wake, guint32 value, gint64 timeout_us)
+{
+#ifdef CV_HAVE_FUTEX
+	struct timespec timeout;
+
+	timeout.tv_sec = (time_t)(timeout_us / G_USEC_PER_SEC);
+	timeout.tv_nsec = (long)(timeout_us % G_USEC_PER_SEC) * 1000;
+	syscall(SYS_futex, (guint32 *)wake, FUTEX_WAIT, value, &timeout, NULL, 0);
+#else
+	if (wake->load(std::memory_order_acquire) == value)
+		g_usleep((gulong)MIN(timeout_us, (gint64)CV_RING_POLL_US));
+#endif
+}
+
+static void ring_wake(std::atomic<guint32> * wake)
+{
+	wake->fetch_add(1, std::memory_order_release);
+#ifdef CV_HAVE_FUTEX
+	syscall(SYS_futex, (guint32 *)wake, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+/*
+ *	Creates the named object at size and maps it for writing. Fails when an
+ *	object of that name exists, unless replace allows removing a left over
+ *	one first, which Windows never needs: its objects go with their last
+ *	handle.
+ */
+static gboolean ring_map_create(CvRingMap * m, const gchar * name, gsize size, gboolean replace)
+{
+	void *map = NULL;
+
+#ifdef G_OS_WIN32
+	m->mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE,
+		(DWORD)((guint64)size >> 32), (DWORD)size, name);
+	if (m->mapping != NULL && GetLastError() == ERROR_ALREADY_EXISTS)
+	{
+		CloseHandle(m->mapping);
+		m->mapping = NULL;
+	}
+	if (m->mapping != NULL)
+	{
+		map = MapViewOfFile(m->mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		if (map == NULL)
+			CloseHandle(m->mapping);
+	}
+#else
+	int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+
+	if (fd < 0 && errno == EEXIST && replace)
+	{
+		shm_unlink(name);
+		fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+	}
+	if (fd >= 0)
+	{
+		if (ftruncate(fd, (off_t)size) == 0)
+		{
+			map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED)
+				map = NULL;
+		}
+		/* The mapping keeps the object alive until it is unmapped */
+		close(fd);
+		if (map == NULL)
+			shm_unlink(name);
+	}
+#endif
+
+	m->map = (guint8 *)map;
+	m->size = size;
+	return map != NULL;
+}
+
+/* Maps the named object for reading, at its own size */
+static gboolean ring_map_open(CvRingMap * m, const gchar * name)
+{
+	void *map = NULL;
+	gsize size = 0;
+
+#ifdef G_OS_WIN32
+	m->mapping = OpenFileMappingA(FILE_MAP_READ, FALSE, name);
+	if (m->mapping != NULL)
+	{
+		map = MapViewOfFile(m->mapping, FILE_MAP_READ, 0, 0, 0);
+		if (map != NULL)
+		{
+			MEMORY_BASIC_INFORMATION info;
+
+			VirtualQuery(map, &info, sizeof(info));
+			size = info.RegionSize;
+		}
+		else
+			CloseHandle(m->mapping);
+	}
+#else
+	struct stat st;
+	int fd = shm_open(name, O_RDONLY, 0);
+
+	if (fd >= 0)
+	{
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			size = (gsize)st.st_size;
+			map = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED)
+				map = NULL;
+		}
+		close(fd);
+	}
+#endif
+
+	m->map = (guint8 *)map;
+	m->size = size;
+	return map != NULL;
+}
+
+static void ring_unmap(CvRingMap * m)
+{
+#ifdef G_OS_WIN32
+	UnmapViewOfFile(m->map);
+	CloseHandle(m->mapping);
+#else
+	munmap(m->map, m->size);
+#endif
+	m->map = NULL;
+}
+
+/* Removes the name of an object the writer created, readers that have it mapped keep it */
+static void ring_unlink(const gchar * name)
+{
+#ifndef G_OS_WIN32
+	shm_unlink(name);
+#endif
+}
+
+/*
+ *	Linux only: a ring whose anchor names a process that is gone was left
+ *	behind by a writer that died, its anchor and frames are removed so the
+ *	name can be taken over. A ring of a live writer, or an object that is no
+ *	ring, stays.
+ */
+static gboolean ring_remove_stale(const gchar * name)
+{
+#ifdef G_OS_WIN32
+	return FALSE;
+#else
+	CvRingMap m;
+	const CvRingAnchor *anchor;
+	gchar *frames;
+	gboolean stale;
+
+	if (!ring_map_open(&m, name))
+		return FALSE;
+	anchor = (const CvRingAnchor *)m.map;
+	stale = m.size >= sizeof(CvRingAnchor) && anchor->magic == CV_RING_MAGIC &&
+		anchor->version == CV_RING_VERSION && kill((pid_t)anchor->pid, 0) != 0 && errno == ESRCH;
+	if (stale)
+	{
+		frames = ring_frames_name(name, anchor->pid, anchor->generation.load(std::memory_order_acquire));
+		shm_unlink(frames);
+		g_free(frames);
+		shm_unlink(name);
+	}
+	ring_unmap(&m);
+	return stale;
+#endif
+}
+
+/*
+ *	Creates generation of the frames of width x height I420, laid out like
+ *	GStreamer's default I420 layout, and makes it the ring's current one.
+ *	Frame numbers go on from ring->next.
+ */
+static gboolean ring_create_frames(CvRing * ring, guint32 generation, gint width, gint height)
+{
+	CvRingHeader *header;
+	gint strides[3];
+	guint64 offsets[3];
+	guint64 frame_size, slot_size, header_size;
+	guint n_slots = ring->n_slots;
+	gchar *name;
+	gboolean ok;
+
+	strides[0] = ROUND_UP(width, 4);
+	strides[1] = strides[2] = ROUND_UP((width + 1) / 2, 4);
+	offsets[0] = 0;
+	offsets[1] = (guint64)strides[0] * height;
+	offsets[2] = offsets[1] + (guint64)strides[1] * ((height + 1) / 2);
+	frame_size = offsets[2] + (guint64)strides[2] * ((height + 1) / 2);
+	slot_size = ROUND_UP(frame_size, CV_RING_PAGE);
+	header_size = ROUND_UP(sizeof(CvRingHeader) + (guint64)n_slots * SLOT_STRIDE, CV_RING_PAGE);
+
+	/* The name carries the writer's process, an object of a dead writer with the same one can go */
+	name = ring_frames_name(ring->name, ring->anchor->pid, generation);
+	ok = ring_map_create(&ring->map, name, (gsize)(header_size + n_slots * slot_size), TRUE);
+	g_free(name);
+	if (!ok)
+		return FALSE;
+
+	/* Fresh shared memory is zeroed, every slot starts out empty */
+	header = ring->header = (CvRingHeader *)ring->map.map;
+	header->version = CV_RING_VERSION;
+	header->generation = generation;
+	header->n_slots = n_slots;
+	header->width = width;
+	header->height = height;
+	memcpy(header->strides, strides, sizeof(strides));
+	memcpy(header->offsets, offsets, sizeof(offsets));
+	header->slot_size = slot_size;
+	header->header_size = header_size;
+	header->first = ring->next;
+	header->published.store(ring->next, std::memory_order_relaxed);
+	/* Readers take the frames once the magic is there */
+	std::atomic_thread_fence(std::memory_order_release);
+	header->magic = CV_RING_MAGIC;
+	ring->generation = generation;
+	return TRUE;
+}
+
+/* Tells the readers of the current generation it is closed and lets go of it */
+static void ring_close_frames(CvRing * ring)
+{
+	gchar *name;
+
+	ring->header->closed.store(1, std::memory_order_release);
+	ring_wake(&ring->header->wake);
+	ring_unmap(&ring->map);
+	name = ring_frames_name(ring->name, ring->anchor->pid, ring->generation);
+	ring_unlink(name);
+	g_free(name);
+	ring->header = NULL;
+}
+
+/*
+ *	Creates the ring name with n_slots frames of width x height I420, laid
+ *	out like GStreamer's default I420 layout. Returns NULL with a message
+ *	when the shared memory cannot be created or another writer has the name.
+ */
+CvRing *cv_ring_create(const gchar * name, guint n_slots, gint width, gint height)
+{
+	CvRing *ring = g_new0(CvRing, 1);
+	CvRingAnchor *anchor;
+
+	ring->name = ring_object_name(name);
+	ring->writer = TRUE;
+	ring->n_slots = MAX(n_slots, 2);
+	if (!ring_map_create(&ring->anchor_map, ring->name, CV_RING_PAGE, FALSE) &&
+		(!ring_remove_stale(ring->name) || !ring_map_create(&ring->anchor_map, ring->name, CV_RING_PAGE, FALSE)))
+	{
+		g_printerr("Ring %s is already written by another process, or its shared memory could not be created.\n", ring->name);
+		g_free(ring->name);
+		g_free(ring);
+		return NULL;
+	}
+	anchor = ring->anchor = (CvRingAnchor *)ring->anchor_map.map;
+	anchor->version = CV_RING_VERSION;
+	anchor->pid = ring_current_pid();
+
+	if (!ring_create_frames(ring, 0, width, height))
+	{
+		g_printerr("Could not create the shared memory of ring %s.\n", ring->name);
+		ring_unmap(&ring->anchor_map);
+		ring_unlink(ring->name);
+		g_free(ring->name);
+		g_free(ring);
+		return NULL;
+	}
+
+	/* Readers open the ring once the magic is there */
+	std::atomic_thread_fence(std::memory_order_release);
+	anchor->magic = CV_RING_MAGIC;
+	return ring;
+}
+
+/*
+ *	Changes the frame size to width x height: the frames go to a new
+ *	generation of the ring, which readers move to, and the number of slots
+ *	stays. On failure the ring keeps the old size.
+ */
+gboolean cv_ring_resize(CvRing * ring, gint width, gint height)
+{
+	CvRingMap old_map = ring->map;
+	CvRingHeader *old_header = ring->header;
+	guint32 old_generation = ring->generation;
+	gchar *name;
+
+	if (!ring_create_frames(ring, old_generation + 1, width, height))
+	{
+		g_printerr("Could not create the shared memory of ring %s for %dx%d frames.\n", ring->name, width, height);
+		ring->map = old_map;
+		ring->header = old_header;
+		return FALSE;
+	}
+
+	/* The new generation is current before the old one reads as closed, so readers find it */
+	ring->anchor->generation.store(ring->generation, std::memory_order_release);
+	old_header->closed.store(1, std::memory_order_release);
+	ring_wake(&old_header->wake);
+	ring_unmap(&old_map);
+	name = ring_frames_name(ring->name, ring->anchor->pid, old_generation);
+	ring_unlink(name);
+	g_free(name);
+	return TRUE;
+}
+
+void cv_ring_get_layout(CvRing * ring, gint strides[3], gsize offsets[3])
+{
+	for (gint i = 0; i < 3; i++)
+	{
+		strides[i] = ring->header->strides[i];
+		offsets[i] = (gsize)ring->header->offsets[i];
+	}
+}
+
+/* Returns the slot to write the next frame into, laid out as cv_ring_get_layout tells */
+guint8 *cv_ring_write_begin(CvRing * ring)
+{
+	CvRingSlot *slot = ring_slot(ring, ring->next);
+
+	slot->seq.store(2 * ring->next + 1, std::memory_order_relaxed);
+	/* Readers that see any of the new pixels see the slot as being written */
+	std::atomic_thread_fence(std::memory_order_release);
+	return ring_slot_data(ring, ring->next);
+}
+
+/* Publishes the frame written since cv_ring_write_begin and wakes the readers */
+void cv_ring_write_end(CvRing * ring, guint64 pts)
+{
+	CvRingSlot *slot = ring_slot(ring, ring->next);
+
+	slot->pts = pts;
+	slot->publish_time = g_get_monotonic_time();
+	slot->seq.store(2 * ring->next + 2, std::memory_order_release);
+	ring->next++;
+	ring->header->published.store(ring->next, std::memory_order_release);
+	ring_wake(&ring->header->wake);
+}
+
+/* Maps the frames of the generation the anchor names, FALSE while they are not there */
+static gboolean ring_open_frames(CvRing * ring, guint32 generation)
+{
+	CvRingMap m;
+	const CvRingHeader *header;
+	gchar *name = ring_frames_name(ring->name, ring->anchor->pid, generation);
+	gboolean ok = ring_map_open(&m, name);
+
+	g_free(name);
+	if (!ok)
+		return FALSE;
+
+	header = (const CvRingHeader *)m.map;
+	if (m.size < sizeof(CvRingHeader) || header->magic != CV_RING_MAGIC ||
+		header->version != CV_RING_VERSION || header->generation != generation ||
+		m.size < header->header_size + header->n_slots * header->slot_size)
+	{
+		ring_unmap(&m);
+		return FALSE;
+	}
+	std::atomic_thread_fence(std::memory_order_acquire);
+
+	ring->map = m;
+	ring->header = (CvRingHeader *)m.map;
+	ring->generation = generation;
+	return TRUE;
+}
+
+/* Maps the current generation, trying again while the writer moves on to another one meanwhile */
+static gboolean ring_open_current(CvRing * ring)
+{
+	guint32 generation = ring->anchor->generation.load(std::memory_order_acquire);
+
+	for (;;)
+	{
+		guint32 current;
+
+		if (ring_open_frames(ring, generation))
+			return TRUE;
+		current = ring->anchor->generation.load(std::memory_order_acquire);
+		if (current == generation)
+			return FALSE;
+		generation = current;
+	}
+}
+
+/* Opens the ring a writer created under name, NULL while there is none */
+CvRing *cv_ring_open(const gchar * name)
+{
+	CvRing *ring = g_new0(CvRing, 1);
+	guint64 published;
+
+	ring->name = ring_object_name(name);
+	if (!ring_map_open(&ring->anchor_map, ring->name))
+	{
+		g_free(ring->name);
+		g_free(ring);
+		return NULL;
+	}
+
+	ring->anchor = (CvRingAnchor *)ring->anchor_map.map;
+	if (ring->anchor_map.size < sizeof(CvRingAnchor) || ring->anchor->magic != CV_RING_MAGIC ||
+		ring->anchor->version != CV_RING_VERSION || !ring_open_current(ring))
+	{
+		ring_unmap(&ring->anchor_map);
+		g_free(ring->name);
+		g_free(ring);
+		return NULL;
+	}
+
+	/* Start at the newest frame, older ones are about to be overwritten */
+	published = ring->header->published.load(std::memory_order_acquire);
+	ring->next = published > ring->header->first ? published - 1 : ring->header->first;
+	return ring;
+}
+
+/*
+ *	The generation the reader is on was closed: moves to the one the writer
+ *	went on with after a new frame size, the frames the reader had not read
+ *	yet count as skipped. FALSE when the writer is gone instead.
+ */
+static gboolean ring_follow(CvRing * ring)
+{
+	CvRingMap old_map = ring->map;
+	CvRingHeader *old_header = ring->header;
+	guint32 old_generation = ring->generation;
+
+	if (ring->anchor->generation.load(std::memory_order_acquire) == old_generation)
+		return FALSE;
+	if (!ring_open_current(ring))
+	{
+		ring->map = old_map;
+		ring->header = old_header;
+		ring->generation = old_generation;
+		return FALSE;
+	}
+	ring_unmap(&old_map);
+
+	if (ring->header->first > ring->next)
+	{
+		ring->skipped += ring->header->first - ring->next;
+		ring->next = ring->header->first;
+	}
+	return TRUE;
+}
+
+/*
+ *	Waits up to timeout_us for the next frame and points frame at it in the
+ *	ring. The pixels can change under the reader, cv_ring_read_end tells
+ *	whether they stayed the frame's while it was read.
+ */
+CvRingReadResult cv_ring_read_begin(CvRing * ring, CvRingFrame * frame, gint64 timeout_us)
+{
+	CvRingHeader *header = ring->header;
+	gint64 deadline = g_get_monotonic_time() + timeout_us;
+
+	for (;;)
+	{
+		guint32 wake = header->wake.load(std::memory_order_acquire);
+		guint64 published = header->published.load(std::memory_order_acquire);
+		gint64 remaining;
+
+		if (published > ring->next)
+		{
+			guint64 number = ring->next;
+			CvRingSlot *slot;
+
+			/* A ring behind, the slots of the unread frames are being reused */
+			if (published - number >= header->n_slots)
+			{
+				ring->skipped += published - 1 - number;
+				number = published - 1;
+			}
+			slot = ring_slot(ring, number);
+			ring->next = number + 1;
+			if (slot->seq.load(std::memory_order_acquire) != 2 * number + 2)
+			{
+				ring->skipped++;
+				continue;
+			}
+
+			frame->data = ring_slot_data(ring, number);
+			frame->width = header->width;
+			frame->height = header->height;
+			for (gint i = 0; i < 3; i++)
+			{
+				frame->strides[i] = header->strides[i];
+				frame->offsets[i] = (gsize)header->offsets[i];
+			}
+			frame->number = number;
+			frame->pts = slot->pts;
+			frame->publish_time = slot->publish_time;
+			return CV_RING_READ_OK;
+		}
+
+		if (header->closed.load(std::memory_order_acquire))
+		{
+			if (ring->writer || !ring_follow(ring))
+				return CV_RING_READ_CLOSED;
+			header = ring->header;
+			continue;
+		}
+		remaining = deadline - g_get_monotonic_time();
+		if (remaining <= 0)
+			return CV_RING_READ_TIMEOUT;
+		ring_wait(&header->wake, wake, remaining);
+	}
+}
+
+/* Whether the frame stayed intact while it was read, a frame that did not is counted as skipped */
+gboolean cv_ring_read_end(CvRing * ring, const CvRingFrame * frame)
+{
+	CvRingSlot *slot = ring_slot(ring, frame->number);
+
+	std::atomic_thread_fence(std::memory_order_acquire);
+	if (slot->seq.load(std::memory_order_relaxed) == 2 * frame->number + 2)
+		return TRUE;
+	ring->skipped++;
+	return FALSE;
+}
+
+/* Frames the reader missed, because it was behind or the writer overwrote them while read */
+guint64 cv_ring_get_skipped(CvRing * ring)
+{
+	return ring->skipped;
+}
+
+/* Closes the ring, the writer also tells the readers and removes its name */
+void cv_ring_close(CvRing * ring)
+{
+	if (ring->writer)
+	{
+		ring_close_frames(ring);
+		ring_unmap(&ring->anchor_map);
+		ring_unlink(ring->name);
+	}
+	else
+	{
+		ring_unmap(&ring->map);
+		ring_unmap(&ring->anchor_map);
+	}
+	g_free(ring->name);
+	g_free(ring);
+}
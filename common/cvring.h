@@ -0,0 +1,69 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _CV_RING_H_
+#define _CV_RING_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _CvRing CvRing;
+
+/* A published I420 frame as a reader sees it, pointing into the shared memory */
+typedef struct _CvRingFrame
+{
+	const guint8 *data;
+	gint width;
+	gint height;
+	gint strides[3];
+	gsize offsets[3];
+	/* Counts the frames the writer published, from 0 */
+	guint64 number;
+	guint64 pts;
+	/* g_get_monotonic_time() of the writer when it published the frame */
+	gint64 publish_time;
+} CvRingFrame;
+
+typedef enum
+{
+	CV_RING_READ_OK,
+	CV_RING_READ_TIMEOUT,
+	/* The writer closed the ring, a new writer may create one under the same name */
+	CV_RING_READ_CLOSED
+} CvRingReadResult;
+
+/* Writer side */
+CvRing *cv_ring_create(const gchar * name, guint n_slots, gint width, gint height);
+gboolean cv_ring_resize(CvRing * ring, gint width, gint height);
+void cv_ring_get_layout(CvRing * ring, gint strides[3], gsize offsets[3]);
+guint8 *cv_ring_write_begin(CvRing * ring);
+void cv_ring_write_end(CvRing * ring, guint64 pts);
+
+/* Reader side */
+CvRing *cv_ring_open(const gchar * name);
+CvRingReadResult cv_ring_read_begin(CvRing * ring, CvRingFrame * frame, gint64 timeout_us);
+gboolean cv_ring_read_end(CvRing * ring, const CvRingFrame * frame);
+guint64 cv_ring_get_skipped(CvRing * ring);
+
+void cv_ring_close(CvRing * ring);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,530 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+/*
+ * Work-stealing scheduler shared by every filter instance in the process,
+ * so that running many streams does not start a set of threads for each
+ * of them and oversubscribe the cores.
+ *
+ * Each plugin compiles its own copy of this file, so the scheduler is not
+ * a static of one module. The first cv_scheduler_get, from the plugin_init
+ * of whichever plugin is loaded first, creates it and stores it on the
+ * GstRegistry, which lives as long as the process, and later calls from
+ * either plugin find it there. All calls go through the table of functions
+ * of the module that created it, and a scheduler of another layout, from
+ * an older build of the other plugin, is left alone.
+ *
+ * Every element instance has a stream on the scheduler, whose runner it
+ * sets on its streaming thread for cv_parallel_for. A loop of a stream is
+ * a job, queued on the stream, and the streams with queued jobs take turns
+ * in handing a job to an idle worker, so a stream with many frames in
+ * flight cannot hold back the others. A worker splits the range of tasks
+ * it holds in halves, keeps the lower half and puts the upper one on its
+ * own deque, until a single task is left to run. Workers take their work
+ * from the bottom of their own deque first, then steal from the top of the
+ * others, where the largest ranges are, and only then start a new job. The
+ * streaming thread sleeps until its loop is done.
+ *
+ * CV_SCHEDULER_THREADS sets the number of workers, one per core by default.
+ * CV_SCHEDULER_CPUS, a list like 0-7,16-23, pins the workers to those CPUs
+ * in turn, and CV_SCHEDULER_NODE pins them to the CPUs of that NUMA node.
+ * Both also default the number of workers to the number of CPUs given.
+ */
+
+#ifdef __linux__
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include <gst/gst.h>
+#include "cvscheduler.h"
+#include <atomic>
+#include <cstdlib>
+
+#ifdef G_OS_WIN32
+#include <windows.h>
+#endif
+
+/* Layout of the structures below, bumped whenever they change */
+#define CV_SCHEDULER_ABI 1
+#define CV_SCHEDULER_QUARK "cv-scheduler"
+
+typedef struct _SchedulerOps
+{
+	guint (*get_n_workers)(CvScheduler * scheduler);
+	CvSchedulerStream *(*stream_new)(CvScheduler * scheduler);
+	void (*stream_free)(CvSchedulerStream * stream);
+	const CvParallelRunner *(*stream_get_runner)(CvSchedulerStream * stream);
+	guint64 (*stream_get_tasks)(CvSchedulerStream * stream);
+} SchedulerOps;
+
+/* The part of the scheduler and its streams every module relies on */
+struct _CvScheduler
+{
+	guint abi;
+	const SchedulerOps *ops;
+};
+
+struct _CvSchedulerStream
+{
+	CvScheduler *scheduler;
+};
+
+typedef struct _Scheduler Scheduler;
+typedef struct _Stream Stream;
+
+/* A loop submitted by a stream, on the stack of its streaming thread */
+typedef struct _Job
+{
+	CvTaskFunc func;
+	gpointer data;
+	gint n_tasks;
+	Stream *stream;
+	std::atomic<gint> remaining;
+} Job;
+
+/* Tasks begin..end-1 of a job */
+typedef struct _Range
+{
+	Job *job;
+	gint begin;
+	gint end;
+} Range;
+
+typedef struct _Worker
+{
+	Scheduler *scheduler;
+	guint index;
+	/* CPU the worker is pinned to, -1 for none */
+	gint cpu;
+	GMutex lock;
+	/* Ranges, the owner works at the tail and thieves steal from the head */
+	GQueue deque;
+	GThread *thread;
+} Worker;
+
+struct _Scheduler
+{
+	CvScheduler base;
+	guint n_workers;
+	Worker *workers;
+
+	/* Protects ready and the jobs of the streams, the condition variables use it too */
+	GMutex lock;
+	GCond wake;
+	GCond done;
+	/* Streams with queued jobs, in the order they take turns */
+	GQueue ready;
+
+	/* Ranges on the deques plus queued jobs, may be briefly off by the ones being moved */
+	std::atomic<gint> available;
+	std::atomic<gint> sleeping;
+};
+
+struct _Stream
+{
+	CvSchedulerStream base;
+	Scheduler *scheduler;
+	CvParallelRunner runner;
+	/* Jobs not yet taken by a worker, under the scheduler lock */
+	GQueue jobs;
+	gboolean queued;
+	std::atomic<guint64> tasks;
+};
+
+/* Wakes a sleeping worker, if any, after work was made available */
+static void wake_worker(Scheduler * scheduler)
+{
+	if (scheduler->sleeping.load() > 0)
+	{
+		g_mutex_lock(&scheduler->lock);
+		g_cond_signal(&scheduler->wake);
+		g_mutex_unlock(&scheduler->lock);
+	}
+}
+
+static void push_range(Worker * worker, Range * range)
+{
+	g_mutex_lock(&worker->lock);
+	g_queue_push_tail(&worker->deque, range);
+	g_mutex_unlock(&worker->lock);
+	worker->scheduler->available.fetch_add(1);
+	wake_worker(worker->scheduler);
+}
+
+static Range *pop_range(Worker * worker, gboolean steal)
+{
+	Range *range;
+
+	g_mutex_lock(&worker->lock);
+	range = (Range *)(steal ? g_queue_pop_head(&worker->deque) : g_queue_pop_tail(&worker->deque));
+	g_mutex_unlock(&worker->lock);
+	if (range != NULL)
+		worker->scheduler->available.fetch_sub(1);
+	return range;
+}
+
+/* Takes the next job of the stream whose turn it is, as a range of all its tasks */
+static Range *take_job(Scheduler * scheduler)
+{
+	Stream *stream;
+	Job *job = NULL;
+
+	g_mutex_lock(&scheduler->lock);
+	stream = (Stream *)g_queue_pop_head(&scheduler->ready);
+	if (stream != NULL)
+	{
+		job = (Job *)g_queue_pop_head(&stream->jobs);
+		if (g_queue_is_empty(&stream->jobs))
+			stream->queued = FALSE;
+		else
+			g_queue_push_tail(&scheduler->ready, stream);
+	}
+	g_mutex_unlock(&scheduler->lock);
+
+	if (job == NULL)
+		return NULL;
+
+	Range *range = g_new(Range, 1);
+	scheduler->available.fetch_sub(1);
+	range->job = job;
+	range->begin = 0;
+	range->end = job->n_tasks;
+	return range;
+}
+
+/* Splits off the upper halves for other workers and runs the first task */
+static void run_range(Worker * worker, Range * range)
+{
+	Job *job = range->job;
+	gint task;
+
+	while (range->end - range->begin > 1)
+	{
+		Range *upper = g_new(Range, 1);
+		gint mid = range->begin + (range->end - range->begin) / 2;
+
+		upper->job = job;
+		upper->begin = mid;
+		upper->end = range->end;
+		range->end = mid;
+		push_range(worker, upper);
+	}
+	task = range->begin;
+	g_free(range);
+
+	job->func(task, job->data);
+	job->stream->tasks.fetch_add(1, std::memory_order_relaxed);
+
+	/* The job lives on the stack of its streaming thread, do not touch it once it is done */
+	if (job->remaining.fetch_sub(1) == 1)
+	{
+		Scheduler *scheduler = worker->scheduler;
+		g_mutex_lock(&scheduler->lock);
+		g_cond_broadcast(&scheduler->done);
+		g_mutex_unlock(&scheduler->lock);
+	}
+}
+
+static void pin_worker(gint cpu)
+{
+	if (cpu < 0)
+		return;
+
+#if defined(G_OS_WIN32)
+	if (cpu < (gint)(8 * sizeof(DWORD_PTR)))
+		SetThreadAffinityMask(GetCurrentThread(), (DWORD_PTR)1 << cpu);
+#elif defined(__linux__)
+	cpu_set_t set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#endif
+}
+
+static gpointer worker_main(gpointer data)
+{
+	Worker *worker = (Worker *)data;
+	Scheduler *scheduler = worker->scheduler;
+
+	pin_worker(worker->cpu);
+
+	for (;;)
+	{
+		Range *range = pop_range(worker, FALSE);
+
+		for (guint i = 1; range == NULL && i < scheduler->n_workers; i++)
+			range = pop_range(&scheduler->workers[(worker->index + i) % scheduler->n_workers], TRUE);
+		if (range == NULL)
+			range = take_job(scheduler);
+
+		if (range != NULL)
+		{
+			run_range(worker, range);
+			continue;
+		}
+
+		g_mutex_lock(&scheduler->lock);
+		scheduler->sleeping.fetch_add(1);
+		while (scheduler->available.load() <= 0)
+			g_cond_wait(&scheduler->wake, &scheduler->lock);
+		scheduler->sleeping.fetch_sub(1);
+		g_mutex_unlock(&scheduler->lock);
+	}
+
+	return NULL;
+}
+
+/* CvParallelRunner of a stream, queues the loop as a job and waits for it */
+static void stream_run(gint n_tasks, CvTaskFunc func, gpointer data, gpointer user_data)
+{
+	Stream *stream = (Stream *)user_data;
+	Scheduler *scheduler = stream->scheduler;
+	Job job;
+
+	job.func = func;
+	job.data = data;
+	job.n_tasks = n_tasks;
+	job.stream = stream;
+	job.remaining.store(n_tasks);
+
+	g_mutex_lock(&scheduler->lock);
+	g_queue_push_tail(&stream->jobs, &job);
+	if (!stream->queued)
+	{
+		stream->queued = TRUE;
+		g_queue_push_tail(&scheduler->ready, stream);
+	}
+	scheduler->available.fetch_add(1);
+	g_cond_signal(&scheduler->wake);
+
+	while (job.remaining.load() > 0)
+		g_cond_wait(&scheduler->done, &scheduler->lock);
+	g_mutex_unlock(&scheduler->lock);
+}
+
+/* Adds the CPUs of a list like 0-7,16-23 */
+static void parse_cpu_list(const gchar * list, GArray * cpus)
+{
+	gchar **ranges = g_strsplit(list, ",", -1);
+
+	for (gchar **r = ranges; *r != NULL; r++)
+	{
+		gchar *end;
+		gint first = (gint)strtol(*r, &end, 10);
+		gint last = *end == '-' ? (gint)strtol(end + 1, NULL, 10) : first;
+
+		if (end == *r)
+			continue;
+		for (gint cpu = first; cpu <= last; cpu++)
+			g_array_append_val(cpus, cpu);
+	}
+	g_strfreev(ranges);
+}
+
+/* CPUs the workers are pinned to, empty when they are not */
+static GArray *scheduler_cpus(void)
+{
+	GArray *cpus = g_array_new(FALSE, FALSE, sizeof(gint));
+	const gchar *list = g_getenv("CV_SCHEDULER_CPUS");
+	const gchar *node = g_getenv("CV_SCHEDULER_NODE");
+
+	if (list != NULL)
+	{
+		parse_cpu_list(list, cpus);
+	}
+	else if (node != NULL)
+	{
+#if defined(G_OS_WIN32)
+		ULONGLONG mask = 0;
+
+		if (GetNumaNodeProcessorMask((UCHAR)atoi(node), &mask))
+		{
+			for (gint cpu = 0; cpu < 64; cpu++)
+				if (mask & ((ULONGLONG)1 << cpu))
+					g_array_append_val(cpus, cpu);
+		}
+#else
+		gchar *path = g_strdup_printf("/sys/devices/system/node/node%d/cpulist", atoi(node));
+		gchar *contents = NULL;
+
+		if (g_file_get_contents(path, &contents, NULL, NULL))
+			parse_cpu_list(g_strstrip(contents), cpus);
+		g_free(contents);
+		g_free(path);
+#endif
+		if (cpus->len == 0)
+			GST_WARNING("No CPUs found on NUMA node %s, the workers are not pinned", node);
+	}
+
+	return cpus;
+}
+
+static guint scheduler_get_n_workers(CvScheduler * base)
+{
+	return ((Scheduler *)base)->n_workers;
+}
+
+static CvSchedulerStream *scheduler_stream_new(CvScheduler * base)
+{
+	Stream *stream = new Stream();
+
+	stream->base.scheduler = base;
+	stream->scheduler = (Scheduler *)base;
+	stream->runner.run = stream_run;
+	stream->runner.user_data = stream;
+	g_queue_init(&stream->jobs);
+	return &stream->base;
+}
+
+/* The stream must have no loop running */
+static void scheduler_stream_free(CvSchedulerStream * base)
+{
+	delete (Stream *)base;
+}
+
+static const CvParallelRunner *scheduler_stream_get_runner(CvSchedulerStream * base)
+{
+	return &((Stream *)base)->runner;
+}
+
+static guint64 scheduler_stream_get_tasks(CvSchedulerStream * base)
+{
+	return ((Stream *)base)->tasks.load(std::memory_order_relaxed);
+}
+
+static const SchedulerOps scheduler_ops = {
+	scheduler_get_n_workers,
+	scheduler_stream_new,
+	scheduler_stream_free,
+	scheduler_stream_get_runner,
+	scheduler_stream_get_tasks
+};
+
+/* Starts the workers, the scheduler is never freed as other modules may hold it */
+static CvScheduler *scheduler_new(void)
+{
+	Scheduler *scheduler = new Scheduler();
+	GArray *cpus = scheduler_cpus();
+	const gchar *threads = g_getenv("CV_SCHEDULER_THREADS");
+
+	scheduler->base.abi = CV_SCHEDULER_ABI;
+	scheduler->base.ops = &scheduler_ops;
+	g_mutex_init(&scheduler->lock);
+	g_cond_init(&scheduler->wake);
+	g_cond_init(&scheduler->done);
+	g_queue_init(&scheduler->ready);
+
+	if (threads != NULL && atoi(threads) > 0)
+		scheduler->n_workers = atoi(threads);
+	else if (cpus->len > 0)
+		scheduler->n_workers = cpus->len;
+	else
+		scheduler->n_workers = g_get_num_processors();
+
+	scheduler->workers = g_new0(Worker, scheduler->n_workers);
+	for (guint i = 0; i < scheduler->n_workers; i++)
+	{
+		Worker *worker = &scheduler->workers[i];
+
+		worker->scheduler = scheduler;
+		worker->index = i;
+		worker->cpu = cpus->len > 0 ? g_array_index(cpus, gint, i % cpus->len) : -1;
+		g_mutex_init(&worker->lock);
+		g_queue_init(&worker->deque);
+	}
+	/* Only once every deque is ready, the workers steal from each other */
+	for (guint i = 0; i < scheduler->n_workers; i++)
+	{
+		gchar *name = g_strdup_printf("cv-worker-%u", i);
+
+		scheduler->workers[i].thread = g_thread_new(name, worker_main, &scheduler->workers[i]);
+		g_free(name);
+	}
+
+	GST_INFO("Started a scheduler with %u workers%s", scheduler->n_workers,
+		cpus->len > 0 ? ", pinned" : "");
+	g_array_free(cpus, TRUE);
+	return &scheduler->base;
+}
+
+/*
+ *	Returns the scheduler shared by the filter elements of the process,
+ *	creating it on the first call. A scheduler left on the registry by an
+ *	incompatible build of another plugin is not used, this module then
+ *	creates one of its own.
+ */
+CvScheduler *cv_scheduler_get(void)
+{
+	static CvScheduler *own = NULL;
+	GstRegistry *registry = gst_registry_get();
+	GQuark quark = g_quark_from_static_string(CV_SCHEDULER_QUARK);
+	CvScheduler *scheduler;
+
+	GST_OBJECT_LOCK(registry);
+	scheduler = (CvScheduler *)g_object_get_qdata(G_OBJECT(registry), quark);
+	if (scheduler == NULL)
+	{
+		scheduler = scheduler_new();
+		g_object_set_qdata(G_OBJECT(registry), quark, scheduler);
+	}
+	else if (scheduler->abi != CV_SCHEDULER_ABI)
+	{
+		if (own == NULL)
+		{
+			GST_WARNING("The shared scheduler is of another build, starting a separate one");
+			own = scheduler_new();
+		}
+		scheduler = own;
+	}
+	GST_OBJECT_UNLOCK(registry);
+
+	return scheduler;
+}
+
+guint cv_scheduler_get_n_workers(CvScheduler * scheduler)
+{
+	return scheduler->ops->get_n_workers(scheduler);
+}
+
+/* Creates the stream of an element instance */
+CvSchedulerStream *cv_scheduler_stream_new(CvScheduler * scheduler)
+{
+	return scheduler->ops->stream_new(scheduler);
+}
+
+void cv_scheduler_stream_free(CvSchedulerStream * stream)
+{
+	stream->scheduler->ops->stream_free(stream);
+}
+
+/* Runner to set on the streaming thread, see cv_parallel_set_runner */
+const CvParallelRunner *cv_scheduler_stream_get_runner(CvSchedulerStream * stream)
+{
+	return stream->scheduler->ops->stream_get_runner(stream);
+}
+
+/* Tasks of the stream's loops run so far */
+guint64 cv_scheduler_stream_get_tasks(CvSchedulerStream * stream)
+{
+	return stream->scheduler->ops->stream_get_tasks(stream);
+}
@@ -0,0 +1,41 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _CV_SCHEDULER_H_
+#define _CV_SCHEDULER_H_
+
+#include <gst/gst.h>
+#include "cvparallel.h"
+
+G_BEGIN_DECLS
+
+typedef struct _CvScheduler CvScheduler;
+typedef struct _CvSchedulerStream CvSchedulerStream;
+
+CvScheduler *cv_scheduler_get(void);
+guint cv_scheduler_get_n_workers(CvScheduler * scheduler);
+
+CvSchedulerStream *cv_scheduler_stream_new(CvScheduler * scheduler);
+void cv_scheduler_stream_free(CvSchedulerStream * stream);
+const CvParallelRunner *cv_scheduler_stream_get_runner(CvSchedulerStream * stream);
+guint64 cv_scheduler_stream_get_tasks(CvSchedulerStream * stream);
+
+G_END_DECLS
+
+#endif
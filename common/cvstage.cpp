@@ -0,0 +1,57 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Stage marks of the filter engines. Engine code records the end of each
+ * stage with cv_stats_mark and its scratch buffers with cv_stats_scratch,
+ * which hand them to the recorder set on the calling thread, if any. The
+ * elements record into their CvStats, see cvstats.cpp. This part only
+ * depends on glib, so the engines build into the standalone cvfilter tool
+ * as well, where no recorder is set and the marks do nothing.
+ */
+
+#include <glib.h>
+#include "cvstage.h"
+
+/* Recorder of the frame the calling thread is processing */
+static GPrivate current_recorder;
+
+/* Sets the recorder of the calling thread, NULL once its frame is done */
+void cv_stage_set_recorder(const CvStageRecorder * recorder)
+{
+	g_private_set(&current_recorder, (gpointer)recorder);
+}
+
+/* Ends the given stage of the current frame */
+void cv_stats_mark(CvStage stage)
+{
+	const CvStageRecorder *recorder = (const CvStageRecorder *)g_private_get(&current_recorder);
+
+	if (recorder != NULL)
+		recorder->mark(stage, recorder->user_data);
+}
+
+/* Accounts a scratch buffer of the current frame, positive when allocated and negative when freed */
+void cv_stats_scratch(gssize bytes)
+{
+	const CvStageRecorder *recorder = (const CvStageRecorder *)g_private_get(&current_recorder);
+
+	if (recorder != NULL)
+		recorder->scratch(bytes, recorder->user_data);
+}
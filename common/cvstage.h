@@ -0,0 +1,54 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _CV_STAGE_H_
+#define _CV_STAGE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* Stages of a frame, each timed separately */
+typedef enum
+{
+	CV_STAGE_PAD,
+	CV_STAGE_HORIZONTAL,
+	CV_STAGE_VERTICAL,
+	CV_STAGE_OUTPUT,
+	CV_STAGE_CHROMA,
+	CV_N_STAGES
+} CvStage;
+
+/* Receives the marks and scratch accounting of the frame a thread is processing */
+typedef struct _CvStageRecorder
+{
+	void (*mark)(CvStage stage, gpointer user_data);
+	void (*scratch)(gssize bytes, gpointer user_data);
+	gpointer user_data;
+} CvStageRecorder;
+
+void cv_stage_set_recorder(const CvStageRecorder * recorder);
+
+void cv_stats_mark(CvStage stage);
+void cv_stats_scratch(gssize bytes);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,262 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+* Boston, MA 02110-1335, USA.
+*/
+/*
+ * Filter statistics shared by the filter elements. The counters are atomics
+ * written by the streaming thread and read from any thread without taking a
+ * lock, so monitoring can poll the stats property or listen for the periodic
+ * element messages while frames are being processed.
+ *
+ * Engine code records the end of each stage with cv_stats_mark, see
+ * cvstage.cpp, which adds the time since the previous mark to that stage of
+ * the frame the calling thread is processing. Outside cv_stats_frame_begin
+ * and cv_stats_frame_end, e.g. in the planner or the kernel benchmark, marks
+ * and scratch accounting do nothing.
+ */
+
+#include <gst/gst.h>
+#include "cvstats.h"
+#include <atomic>
+
+static const gchar *stage_names[CV_N_STAGES] = {
+	"pad", "horizontal", "vertical", "output", "chroma"
+};
+
+struct _CvStats
+{
+	std::atomic<guint64> frames;
+	std::atomic<guint64> stage_ns[CV_N_STAGES];
+	std::atomic<guint64> latency_ns;
+	std::atomic<guint64> latency_max_ns;
+	std::atomic<guint64> histogram[CV_STATS_LATENCY_BINS];
+	std::atomic<guint64> bytes;
+	std::atomic<guint64> peak_scratch;
+	std::atomic<guint64> cache_hits;
+	std::atomic<guint64> cache_misses;
+	std::atomic<const gchar *> engine;
+	std::atomic<gint> threads;
+	std::atomic<guint64> last_post;
+
+	/* Receives the marks while a frame is being processed */
+	CvStageRecorder recorder;
+
+	/* Set before frames are processed, e.g. by the kernel benchmark */
+	CvStatsStageHook stage_hook;
+	gpointer stage_hook_data;
+
+	/* Frame in progress, only touched by the thread processing it */
+	GstClockTime frame_start;
+	GstClockTime last_mark;
+	gsize scratch_live;
+	gsize scratch_peak;
+	gsize scratch_total;
+};
+
+static void atomic_max(std::atomic<guint64> & value, guint64 candidate)
+{
+	guint64 current = value.load(std::memory_order_relaxed);
+
+	while (current < candidate &&
+		!value.compare_exchange_weak(current, candidate, std::memory_order_relaxed))
+		;
+}
+
+static void stats_mark(CvStage stage, gpointer user_data);
+static void stats_scratch(gssize bytes, gpointer user_data);
+
+CvStats *cv_stats_new(void)
+{
+	CvStats *stats = new CvStats();
+
+	stats->recorder.mark = stats_mark;
+	stats->recorder.scratch = stats_scratch;
+	stats->recorder.user_data = stats;
+	return stats;
+}
+
+void cv_stats_free(CvStats * stats)
+{
+	delete stats;
+}
+
+/* Starts timing a frame on the calling thread */
+void cv_stats_frame_begin(CvStats * stats)
+{
+	stats->frame_start = gst_util_get_timestamp();
+	stats->last_mark = stats->frame_start;
+	stats->scratch_live = 0;
+	stats->scratch_peak = 0;
+	stats->scratch_total = 0;
+	cv_stage_set_recorder(&stats->recorder);
+}
+
+/*
+ *	Finishes the frame started with cv_stats_frame_begin. The bytes touched
+ *	by the frame are estimated as frame_bytes, the size of the in- and
+ *	outframe, plus every scratch buffer written and read once.
+ */
+void cv_stats_frame_end(CvStats * stats, gsize frame_bytes)
+{
+	guint64 latency = gst_util_get_timestamp() - stats->frame_start;
+	int bin = 0;
+
+	while (bin < CV_STATS_LATENCY_BINS - 1 && latency >= ((guint64)GST_MSECOND << bin))
+		++bin;
+
+	stats->histogram[bin].fetch_add(1, std::memory_order_relaxed);
+	stats->latency_ns.fetch_add(latency, std::memory_order_relaxed);
+	atomic_max(stats->latency_max_ns, latency);
+	stats->bytes.fetch_add(frame_bytes + 2 * stats->scratch_total, std::memory_order_relaxed);
+	atomic_max(stats->peak_scratch, stats->scratch_peak);
+	stats->frames.fetch_add(1, std::memory_order_release);
+
+	cv_stage_set_recorder(NULL);
+}
+
+/* Records the engine in use, engine must be a static string */
+void cv_stats_set_engine(CvStats * stats, const gchar * engine, gint threads)
+{
+	stats->engine.store(engine, std::memory_order_relaxed);
+	stats->threads.store(threads, std::memory_order_relaxed);
+}
+
+/*
+ *	Calls hook with the stage on every mark, right after its time is taken,
+ *	so the time of the hook itself counts towards the next stage. Must be set
+ *	while no frame is being processed.
+ */
+void cv_stats_set_stage_hook(CvStats * stats, CvStatsStageHook hook, gpointer user_data)
+{
+	stats->stage_hook = hook;
+	stats->stage_hook_data = user_data;
+}
+
+/* Ends the given stage of the current frame */
+static void stats_mark(CvStage stage, gpointer user_data)
+{
+	CvStats *stats = (CvStats *)user_data;
+	GstClockTime now;
+
+	now = gst_util_get_timestamp();
+	stats->stage_ns[stage].fetch_add(now - stats->last_mark, std::memory_order_relaxed);
+	stats->last_mark = now;
+
+	if (stats->stage_hook != NULL)
+		stats->stage_hook(stage, stats->stage_hook_data);
+}
+
+/* Accounts a scratch buffer of the current frame, positive when allocated and negative when freed */
+static void stats_scratch(gssize bytes, gpointer user_data)
+{
+	CvStats *stats = (CvStats *)user_data;
+
+	if (bytes > 0)
+	{
+		stats->scratch_live += bytes;
+		stats->scratch_total += bytes;
+		stats->scratch_peak = MAX(stats->scratch_peak, stats->scratch_live);
+	}
+	else
+	{
+		stats->scratch_live -= MIN((gsize)-bytes, stats->scratch_live);
+	}
+}
+
+/* Counts a lookup in the cache of filtered frames */
+void cv_stats_cache_lookup(CvStats * stats, gboolean hit)
+{
+	if (hit)
+		stats->cache_hits.fetch_add(1, std::memory_order_relaxed);
+	else
+		stats->cache_misses.fetch_add(1, std::memory_order_relaxed);
+}
+
+const gchar *cv_stats_stage_name(CvStage stage)
+{
+	return stage_names[stage];
+}
+
+/* Snapshot of the counters as a structure with the given name */
+GstStructure *cv_stats_get_structure(CvStats * stats, const gchar * name)
+{
+	guint64 frames = stats->frames.load(std::memory_order_acquire);
+	guint64 latency = stats->latency_ns.load(std::memory_order_relaxed);
+	const gchar *engine = stats->engine.load(std::memory_order_relaxed);
+	GValue histogram = G_VALUE_INIT;
+	GstStructure *s;
+
+	s = gst_structure_new(name,
+		"frames", G_TYPE_UINT64, frames,
+		"engine", G_TYPE_STRING, engine != NULL ? engine : "none",
+		"threads", G_TYPE_INT, stats->threads.load(std::memory_order_relaxed),
+		"latency-mean-ns", G_TYPE_UINT64, frames > 0 ? latency / frames : (guint64)0,
+		"latency-max-ns", G_TYPE_UINT64, stats->latency_max_ns.load(std::memory_order_relaxed),
+		"peak-scratch-bytes", G_TYPE_UINT64, stats->peak_scratch.load(std::memory_order_relaxed),
+		"bytes-touched", G_TYPE_UINT64, stats->bytes.load(std::memory_order_relaxed),
+		"cache-hits", G_TYPE_UINT64, stats->cache_hits.load(std::memory_order_relaxed),
+		"cache-misses", G_TYPE_UINT64, stats->cache_misses.load(std::memory_order_relaxed),
+		NULL);
+
+	for (int i = 0; i < CV_N_STAGES; ++i)
+	{
+		gchar *field = g_strdup_printf("%s-ns", stage_names[i]);
+		gst_structure_set(s, field, G_TYPE_UINT64,
+			stats->stage_ns[i].load(std::memory_order_relaxed), NULL);
+		g_free(field);
+	}
+
+	g_value_init(&histogram, GST_TYPE_ARRAY);
+	for (int i = 0; i < CV_STATS_LATENCY_BINS; ++i)
+	{
+		GValue count = G_VALUE_INIT;
+		g_value_init(&count, G_TYPE_UINT64);
+		g_value_set_uint64(&count, stats->histogram[i].load(std::memory_order_relaxed));
+		gst_value_array_append_value(&histogram, &count);
+		g_value_unset(&count);
+	}
+	gst_structure_take_value(s, "latency-histogram", &histogram);
+
+	return s;
+}
+
+/*
+ *	Returns an element message with the statistics when interval has passed
+ *	since the previous one, NULL otherwise or when interval is 0. The first
+ *	call only starts the interval.
+ */
+GstMessage *cv_stats_poll_message(CvStats * stats, GstObject * src, const gchar * name,
+	GstClockTime interval)
+{
+	guint64 now = gst_util_get_timestamp();
+	guint64 last = stats->last_post.load(std::memory_order_relaxed);
+
+	if (interval == 0)
+		return NULL;
+
+	if (last == 0)
+	{
+		stats->last_post.compare_exchange_strong(last, now, std::memory_order_relaxed);
+		return NULL;
+	}
+
+	if (now - last < interval ||
+		!stats->last_post.compare_exchange_strong(last, now, std::memory_order_relaxed))
+		return NULL;
+
+	return gst_message_new_element(src, cv_stats_get_structure(stats, name));
+}
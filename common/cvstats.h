@@ -0,0 +1,54 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _CV_STATS_H_
+#define _CV_STATS_H_
+
+#include <gst/gst.h>
+#include "cvstage.h"
+
+G_BEGIN_DECLS
+
+/* Latency histogram bin k counts frames faster than 2^k ms, the last bin the rest */
+#define CV_STATS_LATENCY_BINS 12
+
+typedef struct _CvStats CvStats;
+
+/* Called on every mark with the stage it ends, on the thread processing the frame */
+typedef void (*CvStatsStageHook)(CvStage stage, gpointer user_data);
+
+CvStats *cv_stats_new(void);
+void cv_stats_free(CvStats * stats);
+
+void cv_stats_frame_begin(CvStats * stats);
+void cv_stats_frame_end(CvStats * stats, gsize frame_bytes);
+void cv_stats_set_engine(CvStats * stats, const gchar * engine, gint threads);
+void cv_stats_set_stage_hook(CvStats * stats, CvStatsStageHook hook, gpointer user_data);
+
+void cv_stats_cache_lookup(CvStats * stats, gboolean hit);
+
+const gchar *cv_stats_stage_name(CvStage stage);
+GstStructure *cv_stats_get_structure(CvStats * stats, const gchar * name);
+GstMessage *cv_stats_poll_message(CvStats * stats, GstObject * src, const gchar * name,
+	GstClockTime interval);
+
+G_END_DECLS
+
+#endif
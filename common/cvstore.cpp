@@ -0,0 +1,90 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+* Boston, MA 02110-1335, USA.
+*/
+/*
+ * Row store helpers writing filtered planes back as 8 bit pixels. They only
+ * depend on glib, so the standalone cvfilter tool writes its frames with
+ * the same code as the elements.
+ */
+
+#include <glib.h>
+#include "cvstore.h"
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CV_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+/*
+ *	Writes a row of filtered pixels, truncated and saturated to 8 bits.
+ *	Rows starting on a 16 byte boundary, which all rows of the aligned pools
+ *	do, are written with non-temporal stores that bypass the cache, as the
+ *	outframe is not read again by the filter.
+ */
+void cv_store_row(guint8 * dest, const float * src, int width)
+{
+	int x = 0;
+
+#ifdef CV_HAVE_SSE2
+	if (((guintptr)dest & 15) == 0)
+	{
+		for (; x + 16 <= width; x += 16)
+		{
+			__m128i a = _mm_cvttps_epi32(_mm_loadu_ps(src + x));
+			__m128i b = _mm_cvttps_epi32(_mm_loadu_ps(src + x + 4));
+			__m128i c = _mm_cvttps_epi32(_mm_loadu_ps(src + x + 8));
+			__m128i d = _mm_cvttps_epi32(_mm_loadu_ps(src + x + 12));
+			__m128i pix = _mm_packus_epi16(_mm_packs_epi32(a, b), _mm_packs_epi32(c, d));
+			_mm_stream_si128((__m128i *)(dest + x), pix);
+		}
+	}
+#endif
+
+	for (; x < width; ++x)
+		dest[x] = (guint8)CLAMP(src[x], 0.0f, 255.0f);
+}
+
+/* Fills a plane with a constant value, e.g. the neutral chroma value */
+void cv_fill_plane(guint8 * dest, gint stride, int width, int height, guint8 value)
+{
+	for (int y = 0; y < height; ++y)
+	{
+		guint8 *row = dest + y*stride;
+		int x = 0;
+
+#ifdef CV_HAVE_SSE2
+		if (((guintptr)row & 15) == 0)
+		{
+			__m128i pix = _mm_set1_epi8((char)value);
+			for (; x + 16 <= width; x += 16)
+				_mm_stream_si128((__m128i *)(row + x), pix);
+		}
+#endif
+
+		memset(row + x, value, width - x);
+	}
+}
+
+/* Orders the non-temporal stores before the frame is pushed downstream */
+void cv_store_fence(void)
+{
+#ifdef CV_HAVE_SSE2
+	_mm_sfence();
+#endif
+}
@@ -0,0 +1,33 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _CV_STORE_H_
+#define _CV_STORE_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+void cv_store_row(guint8 * dest, const float * src, int width);
+void cv_fill_plane(guint8 * dest, gint stride, int width, int height, guint8 value);
+void cv_store_fence(void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,309 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Temporal recursive denoising, shared by the filters. Every output pixel
+ * is a blend of the current frame and the previous output, the history,
+ * so noise that differs from frame to frame averages out over many frames
+ * at the cost of one pass and one extra plane, whatever the strength. The
+ * weight of the history falls with the absolute difference between the
+ * pixel and its history: pixels within threshold grey levels of it take
+ * the full strength, and the weight goes down to nothing at twice the
+ * threshold, so moving parts of the picture do not leave trails.
+ *
+ * The frame is first compared with the history in square blocks, and a
+ * block counts as moving when more than one in 16 of its pixels differ by
+ * twice the threshold or more, or the whole block by more than the
+ * threshold on average, which the noise of a still block does not reach
+ * with a threshold of about twice the noise. A spatial filter can then be
+ * run on the moving blocks only, where the history cannot help, and the
+ * blend takes its output there instead of the frame. The comparison and
+ * the blend run 16 pixels at a time with SSE2, in rows of blocks with
+ * cv_parallel_for. Like the engines this only depends on glib.
+ */
+
+#include <glib.h>
+#include "cvtemporal.h"
+#include "cvparallel.h"
+#include "cvstage.h"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CV_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
+struct _CvTemporal
+{
+	/* The previous output, width bytes per row, blended with once valid */
+	guint8 *history;
+	int width;
+	int height;
+	gboolean valid;
+	/* One byte per block of the frame last compared, not 0 where it moved */
+	guint8 *moving;
+	/* Bytes allocated for history and moving, which only grow, so a stream switching sizes allocates once */
+	gsize history_size;
+	gsize moving_size;
+	int block_size;
+	int blocksx;
+	int blocksy;
+};
+
+/* Arguments of the rows of blocks of one comparison or blend */
+typedef struct
+{
+	CvTemporal *temporal;
+	const guint8 *src;
+	gint src_stride;
+	guint8 *dest;
+	gint dest_stride;
+	int threshold;
+	/* History weight per grey level of closeness, in 1/65536 */
+	int factor;
+	gboolean filtered;
+} TemporalPass;
+
+CvTemporal *cv_temporal_new(void)
+{
+	return g_new0(CvTemporal, 1);
+}
+
+void cv_temporal_free(CvTemporal * temporal)
+{
+	g_free(temporal->history);
+	g_free(temporal->moving);
+	g_free(temporal);
+}
+
+/* Forgets the history, e.g. after a seek, the next frame starts it anew */
+void cv_temporal_reset(CvTemporal * temporal)
+{
+	temporal->valid = FALSE;
+}
+
+/* Returns buffer holding at least size bytes, its content undefined, reallocated only when it is too small */
+static guint8 *temporal_reserve(guint8 * buffer, gsize * allocated, gsize size)
+{
+	if (size <= *allocated)
+		return buffer;
+	g_free(buffer);
+	*allocated = size;
+	return (guint8 *)g_malloc(size);
+}
+
+/* Makes a plane the history, the first frame after a reset or a change of size */
+void cv_temporal_store(CvTemporal * temporal, const guint8 * plane, gint stride, int width, int height)
+{
+	temporal->history = temporal_reserve(temporal->history, &temporal->history_size, (gsize)width*height);
+	temporal->width = width;
+	temporal->height = height;
+	for (int y = 0; y < height; ++y)
+		memcpy(temporal->history + (gsize)y*width, plane + y*stride, width);
+	temporal->valid = TRUE;
+}
+
+/* Compares the blocks of a row of blocks with the history */
+static void motion_band(gint by, gpointer user_data)
+{
+	TemporalPass *pass = (TemporalPass *)user_data;
+	CvTemporal *temporal = pass->temporal;
+	int block_size = temporal->block_size;
+	int y0 = by*block_size;
+	int y1 = MIN(y0 + block_size, temporal->height);
+
+	for (int bx = 0; bx < temporal->blocksx; ++bx)
+	{
+		int x0 = bx*block_size;
+		int x1 = MIN(x0 + block_size, temporal->width);
+		guint sum = 0;
+		guint moved = 0;
+#ifdef CV_HAVE_SSE2
+		__m128i sums = _mm_setzero_si128();
+		__m128i counts = _mm_setzero_si128();
+		__m128i below = _mm_set1_epi8((char)(2 * pass->threshold - 1));
+		__m128i one = _mm_set1_epi8(1);
+#endif
+
+		for (int y = y0; y < y1; ++y)
+		{
+			const guint8 *s = pass->src + y*pass->src_stride;
+			const guint8 *h = temporal->history + (gsize)y*temporal->width;
+			int x = x0;
+
+#ifdef CV_HAVE_SSE2
+			for (; x + 16 <= x1; x += 16)
+			{
+				__m128i a = _mm_loadu_si128((const __m128i *)(s + x));
+				__m128i b = _mm_loadu_si128((const __m128i *)(h + x));
+				__m128i diff = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+				sums = _mm_add_epi64(sums, _mm_sad_epu8(a, b));
+				/* 1 in the lanes at twice the threshold or more, summed like the differences */
+				counts = _mm_add_epi64(counts, _mm_sad_epu8(_mm_min_epu8(_mm_subs_epu8(diff, below), one),
+					_mm_setzero_si128()));
+			}
+#endif
+			for (; x < x1; ++x)
+			{
+				int diff = abs(s[x] - h[x]);
+				sum += diff;
+				moved += diff >= 2 * pass->threshold;
+			}
+		}
+
+#ifdef CV_HAVE_SSE2
+		sum += _mm_cvtsi128_si32(sums) + _mm_cvtsi128_si32(_mm_srli_si128(sums, 8));
+		moved += _mm_cvtsi128_si32(counts) + _mm_cvtsi128_si32(_mm_srli_si128(counts, 8));
+#endif
+		temporal->moving[by*temporal->blocksx + bx] = 16 * moved > (guint)((y1 - y0)*(x1 - x0)) ||
+			sum > (guint)(pass->threshold*(y1 - y0)*(x1 - x0));
+	}
+}
+
+/*
+ *	Compares the frame with the history in blocks of block_size pixels and
+ *	returns one byte per block, in rows of blocks, not 0 where the block
+ *	moved. Returns NULL when there is no history of the same size to blend
+ *	with. threshold is between 1 and 127.
+ */
+const guint8 *cv_temporal_motion(CvTemporal * temporal, const guint8 * src, gint src_stride,
+	int width, int height, int threshold, int block_size)
+{
+	TemporalPass pass;
+	int blocksx = (width + block_size - 1) / block_size;
+	int blocksy = (height + block_size - 1) / block_size;
+
+	if (!temporal->valid || temporal->width != width || temporal->height != height)
+		return NULL;
+
+	temporal->moving = temporal_reserve(temporal->moving, &temporal->moving_size, (gsize)blocksx*blocksy);
+	temporal->block_size = block_size;
+	temporal->blocksx = blocksx;
+	temporal->blocksy = blocksy;
+
+	pass.temporal = temporal;
+	pass.src = src;
+	pass.src_stride = src_stride;
+	pass.threshold = threshold;
+	cv_parallel_for(blocksy, motion_band, &pass);
+	cv_stats_mark(CV_STAGE_PAD);
+	return temporal->moving;
+}
+
+/* Blends a run of pixels of a row with the history into dest and the history */
+static inline void blend_run(const guint8 * s, const guint8 * in, guint8 * h, guint8 * d,
+	int width, int threshold, int factor)
+{
+	int x = 0;
+
+#ifdef CV_HAVE_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i twice = _mm_set1_epi8((char)(2 * threshold));
+	__m128i limit = _mm_set1_epi8((char)threshold);
+	__m128i scale = _mm_set1_epi16((short)factor);
+	__m128i full = _mm_set1_epi16(256);
+	__m128i round = _mm_set1_epi16(128);
+
+	for (; x + 16 <= width; x += 16)
+	{
+		__m128i a = _mm_loadu_si128((const __m128i *)(s + x));
+		__m128i b = _mm_loadu_si128((const __m128i *)(h + x));
+		__m128i pix = _mm_loadu_si128((const __m128i *)(in + x));
+		__m128i diff = _mm_or_si128(_mm_subs_epu8(a, b), _mm_subs_epu8(b, a));
+		/* Closeness to the history, threshold up to it and 0 from twice it */
+		__m128i close = _mm_min_epu8(_mm_subs_epu8(twice, diff), limit);
+		__m128i out[2];
+
+		for (int half = 0; half < 2; ++half)
+		{
+			__m128i c = half ? _mm_unpackhi_epi8(close, zero) : _mm_unpacklo_epi8(close, zero);
+			__m128i p = half ? _mm_unpackhi_epi8(pix, zero) : _mm_unpacklo_epi8(pix, zero);
+			__m128i q = half ? _mm_unpackhi_epi8(b, zero) : _mm_unpacklo_epi8(b, zero);
+			__m128i w = _mm_srli_epi16(_mm_mullo_epi16(c, scale), 8);
+			__m128i sum = _mm_add_epi16(_mm_mullo_epi16(p, _mm_sub_epi16(full, w)), _mm_mullo_epi16(q, w));
+			out[half] = _mm_srli_epi16(_mm_add_epi16(sum, round), 8);
+		}
+		out[0] = _mm_packus_epi16(out[0], out[1]);
+		_mm_storeu_si128((__m128i *)(d + x), out[0]);
+		_mm_storeu_si128((__m128i *)(h + x), out[0]);
+	}
+#endif
+
+	for (; x < width; ++x)
+	{
+		int close = MIN(MAX(2 * threshold - abs(s[x] - h[x]), 0), threshold);
+		int w = (close*factor) >> 8;
+		guint8 out = (guint8)((in[x] * (256 - w) + h[x] * w + 128) >> 8);
+		d[x] = out;
+		h[x] = out;
+	}
+}
+
+/* Blends the rows of a row of blocks */
+static void blend_band(gint by, gpointer user_data)
+{
+	TemporalPass *pass = (TemporalPass *)user_data;
+	CvTemporal *temporal = pass->temporal;
+	int block_size = temporal->block_size;
+	int y0 = by*block_size;
+	int y1 = MIN(y0 + block_size, temporal->height);
+
+	for (int y = y0; y < y1; ++y)
+	{
+		const guint8 *s = pass->src + y*pass->src_stride;
+		guint8 *d = pass->dest + y*pass->dest_stride;
+		guint8 *h = temporal->history + (gsize)y*temporal->width;
+
+		for (int bx = 0; bx < temporal->blocksx; ++bx)
+		{
+			int x0 = bx*block_size;
+			int x1 = MIN(x0 + block_size, temporal->width);
+			/* Moving blocks blend the spatially filtered pixels when there are any */
+			const guint8 *in = pass->filtered && temporal->moving[by*temporal->blocksx + bx] ? d : s;
+
+			blend_run(s + x0, in + x0, h + x0, d + x0, x1 - x0, pass->threshold, pass->factor);
+		}
+	}
+}
+
+/*
+ *	Blends the frame last given to cv_temporal_motion with the history into
+ *	dest, which becomes the history. strength is the weight of the history
+ *	for pixels within threshold of it, at most 0.95. When filtered is TRUE
+ *	dest already holds the moving blocks filtered spatially, and those are
+ *	blended instead of the frame.
+ */
+void cv_temporal_blend(CvTemporal * temporal, const guint8 * src, gint src_stride,
+	guint8 * dest, gint dest_stride, float strength, int threshold, gboolean filtered)
+{
+	TemporalPass pass;
+	int weight = (int)(CLAMP(strength, 0.0f, 0.95f) * 256 + 0.5f);
+
+	pass.temporal = temporal;
+	pass.src = src;
+	pass.src_stride = src_stride;
+	pass.dest = dest;
+	pass.dest_stride = dest_stride;
+	pass.threshold = threshold;
+	pass.factor = (weight * 256 + threshold / 2) / threshold;
+	pass.filtered = filtered;
+	cv_parallel_for(temporal->blocksy, blend_band, &pass);
+	cv_stats_mark(CV_STAGE_OUTPUT);
+}
@@ -0,0 +1,43 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _CV_TEMPORAL_H_
+#define _CV_TEMPORAL_H_
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/* The previous output of a stream and which blocks of the current frame moved since */
+typedef struct _CvTemporal CvTemporal;
+
+CvTemporal *cv_temporal_new(void);
+void cv_temporal_free(CvTemporal * temporal);
+void cv_temporal_reset(CvTemporal * temporal);
+
+void cv_temporal_store(CvTemporal * temporal, const guint8 * plane, gint stride, int width, int height);
+const guint8 *cv_temporal_motion(CvTemporal * temporal, const guint8 * src, gint src_stride,
+	int width, int height, int threshold, int block_size);
+void cv_temporal_blend(CvTemporal * temporal, const guint8 * src, gint src_stride,
+	guint8 * dest, gint dest_stride, float strength, int threshold, gboolean filtered);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,112 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+/*
+ * Trick mode detection shared by the filter elements. While scrubbing or
+ * playing fast forward most frames are shown briefly or dropped by the
+ * sink, so the filters give those frames a cheaper preview, or none, as
+ * set with their trickmode property, and filter the rest in full.
+ *
+ * A segment is a trick mode when it plays faster than normal or backwards,
+ * upstream applied rates included, or when the seek that started it asked
+ * for a trick mode, which lets the demuxer and decoder leave frames out.
+ * Slow motion shows every frame longer than normal and is filtered in full.
+ * A key unit seek only makes its first frame a trick mode frame: it is the
+ * keyframe shown while scrubbing, and playing on from it is normal playback.
+ */
+
+#include <gst/gst.h>
+#include "cvtrickmode.h"
+
+/* Segment flags set by trick mode seeks */
+#define TRICKMODE_SEGMENT_FLAGS (GST_SEGMENT_FLAG_TRICKMODE | GST_SEGMENT_FLAG_TRICKMODE_KEY_UNITS \
+	| GST_SEGMENT_FLAG_TRICKMODE_NO_AUDIO)
+
+static const GEnumValue actions[] = {
+	{ CV_TRICKMODE_FULL, "Filter every frame in full", "full" },
+	{ CV_TRICKMODE_PREVIEW, "Filter trick mode frames at half size", "preview" },
+	{ CV_TRICKMODE_SKIP, "Pass trick mode frames on unfiltered", "skip" },
+	{ 0, NULL, NULL }
+};
+
+/*
+ *	Both filter plugins carry a copy of this file, whichever loads first
+ *	registers the type and the other one finds it by name.
+ */
+GType
+cv_trickmode_action_get_type(void)
+{
+	static gsize action_type = 0;
+
+	if (g_once_init_enter(&action_type))
+	{
+		GType type = g_type_from_name("CvTrickmodeAction");
+
+		if (type == 0)
+			type = g_enum_register_static("CvTrickmodeAction", actions);
+		g_once_init_leave(&action_type, type);
+	}
+	return action_type;
+}
+
+/* Name of the action as shown in the statistics and messages */
+const gchar *cv_trickmode_action_name(CvTrickmodeAction action)
+{
+	return actions[action].value_nick;
+}
+
+void cv_trickmode_init(CvTrickmode * trickmode)
+{
+	trickmode->segment = FALSE;
+	trickmode->seek_key_unit = FALSE;
+	trickmode->key_unit = FALSE;
+}
+
+/* Notes a seek on its way upstream through the element's source pad */
+void cv_trickmode_seek(CvTrickmode * trickmode, GstEvent * event)
+{
+	GstSeekFlags flags;
+
+	gst_event_parse_seek(event, NULL, NULL, &flags, NULL, NULL, NULL, NULL);
+	trickmode->seek_key_unit = (flags & GST_SEEK_FLAG_KEY_UNIT) != 0 && (flags & GST_SEEK_FLAG_FLUSH) != 0;
+}
+
+/* Takes over a new segment arriving on the element's sink pad */
+void cv_trickmode_segment(CvTrickmode * trickmode, GstEvent * event)
+{
+	const GstSegment *segment;
+	gdouble rate;
+
+	gst_event_parse_segment(event, &segment);
+	rate = segment->rate * segment->applied_rate;
+	trickmode->segment = rate > 1.0 || rate < 0.0 || (segment->flags & TRICKMODE_SEGMENT_FLAGS) != 0;
+
+	/* Only the segment of the flushing seek itself starts at the keyframe */
+	trickmode->key_unit = trickmode->seek_key_unit;
+	trickmode->seek_key_unit = FALSE;
+}
+
+/* Whether the next frame belongs to a trick mode, call once for every frame */
+gboolean cv_trickmode_next_frame(CvTrickmode * trickmode)
+{
+	gboolean key_unit = trickmode->key_unit;
+
+	trickmode->key_unit = FALSE;
+	return trickmode->segment || key_unit;
+}
@@ -0,0 +1,59 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+
+#ifndef _CV_TRICKMODE_H_
+#define _CV_TRICKMODE_H_
+
+#include <gst/gst.h>
+
+G_BEGIN_DECLS
+
+#define CV_TYPE_TRICKMODE_ACTION   (cv_trickmode_action_get_type())
+
+/* What the filters do with frames shown in a trick mode, the values of their trickmode property */
+typedef enum
+{
+	CV_TRICKMODE_FULL,
+	CV_TRICKMODE_PREVIEW,
+	CV_TRICKMODE_SKIP
+} CvTrickmodeAction;
+
+/* Follows the seeks and segments passing a filter, must be used under the element's object lock */
+typedef struct _CvTrickmode
+{
+	/* The segment is played fast, backwards or with frames left out */
+	gboolean segment;
+	/* A key unit seek went upstream, its segment starts with the keyframe it landed on */
+	gboolean seek_key_unit;
+	/* The next frame is the keyframe a key unit seek landed on */
+	gboolean key_unit;
+} CvTrickmode;
+
+GType cv_trickmode_action_get_type(void);
+const gchar *cv_trickmode_action_name(CvTrickmodeAction action);
+
+void cv_trickmode_init(CvTrickmode * trickmode);
+void cv_trickmode_seek(CvTrickmode * trickmode, GstEvent * event);
+void cv_trickmode_segment(CvTrickmode * trickmode, GstEvent * event);
+gboolean cv_trickmode_next_frame(CvTrickmode * trickmode);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,541 @@
+/*
+ * cvfilter
+ * Filters Y4M or raw I420 files with the engines of blurfilter and
+ * bilateralfilter, without GStreamer, for offline processing and for
+ * comparing the engines outside a pipeline.
+ *
+ * The input is memory mapped and every frame is filtered straight from the
+ * mapping. The output has the same layout as the input, the Y4M stream and
+ * frame headers are copied, so it is created at its final size and mapped
+ * as well, and each frame is filtered straight into its place in the file.
+ * Frames are spread over a thread pool, one frame per task, so the threads
+ * never share a frame. An output of - streams to stdout instead, through a
+ * window of frame buffers written in order as their frames finish.
+ *
+ * The luma plane goes through the same cv_blur_plane and cv_bilateral_scaled_plane
+ * as the elements and the chroma planes are set to the neutral value, so
+ * the output is identical to the elements' with the same properties.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cvblur.h"
+#include "cvbilateral.h"
+#include "cvstore.h"
+
+#ifdef G_OS_WIN32
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#define Y4M_MAGIC "YUV4MPEG2 "
+#define Y4M_FRAME "FRAME"
+/* Frame buffers per thread when streaming, so the threads keep busy while
+ * the oldest frame is written */
+#define STREAM_BUFFERS_PER_THREAD 2
+
+/* Command line options */
+static gchar *opt_filter = NULL;
+static gdouble opt_sigma = 2.0;
+static gint opt_filtering = -1;
+static gchar *opt_engine = NULL;
+static gdouble opt_tolerance = 5.0;
+static gdouble opt_sigmad = 2.0;
+static gdouble opt_sigmar = 25.0;
+static gboolean opt_no_bilateral = FALSE;
+static gdouble opt_flat_tolerance = 0.01;
+static gdouble opt_sharpen = 0.0;
+static gint opt_scale = 1;
+static gchar *opt_size = NULL;
+static gint opt_threads = 0;
+
+static GOptionEntry entries[] =
+{
+	{ "filter", 'f', 0, G_OPTION_ARG_STRING, &opt_filter, "Filter to apply, blur or bilateral (default blur)", "FILTER" },
+	{ "sigma", 0, 0, G_OPTION_ARG_DOUBLE, &opt_sigma, "Sigma of the blur (default 2)", "SIGMA" },
+	{ "filtering", 0, 0, G_OPTION_ARG_INT, &opt_filtering, "1 to sharpen, -1 to blur, 0 to copy (default -1)", "N" },
+	{ "engine", 0, 0, G_OPTION_ARG_STRING, &opt_engine, "Blur engine, direct, pyramid or auto (default direct)", "ENGINE" },
+	{ "tolerance", 0, 0, G_OPTION_ARG_DOUBLE, &opt_tolerance, "Largest difference the auto engine accepts (default 5)", "LEVELS" },
+	{ "sigmad", 0, 0, G_OPTION_ARG_DOUBLE, &opt_sigmad, "Domain sigma of the bilateral filter (default 2)", "SIGMA" },
+	{ "sigmar", 0, 0, G_OPTION_ARG_DOUBLE, &opt_sigmar, "Range sigma of the bilateral filter (default 25)", "SIGMA" },
+	{ "no-bilateral", 0, 0, G_OPTION_ARG_NONE, &opt_no_bilateral, "Skip the bilateral smoothing, e.g. to only sharpen", NULL },
+	{ "flat-tolerance", 0, 0, G_OPTION_ARG_DOUBLE, &opt_flat_tolerance, "Range weight tolerance of the flat block early-out, 0 disables it (default 0.01)", "TOLERANCE" },
+	{ "sharpen", 0, 0, G_OPTION_ARG_DOUBLE, &opt_sharpen, "Sigma of the unsharp mask after the bilateral filter (default 0, off)", "SIGMA" },
+	{ "scale", 0, 0, G_OPTION_ARG_INT, &opt_scale, "Run the bilateral filter at 1/N of the size, 1 to 4 (default 1)", "N" },
+	{ "size", 's', 0, G_OPTION_ARG_STRING, &opt_size, "Frame size of raw I420 input, Y4M carries its own", "WIDTHxHEIGHT" },
+	{ "threads", 'j', 0, G_OPTION_ARG_INT, &opt_threads, "Frames filtered at once (default the number of cores)", "N" },
+	{ NULL }
+};
+
+/* Layout of the input, shared by the output */
+typedef struct _Layout
+{
+	gint width;
+	gint height;
+	gsize frame_size;
+	/* Offsets of the frames' pixels, the stream and frame headers lie in between */
+	GArray *offsets;
+	gsize size;
+} Layout;
+
+typedef enum
+{
+	FILTER_BLUR,
+	FILTER_BILATERAL
+} FilterType;
+
+typedef struct _Job
+{
+	FilterType filter;
+	CvBlurEngine engine;
+	const Layout *layout;
+	const guint8 *input;
+
+	/* Mapped output, or NULL when streaming */
+	guint8 *output;
+
+	/* Streaming window, frame i is filtered into buffer i % n_buffers */
+	guint8 **buffers;
+	gboolean *ready;
+	guint n_buffers;
+	GMutex lock;
+	GCond cond;
+} Job;
+
+/* Messages of the engines go to stderr, stdout may carry the output */
+static void print_to_stderr(const gchar *string)
+{
+	fputs(string, stderr);
+}
+
+/* Prints the benchmark of each engine the planner times */
+static void print_plan(const gchar *name, gdouble ms, gdouble maxerror, gpointer user_data)
+{
+	g_print("Planner: %s engine %.2f ms, max error %.2f\n", name, ms, maxerror);
+}
+
+/* Parses WIDTHxHEIGHT */
+static gboolean parse_size(const gchar *size, gint *width, gint *height)
+{
+	return size != NULL && sscanf(size, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+/* Bytes of an I420 frame, the chroma planes rounded up like GStreamer does */
+static gsize frame_size(gint width, gint height)
+{
+	return (gsize)width * height + 2 * (gsize)((width + 1) / 2) * ((height + 1) / 2);
+}
+
+/* Finds the end of the line starting at pos, returns the offset after its newline or 0 */
+static gsize line_end(const guint8 *data, gsize size, gsize pos)
+{
+	const guint8 *nl = (const guint8 *)memchr(data + pos, '\n', size - pos);
+
+	return nl != NULL ? (gsize)(nl - data) + 1 : 0;
+}
+
+/* Colour spaces of 8 bit 4:2:0 Y4M, which differ only in where the chroma samples sit */
+static const gchar *y4m_colorspaces[] = { "420", "420jpeg", "420paldv", "420mpeg2" };
+
+static gboolean y4m_colorspace_supported(const gchar *colorspace)
+{
+	for (guint i = 0; i < G_N_ELEMENTS(y4m_colorspaces); i++)
+	{
+		if (strcmp(colorspace, y4m_colorspaces[i]) == 0)
+			return TRUE;
+	}
+	return FALSE;
+}
+
+/* Reads the stream header and the offset of every frame of a Y4M file */
+static gboolean parse_y4m(const guint8 *data, gsize size, Layout *layout)
+{
+	gsize pos = line_end(data, size, 0);
+	gchar *header;
+	gchar **params;
+	gboolean ok = TRUE;
+
+	if (pos == 0)
+	{
+		g_printerr("The Y4M stream header is not terminated.\n");
+		return FALSE;
+	}
+
+	header = g_strndup((const gchar *)data + strlen(Y4M_MAGIC), pos - 1 - strlen(Y4M_MAGIC));
+	params = g_strsplit(header, " ", -1);
+	for (gchar **p = params; *p != NULL; p++)
+	{
+		if ((*p)[0] == 'W')
+			layout->width = atoi(*p + 1);
+		else if ((*p)[0] == 'H')
+			layout->height = atoi(*p + 1);
+		else if ((*p)[0] == 'C' && !y4m_colorspace_supported(*p + 1))
+		{
+			g_printerr("Only 8 bit 4:2:0 Y4M (C420, C420jpeg, C420paldv, C420mpeg2) is supported, "
+				"the stream is C%s.\n", *p + 1);
+			ok = FALSE;
+		}
+	}
+	g_strfreev(params);
+	g_free(header);
+
+	if (!ok)
+		return FALSE;
+	if (layout->width <= 0 || layout->height <= 0)
+	{
+		g_printerr("The Y4M stream header has no frame size.\n");
+		return FALSE;
+	}
+
+	layout->frame_size = frame_size(layout->width, layout->height);
+	while (pos < size)
+	{
+		gsize start;
+
+		if (size - pos < strlen(Y4M_FRAME) || memcmp(data + pos, Y4M_FRAME, strlen(Y4M_FRAME)) != 0)
+		{
+			g_printerr("Expected a Y4M frame header at byte %" G_GSIZE_FORMAT ".\n", pos);
+			return FALSE;
+		}
+		start = line_end(data, size, pos);
+		if (start == 0 || size - start < layout->frame_size)
+		{
+			g_printerr("The Y4M stream ends in the middle of frame %u, it is ignored.\n", layout->offsets->len);
+			break;
+		}
+		g_array_append_val(layout->offsets, start);
+		pos = start + layout->frame_size;
+	}
+	return TRUE;
+}
+
+/* Sets up the layout of raw I420 frames of the given size, back to back */
+static gboolean parse_raw(gsize size, gint width, gint height, Layout *layout)
+{
+	layout->width = width;
+	layout->height = height;
+	layout->frame_size = frame_size(width, height);
+	if (size % layout->frame_size != 0)
+		g_printerr("The input does not hold whole %dx%d frames, the last one is ignored.\n", width, height);
+	for (gsize offset = 0; offset + layout->frame_size <= size; offset += layout->frame_size)
+		g_array_append_val(layout->offsets, offset);
+	return TRUE;
+}
+
+/* Creates the output file at its final size and maps it for writing */
+static guint8 *map_output(const gchar *path, gsize size)
+{
+	void *map = NULL;
+
+#ifdef G_OS_WIN32
+	HANDLE file = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+		FILE_ATTRIBUTE_NORMAL, NULL);
+
+	if (file != INVALID_HANDLE_VALUE)
+	{
+		HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE,
+			(DWORD)((guint64)size >> 32), (DWORD)size, NULL);
+		if (mapping != NULL)
+		{
+			map = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0, size);
+			/* The view keeps the file and its mapping alive until it is unmapped */
+			CloseHandle(mapping);
+		}
+		CloseHandle(file);
+	}
+#else
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+
+	if (fd >= 0)
+	{
+		if (ftruncate(fd, (off_t)size) == 0)
+		{
+			map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+			if (map == MAP_FAILED)
+				map = NULL;
+		}
+		/* The mapping keeps the file open until it is unmapped */
+		close(fd);
+	}
+#endif
+
+	if (map == NULL)
+		g_printerr("Could not map %" G_GSIZE_FORMAT " bytes of %s.\n", size, path);
+	return (guint8 *)map;
+}
+
+static void unmap_output(guint8 *map, gsize size)
+{
+#ifdef G_OS_WIN32
+	FlushViewOfFile(map, size);
+	UnmapViewOfFile(map);
+#else
+	munmap(map, size);
+#endif
+}
+
+/* Filters one I420 frame from src to dest, planes packed back to back */
+static void filter_frame(const Job *job, const guint8 *src, guint8 *dest)
+{
+	gint width = job->layout->width;
+	gint height = job->layout->height;
+	gint chroma_width = (width + 1) / 2;
+	gint chroma_height = (height + 1) / 2;
+
+	if (job->filter == FILTER_BLUR)
+		cv_blur_plane(src, width, dest, width, width, height, opt_sigma, opt_filtering, job->engine);
+	else
+		cv_bilateral_scaled_plane(src, width, dest, width, width, height, opt_sigmad, opt_sigmar,
+			!opt_no_bilateral, opt_flat_tolerance, opt_sharpen, opt_scale);
+
+	/* Each pixel in the UV-colour planes is set to 128 to ensure greyscale, as the elements do */
+	cv_fill_plane(dest + (gsize)width * height, chroma_width, chroma_width, chroma_height, 128);
+	cv_fill_plane(dest + (gsize)width * height + (gsize)chroma_width * chroma_height,
+		chroma_width, chroma_width, chroma_height, 128);
+	cv_store_fence();
+}
+
+/* Thread pool function, the frame number is offset by one as the pool does not take NULL */
+static void filter_task(gpointer data, gpointer user_data)
+{
+	Job *job = (Job *)user_data;
+	guint frame = GPOINTER_TO_UINT(data) - 1;
+	gsize offset = g_array_index(job->layout->offsets, gsize, frame);
+
+	if (job->output != NULL)
+	{
+		filter_frame(job, job->input + offset, job->output + offset);
+		return;
+	}
+
+	filter_frame(job, job->input + offset, job->buffers[frame % job->n_buffers]);
+	g_mutex_lock(&job->lock);
+	job->ready[frame % job->n_buffers] = TRUE;
+	g_cond_broadcast(&job->cond);
+	g_mutex_unlock(&job->lock);
+}
+
+/* Filters every frame into the mapped output, which already holds the headers */
+static gboolean run_mapped(Job *job, GThreadPool *pool)
+{
+	for (guint i = 0; i < job->layout->offsets->len; i++)
+		g_thread_pool_push(pool, GUINT_TO_POINTER(i + 1), NULL);
+	return TRUE;
+}
+
+/* Filters every frame to stdout, in order, keeping at most n_buffers frames in flight */
+static gboolean run_streamed(Job *job, GThreadPool *pool)
+{
+	const GArray *offsets = job->layout->offsets;
+	guint pushed = 0;
+	gsize written = 0;
+	gboolean ok = TRUE;
+
+#ifdef G_OS_WIN32
+	_setmode(_fileno(stdout), _O_BINARY);
+#endif
+
+	for (guint i = 0; i < offsets->len && ok; i++)
+	{
+		gsize offset = g_array_index(offsets, gsize, i);
+		guint slot = i % job->n_buffers;
+
+		g_mutex_lock(&job->lock);
+		while (pushed < offsets->len && pushed < i + job->n_buffers)
+		{
+			g_thread_pool_push(pool, GUINT_TO_POINTER(pushed + 1), NULL);
+			pushed++;
+		}
+		while (!job->ready[slot])
+			g_cond_wait(&job->cond, &job->lock);
+		job->ready[slot] = FALSE;
+		g_mutex_unlock(&job->lock);
+
+		/* The headers since the previous frame, then the frame */
+		ok = fwrite(job->input + written, 1, offset - written, stdout) == offset - written &&
+			fwrite(job->buffers[slot], 1, job->layout->frame_size, stdout) == job->layout->frame_size;
+		written = offset + job->layout->frame_size;
+	}
+
+	if (!ok)
+		g_printerr("Could not write to stdout.\n");
+	else
+		fflush(stdout);
+	return ok;
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	GMappedFile *input = NULL;
+	GThreadPool *pool;
+	Layout layout = { 0 };
+	Job job = { FILTER_BLUR };
+	gboolean streamed;
+	gboolean ok;
+	gint64 start;
+	double seconds;
+	guint n_frames;
+
+	context = g_option_context_new("INPUT OUTPUT - filter a Y4M or raw I420 file, OUTPUT - writes to stdout");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		g_printerr("Option parsing failed: %s\n", error->message);
+		g_clear_error(&error);
+		g_option_context_free(context);
+		return -1;
+	}
+	g_option_context_free(context);
+	g_set_print_handler(print_to_stderr);
+
+	if (argc != 3)
+	{
+		g_printerr("Usage: %s [OPTION...] INPUT OUTPUT\n", argv[0]);
+		return -1;
+	}
+
+	if (opt_filter == NULL || g_strcmp0(opt_filter, "blur") == 0)
+		job.filter = FILTER_BLUR;
+	else if (g_strcmp0(opt_filter, "bilateral") == 0)
+		job.filter = FILTER_BILATERAL;
+	else
+	{
+		g_printerr("Unknown filter %s, expected blur or bilateral.\n", opt_filter);
+		return -1;
+	}
+
+	if (opt_engine == NULL || g_strcmp0(opt_engine, "direct") == 0)
+		job.engine = CV_BLUR_ENGINE_DIRECT;
+	else if (g_strcmp0(opt_engine, "pyramid") == 0)
+		job.engine = CV_BLUR_ENGINE_PYRAMID;
+	else if (g_strcmp0(opt_engine, "auto") == 0)
+		job.engine = CV_BLUR_ENGINE_AUTO;
+	else
+	{
+		g_printerr("Unknown engine %s, expected direct, pyramid or auto.\n", opt_engine);
+		return -1;
+	}
+	opt_filtering = CLAMP(opt_filtering, -1, 1);
+	opt_scale = CLAMP(opt_scale, 1, 4);
+	if (opt_threads <= 0)
+		opt_threads = g_get_num_processors();
+
+	input = g_mapped_file_new(argv[1], FALSE, &error);
+	if (input == NULL)
+	{
+		g_printerr("Could not map %s: %s\n", argv[1], error->message);
+		g_clear_error(&error);
+		return -1;
+	}
+	job.input = (const guint8 *)g_mapped_file_get_contents(input);
+	layout.size = g_mapped_file_get_length(input);
+	layout.offsets = g_array_new(FALSE, FALSE, sizeof(gsize));
+	job.layout = &layout;
+
+	if (layout.size >= strlen(Y4M_MAGIC) && memcmp(job.input, Y4M_MAGIC, strlen(Y4M_MAGIC)) == 0)
+		ok = parse_y4m(job.input, layout.size, &layout);
+	else if (parse_size(opt_size, &layout.width, &layout.height))
+		ok = parse_raw(layout.size, layout.width, layout.height, &layout);
+	else
+	{
+		g_printerr("%s is not Y4M, give the frame size of raw I420 with --size.\n", argv[1]);
+		ok = FALSE;
+	}
+	n_frames = layout.offsets->len;
+	if (ok && n_frames == 0)
+	{
+		g_printerr("%s holds no frames.\n", argv[1]);
+		ok = FALSE;
+	}
+	if (!ok)
+	{
+		g_array_free(layout.offsets, TRUE);
+		g_mapped_file_unref(input);
+		return -1;
+	}
+
+	/* The planner runs once up front, the threads share its choice */
+	if (job.filter == FILTER_BLUR && job.engine == CV_BLUR_ENGINE_AUTO && opt_filtering != 0)
+	{
+		job.engine = cv_blur_plan(opt_sigma, opt_tolerance, layout.width, layout.height, print_plan, NULL);
+		g_print("Sigma %.1f uses the %s engine\n", opt_sigma, cv_blur_engine_name(job.engine, opt_sigma));
+	}
+
+	streamed = g_strcmp0(argv[2], "-") == 0;
+	if (streamed)
+	{
+		job.n_buffers = opt_threads * STREAM_BUFFERS_PER_THREAD;
+		job.buffers = g_new(guint8 *, job.n_buffers);
+		job.ready = g_new0(gboolean, job.n_buffers);
+		for (guint i = 0; i < job.n_buffers; i++)
+			job.buffers[i] = (guint8 *)g_malloc(layout.frame_size);
+	}
+	else
+	{
+		job.output = map_output(argv[2], layout.size);
+		if (job.output == NULL)
+		{
+			g_array_free(layout.offsets, TRUE);
+			g_mapped_file_unref(input);
+			return -1;
+		}
+		/* Copies the stream header and the frame headers, the frames are filtered in place */
+		gsize written = 0;
+		for (guint i = 0; i < n_frames; i++)
+		{
+			gsize offset = g_array_index(layout.offsets, gsize, i);
+			memcpy(job.output + written, job.input + written, offset - written);
+			written = offset + layout.frame_size;
+		}
+		memcpy(job.output + written, job.input + written, layout.size - written);
+	}
+	g_mutex_init(&job.lock);
+	g_cond_init(&job.cond);
+
+	g_printerr("Filtering %u frames of %dx%d with %s on %d threads\n", n_frames, layout.width,
+		layout.height, job.filter == FILTER_BLUR ?
+		(opt_filtering == 0 ? "copy" : cv_blur_engine_name(job.engine, opt_sigma)) :
+		(!opt_no_bilateral && opt_scale > 1 ? "bilateral-scaled" :
+		cv_bilateral_engine_name(!opt_no_bilateral, opt_sharpen, opt_flat_tolerance)), opt_threads);
+
+	start = g_get_monotonic_time();
+	pool = g_thread_pool_new(filter_task, &job, opt_threads, TRUE, NULL);
+	ok = streamed ? run_streamed(&job, pool) : run_mapped(&job, pool);
+	/* Waits for the frames still queued */
+	g_thread_pool_free(pool, FALSE, TRUE);
+	seconds = (g_get_monotonic_time() - start) / 1e6;
+
+	if (ok)
+		g_printerr("%u frames in %.2f s, %.1f fps, %.1f MB/s\n", n_frames, seconds,
+			n_frames / seconds, n_frames * layout.frame_size / seconds / 1e6);
+
+	if (streamed)
+	{
+		for (guint i = 0; i < job.n_buffers; i++)
+			g_free(job.buffers[i]);
+		g_free(job.buffers);
+		g_free(job.ready);
+	}
+	else
+	{
+		unmap_output(job.output, layout.size);
+	}
+	g_mutex_clear(&job.lock);
+	g_cond_clear(&job.cond);
+	g_array_free(layout.offsets, TRUE);
+	g_mapped_file_unref(input);
+	g_free(opt_filter);
+	g_free(opt_engine);
+	g_free(opt_size);
+
+	return ok ? 0 : -1;
+}
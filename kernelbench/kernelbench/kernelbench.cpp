@@ -0,0 +1,857 @@
+/*
+ * Kernel benchmark
+ * Times the convolution stages of blurfilter and bilateralfilter directly on
+ * synthetic frames, without a pipeline or a display, and checks every result
+ * against a double precision reference so a fast path is gated on both speed
+ * and accuracy.
+ *
+ * Kernel cases run a single engine on the zero-padded float image, frame
+ * cases run the whole per-frame convolution of the element on mapped
+ * GstVideoFrames. Within each group of filter, size and sigma the speedup is
+ * given against the scalar engine, blurfilter's direct xyconvolution and the
+ * bilateral xyconvolution without the flat block early-out.
+ *
+ * With --perf every case is run once more with the hardware counters of
+ * the thread read at each stage mark of the engine, giving IPC, bytes per
+ * cycle, cache misses and stalls for the whole run and for every pass.
+ * Bytes per cycle use the same nominal traffic as GB/s, the frame read and
+ * written once, for the passes as well, so they add up like the cycles do.
+ */
+
+#define _USE_MATH_DEFINES
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include "gstblurfilter.h"
+#include "gstbilateralfilter.h"
+#include "cvblur.h"
+#include "cvbilateral.h"
+#include "cvstats.h"
+#include "cvperf.h"
+
+/* Bilateral domain kernel, fixed by bilateralfilter to five taps */
+#define BILATERAL_RADIUS 2
+#define BILATERAL_SIGMAD 2.0
+/* PSNR reported for output identical to the reference */
+#define PSNR_MAX 200.0
+/* Index of the whole run in the counter samples, after the stages */
+#define PERF_TOTAL CV_N_STAGES
+
+typedef struct
+{
+	const gchar *name;
+	gint width;
+	gint height;
+} BenchSize;
+
+static const BenchSize bench_sizes[] =
+{
+	{ "480p", 854, 480 },
+	{ "720p", 1280, 720 },
+	{ "1080p", 1920, 1080 },
+	{ "4k", 3840, 2160 },
+	{ "8k", 7680, 4320 }
+};
+
+typedef enum
+{
+	FILTER_BLUR,
+	FILTER_BILATERAL
+} BenchFilter;
+
+typedef enum
+{
+	STAGE_KERNEL,
+	STAGE_FRAME
+} BenchStage;
+
+typedef struct
+{
+	const gchar *name;
+	BenchFilter filter;
+	BenchStage stage;
+	/* Blur engine, or bilateral flat tolerance */
+	double variant;
+	/* Bilateral sharpen sigma, 0 for none */
+	double sharpen;
+	/* Scalar engine the group's speedups are measured against */
+	gboolean reference;
+	/* Fast path, held to --min-speedup */
+	gboolean fast_path;
+	/* Accuracy limits against the double precision reference */
+	double max_error;
+	double min_psnr;
+} BenchCase;
+
+/*
+ *	The error limits follow what the engines guarantee: the float engines
+ *	agree with the double reference to rounding, frame output is truncated to
+ *	whole grey levels, a level the sharpening amplifies when the bilateral
+ *	result is truncated, and the pyramid engine is an approximation documented
+ *	to stay within about 10 grey levels on hard edges.
+ */
+static const BenchCase bench_cases[] =
+{
+	{ "blur-direct", FILTER_BLUR, STAGE_KERNEL, GST_BLUR_FILTER_ENGINE_DIRECT, 0, TRUE, FALSE, 0.01, 80 },
+	{ "blur-pyramid", FILTER_BLUR, STAGE_KERNEL, GST_BLUR_FILTER_ENGINE_PYRAMID, 0, FALSE, TRUE, 12.0, 35 },
+	{ "blur-frame-direct", FILTER_BLUR, STAGE_FRAME, GST_BLUR_FILTER_ENGINE_DIRECT, 0, FALSE, FALSE, 1.01, 45 },
+	{ "blur-frame-pyramid", FILTER_BLUR, STAGE_FRAME, GST_BLUR_FILTER_ENGINE_PYRAMID, 0, FALSE, FALSE, 12.0, 35 },
+	{ "bilateral-full", FILTER_BILATERAL, STAGE_KERNEL, 0, 0, TRUE, FALSE, 0.01, 80 },
+	{ "bilateral-early-out", FILTER_BILATERAL, STAGE_KERNEL, 0.01, 0, FALSE, TRUE, 0.5, 60 },
+	{ "bilateral-frame", FILTER_BILATERAL, STAGE_FRAME, 0.01, 0, FALSE, FALSE, 1.5, 45 },
+	{ "bilateral-frame-sharpen", FILTER_BILATERAL, STAGE_FRAME, 0.01, 1.0, FALSE, FALSE, 4.0, 40 }
+};
+
+typedef struct
+{
+	const BenchCase *bcase;
+	const BenchSize *size;
+	/* Sigma for blurfilter, sigmar for bilateralfilter */
+	double sigma;
+	double ns_per_pixel;
+	double gb_per_second;
+	double speedup;
+	double max_error;
+	double psnr;
+	gboolean passed;
+	/* Nominal bytes read and written by a run */
+	double bytes;
+	/* Counters per stage and for the whole run, when --perf could open them */
+	gboolean has_perf;
+	CvPerfSample perf[CV_N_STAGES + 1];
+} BenchResult;
+
+/* Counter derived figures, negative when a counter is missing */
+typedef struct
+{
+	double ipc;
+	double bytes_per_cycle;
+	double l1d_misses_per_pixel;
+	double llc_misses_per_pixel;
+	double frontend_stalls;
+	double backend_stalls;
+} PerfMetrics;
+
+/* A run being counted, samples are the perf array of its result */
+typedef struct
+{
+	CvPerfSample start;
+	CvPerfSample last;
+	CvPerfSample *samples;
+} PerfRun;
+
+/* Command line options */
+static gchar *opt_sizes = NULL;
+static gchar *opt_sigmas = NULL;
+static gchar *opt_sigmars = NULL;
+static gchar *opt_cases = NULL;
+static gint opt_repeat = 3;
+static gdouble opt_min_speedup = 0;
+static gchar *opt_csv = NULL;
+static gchar *opt_json = NULL;
+static gboolean opt_perf = FALSE;
+
+/* Hardware counters of the main thread, NULL unless --perf opened them */
+static CvPerf *perf = NULL;
+
+static GOptionEntry entries[] =
+{
+	{ "sizes", 0, 0, G_OPTION_ARG_STRING, &opt_sizes, "Comma separated frame sizes out of 480p, 720p, 1080p, 4k and 8k (default all)", "LIST" },
+	{ "sigmas", 0, 0, G_OPTION_ARG_STRING, &opt_sigmas, "Comma separated blurfilter sigmas (default 1,3,8,16)", "LIST" },
+	{ "sigmars", 0, 0, G_OPTION_ARG_STRING, &opt_sigmars, "Comma separated bilateralfilter range sigmas (default 10,25,50)", "LIST" },
+	{ "cases", 0, 0, G_OPTION_ARG_STRING, &opt_cases, "Comma separated cases to run, by name prefix (default all)", "LIST" },
+	{ "repeat", 'r', 0, G_OPTION_ARG_INT, &opt_repeat, "Runs per case, the fastest counts (default 3)", "N" },
+	{ "min-speedup", 0, 0, G_OPTION_ARG_DOUBLE, &opt_min_speedup, "Fail fast paths slower than this over the scalar engine (default 0, off)", "X" },
+	{ "csv", 0, 0, G_OPTION_ARG_FILENAME, &opt_csv, "Write the results as CSV to FILE", "FILE" },
+	{ "json", 0, 0, G_OPTION_ARG_FILENAME, &opt_json, "Write the results as JSON to FILE", "FILE" },
+	{ "perf", 0, 0, G_OPTION_ARG_NONE, &opt_perf, "Read hardware performance counters per case and pass (Linux)", NULL },
+	{ NULL }
+};
+
+/* Parses a comma separated list of numbers, returns the number of values */
+static guint parse_values(const gchar *list, double *values, guint max_values)
+{
+	gchar **items = g_strsplit(list, ",", -1);
+	guint n = 0;
+
+	for (gchar **item = items; *item != NULL && n < max_values; item++)
+	{
+		if (**item != '\0')
+			values[n++] = g_ascii_strtod(*item, NULL);
+	}
+	g_strfreev(items);
+	return n;
+}
+
+/* Whether name is in the comma separated list, by prefix. A NULL list holds everything */
+static gboolean in_list(const gchar *list, const gchar *name)
+{
+	gchar **items;
+	gboolean found = FALSE;
+
+	if (list == NULL)
+		return TRUE;
+
+	items = g_strsplit(list, ",", -1);
+	for (gchar **item = items; *item != NULL && !found; item++)
+		found = **item != '\0' && g_str_has_prefix(name, *item);
+	g_strfreev(items);
+	return found;
+}
+
+/*
+ *	Fills the luma plane with smooth gradients, noise and flat squares of
+ *	white with hard edges, and the chroma planes with grey. The squares are
+ *	large enough for whole blocks of the bilateral early-out to be flat.
+ */
+static void fill_synthetic(GstVideoFrame * frame)
+{
+	guint8 *y = GST_VIDEO_FRAME_COMP_DATA(frame, 0);
+	gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(frame, 0);
+	gint width = GST_VIDEO_FRAME_COMP_WIDTH(frame, 0);
+	gint height = GST_VIDEO_FRAME_COMP_HEIGHT(frame, 0);
+	guint32 noise = 1;
+
+	for (gint row = 0; row < height; ++row)
+	{
+		for (gint x = 0; x < width; ++x)
+		{
+			noise = noise * 1664525 + 1013904223;
+			double pix = 128 + 60 * sin(x * 0.02) * cos(row * 0.03) + (noise >> 29);
+			if ((x / 128 + row / 128) % 4 == 0)
+				pix = 255;
+			y[row*stride + x] = (guint8)pix;
+		}
+	}
+
+	for (gint c = 1; c < 3; ++c)
+	{
+		for (gint row = 0; row < GST_VIDEO_FRAME_COMP_HEIGHT(frame, c); ++row)
+			memset(GST_VIDEO_FRAME_COMP_DATA(frame, c) + row*GST_VIDEO_FRAME_PLANE_STRIDE(frame, c),
+				128, GST_VIDEO_FRAME_COMP_WIDTH(frame, c));
+	}
+}
+
+/* Copies the plane into a float image zero-padded by radius, as the elements do */
+static float *pad_plane(const guint8 * plane, gint stride, gint width, gint height, gint radius)
+{
+	gint pw = width + 2 * radius;
+	gint ph = height + 2 * radius;
+	float *padded = new float[pw*ph]();
+
+	for (gint y = 0; y < height; ++y)
+		for (gint x = 0; x < width; ++x)
+			padded[(y + radius)*pw + x + radius] = plane[y*stride + x];
+	return padded;
+}
+
+/*
+ *	Separable filter of the zero-padded plane in double precision, first along
+ *	x on every padded row and then along y, like the elements. The taps are
+ *	weighted by a gaussian of sigma and, when sigmar is above 0, by the range
+ *	gaussian of the intensity difference to the centre pixel as well. Returns
+ *	the unpadded width x height result.
+ */
+static double *reference_filter(const guint8 * plane, gint stride, gint width, gint height,
+	double sigma, gint radius, double sigmar)
+{
+	gint pw = width + 2 * radius;
+	gint ph = height + 2 * radius;
+	double *padded = new double[pw*ph]();
+	double *temp = new double[pw*ph]();
+	double *result = new double[width*height];
+	double *kernel = new double[2 * radius + 1];
+
+	for (gint k = -radius; k <= radius; ++k)
+		kernel[k + radius] = exp(-(double)(k*k) / (2 * sigma*sigma));
+
+	for (gint y = 0; y < height; ++y)
+		for (gint x = 0; x < width; ++x)
+			padded[(y + radius)*pw + x + radius] = plane[y*stride + x];
+
+	for (gint y = 0; y < ph; ++y)
+	{
+		for (gint x = radius; x < pw - radius; ++x)
+		{
+			double centre = padded[y*pw + x];
+			double sum = 0, weight = 0;
+			for (gint k = -radius; k <= radius; ++k)
+			{
+				double pix = padded[y*pw + x + k];
+				double w = kernel[k + radius];
+				if (sigmar > 0)
+					w *= exp(-(centre - pix)*(centre - pix) / (2 * sigmar*sigmar));
+				sum += w * pix;
+				weight += w;
+			}
+			temp[y*pw + x] = sum / weight;
+		}
+	}
+
+	for (gint y = 0; y < height; ++y)
+	{
+		for (gint x = 0; x < width; ++x)
+		{
+			gint py = y + radius;
+			gint px = x + radius;
+			double centre = temp[py*pw + px];
+			double sum = 0, weight = 0;
+			for (gint k = -radius; k <= radius; ++k)
+			{
+				double pix = temp[(py + k)*pw + px];
+				double w = kernel[k + radius];
+				if (sigmar > 0)
+					w *= exp(-(centre - pix)*(centre - pix) / (2 * sigmar*sigmar));
+				sum += w * pix;
+				weight += w;
+			}
+			result[y*width + x] = sum / weight;
+		}
+	}
+
+	delete[] kernel;
+	delete[] padded;
+	delete[] temp;
+	return result;
+}
+
+/*
+ *	Unsharp mask of the reference, truncated to whole grey levels first like
+ *	the handoff between bilateralfilter and blurfilter, following the fused
+ *	sharpening of bilateralfilter.
+ */
+static double *reference_sharpen(const double * image, gint width, gint height, double sharpen)
+{
+	guint8 *levels = new guint8[width*height];
+	double *blurred;
+	double *result = new double[width*height];
+
+	for (gint i = 0; i < width*height; ++i)
+		levels[i] = (guint8)CLAMP((int)image[i], 0, 255);
+
+	blurred = reference_filter(levels, width, width, height, sharpen, (gint)(2 * sharpen), 0);
+	for (gint i = 0; i < width*height; ++i)
+		result[i] = 2.0 * levels[i] - blurred[i];
+
+	delete[] levels;
+	delete[] blurred;
+	return result;
+}
+
+/*
+ *	Compares a result to the reference, clamped to the range of the output
+ *	when it is 8-bit. Accumulates the largest absolute error and the PSNR
+ *	for a peak of 255 grey levels.
+ */
+static void compare(const double * reference, gint width, gint height, const float * fimage,
+	const guint8 * bimage, gint stride, gboolean clamp, double * max_error, double * psnr)
+{
+	double sq = 0;
+	double worst = 0;
+
+	for (gint y = 0; y < height; ++y)
+	{
+		for (gint x = 0; x < width; ++x)
+		{
+			double ref = reference[y*width + x];
+			double val = fimage != NULL ? fimage[y*stride + x] : bimage[y*stride + x];
+			if (clamp)
+				ref = CLAMP(ref, 0.0, 255.0);
+			double err = fabs(val - ref);
+			worst = MAX(worst, err);
+			sq += err * err;
+		}
+	}
+
+	*max_error = worst;
+	*psnr = sq > 0 ? MIN(10 * log10(255.0 * 255.0 * width * height / sq), PSNR_MAX) : PSNR_MAX;
+}
+
+/* Times one run of the case, returns nanoseconds */
+static double run_kernel(const BenchCase * bcase, float * preimage, float * postimage,
+	double sigma, gint pw, gint ph)
+{
+	GstClockTime start = gst_util_get_timestamp();
+
+	if (bcase->filter == FILTER_BLUR)
+	{
+		cv_blur_run_engine((CvBlurEngine)(gint)bcase->variant, preimage, postimage,
+			sigma, pw, ph);
+	}
+	else
+	{
+		float kernel[2 * BILATERAL_RADIUS + 1];
+		for (gint k = -BILATERAL_RADIUS; k <= BILATERAL_RADIUS; ++k)
+			kernel[k + BILATERAL_RADIUS] = exp(-(k*k) / (2 * BILATERAL_SIGMAD*BILATERAL_SIGMAD));
+		cv_bilateral_xyconvolution(preimage, postimage, kernel, sigma,
+			cv_bilateral_flatspan(sigma, bcase->variant), 2 * BILATERAL_RADIUS + 1, pw, ph);
+	}
+
+	return (double)(gst_util_get_timestamp() - start);
+}
+
+/* Adds the counters since the previous mark to the stage that just ended */
+static void perf_stage_hook(CvStage stage, gpointer user_data)
+{
+	PerfRun *run = (PerfRun *)user_data;
+	CvPerfSample now;
+
+	cv_perf_read(perf, &now);
+	cv_perf_sample_add_delta(&run->samples[stage], &run->last, &now);
+	run->last = now;
+}
+
+/* Starts counting a run into samples, per stage through the marks made on stats */
+static void perf_begin(PerfRun * run, CvStats * stats, CvPerfSample * samples)
+{
+	memset(samples, 0, sizeof(CvPerfSample) * (CV_N_STAGES + 1));
+	run->samples = samples;
+	cv_stats_set_stage_hook(stats, perf_stage_hook, run);
+	cv_stats_frame_begin(stats);
+	cv_perf_read(perf, &run->start);
+	run->last = run->start;
+}
+
+static void perf_end(PerfRun * run, CvStats * stats)
+{
+	CvPerfSample end;
+
+	cv_perf_read(perf, &end);
+	cv_stats_frame_end(stats, 0);
+	cv_stats_set_stage_hook(stats, NULL, NULL);
+	cv_perf_sample_add_delta(&run->samples[PERF_TOTAL], &run->start, &end);
+}
+
+/* Swallows the greeting the elements print when they are created */
+static void silent_print(const gchar * string)
+{
+}
+
+/* Creates the element of the case, configured as the case runs it */
+static GstVideoFilter *make_element(const BenchCase * bcase, double sigma)
+{
+	GPrintFunc print = g_set_print_handler(silent_print);
+	GObject *element;
+
+	if (bcase->filter == FILTER_BLUR)
+	{
+		element = G_OBJECT(g_object_new(GST_TYPE_BLUR_FILTER, NULL));
+		g_object_set(element, "sigma", sigma, "filtering", -1,
+			"engine", (GstBlurFilterEngine)(gint)bcase->variant, NULL);
+	}
+	else
+	{
+		element = G_OBJECT(g_object_new(GST_TYPE_BILATERAL_FILTER, NULL));
+		g_object_set(element, "sigmad", BILATERAL_SIGMAD, "sigmar", sigma, "filtering", TRUE,
+			"flat-tolerance", bcase->variant, "sharpen", bcase->sharpen, NULL);
+	}
+	/* The counters and stage marks only follow this thread, so the frame is not split across the workers */
+	g_object_set(element, "parallel", FALSE, NULL);
+	gst_object_ref_sink(element);
+	g_set_print_handler(print);
+	return GST_VIDEO_FILTER(element);
+}
+
+/* Runs one case on the synthetic frame and fills in its speed and accuracy */
+static void run_case(const BenchCase * bcase, const BenchSize * size, double sigma,
+	GstVideoFrame * src, GstVideoFrame * dest, const double * reference, BenchResult * result)
+{
+	gint width = size->width;
+	gint height = size->height;
+	gint radius = bcase->filter == FILTER_BLUR ? (gint)(2 * (float)sigma) : BILATERAL_RADIUS;
+	double best = G_MAXDOUBLE;
+	double bytes;
+
+	if (bcase->stage == STAGE_KERNEL)
+	{
+		gint pw = width + 2 * radius;
+		gint ph = height + 2 * radius;
+		float *preimage = pad_plane(GST_VIDEO_FRAME_COMP_DATA(src, 0),
+			GST_VIDEO_FRAME_PLANE_STRIDE(src, 0), width, height, radius);
+		float *postimage = new float[pw*ph]();
+
+		for (gint i = 0; i < opt_repeat; ++i)
+			best = MIN(best, run_kernel(bcase, preimage, postimage, sigma, pw, ph));
+
+		/* Outside a frame the engine's marks cost nothing, so they are only made for the counted run */
+		if (perf != NULL)
+		{
+			CvStats *stats = cv_stats_new();
+			PerfRun run;
+
+			perf_begin(&run, stats, result->perf);
+			run_kernel(bcase, preimage, postimage, sigma, pw, ph);
+			perf_end(&run, stats);
+			cv_stats_free(stats);
+		}
+
+		/* The float image is read and the float result written once */
+		bytes = 2.0 * sizeof(float) * pw * ph;
+		compare(reference, width, height, postimage + radius*pw + radius, NULL, pw, FALSE,
+			&result->max_error, &result->psnr);
+
+		delete[] preimage;
+		delete[] postimage;
+	}
+	else
+	{
+		GstVideoFilter *element = make_element(bcase, sigma);
+
+		for (gint i = 0; i < opt_repeat; ++i)
+		{
+			GstClockTime start = gst_util_get_timestamp();
+			if (bcase->filter == FILTER_BLUR)
+				gst_blur_filter_convolution(GST_BLUR_FILTER(element), dest, src);
+			else
+				gst_bilateral_filter_convolution(GST_BILATERAL_FILTER(element), dest, src);
+			best = MIN(best, (double)(gst_util_get_timestamp() - start));
+		}
+
+		if (perf != NULL)
+		{
+			CvStats *stats = bcase->filter == FILTER_BLUR ?
+				GST_BLUR_FILTER(element)->stats : GST_BILATERAL_FILTER(element)->stats;
+			PerfRun run;
+
+			perf_begin(&run, stats, result->perf);
+			if (bcase->filter == FILTER_BLUR)
+				gst_blur_filter_convolution(GST_BLUR_FILTER(element), dest, src);
+			else
+				gst_bilateral_filter_convolution(GST_BILATERAL_FILTER(element), dest, src);
+			perf_end(&run, stats);
+		}
+
+		/* The I420 frame is read and the output frame written once */
+		bytes = 2.0 * GST_VIDEO_INFO_SIZE(&src->info);
+		compare(reference, width, height, NULL, GST_VIDEO_FRAME_COMP_DATA(dest, 0),
+			GST_VIDEO_FRAME_PLANE_STRIDE(dest, 0), TRUE, &result->max_error, &result->psnr);
+
+		gst_object_unref(element);
+	}
+
+	result->bcase = bcase;
+	result->size = size;
+	result->sigma = sigma;
+	result->ns_per_pixel = best / ((double)width * height);
+	result->gb_per_second = bytes / best;
+	result->bytes = bytes;
+	result->has_perf = perf != NULL;
+	result->speedup = 1.0;
+	result->passed = result->max_error <= bcase->max_error && result->psnr >= bcase->min_psnr;
+}
+
+/* Sets the speedups of a group against its scalar engine and applies the speed gate */
+static void finish_group(BenchResult * results, guint n)
+{
+	double reference_ns = 0;
+
+	for (guint i = 0; i < n; ++i)
+		if (results[i].bcase->reference)
+			reference_ns = results[i].ns_per_pixel;
+
+	for (guint i = 0; i < n && reference_ns > 0; ++i)
+	{
+		results[i].speedup = reference_ns / results[i].ns_per_pixel;
+		if (results[i].bcase->fast_path && results[i].speedup < opt_min_speedup)
+			results[i].passed = FALSE;
+	}
+}
+
+static PerfMetrics perf_metrics(const CvPerfSample * sample, double bytes, double pixels)
+{
+	PerfMetrics m;
+	gboolean cycles = (sample->valid & (1u << CV_PERF_CYCLES)) && sample->value[CV_PERF_CYCLES] > 0;
+	double c = (double)sample->value[CV_PERF_CYCLES];
+
+	m.ipc = cycles && (sample->valid & (1u << CV_PERF_INSTRUCTIONS)) ?
+		sample->value[CV_PERF_INSTRUCTIONS] / c : -1;
+	m.bytes_per_cycle = cycles ? bytes / c : -1;
+	m.l1d_misses_per_pixel = (sample->valid & (1u << CV_PERF_L1D_MISSES)) ?
+		sample->value[CV_PERF_L1D_MISSES] / pixels : -1;
+	m.llc_misses_per_pixel = (sample->valid & (1u << CV_PERF_LLC_MISSES)) ?
+		sample->value[CV_PERF_LLC_MISSES] / pixels : -1;
+	m.frontend_stalls = cycles && (sample->valid & (1u << CV_PERF_STALLED_FRONTEND)) ?
+		sample->value[CV_PERF_STALLED_FRONTEND] / c : -1;
+	m.backend_stalls = cycles && (sample->valid & (1u << CV_PERF_STALLED_BACKEND)) ?
+		sample->value[CV_PERF_STALLED_BACKEND] / c : -1;
+	return m;
+}
+
+/* Formats a counter figure into buffer, "-" when it is missing */
+static const gchar *format_metric(gchar * buffer, gsize size, const gchar * format, double value)
+{
+	if (value < 0)
+		return "-";
+	g_snprintf(buffer, size, format, value);
+	return buffer;
+}
+
+static void print_perf(const gchar * label, const CvPerfSample * sample, double bytes, double pixels)
+{
+	PerfMetrics m = perf_metrics(sample, bytes, pixels);
+	gchar ipc[16], bpc[16], l1d[16], llc[16], fe[16], be[16];
+
+	g_print("    %-12s IPC %6s  B/cycle %7s  L1D miss/px %8s  LLC miss/px %8s  stalls fe %6s be %6s\n",
+		label, format_metric(ipc, sizeof(ipc), "%.2f", m.ipc),
+		format_metric(bpc, sizeof(bpc), "%.3f", m.bytes_per_cycle),
+		format_metric(l1d, sizeof(l1d), "%.4f", m.l1d_misses_per_pixel),
+		format_metric(llc, sizeof(llc), "%.4f", m.llc_misses_per_pixel),
+		format_metric(fe, sizeof(fe), "%.1f%%", 100 * m.frontend_stalls),
+		format_metric(be, sizeof(be), "%.1f%%", 100 * m.backend_stalls));
+}
+
+static void print_result(const BenchResult * r)
+{
+	double pixels = (double)r->size->width * r->size->height;
+
+	g_print("%-24s %-6s %6.1f %10.2f %8.2f %8.2fx %10.4f %8.2f  %s\n",
+		r->bcase->name, r->size->name, r->sigma, r->ns_per_pixel, r->gb_per_second,
+		r->speedup, r->max_error, r->psnr, r->passed ? "ok" : "FAIL");
+
+	if (!r->has_perf)
+		return;
+	print_perf("run", &r->perf[PERF_TOTAL], r->bytes, pixels);
+	for (gint s = 0; s < CV_N_STAGES; ++s)
+		if (r->perf[s].valid != 0)
+			print_perf(cv_stats_stage_name((CvStage)s), &r->perf[s], r->bytes, pixels);
+}
+
+/* Appends the counter figures of a sample, missing ones as empty CSV fields or JSON nulls */
+static void append_metrics(GString * out, const CvPerfSample * sample, double bytes, double pixels,
+	gboolean json)
+{
+	static const gchar *names[] = {
+		"ipc", "bytes_per_cycle", "l1d_misses_per_pixel", "llc_misses_per_pixel",
+		"frontend_stalls", "backend_stalls"
+	};
+	PerfMetrics m = perf_metrics(sample, bytes, pixels);
+	const double values[] = {
+		m.ipc, m.bytes_per_cycle, m.l1d_misses_per_pixel, m.llc_misses_per_pixel,
+		m.frontend_stalls, m.backend_stalls
+	};
+
+	for (guint i = 0; i < G_N_ELEMENTS(values); ++i)
+	{
+		if (json)
+			g_string_append_printf(out, "%s\"%s\": ", i > 0 ? ", " : "", names[i]);
+		else
+			g_string_append_c(out, ',');
+
+		if (values[i] >= 0)
+			g_string_append_printf(out, "%.4f", values[i]);
+		else if (json)
+			g_string_append(out, "null");
+	}
+}
+
+static void write_csv(const gchar * path, GArray * results)
+{
+	GString *csv = g_string_new("case,filter,stage,size,width,height,sigma,ns_per_pixel,gb_per_s,speedup,max_abs_error,psnr,passed,"
+		"ipc,bytes_per_cycle,l1d_misses_per_pixel,llc_misses_per_pixel,frontend_stalls,backend_stalls\n");
+	GError *err = NULL;
+
+	for (guint i = 0; i < results->len; ++i)
+	{
+		BenchResult *r = &g_array_index(results, BenchResult, i);
+		CvPerfSample none = { { 0 }, 0 };
+
+		g_string_append_printf(csv, "%s,%s,%s,%s,%d,%d,%.2f,%.4f,%.4f,%.4f,%.6f,%.3f,%d",
+			r->bcase->name, r->bcase->filter == FILTER_BLUR ? "blurfilter" : "bilateralfilter",
+			r->bcase->stage == STAGE_KERNEL ? "kernel" : "frame", r->size->name,
+			r->size->width, r->size->height, r->sigma, r->ns_per_pixel, r->gb_per_second,
+			r->speedup, r->max_error, r->psnr, r->passed);
+		append_metrics(csv, r->has_perf ? &r->perf[PERF_TOTAL] : &none, r->bytes,
+			(double)r->size->width * r->size->height, FALSE);
+		g_string_append_c(csv, '\n');
+	}
+
+	if (!g_file_set_contents(path, csv->str, csv->len, &err))
+	{
+		g_printerr("Could not write %s: %s\n", path, err->message);
+		g_clear_error(&err);
+	}
+	g_string_free(csv, TRUE);
+}
+
+static void write_json(const gchar * path, GArray * results, gboolean passed)
+{
+	GString *json = g_string_new("{\n");
+	GError *err = NULL;
+
+	g_string_append_printf(json, "  \"repeat\": %d,\n  \"passed\": %s,\n  \"results\": [\n",
+		opt_repeat, passed ? "true" : "false");
+	for (guint i = 0; i < results->len; ++i)
+	{
+		BenchResult *r = &g_array_index(results, BenchResult, i);
+		double pixels = (double)r->size->width * r->size->height;
+
+		g_string_append_printf(json,
+			"    { \"case\": \"%s\", \"filter\": \"%s\", \"stage\": \"%s\", \"size\": \"%s\", "
+			"\"width\": %d, \"height\": %d, \"sigma\": %.2f, \"ns_per_pixel\": %.4f, "
+			"\"gb_per_s\": %.4f, \"speedup\": %.4f, \"max_abs_error\": %.6f, \"psnr\": %.3f, "
+			"\"passed\": %s",
+			r->bcase->name, r->bcase->filter == FILTER_BLUR ? "blurfilter" : "bilateralfilter",
+			r->bcase->stage == STAGE_KERNEL ? "kernel" : "frame", r->size->name,
+			r->size->width, r->size->height, r->sigma, r->ns_per_pixel, r->gb_per_second,
+			r->speedup, r->max_error, r->psnr, r->passed ? "true" : "false");
+
+		if (r->has_perf)
+		{
+			g_string_append(json, ",\n      \"perf\": { \"run\": { ");
+			append_metrics(json, &r->perf[PERF_TOTAL], r->bytes, pixels, TRUE);
+			g_string_append(json, " }");
+			for (gint s = 0; s < CV_N_STAGES; ++s)
+			{
+				if (r->perf[s].valid == 0)
+					continue;
+				g_string_append_printf(json, ", \"%s\": { ", cv_stats_stage_name((CvStage)s));
+				append_metrics(json, &r->perf[s], r->bytes, pixels, TRUE);
+				g_string_append(json, " }");
+			}
+			g_string_append(json, " }");
+		}
+		g_string_append_printf(json, " }%s\n", i + 1 < results->len ? "," : "");
+	}
+	g_string_append(json, "  ]\n}\n");
+
+	if (!g_file_set_contents(path, json->str, json->len, &err))
+	{
+		g_printerr("Could not write %s: %s\n", path, err->message);
+		g_clear_error(&err);
+	}
+	g_string_free(json, TRUE);
+}
+
+/* Runs all selected cases of one filter on one size for one sigma */
+static void run_group(BenchFilter filter, const BenchSize * size, double sigma,
+	GstVideoFrame * src, GstVideoFrame * dest, GArray * results)
+{
+	const guint8 *plane = GST_VIDEO_FRAME_COMP_DATA(src, 0);
+	gint stride = GST_VIDEO_FRAME_PLANE_STRIDE(src, 0);
+	double *reference;
+	double *sharpened = NULL;
+	guint first = results->len;
+
+	if (filter == FILTER_BLUR)
+		reference = reference_filter(plane, stride, size->width, size->height, sigma,
+			(gint)(2 * (float)sigma), 0);
+	else
+		reference = reference_filter(plane, stride, size->width, size->height,
+			BILATERAL_SIGMAD, BILATERAL_RADIUS, sigma);
+
+	for (guint c = 0; c < G_N_ELEMENTS(bench_cases); ++c)
+	{
+		const BenchCase *bcase = &bench_cases[c];
+		BenchResult result;
+
+		if (bcase->filter != filter || !in_list(opt_cases, bcase->name))
+			continue;
+
+		if (bcase->sharpen > 0 && sharpened == NULL)
+			sharpened = reference_sharpen(reference, size->width, size->height, bcase->sharpen);
+
+		run_case(bcase, size, sigma, src, dest,
+			bcase->sharpen > 0 ? sharpened : reference, &result);
+		g_array_append_val(results, result);
+	}
+
+	finish_group(&g_array_index(results, BenchResult, first), results->len - first);
+	for (guint i = first; i < results->len; ++i)
+		print_result(&g_array_index(results, BenchResult, i));
+
+	delete[] reference;
+	delete[] sharpened;
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	double sigmas[16];
+	double sigmars[16];
+	guint n_sigmas, n_sigmars;
+	GArray *results;
+	gboolean passed = TRUE;
+
+	context = g_option_context_new("- benchmark the ContextVision filter kernels");
+	g_option_context_add_main_entries(context, entries, NULL);
+	g_option_context_add_group(context, gst_init_get_option_group());
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		g_printerr("Option parsing failed: %s\n", error->message);
+		g_clear_error(&error);
+		g_option_context_free(context);
+		return 2;
+	}
+	g_option_context_free(context);
+
+	n_sigmas = parse_values(opt_sigmas ? opt_sigmas : "1,3,8,16", sigmas, G_N_ELEMENTS(sigmas));
+	n_sigmars = parse_values(opt_sigmars ? opt_sigmars : "10,25,50", sigmars, G_N_ELEMENTS(sigmars));
+	opt_repeat = MAX(opt_repeat, 1);
+
+	if (opt_perf)
+	{
+		perf = cv_perf_open(&error);
+		if (perf == NULL)
+		{
+			g_printerr("Hardware performance counters are not available, running without: %s\n", error->message);
+			g_clear_error(&error);
+		}
+	}
+	results = g_array_new(FALSE, FALSE, sizeof(BenchResult));
+
+	g_print("%-24s %-6s %6s %10s %8s %9s %10s %8s\n",
+		"case", "size", "sigma", "ns/pixel", "GB/s", "speedup", "max error", "PSNR");
+
+	for (guint s = 0; s < G_N_ELEMENTS(bench_sizes); ++s)
+	{
+		const BenchSize *size = &bench_sizes[s];
+		GstVideoInfo info;
+		GstBuffer *inbuf, *outbuf;
+		GstVideoFrame src, dest;
+
+		if (!in_list(opt_sizes, size->name))
+			continue;
+
+		gst_video_info_set_format(&info, GST_VIDEO_FORMAT_I420, size->width, size->height);
+		inbuf = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(&info), NULL);
+		outbuf = gst_buffer_new_allocate(NULL, GST_VIDEO_INFO_SIZE(&info), NULL);
+		gst_video_frame_map(&src, &info, inbuf, GST_MAP_READWRITE);
+		gst_video_frame_map(&dest, &info, outbuf, GST_MAP_WRITE);
+		fill_synthetic(&src);
+
+		for (guint i = 0; i < n_sigmas; ++i)
+		{
+			/* Below 0.5 the blur kernel is a single tap */
+			if ((gint)(2 * (float)sigmas[i]) > 0)
+				run_group(FILTER_BLUR, size, sigmas[i], &src, &dest, results);
+		}
+		for (guint i = 0; i < n_sigmars; ++i)
+		{
+			if (sigmars[i] > 0)
+				run_group(FILTER_BILATERAL, size, sigmars[i], &src, &dest, results);
+		}
+
+		gst_video_frame_unmap(&src);
+		gst_video_frame_unmap(&dest);
+		gst_buffer_unref(inbuf);
+		gst_buffer_unref(outbuf);
+	}
+
+	for (guint i = 0; i < results->len; ++i)
+		passed = passed && g_array_index(results, BenchResult, i).passed;
+	g_print("%s\n", passed ? "All cases passed." : "Some cases FAILED.");
+
+	if (opt_csv != NULL)
+		write_csv(opt_csv, results);
+	if (opt_json != NULL)
+		write_json(opt_json, results, passed);
+
+	g_array_free(results, TRUE);
+	if (perf != NULL)
+		cv_perf_close(perf);
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,511 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob 
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+* Boston, MA 02110-1335, USA.
+*/
+/**
+* SECTION:element-gstmedianfilter
+*
+* The medianfilter element removes impulse noise from each frame in a
+* grayscale video, replacing every pixel by the median of the square
+* window of 2 * radius + 1 pixels around it. The median takes the same time
+* per pixel whatever the radius.
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+#include "gstmedianfilter.h"
+#include "cvallocation.h"
+#include "cvmedian.h"
+#include "cvscheduler.h"
+#include "cvstats.h"
+#include <cstring>
+
+
+GST_DEBUG_CATEGORY_STATIC(gst_median_filter_debug_category);
+#define GST_CAT_DEFAULT gst_median_filter_debug_category
+
+/* Quick fix to make GParamFlags enums cooperate with | */
+inline GParamFlags operator | (GParamFlags lhs, GParamFlags rhs)
+{
+	return static_cast<GParamFlags>(static_cast<int>(lhs) | static_cast<int>(rhs));
+}
+
+
+static void gst_median_filter_set_property(GObject * object,
+	guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_median_filter_get_property(GObject * object,
+	guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_median_filter_finalize(GObject * object);
+static gboolean gst_median_filter_src_event(GstBaseTransform * trans,
+	GstEvent * event);
+static gboolean gst_median_filter_sink_event(GstBaseTransform * trans,
+	GstEvent * event);
+static gboolean gst_median_filter_propose_allocation(GstBaseTransform * trans,
+	GstQuery * decide_query, GstQuery * query);
+static gboolean gst_median_filter_decide_allocation(GstBaseTransform * trans,
+	GstQuery * query);
+static GstFlowReturn gst_median_filter_transform_frame(GstVideoFilter * filter,
+	GstVideoFrame * inframe, GstVideoFrame * outframe);
+
+enum
+{
+	PROP_0,
+	PROP_RADIUS,
+	PROP_POOL_PADDING,
+	PROP_STATS,
+	PROP_STATS_INTERVAL,
+	PROP_CACHE_SIZE,
+	PROP_CACHE_SPILL_LOCATION,
+	PROP_CACHE_SPILL_SIZE,
+	PROP_PARALLEL,
+	PROP_TRICKMODE
+};
+
+/* Only designed and properly tested for I420 */
+#define VIDEO_SRC_CAPS \
+    GST_VIDEO_CAPS_MAKE("{ I420 }")
+
+#define VIDEO_SINK_CAPS \
+    GST_VIDEO_CAPS_MAKE("{ I420 }")
+
+
+/* class initialization */
+G_DEFINE_TYPE_WITH_CODE(GstMedianFilter, gst_median_filter, GST_TYPE_VIDEO_FILTER,
+	GST_DEBUG_CATEGORY_INIT(gst_median_filter_debug_category, "medianfilter", 0,
+		"debug category for medianfilter filter"));
+
+
+/* Filter class initialization */
+static void
+gst_median_filter_class_init(GstMedianFilterClass * klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	GstBaseTransformClass *base_transform_class = GST_BASE_TRANSFORM_CLASS(klass);
+	GstVideoFilterClass *video_filter_class = GST_VIDEO_FILTER_CLASS(klass);
+
+	gst_element_class_add_pad_template(GST_ELEMENT_CLASS(klass),
+		gst_pad_template_new("src", GST_PAD_SRC, GST_PAD_ALWAYS,
+			gst_caps_from_string(VIDEO_SRC_CAPS)));
+	gst_element_class_add_pad_template(GST_ELEMENT_CLASS(klass),
+		gst_pad_template_new("sink", GST_PAD_SINK, GST_PAD_ALWAYS,
+			gst_caps_from_string(VIDEO_SINK_CAPS)));
+
+	gst_element_class_set_static_metadata(GST_ELEMENT_CLASS(klass),
+		"Median filter", "Generic", "Constant time median filter removing impulse noise",
+		"Jakob");
+
+	gobject_class->set_property = gst_median_filter_set_property;
+	gobject_class->get_property = gst_median_filter_get_property;
+	gobject_class->finalize = gst_median_filter_finalize;
+
+	video_filter_class->transform_frame = GST_DEBUG_FUNCPTR(gst_median_filter_transform_frame);
+	base_transform_class->src_event = GST_DEBUG_FUNCPTR(gst_median_filter_src_event);
+	base_transform_class->sink_event = GST_DEBUG_FUNCPTR(gst_median_filter_sink_event);
+	base_transform_class->propose_allocation = GST_DEBUG_FUNCPTR(gst_median_filter_propose_allocation);
+	base_transform_class->decide_allocation = GST_DEBUG_FUNCPTR(gst_median_filter_decide_allocation);
+
+	/* Install class properties */
+	g_object_class_install_property(gobject_class, PROP_RADIUS,
+		g_param_spec_int("radius", "Radius",
+			"Pixels on each side of the centre pixel in the median window, 0 disables the filter",
+			0, CV_MEDIAN_MAX_RADIUS, 1, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_POOL_PADDING,
+		g_param_spec_uint("pool-padding", "Pool padding",
+			"Pixels of padding around the planes of the buffers proposed to upstream",
+			0, 256, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_STATS,
+		g_param_spec_boxed("stats", "Statistics",
+			"Frames processed, time per stage, latency histogram, engine and memory use",
+			GST_TYPE_STRUCTURE, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_STATS_INTERVAL,
+		g_param_spec_uint("stats-interval", "Statistics interval",
+			"Milliseconds between element messages with the statistics, 0 disables them",
+			0, G_MAXUINT, 1000, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_CACHE_SIZE,
+		g_param_spec_uint("cache-size", "Cache size",
+			"Megabytes of filtered frames kept in memory and reused for the same input, 0 disables the cache",
+			0, 65536, 0, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_CACHE_SPILL_LOCATION,
+		g_param_spec_string("cache-spill-location", "Cache spill location",
+			"File the cache maps to keep frames that no longer fit in memory, NULL drops them",
+			NULL, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_CACHE_SPILL_SIZE,
+		g_param_spec_uint("cache-spill-size", "Cache spill size",
+			"Megabytes of frames kept in the spill file",
+			0, G_MAXUINT, 1024, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_PARALLEL,
+		g_param_spec_boolean("parallel", "Parallel",
+			"Filter each frame on the worker threads shared by all filter elements",
+			TRUE, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_TRICKMODE,
+		g_param_spec_enum("trickmode", "Trick mode",
+			"What frames get while scrubbing, fast forward or reverse playback",
+			CV_TYPE_TRICKMODE_ACTION, CV_TRICKMODE_PREVIEW,
+			G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+}
+
+
+/* Initialize start values for the filter parameters */
+static void
+gst_median_filter_init(GstMedianFilter *medianfilter)
+{
+	medianfilter->radius = 1;
+	medianfilter->pool_padding = 0;
+	medianfilter->stats = cv_stats_new();
+	medianfilter->stats_interval = 1000;
+	medianfilter->cache = NULL;
+	medianfilter->cache_size = 0;
+	medianfilter->cache_spill_location = NULL;
+	medianfilter->cache_spill_size = 1024;
+	medianfilter->parallel = TRUE;
+	medianfilter->scheduler = cv_scheduler_get();
+	medianfilter->stream = cv_scheduler_stream_new(medianfilter->scheduler);
+	medianfilter->trickmode = CV_TRICKMODE_PREVIEW;
+	cv_trickmode_init(&medianfilter->trickmode_state);
+	medianfilter->frame_action = CV_TRICKMODE_FULL;
+	g_print("Median filter for grayscale video\n");
+	g_print("Press '+' to widen and '-' to narrow the median window\n");
+}
+
+/* Event function for handling navigation events e.g. key-presses */
+static gboolean
+gst_median_filter_src_event(GstBaseTransform * trans, GstEvent * event)
+{
+	GstMedianFilter *medianfilter = GST_MEDIAN_FILTER(trans);
+	const gchar *type;
+	const gchar *key;
+
+	/* Seeks tell key unit seeks, whose first frame is only a preview */
+	if (GST_EVENT_TYPE(event) == GST_EVENT_SEEK)
+	{
+		GST_OBJECT_LOCK(medianfilter);
+		cv_trickmode_seek(&medianfilter->trickmode_state, event);
+		GST_OBJECT_UNLOCK(medianfilter);
+	}
+
+	/* If a navigation event happens */
+	if (GST_EVENT_TYPE(event) == GST_EVENT_NAVIGATION)
+	{
+		const GstStructure *s = gst_event_get_structure(event);
+
+		/* Get the type of event */
+		type = gst_structure_get_string(s, "event");
+		if (g_str_equal(type, "key-release"))
+		{
+			/* Get the key-press once the key has been released */
+			key = gst_structure_get_string(s, "key");
+			if (g_str_equal(key, "+") || g_str_equal(key, "-"))
+			{
+				/* Mutex lock the filter */
+				GST_OBJECT_LOCK(medianfilter);
+				medianfilter->radius = CLAMP(medianfilter->radius + (g_str_equal(key, "+") ? 1 : -1),
+					0, CV_MEDIAN_MAX_RADIUS);
+				g_print("Radius set to %d\n", medianfilter->radius);
+				GST_OBJECT_UNLOCK(medianfilter);
+			}
+		}
+	}
+
+	return GST_BASE_TRANSFORM_CLASS(gst_median_filter_parent_class)->src_event(trans, event);
+
+}
+
+/* Event function for the segments, to follow trick modes */
+static gboolean
+gst_median_filter_sink_event(GstBaseTransform * trans, GstEvent * event)
+{
+	GstMedianFilter *medianfilter = GST_MEDIAN_FILTER(trans);
+
+	if (GST_EVENT_TYPE(event) == GST_EVENT_SEGMENT)
+	{
+		GST_OBJECT_LOCK(medianfilter);
+		cv_trickmode_segment(&medianfilter->trickmode_state, event);
+		if (medianfilter->trickmode_state.segment)
+			GST_INFO_OBJECT(medianfilter, "trick mode segment, frames get %s",
+				cv_trickmode_action_name(medianfilter->trickmode));
+		GST_OBJECT_UNLOCK(medianfilter);
+	}
+
+	return GST_BASE_TRANSFORM_CLASS(gst_median_filter_parent_class)->sink_event(trans, event);
+}
+
+/* Property setter for external access */
+void
+gst_median_filter_set_property(GObject * object, guint property_id,
+	const GValue * value, GParamSpec * pspec)
+{
+	GstMedianFilter *medianfilter = GST_MEDIAN_FILTER(object);
+
+	switch (property_id) {
+	case PROP_RADIUS:
+		GST_OBJECT_LOCK(medianfilter);
+		medianfilter->radius = g_value_get_int(value);
+		GST_OBJECT_UNLOCK(medianfilter);
+		g_print("Radius set to %d\n", medianfilter->radius);
+		break;
+	case PROP_POOL_PADDING:
+		medianfilter->pool_padding = g_value_get_uint(value);
+		break;
+	case PROP_STATS_INTERVAL:
+		medianfilter->stats_interval = g_value_get_uint(value);
+		break;
+	case PROP_CACHE_SIZE:
+	case PROP_CACHE_SPILL_LOCATION:
+	case PROP_CACHE_SPILL_SIZE:
+		/* The cache is created again with the new settings on the next frame */
+		GST_OBJECT_LOCK(medianfilter);
+		if (property_id == PROP_CACHE_SIZE)
+			medianfilter->cache_size = g_value_get_uint(value);
+		else if (property_id == PROP_CACHE_SPILL_SIZE)
+			medianfilter->cache_spill_size = g_value_get_uint(value);
+		else
+		{
+			g_free(medianfilter->cache_spill_location);
+			medianfilter->cache_spill_location = g_value_dup_string(value);
+		}
+		if (medianfilter->cache != NULL)
+		{
+			cv_cache_free(medianfilter->cache);
+			medianfilter->cache = NULL;
+		}
+		GST_OBJECT_UNLOCK(medianfilter);
+		break;
+	case PROP_PARALLEL:
+		GST_OBJECT_LOCK(medianfilter);
+		medianfilter->parallel = g_value_get_boolean(value);
+		GST_OBJECT_UNLOCK(medianfilter);
+		break;
+	case PROP_TRICKMODE:
+		GST_OBJECT_LOCK(medianfilter);
+		medianfilter->trickmode = (CvTrickmodeAction)g_value_get_enum(value);
+		GST_OBJECT_UNLOCK(medianfilter);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+		break;
+	}
+}
+
+/* Property getters for external access */
+void
+gst_median_filter_get_property(GObject * object, guint property_id,
+	GValue * value, GParamSpec * pspec)
+{
+	GstMedianFilter *medianfilter = GST_MEDIAN_FILTER(object);
+
+	switch (property_id) {
+	case PROP_RADIUS:
+		g_value_set_int(value, medianfilter->radius);
+		break;
+	case PROP_POOL_PADDING:
+		g_value_set_uint(value, medianfilter->pool_padding);
+		break;
+	case PROP_STATS:
+		g_value_take_boxed(value, cv_stats_get_structure(medianfilter->stats, "medianfilter-stats"));
+		break;
+	case PROP_STATS_INTERVAL:
+		g_value_set_uint(value, medianfilter->stats_interval);
+		break;
+	case PROP_CACHE_SIZE:
+		g_value_set_uint(value, medianfilter->cache_size);
+		break;
+	case PROP_CACHE_SPILL_LOCATION:
+		g_value_set_string(value, medianfilter->cache_spill_location);
+		break;
+	case PROP_CACHE_SPILL_SIZE:
+		g_value_set_uint(value, medianfilter->cache_spill_size);
+		break;
+	case PROP_PARALLEL:
+		g_value_set_boolean(value, medianfilter->parallel);
+		break;
+	case PROP_TRICKMODE:
+		g_value_set_enum(value, medianfilter->trickmode);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+		break;
+	}
+}
+
+static void
+gst_median_filter_finalize(GObject * object)
+{
+	GstMedianFilter *medianfilter = GST_MEDIAN_FILTER(object);
+
+	cv_stats_free(medianfilter->stats);
+	cv_scheduler_stream_free(medianfilter->stream);
+	if (medianfilter->cache != NULL)
+		cv_cache_free(medianfilter->cache);
+	g_free(medianfilter->cache_spill_location);
+
+	G_OBJECT_CLASS(gst_median_filter_parent_class)->finalize(object);
+}
+
+/* Offers upstream a pool of frames with aligned planes and strides */
+static gboolean
+gst_median_filter_propose_allocation(GstBaseTransform * trans, GstQuery * decide_query,
+	GstQuery * query)
+{
+	GstMedianFilter *medianfilter = GST_MEDIAN_FILTER(trans);
+	guint padding;
+
+	/* Nothing to propose in passthrough */
+	if (decide_query == NULL)
+		return GST_BASE_TRANSFORM_CLASS(gst_median_filter_parent_class)->propose_allocation(trans,
+			decide_query, query);
+
+	GST_OBJECT_LOCK(medianfilter);
+	padding = medianfilter->pool_padding;
+	GST_OBJECT_UNLOCK(medianfilter);
+
+	if (cv_propose_aligned_pool(query, padding))
+		return TRUE;
+	return GST_BASE_TRANSFORM_CLASS(gst_median_filter_parent_class)->propose_allocation(trans,
+		decide_query, query);
+}
+
+/* Makes the output frames come from a pool with aligned planes and strides */
+static gboolean
+gst_median_filter_decide_allocation(GstBaseTransform * trans, GstQuery * query)
+{
+	if (!cv_decide_aligned_pool(query, 0))
+		GST_DEBUG_OBJECT(trans, "downstream pool kept, output strides are not aligned");
+
+	return GST_BASE_TRANSFORM_CLASS(gst_median_filter_parent_class)->decide_allocation(trans, query);
+}
+
+/* Main function for the actual filtering, must hold the object lock */
+static void gst_median_filter_median(GstMedianFilter * medianfilter, GstVideoFrame * dest, const GstVideoFrame * src)
+{
+	/* Trick mode frames may be passed on unfiltered */
+	gint radius = medianfilter->frame_action == CV_TRICKMODE_SKIP ? 0 : medianfilter->radius;
+	gboolean preview = medianfilter->frame_action == CV_TRICKMODE_PREVIEW;
+	const guint8 *s = GST_VIDEO_FRAME_COMP_DATA(src, 0);
+	guint8 *d = GST_VIDEO_FRAME_COMP_DATA(dest, 0);
+
+	cv_stats_set_engine(medianfilter->stats, radius == 0 ? "copy" : preview ? "preview" : "median",
+		medianfilter->parallel ? cv_scheduler_get_n_workers(medianfilter->scheduler) : 1);
+
+	/* The tiles run on the shared workers, with the other streams' */
+	if (medianfilter->parallel)
+		cv_parallel_set_runner(cv_scheduler_stream_get_runner(medianfilter->stream));
+	if (preview)
+		cv_median_preview_plane(s, GST_VIDEO_FRAME_PLANE_STRIDE(src, 0), d, GST_VIDEO_FRAME_PLANE_STRIDE(dest, 0),
+			GST_VIDEO_FRAME_COMP_WIDTH(dest, 0), GST_VIDEO_FRAME_COMP_HEIGHT(dest, 0), radius);
+	else
+		cv_median_plane(s, GST_VIDEO_FRAME_PLANE_STRIDE(src, 0), d, GST_VIDEO_FRAME_PLANE_STRIDE(dest, 0),
+			GST_VIDEO_FRAME_COMP_WIDTH(dest, 0), GST_VIDEO_FRAME_COMP_HEIGHT(dest, 0), radius);
+	cv_parallel_set_runner(NULL);
+
+	/* Each pixel in the UV-colour planes is set to 128 to ensure greyscale */
+	for (gint c = 1; c < 3; ++c)
+		cv_fill_plane(GST_VIDEO_FRAME_COMP_DATA(dest, c), GST_VIDEO_FRAME_PLANE_STRIDE(dest, c),
+			GST_VIDEO_FRAME_COMP_WIDTH(dest, c), GST_VIDEO_FRAME_COMP_HEIGHT(dest, c),
+			1 << (GST_VIDEO_FRAME_COMP_DEPTH(src, c) - 1));
+	cv_store_fence();
+	cv_stats_mark(CV_STAGE_CHROMA);
+}
+
+
+/* Frame transformation function */
+static GstFlowReturn
+gst_median_filter_transform_frame(GstVideoFilter * filter, GstVideoFrame * inframe,
+	GstVideoFrame * outframe)
+{
+
+	GstMedianFilter *medianfilter = GST_MEDIAN_FILTER(filter);
+	GstClockTime interval;
+	GstMessage *msg;
+	CvCacheKey key;
+	gboolean hit = FALSE;
+
+	/* Mutex lock the filter */
+	GST_OBJECT_LOCK(medianfilter);
+	cv_stats_frame_begin(medianfilter->stats);
+	medianfilter->frame_action = cv_trickmode_next_frame(&medianfilter->trickmode_state) ?
+		medianfilter->trickmode : CV_TRICKMODE_FULL;
+
+	/* Reuse the output of the same input filtered with the same parameters */
+	if (medianfilter->cache_size > 0)
+	{
+		double params[] = { (double)medianfilter->radius };
+
+		if (medianfilter->cache == NULL)
+			medianfilter->cache = cv_cache_new((gsize)medianfilter->cache_size << 20,
+				medianfilter->cache_spill_location, (gsize)medianfilter->cache_spill_size << 20);
+		cv_cache_key_init(&key, inframe, outframe, cv_cache_hash(params, sizeof(params), 0));
+		hit = cv_cache_load_frame(medianfilter->cache, &key, outframe);
+		cv_stats_cache_lookup(medianfilter->stats, hit);
+	}
+	if (!hit)
+	{
+		gst_median_filter_median(medianfilter, outframe, inframe);
+		/* Previews and skipped frames are not what the parameters promise */
+		if (medianfilter->cache != NULL && medianfilter->frame_action == CV_TRICKMODE_FULL)
+			cv_cache_store_frame(medianfilter->cache, &key, outframe);
+	}
+	cv_stats_frame_end(medianfilter->stats,
+		GST_VIDEO_FRAME_SIZE(inframe) + GST_VIDEO_FRAME_SIZE(outframe));
+	interval = medianfilter->stats_interval * GST_MSECOND;
+	GST_OBJECT_UNLOCK(medianfilter);
+
+	/* Post the statistics periodically for monitoring */
+	msg = cv_stats_poll_message(medianfilter->stats, GST_OBJECT(medianfilter), "medianfilter-stats", interval);
+	if (msg != NULL)
+		gst_element_post_message(GST_ELEMENT(medianfilter), msg);
+
+	return GST_FLOW_OK;
+}
+
+
+/* Boilerplate plugin initialization */
+static gboolean
+plugin_init(GstPlugin * plugin)
+{
+	/* Starts the workers shared with the other filter plugins, unless one of them already did */
+	cv_scheduler_get();
+
+	return gst_element_register(plugin, "medianfilter", GST_RANK_NONE,
+		GST_TYPE_MEDIAN_FILTER);
+}
+
+
+/* Plugin definitions */
+#ifndef VERSION
+#define VERSION "0.1.0"
+#endif
+#ifndef PACKAGE
+#define PACKAGE "SimplePackage"
+#endif
+#ifndef PACKAGE_NAME
+#define PACKAGE_NAME "Package name"
+#endif
+#ifndef GST_PACKAGE_ORIGIN
+#define GST_PACKAGE_ORIGIN "http://origin.org/"
+#endif
+
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR,
+	GST_VERSION_MINOR,
+	medianfilter,
+	"Constant time median filter",
+	plugin_init, VERSION, "LGPL", PACKAGE_NAME, GST_PACKAGE_ORIGIN)
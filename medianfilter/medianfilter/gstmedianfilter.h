@@ -0,0 +1,73 @@
+/* GStreamer
+* Copyright (C) 2019 FIXME <fixme@example.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _GST_MEDIAN_FILTER_H_
+#define _GST_MEDIAN_FILTER_H_
+
+#include <gst/video/video.h>
+#include <gst/video/gstvideofilter.h>
+#include "cvstats.h"
+#include "cvcache.h"
+#include "cvscheduler.h"
+#include "cvtrickmode.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_MEDIAN_FILTER   (gst_median_filter_get_type())
+#define GST_MEDIAN_FILTER(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_MEDIAN_FILTER,GstMedianFilter))
+#define GST_MEDIAN_FILTER_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_MEDIAN_FILTER,GstMedianFilterClass))
+#define GST_IS_MEDIAN_FILTER(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_MEDIAN_FILTER))
+#define GST_IS_MEDIAN_FILTER_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_MEDIAN_FILTER))
+
+typedef struct _GstMedianFilter GstMedianFilter;
+typedef struct _GstMedianFilterClass GstMedianFilterClass;
+
+struct _GstMedianFilter
+{
+	GstVideoFilter base_medianfilter;
+	gint radius;
+	guint pool_padding;
+	CvStats *stats;
+	guint stats_interval;
+	/* Filtered frames, created on the first frame while cache_size is not 0 */
+	CvCache *cache;
+	guint cache_size;
+	gchar *cache_spill_location;
+	guint cache_spill_size;
+	/* Splits the frames into tasks for the shared scheduler when parallel is TRUE */
+	gboolean parallel;
+	CvScheduler *scheduler;
+	CvSchedulerStream *stream;
+	/* What trick mode frames get, whether the segment is one, and what the frame being filtered gets */
+	CvTrickmodeAction trickmode;
+	CvTrickmode trickmode_state;
+	CvTrickmodeAction frame_action;
+
+};
+
+struct _GstMedianFilterClass
+{
+	GstVideoFilterClass base_medianfilter_class;
+};
+
+GType gst_median_filter_get_type(void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,578 @@
+/*
+ * GStreamer Media Player
+ * Offline filtering of many videos, several pipelines at a time.
+ *
+ * Every input gets a pipeline of its own,
+ *
+ *   uridecodebin ! videoconvert ! filter ! encoder ! filesink
+ *
+ * and up to jobs pipelines run at once, all watched from one main loop.
+ * When one finishes the next input is started. Filters with the parallel
+ * property set run their frames on the workers shared by all filters in
+ * the process, so by default as many pipelines run as there are cores,
+ * divided by the shared workers when the filter uses them.
+ *
+ * Outputs are named after their input with the extension replaced. When
+ * two inputs would get the same name, like clip.mov and clip.mp4, the later
+ * one in input order gets a counter, clip-2.mp4, so the same inputs always
+ * get the same outputs and no two jobs write one file.
+ *
+ * A pipeline writes to OUTPUT.part and renames it to OUTPUT once the muxer
+ * has finished the file, after which the input is appended to a journal in
+ * the output directory. A later run skips the inputs in the journal whose
+ * output is still there, so an interrupted batch picks up where it stopped
+ * and only redoes the files that were in progress.
+ */
+
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+#include "batch.h"
+#include "cvscheduler.h"
+
+#define JOURNAL_NAME "batch-journal.txt"
+/* Seconds between progress lines */
+#define PROGRESS_INTERVAL 5
+
+typedef struct _BatchRun BatchRun;
+
+typedef struct _BatchJob
+{
+	BatchRun *run;
+	gchar *uri;
+	gchar *output;
+	/* Written to while running, renamed to output when complete */
+	gchar *partial;
+	GstElement *pipeline;
+	GstElement *convert;
+	/* Frames out of the filter, counted on the streaming thread */
+	gint frames;
+	gint64 start;
+} BatchJob;
+
+struct _BatchRun
+{
+	const BatchOptions *options;
+	GMainLoop *loop;
+	/* Jobs not started yet, with their input and output */
+	GQueue pending;
+	GPtrArray *running;
+	guint jobs;
+	guint total;
+	guint converted;
+	guint failed;
+	guint skipped;
+	guint64 frames;
+	FILE *journal;
+};
+
+static gint compare_strings(gconstpointer a, gconstpointer b)
+{
+	return strcmp(*(const gchar **)a, *(const gchar **)b);
+}
+
+/* Adds the files of a directory as URIs, in name order, without the journal and partial outputs of a batch writing there */
+static gboolean collect_directory(const gchar *path, GPtrArray *uris, gboolean skip_batch_files)
+{
+	GError *error = NULL;
+	GDir *dir = g_dir_open(path, 0, &error);
+	GPtrArray *names;
+	const gchar *name;
+
+	if (dir == NULL)
+	{
+		g_printerr("Could not read %s: %s\n", path, error->message);
+		g_clear_error(&error);
+		return FALSE;
+	}
+
+	names = g_ptr_array_new_with_free_func(g_free);
+	while ((name = g_dir_read_name(dir)) != NULL)
+	{
+		gchar *file = g_build_filename(path, name, NULL);
+
+		if (skip_batch_files && (g_str_equal(name, JOURNAL_NAME) || g_str_has_suffix(name, ".part")))
+			g_free(file);
+		else if (name[0] != '.' && g_file_test(file, G_FILE_TEST_IS_REGULAR))
+			g_ptr_array_add(names, file);
+		else
+			g_free(file);
+	}
+	g_dir_close(dir);
+
+	g_ptr_array_sort(names, compare_strings);
+	for (guint i = 0; i < names->len; i++)
+	{
+		gchar *uri = gst_filename_to_uri((const gchar *)g_ptr_array_index(names, i), NULL);
+		if (uri != NULL)
+			g_ptr_array_add(uris, uri);
+	}
+	g_ptr_array_free(names, TRUE);
+	return TRUE;
+}
+
+/* Adds the inputs of a list file, one file name or URI per line, skipping empty lines and lines starting with # */
+static gboolean collect_list(const gchar *path, GPtrArray *uris)
+{
+	GError *error = NULL;
+	gchar *contents;
+	gchar **lines;
+
+	if (!g_file_get_contents(path, &contents, NULL, &error))
+	{
+		g_printerr("Could not read %s: %s\n", path, error->message);
+		g_clear_error(&error);
+		return FALSE;
+	}
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (gchar **line = lines; *line != NULL; line++)
+	{
+		gchar *input = g_strstrip(*line);
+		gchar *uri;
+
+		if (input[0] == '\0' || input[0] == '#')
+			continue;
+		uri = gst_uri_is_valid(input) ? g_strdup(input) : gst_filename_to_uri(input, NULL);
+		if (uri != NULL)
+			g_ptr_array_add(uris, uri);
+		else
+			g_printerr("Skipping invalid file name %s.\n", input);
+	}
+	g_strfreev(lines);
+	g_free(contents);
+	return TRUE;
+}
+
+/* Adds the videos of a directory, or listed in a file, to uris as URIs */
+gboolean batch_collect_inputs(const gchar *path, GPtrArray *uris)
+{
+	if (g_file_test(path, G_FILE_TEST_IS_DIR))
+		return collect_directory(path, uris, FALSE);
+	return collect_list(path, uris);
+}
+
+/* Whether two paths name the same file or directory */
+static gboolean same_path(const gchar *a, const gchar *b)
+{
+	gchar *ca = g_canonicalize_filename(a, NULL);
+	gchar *cb = g_canonicalize_filename(b, NULL);
+	gboolean same = g_str_equal(ca, cb);
+
+	g_free(ca);
+	g_free(cb);
+	return same;
+}
+
+/*
+ *	Output file for an input: its name with the extension replaced, in the
+ *	output directory. A name already used, compared without case for the
+ *	file systems that ignore it, or the input itself, gets a counter before
+ *	the extension. The name is added to used.
+ */
+static gchar *output_for(const BatchOptions *options, const gchar *uri, GHashTable *used)
+{
+	gchar *unescaped = g_uri_unescape_string(uri, NULL);
+	gchar *base = g_path_get_basename(unescaped != NULL ? unescaped : uri);
+	gchar *input = g_filename_from_uri(uri, NULL, NULL);
+	gchar *dot = strrchr(base, '.');
+	gchar *output = NULL;
+
+	if (dot != NULL && dot != base)
+		*dot = '\0';
+	for (guint n = 1; output == NULL; n++)
+	{
+		gchar *name = n == 1 ? g_strdup_printf("%s.%s", base, options->extension) :
+			g_strdup_printf("%s-%u.%s", base, n, options->extension);
+		gchar *key = g_utf8_casefold(name, -1);
+
+		output = g_build_filename(options->output_dir, name, NULL);
+		if (g_hash_table_contains(used, key) || (input != NULL && same_path(input, output)))
+		{
+			g_free(output);
+			output = NULL;
+			g_free(key);
+		}
+		else
+			g_hash_table_add(used, key);
+		g_free(name);
+	}
+
+	g_free(input);
+	g_free(base);
+	g_free(unescaped);
+	return output;
+}
+
+/* URIs finished by earlier runs, according to the journal */
+static GHashTable *read_journal(const gchar *journal_path)
+{
+	GHashTable *done = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	gchar *contents;
+	gchar **lines;
+
+	if (!g_file_get_contents(journal_path, &contents, NULL, NULL))
+		return done;
+
+	lines = g_strsplit(contents, "\n", -1);
+	for (gchar **line = lines; *line != NULL; line++)
+	{
+		gchar **fields = g_strsplit(*line, "\t", 2);
+
+		if (fields[0] != NULL && fields[0][0] != '\0')
+			g_hash_table_add(done, g_strdup(fields[0]));
+		g_strfreev(fields);
+	}
+	g_strfreev(lines);
+	g_free(contents);
+	return done;
+}
+
+/*
+ *	Number of threads a filter uses per frame: the workers of the shared
+ *	scheduler when its parallel property is set, which its plugin created on
+ *	loading, and otherwise one.
+ */
+static gint filter_threads(GstElement *filter)
+{
+	GParamSpec *spec = g_object_class_find_property(G_OBJECT_GET_CLASS(filter), "parallel");
+	gboolean parallel = FALSE;
+
+	if (spec != NULL && G_PARAM_SPEC_VALUE_TYPE(spec) == G_TYPE_BOOLEAN)
+		g_object_get(filter, "parallel", &parallel, NULL);
+
+	return parallel ? (gint)MAX(cv_scheduler_get_n_workers(cv_scheduler_get()), 1u) : 1;
+}
+
+static GstPadProbeReturn count_frame(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	BatchJob *job = (BatchJob *)user_data;
+
+	g_atomic_int_inc(&job->frames);
+	return GST_PAD_PROBE_OK;
+}
+
+/* Links the decoder's video pad to the converter, other streams are left unlinked */
+static void batch_pad_added(GstElement *src, GstPad *new_pad, BatchJob *job)
+{
+	GstPad *sink_pad = gst_element_get_static_pad(job->convert, "sink");
+	GstCaps *caps = gst_pad_get_current_caps(new_pad);
+
+	if (caps != NULL && !gst_pad_is_linked(sink_pad) &&
+		g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/x-raw"))
+	{
+		if (GST_PAD_LINK_FAILED(gst_pad_link(new_pad, sink_pad)))
+			g_printerr("%s: could not link the decoder.\n", job->uri);
+	}
+
+	if (caps != NULL)
+		gst_caps_unref(caps);
+	gst_object_unref(sink_pad);
+}
+
+static void batch_job_free(BatchJob *job)
+{
+	if (job->pipeline != NULL)
+	{
+		gst_element_set_state(job->pipeline, GST_STATE_NULL);
+		gst_object_unref(job->pipeline);
+	}
+	g_free(job->uri);
+	g_free(job->output);
+	g_free(job->partial);
+	g_free(job);
+}
+
+static void start_jobs(BatchRun *run);
+
+/* Ends a job, keeping its output and recording it in the journal when it succeeded */
+static void finish_job(BatchJob *job, gboolean success)
+{
+	BatchRun *run = job->run;
+	double seconds = (g_get_monotonic_time() - job->start) / 1e6;
+	gint frames = g_atomic_int_get(&job->frames);
+	gint64 duration = GST_CLOCK_TIME_NONE;
+
+	if (success)
+		gst_element_query_duration(job->pipeline, GST_FORMAT_TIME, &duration);
+	gst_element_set_state(job->pipeline, GST_STATE_NULL);
+
+	/* Renaming does not replace an existing file on every platform */
+	if (success)
+	{
+		g_remove(job->output);
+		if (g_rename(job->partial, job->output) != 0)
+		{
+			g_printerr("%s: could not rename %s to %s.\n", job->uri, job->partial, job->output);
+			success = FALSE;
+		}
+	}
+
+	if (success)
+	{
+		run->converted++;
+		run->frames += frames;
+		g_print("[%u/%u] %s: %d frames in %.1f s, %.1f fps", run->converted + run->failed + run->skipped,
+			run->total, job->output, frames, seconds, seconds > 0 ? frames / seconds : 0.0);
+		if (duration > 0 && seconds > 0)
+			g_print(", %.2fx real time", duration / 1e9 / seconds);
+		g_print("\n");
+
+		if (run->journal != NULL)
+		{
+			fprintf(run->journal, "%s\t%s\t%d\t%.3f\n", job->uri, job->output, frames, seconds);
+			fflush(run->journal);
+		}
+	}
+	else
+	{
+		run->failed++;
+		g_remove(job->partial);
+		g_printerr("[%u/%u] %s failed after %.1f s.\n", run->converted + run->failed + run->skipped,
+			run->total, job->uri, seconds);
+	}
+
+	g_ptr_array_remove(run->running, job);
+	batch_job_free(job);
+	start_jobs(run);
+}
+
+static gboolean batch_bus_handler(GstBus *bus, GstMessage *msg, BatchJob *job)
+{
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE(msg))
+	{
+	case GST_MESSAGE_ERROR:
+		gst_message_parse_error(msg, &err, &debug_info);
+		g_printerr("%s: error from element %s: %s\n", job->uri, GST_OBJECT_NAME(msg->src), err->message);
+		g_printerr("Debugging information: %s \n", debug_info ? debug_info : "none");
+		g_clear_error(&err);
+		g_free(debug_info);
+		finish_job(job, FALSE);
+		/* The job is gone, stop watching its bus */
+		return FALSE;
+	case GST_MESSAGE_EOS:
+		finish_job(job, TRUE);
+		return FALSE;
+	default:
+		break;
+	}
+
+	return TRUE;
+}
+
+/* Builds the pipeline of an input and starts it, FALSE when that is not possible */
+static gboolean start_job(BatchJob *job)
+{
+	const BatchOptions *options = job->run->options;
+	GstElement *source, *filter, *encoder, *sink;
+	GError *error = NULL;
+	GstBus *bus;
+	GstPad *pad;
+
+	job->pipeline = gst_pipeline_new(NULL);
+	source = gst_element_factory_make("uridecodebin", NULL);
+	job->convert = gst_element_factory_make("videoconvert", NULL);
+	filter = options->make_filter();
+	encoder = gst_parse_bin_from_description(options->encoder, TRUE, &error);
+	sink = gst_element_factory_make("filesink", NULL);
+
+	if (error != NULL)
+	{
+		g_printerr("Invalid encoder '%s': %s\n", options->encoder, error->message);
+		g_clear_error(&error);
+	}
+	if (source == NULL || job->convert == NULL || filter == NULL || encoder == NULL || sink == NULL)
+	{
+		g_printerr("%s: all elements could not be created.\n", job->uri);
+		/* Whatever was created is still floating and not in the pipeline */
+		if (source != NULL)
+			gst_object_unref(gst_object_ref_sink(source));
+		if (job->convert != NULL)
+			gst_object_unref(gst_object_ref_sink(job->convert));
+		if (filter != NULL)
+			gst_object_unref(gst_object_ref_sink(filter));
+		if (encoder != NULL)
+			gst_object_unref(gst_object_ref_sink(encoder));
+		if (sink != NULL)
+			gst_object_unref(gst_object_ref_sink(sink));
+		return FALSE;
+	}
+
+	gst_bin_add_many(GST_BIN(job->pipeline), source, job->convert, filter, encoder, sink, NULL);
+	if (!gst_element_link_many(job->convert, filter, encoder, sink, NULL))
+	{
+		g_printerr("%s: elements could not be linked.\n", job->uri);
+		return FALSE;
+	}
+
+	g_object_set(source, "uri", job->uri, NULL);
+	g_object_set(sink, "location", job->partial, NULL);
+	g_signal_connect(source, "pad-added", G_CALLBACK(batch_pad_added), job);
+
+	pad = gst_element_get_static_pad(filter, "src");
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, count_frame, job, NULL);
+	gst_object_unref(pad);
+
+	bus = gst_element_get_bus(job->pipeline);
+	gst_bus_add_watch(bus, (GstBusFunc)batch_bus_handler, job);
+
+	job->start = g_get_monotonic_time();
+	if (gst_element_set_state(job->pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+	{
+		g_printerr("%s: unable to set the pipeline to the playing state.\n", job->uri);
+		gst_bus_remove_watch(bus);
+		gst_object_unref(bus);
+		return FALSE;
+	}
+	gst_object_unref(bus);
+	return TRUE;
+}
+
+/* Starts inputs until jobs pipelines are running, and ends the run when none are left */
+static void start_jobs(BatchRun *run)
+{
+	while (run->running->len < run->jobs && !g_queue_is_empty(&run->pending))
+	{
+		BatchJob *job = (BatchJob *)g_queue_pop_head(&run->pending);
+
+		if (start_job(job))
+		{
+			g_ptr_array_add(run->running, job);
+			continue;
+		}
+
+		run->failed++;
+		g_remove(job->partial);
+		g_printerr("[%u/%u] %s failed to start.\n", run->converted + run->failed + run->skipped,
+			run->total, job->uri);
+		batch_job_free(job);
+	}
+
+	if (run->running->len == 0)
+		g_main_loop_quit(run->loop);
+}
+
+/* Prints how far the running pipelines have come */
+static gboolean print_progress(gpointer user_data)
+{
+	BatchRun *run = (BatchRun *)user_data;
+
+	g_print("Progress: %u of %u done, %u failed, %u waiting", run->converted + run->skipped,
+		run->total, run->failed, g_queue_get_length(&run->pending));
+	for (guint i = 0; i < run->running->len; i++)
+	{
+		BatchJob *job = (BatchJob *)g_ptr_array_index(run->running, i);
+		gint64 position, duration;
+		gchar *name = g_path_get_basename(job->output);
+
+		if (gst_element_query_position(job->pipeline, GST_FORMAT_TIME, &position) &&
+			gst_element_query_duration(job->pipeline, GST_FORMAT_TIME, &duration) && duration > 0)
+			g_print(", %s %.0f%%", name, 100.0 * position / duration);
+		else
+			g_print(", %s %d frames", name, g_atomic_int_get(&job->frames));
+		g_free(name);
+	}
+	g_print("\n");
+	return TRUE;
+}
+
+/* Filters every input, returns FALSE when an input failed or the batch could not start */
+gboolean batch_run(const BatchOptions *options)
+{
+	BatchRun run = { 0 };
+	GPtrArray *uris = g_ptr_array_new_with_free_func(g_free);
+	GHashTable *done, *used;
+	gchar *journal_path;
+	GstElement *filter;
+	gint64 start;
+	double seconds;
+	guint progress;
+
+	/* A filter made up front checks the properties once and tells its thread count */
+	filter = options->make_filter();
+	if (filter == NULL)
+	{
+		g_ptr_array_free(uris, TRUE);
+		return FALSE;
+	}
+	gst_object_ref_sink(filter);
+	run.jobs = options->jobs > 0 ? options->jobs : MAX(1, (gint)g_get_num_processors() / filter_threads(filter));
+	gst_object_unref(filter);
+
+	/* Inputs read from the output directory leave out what the batch writes there */
+	if (g_file_test(options->inputs, G_FILE_TEST_IS_DIR) ?
+		!collect_directory(options->inputs, uris, same_path(options->inputs, options->output_dir)) :
+		!collect_list(options->inputs, uris))
+	{
+		g_ptr_array_free(uris, TRUE);
+		return FALSE;
+	}
+	if (g_mkdir_with_parents(options->output_dir, 0755) != 0)
+	{
+		g_printerr("Could not create the output directory %s.\n", options->output_dir);
+		g_ptr_array_free(uris, TRUE);
+		return FALSE;
+	}
+
+	/* Inputs whose output an earlier run completed are not filtered again */
+	journal_path = g_build_filename(options->output_dir, JOURNAL_NAME, NULL);
+	done = read_journal(journal_path);
+	used = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+	g_queue_init(&run.pending);
+	run.options = options;
+	run.total = uris->len;
+	for (guint i = 0; i < uris->len; i++)
+	{
+		BatchJob *job = g_new0(BatchJob, 1);
+
+		job->run = &run;
+		job->uri = g_strdup((const gchar *)g_ptr_array_index(uris, i));
+		job->output = output_for(options, job->uri, used);
+		job->partial = g_strdup_printf("%s.part", job->output);
+
+		if (g_hash_table_contains(done, job->uri) && g_file_test(job->output, G_FILE_TEST_EXISTS))
+		{
+			run.skipped++;
+			batch_job_free(job);
+		}
+		else
+			g_queue_push_tail(&run.pending, job);
+	}
+	g_hash_table_destroy(used);
+	g_hash_table_destroy(done);
+	g_ptr_array_free(uris, TRUE);
+
+	run.journal = fopen(journal_path, "a");
+	if (run.journal == NULL)
+		g_printerr("Could not open %s, this run cannot be resumed.\n", journal_path);
+	g_free(journal_path);
+
+	g_print("Batch of %u videos, %u done in earlier runs, %u pipelines at a time.\n",
+		run.total, run.skipped, run.jobs);
+
+	run.loop = g_main_loop_new(NULL, FALSE);
+	run.running = g_ptr_array_new();
+	start = g_get_monotonic_time();
+	start_jobs(&run);
+	if (run.running->len > 0)
+	{
+		progress = g_timeout_add_seconds(PROGRESS_INTERVAL, print_progress, &run);
+		g_main_loop_run(run.loop);
+		g_source_remove(progress);
+	}
+	seconds = (g_get_monotonic_time() - start) / 1e6;
+
+	g_print("\nBatch done in %.1f s: %u filtered, %u failed, %u skipped, %" G_GUINT64_FORMAT " frames, %.1f fps overall\n",
+		seconds, run.converted, run.failed, run.skipped, run.frames,
+		seconds > 0 ? run.frames / seconds : 0.0);
+
+	if (run.journal != NULL)
+		fclose(run.journal);
+	g_ptr_array_free(run.running, TRUE);
+	g_main_loop_unref(run.loop);
+	return run.failed == 0;
+}
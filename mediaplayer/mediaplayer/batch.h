@@ -0,0 +1,28 @@
+/*
+ * GStreamer Media Player
+ * Offline filtering of many videos, several pipelines at a time.
+ */
+
+#ifndef _BATCH_H_
+#define _BATCH_H_
+
+#include <gst/gst.h>
+
+typedef struct _BatchOptions
+{
+	/* Directory of videos, or a file listing one file name or URI per line */
+	const gchar *inputs;
+	const gchar *output_dir;
+	/* Bin description from raw video to a muxed stream, and the extension of its files */
+	const gchar *encoder;
+	const gchar *extension;
+	/* Pipelines run at once, 0 divides the cores by the threads of the filter */
+	gint jobs;
+	/* Creates a filter element with its properties set, NULL on failure */
+	GstElement *(*make_filter)(void);
+} BatchOptions;
+
+gboolean batch_collect_inputs(const gchar *path, GPtrArray *uris);
+gboolean batch_run(const BatchOptions *options);
+
+#endif
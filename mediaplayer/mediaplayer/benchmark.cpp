@@ -0,0 +1,290 @@
+/*
+ * GStreamer Media Player
+ * Headless throughput measurement of the decode and filter chain.
+ *
+ * Buffer probes record when every frame leaves the decoder, enters and
+ * leaves the filter, and reaches the sink. Frames keep their order along
+ * the chain, so frame i is the i-th buffer at every probe and the stages
+ * can be told apart:
+ *
+ *   decode   time from frame i-1 reaching the sink to frame i leaving the decoder
+ *   filter   time from frame i entering to leaving the filter
+ *   total    time from the start to the last frame reaching the sink
+ *
+ * A flushing seek, like the one that starts looping after the preroll,
+ * throws away the frames between the decoder and the sink. Each probe
+ * point therefore forgets, when the flush passes it, the frames it saw
+ * beyond those that reached the sink, so frame i stays the same frame at
+ * every probe. Times are measured from the start, when the pipeline first
+ * goes to playing, not from the preroll, which waits for the main loop.
+ *
+ * That decode time assumes the chain runs on the decoder's streaming thread.
+ * With queues between the stages the decoder works ahead while later frames
+ * are filtered, and decoding is instead measured by the rate at which frames
+ * leave the decoder.
+ */
+
+#include <gst/gst.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "benchmark.h"
+
+/* Probe points, in the order a frame passes them */
+enum
+{
+	STAGE_DECODED,
+	STAGE_FILTER_IN,
+	STAGE_FILTER_OUT,
+	STAGE_SINK,
+	N_STAGES
+};
+
+typedef struct _BenchmarkProbe
+{
+	Benchmark *bench;
+	gint stage;
+} BenchmarkProbe;
+
+struct _Benchmark
+{
+	/* Arrival times in nanoseconds, one array per stage */
+	GArray *times[N_STAGES];
+	BenchmarkProbe probes[N_STAGES];
+	/* Frames that reached the sink, read by the other probe points on a flush */
+	gint sink_frames;
+	/* When the pipeline first went to playing, 0 before */
+	guint64 start;
+	/* Queues let the stages run concurrently */
+	gboolean concurrent;
+};
+
+/* Records the time a buffer passes a probe point, and drops the flushed frames at the end of a flush */
+static GstPadProbeReturn benchmark_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	BenchmarkProbe *probe = (BenchmarkProbe *)user_data;
+	GArray *times = probe->bench->times[probe->stage];
+	guint64 now;
+
+	if (info->type & GST_PAD_PROBE_TYPE_EVENT_FLUSH)
+	{
+		/* The sink takes no frames from the start of the flush on, its count is final */
+		if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_FLUSH_STOP)
+			g_array_set_size(times, MIN(times->len, (guint)g_atomic_int_get(&probe->bench->sink_frames)));
+		return GST_PAD_PROBE_OK;
+	}
+
+	now = gst_util_get_timestamp();
+	g_array_append_val(times, now);
+	if (probe->stage == STAGE_SINK)
+		g_atomic_int_inc(&probe->bench->sink_frames);
+	return GST_PAD_PROBE_OK;
+}
+
+Benchmark *benchmark_new(void)
+{
+	Benchmark *bench = g_new0(Benchmark, 1);
+
+	for (gint i = 0; i < N_STAGES; i++)
+	{
+		bench->times[i] = g_array_new(FALSE, FALSE, sizeof(guint64));
+		bench->probes[i].bench = bench;
+		bench->probes[i].stage = i;
+	}
+	return bench;
+}
+
+static void add_probe(Benchmark *bench, GstElement *element, const gchar *pad_name, gint stage)
+{
+	GstPad *pad = gst_element_get_static_pad(element, pad_name);
+
+	gst_pad_add_probe(pad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_FLUSH), benchmark_probe, &bench->probes[stage], NULL);
+	gst_object_unref(pad);
+}
+
+/* Installs the probes, first must be the first element after the decoder */
+void benchmark_attach(Benchmark *bench, GstElement *first, GstElement *filter, GstElement *videosink, gboolean concurrent)
+{
+	bench->concurrent = concurrent;
+	add_probe(bench, first, "sink", STAGE_DECODED);
+	add_probe(bench, filter, "sink", STAGE_FILTER_IN);
+	add_probe(bench, filter, "src", STAGE_FILTER_OUT);
+	add_probe(bench, videosink, "sink", STAGE_SINK);
+}
+
+/* Marks the start of the measurement, call when the pipeline first goes to playing */
+void benchmark_start(Benchmark *bench)
+{
+	if (bench->start == 0)
+		bench->start = gst_util_get_timestamp();
+}
+
+static int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return x < y ? -1 : x > y;
+}
+
+/* Nearest-rank percentile of sorted values, p in 0..100 */
+static double percentile(const double *sorted, guint n, double p)
+{
+	guint rank;
+
+	if (n == 0)
+		return 0.0;
+	rank = (guint)(p / 100.0 * n + 0.5);
+	return sorted[CLAMP(rank, 1u, n) - 1];
+}
+
+/* Sorts the latencies in place and summarizes them, in milliseconds */
+LatencyStats benchmark_summarize(double *latencies, guint n)
+{
+	LatencyStats stats;
+
+	qsort(latencies, n, sizeof(double), compare_double);
+	stats.p50 = percentile(latencies, n, 50);
+	stats.p90 = percentile(latencies, n, 90);
+	stats.p99 = percentile(latencies, n, 99);
+	stats.max = n > 0 ? latencies[n - 1] : 0.0;
+	return stats;
+}
+
+/* Appends str as a quoted JSON string, the bytes of UTF-8 characters pass unchanged */
+static void append_json_string(GString *json, const gchar *str)
+{
+	g_string_append_c(json, '"');
+	for (const gchar *c = str; *c != '\0'; c++)
+	{
+		switch (*c)
+		{
+		case '"':
+			g_string_append(json, "\\\"");
+			break;
+		case '\\':
+			g_string_append(json, "\\\\");
+			break;
+		case '\n':
+			g_string_append(json, "\\n");
+			break;
+		case '\r':
+			g_string_append(json, "\\r");
+			break;
+		case '\t':
+			g_string_append(json, "\\t");
+			break;
+		default:
+			if ((guchar)*c < 0x20)
+				g_string_append_printf(json, "\\u%04x", (guchar)*c);
+			else
+				g_string_append_c(json, *c);
+			break;
+		}
+	}
+	g_string_append_c(json, '"');
+}
+
+/* Prints the results, and writes them as JSON to json_path unless it is NULL */
+void benchmark_report(Benchmark *bench, const gchar *uri, const gchar *filter_name, guint loops, const gchar *json_path)
+{
+	guint64 *t[N_STAGES];
+	guint frames = G_MAXUINT;
+	double decode_ns = 0, filter_ns = 0, total_ns = 0;
+	double *filter_latency, *chain_latency;
+	LatencyStats filter_stats, chain_stats;
+	double decode_fps, filter_fps, total_fps;
+	guint64 start;
+	guint decoded = 0;
+
+	for (gint i = 0; i < N_STAGES; i++)
+	{
+		t[i] = (guint64 *)bench->times[i]->data;
+		frames = MIN(frames, bench->times[i]->len);
+	}
+
+	if (frames < 2)
+	{
+		g_printerr("Benchmark: too few frames to report (%u).\n", frames);
+		return;
+	}
+
+	/* Frames prerolled before the start count, the time they waited for it does not */
+	start = MAX(bench->start, t[STAGE_DECODED][0]);
+
+	filter_latency = g_new(double, frames);
+	chain_latency = g_new(double, frames);
+	for (guint i = 0; i < frames; i++)
+	{
+		if (i > 0 && !bench->concurrent && t[STAGE_DECODED][i] > MAX(t[STAGE_SINK][i - 1], start))
+			decode_ns += (double)(t[STAGE_DECODED][i] - MAX(t[STAGE_SINK][i - 1], start));
+		filter_ns += (double)(t[STAGE_FILTER_OUT][i] - t[STAGE_FILTER_IN][i]);
+		filter_latency[i] = (t[STAGE_FILTER_OUT][i] - t[STAGE_FILTER_IN][i]) / 1e6;
+		chain_latency[i] = (t[STAGE_SINK][i] - t[STAGE_DECODED][i]) / 1e6;
+	}
+	total_ns = t[STAGE_SINK][frames - 1] > start ? (double)(t[STAGE_SINK][frames - 1] - start) : 0.0;
+	decoded = frames - 1;
+	if (bench->concurrent)
+	{
+		/* The decoder works ahead during the preroll, its rate counts from the first frame after the start */
+		guint first = 0;
+
+		while (first + 1 < frames && t[STAGE_DECODED][first] < start)
+			first++;
+		decoded = frames - 1 - first;
+		decode_ns = (double)(t[STAGE_DECODED][frames - 1] - t[STAGE_DECODED][first]);
+	}
+
+	/* The first frame has no predecessor to measure decoding from */
+	decode_fps = decode_ns > 0 ? decoded / (decode_ns / 1e9) : 0.0;
+	filter_fps = filter_ns > 0 ? frames / (filter_ns / 1e9) : 0.0;
+	total_fps = total_ns > 0 ? frames / (total_ns / 1e9) : 0.0;
+	filter_stats = benchmark_summarize(filter_latency, frames);
+	chain_stats = benchmark_summarize(chain_latency, frames);
+
+	g_print("\nBenchmark of %s on %s, %u loop(s)\n", filter_name, uri, loops);
+	g_print("  frames          %u\n", frames);
+	g_print("  decode          %9.1f fps\n", decode_fps);
+	g_print("  filter          %9.1f fps\n", filter_fps);
+	g_print("  total           %9.1f fps\n", total_fps);
+	g_print("  filter latency  p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+		filter_stats.p50, filter_stats.p90, filter_stats.p99, filter_stats.max);
+	g_print("  chain latency   p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+		chain_stats.p50, chain_stats.p90, chain_stats.p99, chain_stats.max);
+
+	if (json_path != NULL)
+	{
+		GString *json = g_string_new("{\n  \"uri\": ");
+		GError *err = NULL;
+
+		/* The names come from the command line and may hold any character */
+		append_json_string(json, uri);
+		g_string_append(json, ",\n  \"filter\": ");
+		append_json_string(json, filter_name);
+		g_string_append_printf(json, ",\n"
+			"  \"loops\": %u,\n"
+			"  \"frames\": %u,\n"
+			"  \"fps\": { \"decode\": %.3f, \"filter\": %.3f, \"total\": %.3f },\n"
+			"  \"filter_latency_ms\": { \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f },\n"
+			"  \"chain_latency_ms\": { \"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f }\n"
+			"}\n",
+			loops, frames, decode_fps, filter_fps, total_fps,
+			filter_stats.p50, filter_stats.p90, filter_stats.p99, filter_stats.max,
+			chain_stats.p50, chain_stats.p90, chain_stats.p99, chain_stats.max);
+
+		if (!g_file_set_contents(json_path, json->str, json->len, &err))
+		{
+			g_printerr("Could not write %s: %s\n", json_path, err->message);
+			g_clear_error(&err);
+		}
+		g_string_free(json, TRUE);
+	}
+
+	g_free(filter_latency);
+	g_free(chain_latency);
+}
+
+void benchmark_free(Benchmark *bench)
+{
+	for (gint i = 0; i < N_STAGES; i++)
+		g_array_free(bench->times[i], TRUE);
+	g_free(bench);
+}
@@ -0,0 +1,27 @@
+/*
+ * GStreamer Media Player
+ * Headless throughput measurement of the decode and filter chain.
+ */
+
+#ifndef _BENCHMARK_H_
+#define _BENCHMARK_H_
+
+#include <gst/gst.h>
+
+typedef struct _Benchmark Benchmark;
+
+/* Summary of a latency distribution, in milliseconds */
+typedef struct _LatencyStats
+{
+	double p50, p90, p99, max;
+} LatencyStats;
+
+Benchmark *benchmark_new(void);
+void benchmark_attach(Benchmark *bench, GstElement *first, GstElement *filter, GstElement *videosink, gboolean concurrent);
+void benchmark_start(Benchmark *bench);
+void benchmark_report(Benchmark *bench, const gchar *uri, const gchar *filter_name, guint loops, const gchar *json_path);
+void benchmark_free(Benchmark *bench);
+
+LatencyStats benchmark_summarize(double *latencies, guint n);
+
+#endif
@@ -0,0 +1,273 @@
+/*
+ * GStreamer Media Player
+ * Hands the filtered frames to consumers in the same process, without copies.
+ *
+ * A tee after the filter feeds a second branch, queue ! appsink, next to the
+ * one to the display. The tee passes the same buffer to both branches, so
+ * the appsink receives the very buffer the filter wrote and the consumer
+ * reads it mapped in place, holding a reference for as long as it needs it.
+ *
+ * The queue decides what happens when the consumer falls behind: with the
+ * block policy it fills up and holds the tee, and with it the filter and
+ * the display, until the consumer catches up; the drop policies make it
+ * leaky so the display never waits for the consumer. The appsink does not
+ * sync to the clock or take part in prerolling, so the consumer gets each
+ * frame as soon as it is filtered and a consumer that never returns cannot
+ * stall the start of the pipeline.
+ */
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include "export.h"
+#include "queues.h"
+
+struct _FrameExport
+{
+	guint max_frames;
+	ExportPolicy policy;
+	FrameExportFunc func;
+	gpointer user_data;
+	GstElement *queue;
+	GstElement *appsink;
+	GstPad *pad;
+	gulong probe;
+
+	/* Caps of the last sample and the layout they describe, used on the appsink's thread only */
+	GstCaps *caps;
+	GstVideoInfo info;
+
+	/* Protects everything below, written by the filter's and the export branch's streaming threads */
+	GMutex lock;
+	guint64 frames;
+	guint64 full;
+	guint64 latency_sum;
+	guint64 latency_max;
+};
+
+static const gchar *policy_names[] = { "block", "drop-oldest", "drop-newest" };
+
+/*
+ *	Time a buffer left the filter, carried on the buffer itself, which is
+ *	the same in both branches. Frames the queue drops take it with them, and
+ *	a buffer back from the pool gets a new one the next time it passes.
+ */
+static GQuark entered_quark;
+
+ExportedFrame *exported_frame_ref(ExportedFrame *frame)
+{
+	g_atomic_int_inc(&frame->ref_count);
+	return frame;
+}
+
+/* Unmaps the frame once the last reference is gone, which returns the buffer to the filter's pool */
+void exported_frame_unref(ExportedFrame *frame)
+{
+	if (!g_atomic_int_dec_and_test(&frame->ref_count))
+		return;
+
+	gst_video_frame_unmap(&frame->frame);
+	g_free(frame);
+}
+
+/* Reads a policy name as given to --export-policy */
+gboolean frame_export_parse_policy(const gchar *name, ExportPolicy *policy)
+{
+	for (guint i = 0; i < G_N_ELEMENTS(policy_names); i++)
+	{
+		if (g_strcmp0(name, policy_names[i]) == 0)
+		{
+			*policy = (ExportPolicy)i;
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+/* Keeps at most max_frames filtered frames waiting for the consumer */
+FrameExport *frame_export_new(guint max_frames, ExportPolicy policy)
+{
+	FrameExport *exp = g_new0(FrameExport, 1);
+
+	exp->max_frames = MAX(max_frames, 1);
+	exp->policy = policy;
+	gst_video_info_init(&exp->info);
+	g_mutex_init(&exp->lock);
+	if (entered_quark == 0)
+		entered_quark = g_quark_from_static_string("frame-export-entered");
+	return exp;
+}
+
+/* Sets the consumer, before the pipeline starts */
+void frame_export_set_callback(FrameExport *exp, FrameExportFunc func, gpointer user_data)
+{
+	exp->func = func;
+	exp->user_data = user_data;
+}
+
+/* Notes when a frame leaves the filter, on the filter's streaming thread */
+static GstPadProbeReturn frame_export_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	guint64 *time = g_new(guint64, 1);
+
+	*time = gst_util_get_timestamp();
+	gst_mini_object_set_qdata(GST_MINI_OBJECT_CAST(GST_PAD_PROBE_INFO_BUFFER(info)), entered_quark, time, g_free);
+	return GST_PAD_PROBE_OK;
+}
+
+/* The consumer is behind: the queue either blocks or drops a frame */
+static void frame_export_overrun(GstElement *queue, FrameExport *exp)
+{
+	g_mutex_lock(&exp->lock);
+	exp->full++;
+	g_mutex_unlock(&exp->lock);
+}
+
+/* Maps the new frame and hands it to the consumer, on the export branch's streaming thread */
+static GstFlowReturn frame_export_new_sample(GstAppSink *appsink, gpointer user_data)
+{
+	FrameExport *exp = (FrameExport *)user_data;
+	GstSample *sample = gst_app_sink_pull_sample(appsink);
+	GstBuffer *buffer;
+	GstCaps *caps;
+	ExportedFrame *frame;
+	guint64 *entered;
+	guint64 now;
+
+	if (sample == NULL)
+		return GST_FLOW_EOS;
+
+	buffer = gst_sample_get_buffer(sample);
+	caps = gst_sample_get_caps(sample);
+	if (caps != exp->caps)
+	{
+		if (caps == NULL || !gst_video_info_from_caps(&exp->info, caps))
+		{
+			gst_sample_unref(sample);
+			return GST_FLOW_NOT_NEGOTIATED;
+		}
+		gst_caps_replace(&exp->caps, caps);
+	}
+
+	/* The frame keeps its own reference to the buffer, the sample can go */
+	frame = g_new0(ExportedFrame, 1);
+	if (buffer == NULL || !gst_video_frame_map(&frame->frame, &exp->info, buffer, GST_MAP_READ))
+	{
+		g_free(frame);
+		gst_sample_unref(sample);
+		return GST_FLOW_ERROR;
+	}
+	frame->ref_count = 1;
+
+	now = gst_util_get_timestamp();
+	entered = (guint64 *)gst_mini_object_steal_qdata(GST_MINI_OBJECT_CAST(buffer), entered_quark);
+	gst_sample_unref(sample);
+	if (entered != NULL)
+	{
+		frame->latency = now - *entered;
+		g_free(entered);
+	}
+	g_mutex_lock(&exp->lock);
+	frame->number = exp->frames++;
+	exp->latency_sum += frame->latency;
+	exp->latency_max = MAX(exp->latency_max, frame->latency);
+	g_mutex_unlock(&exp->lock);
+
+	if (exp->func != NULL)
+		exp->func(frame, exp->user_data);
+	exported_frame_unref(frame);
+	return GST_FLOW_OK;
+}
+
+/* Takes the export branch out of the pipeline again, giving back the tee's src pad; the tee stays, it is the caller's */
+static void frame_export_detach(FrameExport *exp, GstElement *pipeline, GstElement *tee)
+{
+	GstPad *sinkpad = gst_element_get_static_pad(exp->queue, "sink");
+	GstPad *teepad = gst_pad_get_peer(sinkpad);
+
+	if (teepad != NULL)
+	{
+		gst_pad_unlink(teepad, sinkpad);
+		gst_element_release_request_pad(tee, teepad);
+		gst_object_unref(teepad);
+	}
+	gst_object_unref(sinkpad);
+	gst_bin_remove_many(GST_BIN(pipeline), exp->queue, exp->appsink, NULL);
+}
+
+/* Adds the export branch to the pipeline and links it to a tee following the filter */
+gboolean frame_export_attach(FrameExport *exp, GstElement *pipeline, GstElement *tee)
+{
+	GstAppSinkCallbacks callbacks = { 0 };
+
+	exp->queue = queues_make("queue-export", exp->max_frames, exp->policy == EXPORT_POLICY_DROP_OLDEST);
+	exp->appsink = gst_element_factory_make("appsink", "export");
+	if (exp->queue == NULL || exp->appsink == NULL)
+	{
+		g_printerr("Export branch could not be created.\n");
+		if (exp->queue != NULL)
+			gst_object_unref(gst_object_ref_sink(exp->queue));
+		if (exp->appsink != NULL)
+			gst_object_unref(gst_object_ref_sink(exp->appsink));
+		exp->queue = NULL;
+		exp->appsink = NULL;
+		return FALSE;
+	}
+	if (exp->policy == EXPORT_POLICY_DROP_NEWEST)
+		gst_util_set_object_arg(G_OBJECT(exp->queue), "leaky", "upstream");
+
+	/* The queue holds the waiting frames, the appsink keeps none of its own, not even the last one */
+	g_object_set(exp->appsink, "sync", FALSE, "async", FALSE, "max-buffers", 1u, "drop", FALSE,
+		"enable-last-sample", FALSE, NULL);
+	callbacks.new_sample = frame_export_new_sample;
+	gst_app_sink_set_callbacks(GST_APP_SINK(exp->appsink), &callbacks, exp, NULL);
+	g_signal_connect(exp->queue, "overrun", G_CALLBACK(frame_export_overrun), exp);
+
+	exp->queue = GST_ELEMENT(gst_object_ref(exp->queue));
+	exp->appsink = GST_ELEMENT(gst_object_ref(exp->appsink));
+	gst_bin_add_many(GST_BIN(pipeline), exp->queue, exp->appsink, NULL);
+	if (!gst_element_link_many(tee, exp->queue, exp->appsink, NULL))
+	{
+		g_printerr("Export branch could not be linked.\n");
+		frame_export_detach(exp, pipeline, tee);
+		return FALSE;
+	}
+
+	exp->pad = gst_element_get_static_pad(tee, "sink");
+	exp->probe = gst_pad_add_probe(exp->pad, GST_PAD_PROBE_TYPE_BUFFER, frame_export_probe, exp, NULL);
+	return TRUE;
+}
+
+/* Prints how many frames the consumer got and how fast, call once the pipeline has stopped */
+void frame_export_report(FrameExport *exp)
+{
+	double n = exp->frames > 0 ? (double)exp->frames : 1.0;
+
+	g_print("\nExport, filtered frames handed to the consumer (policy %s, %u frames waiting at most)\n",
+		policy_names[exp->policy], exp->max_frames);
+	g_print("  frames %" G_GUINT64_FORMAT ", latency mean %.3f ms, max %.3f ms\n",
+		exp->frames, exp->latency_sum / n / 1e6, exp->latency_max / 1e6);
+	if (exp->policy == EXPORT_POLICY_BLOCK)
+		g_print("  the consumer held up the filter %" G_GUINT64_FORMAT " times\n", exp->full);
+	else
+		g_print("  dropped %" G_GUINT64_FORMAT " frames the consumer could not keep up with\n", exp->full);
+}
+
+void frame_export_free(FrameExport *exp)
+{
+	if (exp->pad != NULL)
+	{
+		gst_pad_remove_probe(exp->pad, exp->probe);
+		gst_object_unref(exp->pad);
+	}
+	if (exp->queue != NULL)
+	{
+		g_signal_handlers_disconnect_by_data(exp->queue, exp);
+		gst_object_unref(exp->queue);
+	}
+	if (exp->appsink != NULL)
+		gst_object_unref(exp->appsink);
+	gst_caps_replace(&exp->caps, NULL);
+	g_mutex_clear(&exp->lock);
+	g_free(exp);
+}
@@ -0,0 +1,57 @@
+/*
+ * GStreamer Media Player
+ * Hands the filtered frames to consumers in the same process, without copies.
+ */
+
+#ifndef _EXPORT_H_
+#define _EXPORT_H_
+
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+typedef struct _FrameExport FrameExport;
+
+/* What happens to a filtered frame when the consumer is still busy with earlier ones */
+typedef enum
+{
+	/* Wait for the consumer, slowing the filter and the display down to its pace */
+	EXPORT_POLICY_BLOCK,
+	/* Drop the oldest waiting frame, the consumer always gets the latest */
+	EXPORT_POLICY_DROP_OLDEST,
+	/* Drop the new frame, the consumer gets every frame of a burst it can keep up with */
+	EXPORT_POLICY_DROP_NEWEST
+} ExportPolicy;
+
+/*
+ *	A filtered frame, mapped for reading. It shares the memory of the buffer
+ *	the filter wrote, which stays out of the filter's pool until the last
+ *	reference is dropped, so consumers should not hold on to many frames.
+ */
+typedef struct _ExportedFrame
+{
+	GstVideoFrame frame;
+	/* Counts the frames handed out, dropped frames leave gaps */
+	guint64 number;
+	/* Time from the frame leaving the filter to being handed out, in nanoseconds */
+	guint64 latency;
+	gint ref_count;
+} ExportedFrame;
+
+/*
+ *	Called on the streaming thread of the export branch for every frame. The
+ *	frame is only valid during the call unless the consumer takes a reference.
+ */
+typedef void (*FrameExportFunc)(ExportedFrame *frame, gpointer user_data);
+
+ExportedFrame *exported_frame_ref(ExportedFrame *frame);
+void exported_frame_unref(ExportedFrame *frame);
+
+gboolean frame_export_parse_policy(const gchar *name, ExportPolicy *policy);
+
+FrameExport *frame_export_new(guint max_frames, ExportPolicy policy);
+void frame_export_set_callback(FrameExport *exp, FrameExportFunc func, gpointer user_data);
+gboolean frame_export_attach(FrameExport *exp, GstElement *pipeline, GstElement *tee);
+void frame_export_report(FrameExport *exp);
+void frame_export_free(FrameExport *exp);
+
+#endif
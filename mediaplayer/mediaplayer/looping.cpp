@@ -0,0 +1,147 @@
+/*
+ * GStreamer Media Player
+ * Latency of the boundary between loops when looping with segment seeks.
+ *
+ * A segment seek issued on SEGMENT_DONE starts the next loop without a
+ * flush, so the frames of the ending loop still in the queues, the filter
+ * and the sink are played out and the new segment follows them. The sink
+ * pad is probed for the segment event that starts the new loop and the
+ * first frame after it, giving for every boundary
+ *
+ *   seek   time from the seek being issued to the first frame of the new loop
+ *          reaching the sink
+ *   gap    time between the last frame of the old and the first frame of the
+ *          new loop at the sink, next to the usual time between frames
+ */
+
+#include <gst/gst.h>
+#include "looping.h"
+#include "benchmark.h"
+
+typedef enum
+{
+	BOUNDARY_NONE,
+	/* The seek is issued, the new segment has not reached the sink */
+	BOUNDARY_SEEKING,
+	/* The new segment reached the sink, its first frame has not */
+	BOUNDARY_SEGMENT
+} BoundaryState;
+
+struct _LoopMonitor
+{
+	GstPad *pad;
+	gulong probe;
+
+	/* Protects everything below, written by the sink's streaming thread and the main loop */
+	GMutex lock;
+	BoundaryState state;
+	guint64 seek_time;
+	guint64 last_frame;
+	GArray *seek_latency;
+	GArray *gaps;
+	GArray *intervals;
+};
+
+static GstPadProbeReturn loop_monitor_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	LoopMonitor *monitor = (LoopMonitor *)user_data;
+	guint64 now = gst_util_get_timestamp();
+
+	g_mutex_lock(&monitor->lock);
+	if (info->type & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+	{
+		if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_SEGMENT &&
+			monitor->state == BOUNDARY_SEEKING)
+			monitor->state = BOUNDARY_SEGMENT;
+	}
+	else
+	{
+		double since_last = monitor->last_frame > 0 ? (now - monitor->last_frame) / 1e6 : -1.0;
+
+		if (monitor->state == BOUNDARY_SEGMENT)
+		{
+			double seek = (now - monitor->seek_time) / 1e6;
+
+			g_array_append_val(monitor->seek_latency, seek);
+			if (since_last >= 0)
+				g_array_append_val(monitor->gaps, since_last);
+			monitor->state = BOUNDARY_NONE;
+		}
+		else if (since_last >= 0)
+		{
+			g_array_append_val(monitor->intervals, since_last);
+		}
+		monitor->last_frame = now;
+	}
+	g_mutex_unlock(&monitor->lock);
+
+	return GST_PAD_PROBE_OK;
+}
+
+/* Watches the frames and segments arriving at the sink */
+LoopMonitor *loop_monitor_new(GstElement *videosink)
+{
+	LoopMonitor *monitor = g_new0(LoopMonitor, 1);
+
+	g_mutex_init(&monitor->lock);
+	monitor->seek_latency = g_array_new(FALSE, FALSE, sizeof(double));
+	monitor->gaps = g_array_new(FALSE, FALSE, sizeof(double));
+	monitor->intervals = g_array_new(FALSE, FALSE, sizeof(double));
+	monitor->pad = gst_element_get_static_pad(videosink, "sink");
+	monitor->probe = gst_pad_add_probe(monitor->pad,
+		(GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+		loop_monitor_probe, monitor, NULL);
+	return monitor;
+}
+
+/* Marks the seek into the next loop, call right before issuing it */
+void loop_monitor_boundary(LoopMonitor *monitor)
+{
+	g_mutex_lock(&monitor->lock);
+	monitor->seek_time = gst_util_get_timestamp();
+	monitor->state = BOUNDARY_SEEKING;
+	g_mutex_unlock(&monitor->lock);
+}
+
+static void print_latency(const gchar *label, GArray *values)
+{
+	double *copy = g_new(double, values->len);
+	double mean = 0.0;
+	LatencyStats stats;
+
+	/* Summarizing sorts in place, so it works on a copy */
+	for (guint i = 0; i < values->len; i++)
+	{
+		copy[i] = g_array_index(values, double, i);
+		mean += copy[i];
+	}
+	mean /= values->len;
+	stats = benchmark_summarize(copy, values->len);
+	g_print("  %-8s mean %.3f ms, p50 %.3f ms, max %.3f ms\n", label, mean, stats.p50, stats.max);
+	g_free(copy);
+}
+
+/* Prints the boundary latencies, call once the pipeline has stopped */
+void loop_monitor_report(LoopMonitor *monitor)
+{
+	if (monitor->seek_latency->len == 0)
+		return;
+
+	g_print("\nLoop boundaries, %u measured\n", monitor->seek_latency->len);
+	print_latency("seek", monitor->seek_latency);
+	if (monitor->gaps->len > 0)
+		print_latency("gap", monitor->gaps);
+	if (monitor->intervals->len > 0)
+		print_latency("frames", monitor->intervals);
+}
+
+void loop_monitor_free(LoopMonitor *monitor)
+{
+	gst_pad_remove_probe(monitor->pad, monitor->probe);
+	gst_object_unref(monitor->pad);
+	g_array_free(monitor->seek_latency, TRUE);
+	g_array_free(monitor->gaps, TRUE);
+	g_array_free(monitor->intervals, TRUE);
+	g_mutex_clear(&monitor->lock);
+	g_free(monitor);
+}
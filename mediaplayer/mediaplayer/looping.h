@@ -0,0 +1,18 @@
+/*
+ * GStreamer Media Player
+ * Latency of the boundary between loops when looping with segment seeks.
+ */
+
+#ifndef _LOOPING_H_
+#define _LOOPING_H_
+
+#include <gst/gst.h>
+
+typedef struct _LoopMonitor LoopMonitor;
+
+LoopMonitor *loop_monitor_new(GstElement *videosink);
+void loop_monitor_boundary(LoopMonitor *monitor);
+void loop_monitor_report(LoopMonitor *monitor);
+void loop_monitor_free(LoopMonitor *monitor);
+
+#endif
@@ -6,7 +6,71 @@
 
 #include <gst/gst.h>
 #include <stdio.h>
+#include "benchmark.h"
+#include "tracer.h"
+#include "queues.h"
+#include "looping.h"
+#include "batch.h"
+#include "playlist.h"
+#include "export.h"
+#include "trickplay.h"
 
+/* Played when no URI is given on the command line, must be set by the user */
+#define DEFAULT_URI "file:///C:/Change/to/Address/to/Repository/ContextVision/media/testvideo4.mp4"
+#define DEFAULT_FILTER "blurfilter"
+#define DEFAULT_QUEUE_BUFFERS 3
+#define DEFAULT_OUTPUT_DIR "filtered"
+#define DEFAULT_ENCODER "x264enc ! mp4mux"
+#define DEFAULT_EXTENSION "mp4"
+#define DEFAULT_EXPORT_BUFFERS 2
+#define DEFAULT_EXPORT_POLICY "drop-oldest"
+
+/* Command line options */
+static gchar *opt_uri = NULL;
+static gchar *opt_filter = NULL;
+static gchar **opt_properties = NULL;
+static gboolean opt_benchmark = FALSE;
+static gint opt_loops = 1;
+static gchar *opt_json = NULL;
+static gchar *opt_trace = NULL;
+static gchar *opt_queues = NULL;
+static gint opt_queue_buffers = DEFAULT_QUEUE_BUFFERS;
+static gboolean opt_queue_leaky = FALSE;
+static gchar *opt_playlist = NULL;
+static gchar *opt_batch = NULL;
+static gchar *opt_output_dir = NULL;
+static gchar *opt_encoder = NULL;
+static gchar *opt_extension = NULL;
+static gint opt_jobs = 0;
+static gboolean opt_export = FALSE;
+static gint opt_export_buffers = DEFAULT_EXPORT_BUFFERS;
+static gchar *opt_export_policy = NULL;
+static gchar *opt_ring = NULL;
+
+static GOptionEntry entries[] =
+{
+	{ "uri", 'u', 0, G_OPTION_ARG_STRING, &opt_uri, "URI or file name of the video to play", "URI" },
+	{ "filter", 'f', 0, G_OPTION_ARG_STRING, &opt_filter, "Filter element to apply (default " DEFAULT_FILTER ")", "ELEMENT" },
+	{ "set", 's', 0, G_OPTION_ARG_STRING_ARRAY, &opt_properties, "Set a filter property, may be repeated", "PROPERTY=VALUE" },
+	{ "benchmark", 'b', 0, G_OPTION_ARG_NONE, &opt_benchmark, "Run headless as fast as possible and report throughput", NULL },
+	{ "loops", 'n', 0, G_OPTION_ARG_INT, &opt_loops, "Number of times to play the video in benchmark mode (default 1)", "N" },
+	{ "json", 'j', 0, G_OPTION_ARG_FILENAME, &opt_json, "Also write the benchmark results as JSON to FILE", "FILE" },
+	{ "trace", 't', 0, G_OPTION_ARG_FILENAME, &opt_trace, "Trace the latency of every hop and write a Chrome trace to FILE", "FILE" },
+	{ "queues", 'q', 0, G_OPTION_ARG_STRING, &opt_queues, "Run the listed stages on threads of their own behind a queue: convert, filter, sink or all", "LIST" },
+	{ "queue-buffers", 0, 0, G_OPTION_ARG_INT, &opt_queue_buffers, "Frames each queue holds at most (default 3)", "N" },
+	{ "queue-leaky", 0, 0, G_OPTION_ARG_NONE, &opt_queue_leaky, "Drop the oldest frame when a queue is full instead of blocking, for live use", NULL },
+	{ "playlist", 'p', 0, G_OPTION_ARG_FILENAME, &opt_playlist, "Play every video in a directory, or listed in a file, through one pipeline", "PATH" },
+	{ "batch", 'B', 0, G_OPTION_ARG_FILENAME, &opt_batch, "Filter every video in a directory, or listed in a file, to encoded files", "PATH" },
+	{ "output-dir", 'o', 0, G_OPTION_ARG_FILENAME, &opt_output_dir, "Directory of the batch output and its journal (default " DEFAULT_OUTPUT_DIR ")", "DIR" },
+	{ "encoder", 'e', 0, G_OPTION_ARG_STRING, &opt_encoder, "Elements encoding and muxing the batch output (default \"" DEFAULT_ENCODER "\")", "PIPELINE" },
+	{ "extension", 0, 0, G_OPTION_ARG_STRING, &opt_extension, "Extension of the batch output files (default " DEFAULT_EXTENSION ")", "EXT" },
+	{ "jobs", 'J', 0, G_OPTION_ARG_INT, &opt_jobs, "Videos filtered at once in batch mode (default cores divided by the filter's shared workers, or cores when it is not parallel)", "N" },
+	{ "export", 'x', 0, G_OPTION_ARG_NONE, &opt_export, "Also hand the filtered frames to an in-process consumer through an appsink", NULL },
+	{ "export-buffers", 0, 0, G_OPTION_ARG_INT, &opt_export_buffers, "Filtered frames waiting for the consumer at most (default 2)", "N" },
+	{ "export-policy", 0, 0, G_OPTION_ARG_STRING, &opt_export_policy, "When the consumer is behind: block, drop-oldest or drop-newest (default " DEFAULT_EXPORT_POLICY ")", "POLICY" },
+	{ "ring", 'r', 0, G_OPTION_ARG_STRING, &opt_ring, "Also publish the filtered frames in the shared memory ring NAME for other processes", "NAME" },
+	{ NULL }
+};
 
 /* Structure to contain all our information, so we can pass it to callbacks */
 typedef struct _CustomData
@@ -16,35 +80,265 @@ typedef struct _CustomData
 	GstElement *videoconvert;
 	GstElement *videosink;
 	GstElement *filter;
+	/* First element after the decoder, linked when the decoder's pad appears */
+	GstElement *head;
+	GMainLoop *loop;
+	LoopMonitor *loop_monitor;
+	Playlist *playlist;
+	/* Commands typed on the console, when playing interactively */
+	TrickPlay *trick_play;
+	/* Measures the chain when benchmarking */
+	Benchmark *bench;
+	/* Loops left to play in benchmark mode */
+	gint loops_left;
+	/* The first segment seek is done, the next preroll starts playing */
+	gboolean looping;
+	/* EOS was sent to end the last loop */
+	gboolean ending;
+	gboolean reported_latency;
+	gboolean failed;
 } CustomData;
 
-/* Quick fix to make GstMessageType cooperate with or operators */
-inline GstMessageType operator | (GstMessageType lhs, GstMessageType rhs)
+/* Stands in for the analytics reading the exported frames, sums the luma in place */
+typedef struct _ExportConsumer
 {
-	return static_cast<GstMessageType>(
-		static_cast<int>(lhs) | static_cast<int>(rhs));
-}
+	guint64 frames;
+	double luma_sum;
+} ExportConsumer;
+
+/* Stages a queue can be put in front of, in pipeline order */
+static const gchar *queue_stages[] = { "convert", "filter", "sink" };
 
 /* Handler for the pad-added signal */
 static void pad_added_handler(GstElement *src, GstPad *pad, CustomData *data);
 
+/* Handler for the messages on the pipeline's bus */
+static gboolean bus_handler(GstBus *bus, GstMessage *msg, CustomData *data);
+
+/* Applies the PROPERTY=VALUE assignments to the filter */
+static gboolean set_filter_properties(GstElement *filter, gchar **properties);
+
+/* Whether --queues asks for a queue in front of the stage, unknown stages fail the check in main */
+static gboolean queue_before(const gchar *stage)
+{
+	gchar **stages;
+	gboolean found = FALSE;
+
+	if (opt_queues == NULL)
+		return FALSE;
+
+	stages = g_strsplit(opt_queues, ",", -1);
+	for (gchar **s = stages; *s != NULL && !found; s++)
+		found = g_strcmp0(g_strstrip(*s), stage) == 0 || g_strcmp0(*s, "all") == 0;
+	g_strfreev(stages);
+	return found;
+}
+
+/* Returns FALSE with a message when --queues names a stage that does not exist */
+static gboolean check_queue_stages(void)
+{
+	gchar **stages;
+	gboolean valid = TRUE;
+
+	if (opt_queues == NULL)
+		return TRUE;
+
+	stages = g_strsplit(opt_queues, ",", -1);
+	for (gchar **s = stages; *s != NULL; s++)
+	{
+		gboolean known = g_strcmp0(g_strstrip(*s), "all") == 0;
+		for (guint i = 0; i < G_N_ELEMENTS(queue_stages); i++)
+			known = known || g_strcmp0(*s, queue_stages[i]) == 0;
+		if (!known)
+		{
+			g_printerr("Unknown stage '%s' in --queues, expected convert, filter, sink or all.\n", *s);
+			valid = FALSE;
+		}
+	}
+	g_strfreev(stages);
+	return valid;
+}
+
+/* Creates the filter with the --set properties applied, for every video of a batch */
+static GstElement *make_filter(void)
+{
+	GstElement *filter = gst_element_factory_make(opt_filter, NULL);
+
+	if (filter == NULL)
+	{
+		g_printerr("Filter %s could not be created.\n", opt_filter);
+		return NULL;
+	}
+	if (!set_filter_properties(filter, opt_properties))
+	{
+		gst_object_unref(gst_object_ref_sink(filter));
+		return NULL;
+	}
+	return filter;
+}
+
+/* Consumer of the exported frames, on the export branch's streaming thread */
+static void consume_frame(ExportedFrame *frame, gpointer user_data)
+{
+	ExportConsumer *consumer = (ExportConsumer *)user_data;
+	const guint8 *row = (const guint8 *)GST_VIDEO_FRAME_COMP_DATA(&frame->frame, 0);
+	gint stride = GST_VIDEO_FRAME_COMP_STRIDE(&frame->frame, 0);
+	gint width = GST_VIDEO_FRAME_COMP_WIDTH(&frame->frame, 0);
+	gint height = GST_VIDEO_FRAME_COMP_HEIGHT(&frame->frame, 0);
+	guint64 sum = 0;
+
+	for (gint y = 0; y < height; y++, row += stride)
+		for (gint x = 0; x < width; x++)
+			sum += row[x];
+	consumer->luma_sum += (double)sum / ((double)width * height);
+	consumer->frames++;
+}
+
+/* Adds a branch publishing the filtered frames in a shared memory ring, behind a leaky queue so the display never waits for it */
+static gboolean attach_ring(GstElement *pipeline, GstElement *tee)
+{
+	GstElement *queue = queues_make("queue-ring", DEFAULT_EXPORT_BUFFERS, TRUE);
+	GstElement *ringsink = gst_element_factory_make("ringsink", "ringsink");
+
+	if (queue == NULL || ringsink == NULL)
+	{
+		g_printerr("Ring branch could not be created, is the ringsink plugin installed?\n");
+		if (queue != NULL)
+			gst_object_unref(gst_object_ref_sink(queue));
+		if (ringsink != NULL)
+			gst_object_unref(gst_object_ref_sink(ringsink));
+		return FALSE;
+	}
+	g_object_set(ringsink, "ring-name", opt_ring, "async", FALSE, NULL);
+	gst_bin_add_many(GST_BIN(pipeline), queue, ringsink, NULL);
+	if (!gst_element_link_many(tee, queue, ringsink, NULL))
+	{
+		g_printerr("Ring branch could not be linked.\n");
+		return FALSE;
+	}
+	g_print("Publishing the filtered frames in ring %s.\n", opt_ring);
+	return TRUE;
+}
+
+/* Waits for a key press when running interactively, so the console stays open */
+static void wait_for_key(void)
+{
+	if (!opt_benchmark)
+		getchar();
+}
+
 int main(int argc, char *argv[])
 {
-	CustomData data;
+	CustomData data = { 0 };
 	GstBus *bus;
-	GstMessage *msg;
 	GstStateChangeReturn ret;
-	gboolean terminate = FALSE;
-	char c;
+	GOptionContext *context;
+	GError *error = NULL;
+	Benchmark *bench = NULL;
+	Tracer *tracer = NULL;
+	QueueMonitor *queue_monitor = NULL;
+	GstElement *stages[G_N_ELEMENTS(queue_stages)];
+	GstElement *chain[2 * G_N_ELEMENTS(queue_stages) + 1];
+	guint chain_length = 0;
+	GstElement *tee = NULL;
+	FrameExport *frame_export = NULL;
+	ExportPolicy export_policy = EXPORT_POLICY_DROP_OLDEST;
+	ExportConsumer consumer = { 0 };
+	gchar *uri;
+
+	/* Initialize GStreamer and parse the command line */
+	context = g_option_context_new("- play a video through a ContextVision filter");
+	g_option_context_add_main_entries(context, entries, NULL);
+	g_option_context_add_group(context, gst_init_get_option_group());
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		g_printerr("Option parsing failed: %s\n", error->message);
+		g_clear_error(&error);
+		g_option_context_free(context);
+		return -1;
+	}
+	g_option_context_free(context);
+
+	if (opt_filter == NULL)
+		opt_filter = g_strdup(DEFAULT_FILTER);
+	if (opt_loops < 1)
+		opt_loops = 1;
+	if (opt_queue_buffers < 1)
+		opt_queue_buffers = 1;
+	if (!check_queue_stages())
+		return -1;
+	if (opt_export_policy != NULL && !frame_export_parse_policy(opt_export_policy, &export_policy))
+	{
+		g_printerr("Unknown export policy '%s', expected block, drop-oldest or drop-newest.\n", opt_export_policy);
+		return -1;
+	}
+	/* The benchmark follows frames by their order, which dropped frames would upset */
+	if (opt_benchmark && opt_queue_leaky)
+	{
+		g_print("Leaky queues drop frames, --queue-leaky is ignored when benchmarking.\n");
+		opt_queue_leaky = FALSE;
+	}
+	data.loops_left = opt_loops;
 
-	/* Initialize GStreamer */
-	gst_init(&argc, &argv);
+	/* Batch mode filters files offline and never opens a window */
+	if (opt_batch != NULL)
+	{
+		BatchOptions batch = { 0 };
 
-	/* Create the media player elements */
+		batch.inputs = opt_batch;
+		batch.output_dir = opt_output_dir != NULL ? opt_output_dir : DEFAULT_OUTPUT_DIR;
+		batch.encoder = opt_encoder != NULL ? opt_encoder : DEFAULT_ENCODER;
+		batch.extension = opt_extension != NULL ? opt_extension : DEFAULT_EXTENSION;
+		batch.jobs = opt_jobs;
+		batch.make_filter = make_filter;
+		return batch_run(&batch) ? 0 : -1;
+	}
+
+	/* A playlist is played through the pipeline built for its first video */
+	if (opt_playlist != NULL)
+	{
+		GPtrArray *uris = g_ptr_array_new_with_free_func(g_free);
+
+		if (!batch_collect_inputs(opt_playlist, uris) || uris->len == 0)
+		{
+			g_printerr("No videos to play in %s.\n", opt_playlist);
+			g_ptr_array_free(uris, TRUE);
+			return -1;
+		}
+		/* Benchmarks play the whole list --loops times, otherwise it repeats until stopped */
+		data.playlist = playlist_new(uris, opt_benchmark ? opt_loops : 0);
+		g_ptr_array_free(uris, TRUE);
+	}
+
+	/* Accept plain file names as well as URIs */
+	if (data.playlist != NULL)
+		uri = g_strdup(playlist_first_uri(data.playlist));
+	else if (opt_uri == NULL)
+		uri = g_strdup(DEFAULT_URI);
+	else if (gst_uri_is_valid(opt_uri))
+		uri = g_strdup(opt_uri);
+	else
+		uri = gst_filename_to_uri(opt_uri, NULL);
+	if (uri == NULL)
+	{
+		g_printerr("Invalid URI or file name %s.\n", opt_uri);
+		return -1;
+	}
+
+	/* Create the media player elements, benchmarks render to a sink that does not wait for the clock */
 	data.source = gst_element_factory_make("uridecodebin", "source");
 	data.videoconvert = gst_element_factory_make("videoconvert", "videoconvert");
-	data.filter = gst_element_factory_make("blurfilter", "blurfilter");
-	data.videosink = gst_element_factory_make("autovideosink", "videosink");
+	data.filter = gst_element_factory_make(opt_filter, "filter");
+	if (opt_benchmark)
+	{
+		data.videosink = gst_element_factory_make("fakesink", "videosink");
+		if (data.videosink)
+			g_object_set(data.videosink, "sync", FALSE, NULL);
+	}
+	else
+	{
+		data.videosink = gst_element_factory_make("autovideosink", "videosink");
+	}
 
 	/* Create the empty pipeline */
 	data.pipeline = gst_pipeline_new("video-pipeline");
@@ -52,113 +346,342 @@ int main(int argc, char *argv[])
 	if (!data.pipeline || !data.source || !data.videosink || !data.videoconvert || !data.filter)
 	{
 		g_printerr("All elements could not be created.\n");
-		c = getchar();
+		wait_for_key();
 		return -1;
 	}
-	
+
+	if (!set_filter_properties(data.filter, opt_properties))
+	{
+		wait_for_key();
+		return -1;
+	}
+
+	/* Put the stages in order, each behind a queue when asked for */
+	stages[0] = data.videoconvert;
+	stages[1] = data.filter;
+	stages[2] = data.videosink;
+	queue_monitor = queue_monitor_new();
+	for (guint i = 0; i < G_N_ELEMENTS(queue_stages); i++)
+	{
+		if (queue_before(queue_stages[i]))
+		{
+			gchar *name = g_strdup_printf("queue-%s", queue_stages[i]);
+			GstElement *queue = queues_make(name, opt_queue_buffers, opt_queue_leaky);
+
+			g_free(name);
+			if (queue == NULL)
+			{
+				g_printerr("Queue could not be created.\n");
+				wait_for_key();
+				return -1;
+			}
+			chain[chain_length++] = queue;
+			queue_monitor_add(queue_monitor, queue);
+		}
+		chain[chain_length++] = stages[i];
+
+		/* The export and ring branches leave the main one right after the filter */
+		if ((opt_export || opt_ring != NULL) && stages[i] == data.filter)
+		{
+			tee = gst_element_factory_make("tee", "tee");
+			if (tee == NULL)
+			{
+				g_printerr("Tee could not be created.\n");
+				wait_for_key();
+				return -1;
+			}
+			chain[chain_length++] = tee;
+		}
+	}
+	data.head = chain[0];
 
 	/* Construct the pipeline and link everything but the source */
-	gst_bin_add_many(GST_BIN(data.pipeline), data.source, data.videoconvert, data.filter, data.videosink, NULL);
+	gst_bin_add(GST_BIN(data.pipeline), data.source);
+	for (guint i = 0; i < chain_length; i++)
+		gst_bin_add(GST_BIN(data.pipeline), chain[i]);
 
-	if (gst_element_link(data.videoconvert, data.filter) != TRUE)
+	for (guint i = 0; i + 1 < chain_length; i++)
 	{
-		g_printerr("Elements could not be linked.\n");
-		gst_object_unref(data.pipeline);
-		c = getchar();
-		return -1;
+		if (gst_element_link(chain[i], chain[i + 1]) != TRUE)
+		{
+			g_printerr("Elements could not be linked.\n");
+			gst_object_unref(data.pipeline);
+			wait_for_key();
+			return -1;
+		}
 	}
-	if (gst_element_link(data.filter, data.videosink) != TRUE)
+
+	if (opt_ring != NULL && !attach_ring(data.pipeline, tee))
 	{
-		g_printerr("Elements could not be linked.\n");
 		gst_object_unref(data.pipeline);
-		c = getchar();
+		wait_for_key();
 		return -1;
 	}
+	if (opt_export)
+	{
+		frame_export = frame_export_new(opt_export_buffers, export_policy);
+		frame_export_set_callback(frame_export, consume_frame, &consumer);
+		if (!frame_export_attach(frame_export, data.pipeline, tee))
+		{
+			frame_export_free(frame_export);
+			gst_object_unref(data.pipeline);
+			wait_for_key();
+			return -1;
+		}
+	}
+
+	/* Set the URI of the video */
+	g_object_set(data.source, "uri", uri, NULL);
+
+	if (opt_benchmark)
+	{
+		bench = benchmark_new();
+		benchmark_attach(bench, data.head, data.filter, data.videosink, opt_queues != NULL);
+		data.bench = bench;
+	}
+
+	/* Trace every hop, pads linked later on are picked up as they are added */
+	if (opt_trace != NULL)
+	{
+		tracer = tracer_new();
+		tracer_attach(tracer, data.pipeline);
+	}
 
-	/* Set the URI to the test video, must be set by the user */
-	g_object_set(data.source, "uri", "file:///C:/Change/to/Address/to/Repository/ContextVision/media/testvideo4.mp4", NULL);
+	/* Files after the first are played by restarting the decoder, keeping the rest of the pipeline */
+	if (data.playlist != NULL)
+		playlist_attach(data.playlist, data.pipeline, data.source, data.head, data.videosink);
 
 	/* Connect to pad-added signal for dynamic pipeline handling */
 	g_signal_connect(data.source, "pad-added", G_CALLBACK(pad_added_handler), &data);
 
-	/* Video playing loop */
-	do
+	/* Watch the bus from the main loop, the player reacts to the messages as they come */
+	data.loop = g_main_loop_new(NULL, FALSE);
+	data.loop_monitor = loop_monitor_new(data.videosink);
+	if (!opt_benchmark)
+	{
+		data.trick_play = trick_play_new(data.pipeline, data.loop, data.playlist == NULL);
+		trick_play_print_help();
+	}
+	bus = gst_element_get_bus(data.pipeline);
+	gst_bus_add_watch(bus, (GstBusFunc)bus_handler, &data);
+
+	/* Preroll first, the segment seek needs a paused pipeline and playing starts once it is done */
+	if (data.playlist != NULL)
+		playlist_start(data.playlist);
+	ret = gst_element_set_state(data.pipeline, GST_STATE_PAUSED);
+	if (ret == GST_STATE_CHANGE_FAILURE)
+	{
+		g_printerr("Unable to set pipeline to the paused state.\n");
+		gst_object_unref(data.pipeline);
+		wait_for_key();
+		return -1;
+	}
+
+	g_main_loop_run(data.loop);
+
+	/* Free resources */
+	if (data.trick_play != NULL)
+		trick_play_free(data.trick_play);
+	gst_bus_remove_watch(bus);
+	gst_object_unref(bus);
+	gst_element_set_state(data.pipeline, GST_STATE_NULL);
+	g_main_loop_unref(data.loop);
+	loop_monitor_report(data.loop_monitor);
+	loop_monitor_free(data.loop_monitor);
+	queue_monitor_report(queue_monitor);
+	queue_monitor_free(queue_monitor);
+	if (data.playlist != NULL)
+		playlist_report(data.playlist);
+	if (frame_export != NULL)
+	{
+		frame_export_report(frame_export);
+		if (consumer.frames > 0)
+			g_print("  mean luma %.1f\n", consumer.luma_sum / consumer.frames);
+		frame_export_free(frame_export);
+	}
+	if (tracer != NULL)
+	{
+		tracer_report(tracer, opt_trace);
+		tracer_free(tracer);
+	}
+	gst_object_unref(data.pipeline);
+
+	if (bench != NULL)
+	{
+		if (data.playlist != NULL)
+			benchmark_report(bench, opt_playlist, opt_filter, playlist_loops_played(data.playlist), opt_json);
+		else
+			benchmark_report(bench, uri, opt_filter, opt_loops - data.loops_left, opt_json);
+		benchmark_free(bench);
+	}
+	if (data.playlist != NULL)
+		playlist_free(data.playlist);
+	g_free(uri);
+
+	wait_for_key();
+	return data.failed ? -1 : 0;
+}
+
+/* Rate set on the console, each loop plays at it, backwards too */
+static gdouble current_rate(CustomData *data)
+{
+	return data->trick_play != NULL ? trick_play_get_rate(data->trick_play) : 1.0;
+}
+
+/*
+ *	Seeks back to the start of the video as a segment, so reaching its end
+ *	posts SEGMENT_DONE instead of sending EOS down the pipeline. Without
+ *	flush the next loop follows the frames still on their way to the sink.
+ */
+static gboolean seek_to_start(CustomData *data, gboolean flush)
+{
+	GstSeekFlags flags = flush ?
+		(GstSeekFlags)(GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_SEGMENT) : GST_SEEK_FLAG_SEGMENT;
+
+	if (data->trick_play != NULL)
+		flags = (GstSeekFlags)(flags | trick_play_seek_flags(data->trick_play));
+	return gst_element_seek(data->pipeline, current_rate(data), GST_FORMAT_TIME, flags,
+		GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+}
+
+/* Starts the next loop, or ends playing after the last one of a benchmark */
+static void next_loop(CustomData *data, gboolean segment)
+{
+	/* A benchmark stops after the requested number of loops */
+	if (opt_benchmark && --data->loops_left == 0)
 	{
-		/* Start playing */
-		ret = gst_element_set_state(data.pipeline, GST_STATE_PLAYING);
-		if (ret == GST_STATE_CHANGE_FAILURE)
+		/* Let the frames still on their way reach the sink, EOS follows them */
+		if (segment)
 		{
-			g_printerr("Unable to set pipeline to the playing state.\n");
-			gst_object_unref(data.pipeline);
-			c = getchar();
-			return -1;
+			data->ending = TRUE;
+			gst_element_send_event(data->pipeline, gst_event_new_eos());
+		}
+		else
+		{
+			g_main_loop_quit(data->loop);
 		}
+		return;
+	}
 
-		/* Listen to the bus */
-		bus = gst_element_get_bus(data.pipeline);
+	if (segment)
+	{
+		loop_monitor_boundary(data->loop_monitor);
+		if (seek_to_start(data, FALSE))
+			return;
+		g_print("Segment seek failed, restarting with a flushing seek.\n");
+	}
 
-		msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE,
-			GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+	/* Without segments the pipeline is flushed and restarted from the beginning */
+	if (!gst_element_seek(data->pipeline,
+		current_rate(data), GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
+		GST_SEEK_TYPE_SET, 0,
+		GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE)) {
+		g_print("Seek failed!\n");
+	}
+}
 
-		/* Parse message */
-		if (msg != NULL)
+/* Handler for the messages on the pipeline's bus */
+static gboolean bus_handler(GstBus *bus, GstMessage *msg, CustomData *data)
+{
+	GError *err;
+	gchar *debug_info;
+
+	switch (GST_MESSAGE_TYPE(msg))
+	{
+	case GST_MESSAGE_ERROR:
+		gst_message_parse_error(msg, &err, &debug_info);
+		g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
+		g_printerr("Debugging information: %s \n", debug_info ? debug_info : "none");
+		g_clear_error(&err);
+		g_free(debug_info);
+		data->failed = TRUE;
+		g_main_loop_quit(data->loop);
+		break;
+	case GST_MESSAGE_SEGMENT_DONE:
+		g_print("End of segment reached, looping.\n");
+		next_loop(data, TRUE);
+		break;
+	case GST_MESSAGE_EOS:
+		g_print("End-Of-Stream reached.\n");
+		/* Only the last loop ends in EOS, unless the video cannot be played as a segment */
+		if (data->ending || data->playlist != NULL)
+			g_main_loop_quit(data->loop);
+		else
+			next_loop(data, FALSE);
+		break;
+	case GST_MESSAGE_ASYNC_DONE:
+		/* Prerolled: the first time loop the video as segments, after that play, a playlist plays right away */
+		if (GST_MESSAGE_SRC(msg) != GST_OBJECT(data->pipeline))
+			break;
+		if (!data->looping && data->playlist == NULL)
 		{
-			GError *err;
-			gchar *debug_info;
+			data->looping = TRUE;
+			if (seek_to_start(data, TRUE))
+				break;
+			g_print("Segment seek failed, looping with flushing seeks.\n");
+		}
+		/* Seeks while paused on the console preroll again, but stay paused */
+		if (data->trick_play == NULL || !trick_play_is_paused(data->trick_play))
+		{
+			/* The benchmark starts here, not at the preroll and the seek to loop */
+			if (data->bench != NULL)
+				benchmark_start(data->bench);
+			gst_element_set_state(data->pipeline, GST_STATE_PLAYING);
+		}
+		break;
+	case GST_MESSAGE_STATE_CHANGED:
+		/* We are only interested in state-changed messages from the pipeline */
+		if (GST_MESSAGE_SRC(msg) == GST_OBJECT(data->pipeline))
+		{
+			GstState old_state, new_state, pending_state;
+			gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
+			g_print("Pipeline state changed from %s to %s:\n",
+				gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
 
-			switch (GST_MESSAGE_TYPE(msg))
+			/* Once playing every element can answer, queues included */
+			if (new_state == GST_STATE_PLAYING && !data->reported_latency)
 			{
-			case GST_MESSAGE_ERROR:
-				gst_message_parse_error(msg, &err, &debug_info);
-				g_printerr("Error received from element %s: %s\n", GST_OBJECT_NAME(msg->src), err->message);
-				g_printerr("Debugging information: %s \n", debug_info ? debug_info : "none");
-				g_clear_error(&err);
-				g_free(debug_info);
-				terminate = TRUE;
-				break;
-			case GST_MESSAGE_EOS:
-				g_print("End-Of-Stream reached.\n");
-				terminate = FALSE;
-				/* If end-of-stream reached, restart from the beginning */
-				if (!gst_element_seek(data.pipeline,
-					1.0, GST_FORMAT_TIME, GST_SEEK_FLAG_FLUSH,
-					GST_SEEK_TYPE_SET, 0, 
-					GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE)) {
-					g_print("Seek failed!\n");
-				}
-				break;
-			case GST_MESSAGE_STATE_CHANGED:
-				/* We are only interested in state-changed messages from the pipeline */
-				if (GST_MESSAGE_SRC(msg) == GST_OBJECT(data.pipeline))
-				{
-					GstState old_state, new_state, pending_state;
-					gst_message_parse_state_changed(msg, &old_state, &new_state, &pending_state);
-					g_print("Pipeline state changed from %s to %s:\n",
-						gst_element_state_get_name(old_state), gst_element_state_get_name(new_state));
-				}
-				break;
-			default:
-				/* Should not be reached, but just in case */
-				g_printerr("Unexpected message received.\n");
-				break;
+				queues_report_latency(data->pipeline);
+				data->reported_latency = TRUE;
 			}
-			gst_message_unref(msg);
 		}
-	} while (!terminate);
+		break;
+	default:
+		break;
+	}
 
-	/* Free resources */
-	gst_object_unref(bus);
-	gst_element_set_state(data.pipeline, GST_STATE_NULL);
-	gst_object_unref(data.pipeline);
+	/* Keep watching */
+	return TRUE;
+}
+
+/* Applies the PROPERTY=VALUE assignments to the filter */
+static gboolean set_filter_properties(GstElement *filter, gchar **properties)
+{
+	if (properties == NULL)
+		return TRUE;
 
-	c = getchar();
-	return 0;
+	for (gchar **property = properties; *property != NULL; property++)
+	{
+		gchar **pair = g_strsplit(*property, "=", 2);
+
+		if (pair[0] == NULL || pair[1] == NULL ||
+			g_object_class_find_property(G_OBJECT_GET_CLASS(filter), pair[0]) == NULL)
+		{
+			g_printerr("Unknown filter property assignment '%s'.\n", *property);
+			g_strfreev(pair);
+			return FALSE;
+		}
+		gst_util_set_object_arg(G_OBJECT(filter), pair[0], pair[1]);
+		g_print("Set filter property %s to %s.\n", pair[0], pair[1]);
+		g_strfreev(pair);
+	}
+	return TRUE;
 }
 
 /* Handler for the pad-added signal */
 static void pad_added_handler(GstElement *src, GstPad *new_pad, CustomData *data)
 {
-	GstPad *video_sink_pad = gst_element_get_static_pad(data->videoconvert, "sink");
+	GstPad *video_sink_pad = gst_element_get_static_pad(data->head, "sink");
 	GstPadLinkReturn ret;
 	GstCaps *new_pad_caps = NULL;
 	GstStructure *new_pad_struct = NULL;
@@ -166,7 +689,7 @@ static void pad_added_handler(GstElement *src, GstPad *new_pad, CustomData *data
 	
 	g_print("Received new pad %s from %s:\n", GST_PAD_NAME(new_pad), GST_ELEMENT_NAME(src));
 
-	/* If our converter is already linked, we have nothing to do here */
+	/* If the first element is already linked, we have nothing to do here */
 	if (gst_pad_is_linked(video_sink_pad))
 	{
 		g_print("We are already linked. Ignoring.\n");
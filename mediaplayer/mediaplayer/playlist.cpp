@@ -0,0 +1,288 @@
+/*
+ * GStreamer Media Player
+ * Playing a list of videos through one pipeline, switching the decoder's URI.
+ *
+ * Rebuilding the pipeline for every file would also rebuild the converter,
+ * the filter with its planned engine and scratch buffers, and the sink. The
+ * playlist instead keeps the pipeline playing and only restarts the
+ * uridecodebin. When a file ends, its EOS is dropped in front of the first
+ * element after the decoder, so nothing downstream sees the end, and from
+ * the main loop the decoder is stopped, given the next URI and started
+ * again. Its new pad is linked by the player as usual.
+ *
+ * The new file starts at running time 0 while the pipeline has been playing
+ * for a while, so when its first frame leaves the decoder the pad is offset
+ * to put that frame at the current running time, and the sink shows it
+ * right away instead of dropping it as late.
+ *
+ * The time to first frame of every file is measured from the end of the
+ * previous one, or from the start for the first, to its first frame at the
+ * sink. Frames keep their order, so the first frame of a file is told apart
+ * by counting the frames that entered the chain before it.
+ */
+
+#include <gst/gst.h>
+#include "playlist.h"
+
+typedef struct _PlaylistSwitch
+{
+	guint index;
+	double decoder_ms;
+	double first_frame_ms;
+} PlaylistSwitch;
+
+struct _Playlist
+{
+	GPtrArray *uris;
+	/* Times to play the list, 0 plays it until stopped */
+	guint loops;
+	guint loop;
+	guint current;
+
+	GstElement *pipeline;
+	GstElement *source;
+	GstPad *head_pad;
+	GstPad *sink_pad;
+
+	/* Frames that entered the chain and reached the sink, each counted on its own thread */
+	guint64 frames_in;
+	guint64 frames_out;
+
+	/* Switch waiting for its first frame at the sink */
+	gint pending;
+	gint retime;
+	guint pending_index;
+	guint64 switch_frame;
+	guint64 switch_start;
+	guint64 decoder_ready;
+
+	GArray *switches;
+};
+
+static gchar *display_name(const gchar *uri)
+{
+	gchar *unescaped = g_uri_unescape_string(uri, NULL);
+	gchar *name = g_path_get_basename(unescaped != NULL ? unescaped : uri);
+
+	g_free(unescaped);
+	return name;
+}
+
+/* Takes a copy of the URIs, loops 0 plays the list until stopped */
+Playlist *playlist_new(GPtrArray *uris, guint loops)
+{
+	Playlist *playlist = g_new0(Playlist, 1);
+
+	playlist->uris = g_ptr_array_new_with_free_func(g_free);
+	for (guint i = 0; i < uris->len; i++)
+		g_ptr_array_add(playlist->uris, g_strdup((const gchar *)g_ptr_array_index(uris, i)));
+	playlist->loops = loops;
+	playlist->switches = g_array_new(FALSE, FALSE, sizeof(PlaylistSwitch));
+	return playlist;
+}
+
+const gchar *playlist_first_uri(Playlist *playlist)
+{
+	return (const gchar *)g_ptr_array_index(playlist->uris, 0);
+}
+
+/* Running time of the pipeline, 0 before it has a clock */
+static GstClockTime running_time(GstElement *pipeline)
+{
+	GstClock *clock = gst_element_get_clock(pipeline);
+	GstClockTime now;
+
+	if (clock == NULL)
+		return 0;
+	now = gst_clock_get_time(clock);
+	gst_object_unref(clock);
+	return now - gst_element_get_base_time(pipeline);
+}
+
+/* Moves the first frame of a new file to the current running time, once */
+static GstPadProbeReturn retime_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	Playlist *playlist = (Playlist *)user_data;
+	GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+	GstEvent *event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+
+	if (event != NULL)
+	{
+		GstSegment segment;
+		guint64 position;
+
+		gst_event_copy_segment(event, &segment);
+		gst_event_unref(event);
+		position = gst_segment_to_running_time(&segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+		/* Probes run before the sticky events are checked again, so this buffer is offset too */
+		if (GST_CLOCK_TIME_IS_VALID(position))
+			gst_pad_set_offset(pad, (gint64)running_time(playlist->pipeline) - (gint64)position);
+	}
+	return GST_PAD_PROBE_REMOVE;
+}
+
+/* Notes when the decoder of a new file is ready, and has its frames retimed */
+static void playlist_pad_added(GstElement *src, GstPad *new_pad, Playlist *playlist)
+{
+	GstCaps *caps = gst_pad_query_caps(new_pad, NULL);
+	gboolean video = caps != NULL && gst_caps_get_size(caps) > 0 &&
+		g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/x-raw");
+
+	if (caps != NULL)
+		gst_caps_unref(caps);
+	if (!video)
+		return;
+
+	playlist->decoder_ready = gst_util_get_timestamp();
+	if (g_atomic_int_compare_and_exchange(&playlist->retime, TRUE, FALSE))
+		gst_pad_add_probe(new_pad, GST_PAD_PROBE_TYPE_BUFFER, retime_probe, playlist, NULL);
+}
+
+/* Restarts the decoder on the current URI, from the main loop */
+static gboolean playlist_switch(gpointer user_data)
+{
+	Playlist *playlist = (Playlist *)user_data;
+	const gchar *uri = (const gchar *)g_ptr_array_index(playlist->uris, playlist->current);
+
+	g_print("Switching to %s\n", uri);
+	g_atomic_int_set(&playlist->retime, TRUE);
+	gst_element_set_state(playlist->source, GST_STATE_NULL);
+	g_object_set(playlist->source, "uri", uri, NULL);
+	if (!gst_element_sync_state_with_parent(playlist->source))
+		g_printerr("Could not start the decoder on %s.\n", uri);
+	return FALSE;
+}
+
+/* Counts the frames entering the chain, and turns the end of a file into a switch to the next */
+static GstPadProbeReturn head_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	Playlist *playlist = (Playlist *)user_data;
+
+	if (info->type & GST_PAD_PROBE_TYPE_BUFFER)
+	{
+		playlist->frames_in++;
+		return GST_PAD_PROBE_OK;
+	}
+	if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) != GST_EVENT_EOS)
+		return GST_PAD_PROBE_OK;
+
+	/* The end of the last file ends playing */
+	if (playlist->current + 1 == playlist->uris->len)
+	{
+		if (playlist->loops != 0 && playlist->loop + 1 >= playlist->loops)
+			return GST_PAD_PROBE_OK;
+		playlist->loop++;
+		playlist->current = 0;
+	}
+	else
+	{
+		playlist->current++;
+	}
+
+	playlist->switch_start = gst_util_get_timestamp();
+	playlist->switch_frame = playlist->frames_in;
+	playlist->pending_index = playlist->current;
+	g_atomic_int_set(&playlist->pending, TRUE);
+	g_idle_add(playlist_switch, playlist);
+	return GST_PAD_PROBE_DROP;
+}
+
+/* Records the time to first frame when the first frame of a file reaches the sink */
+static GstPadProbeReturn sink_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	Playlist *playlist = (Playlist *)user_data;
+	guint64 frame = playlist->frames_out++;
+
+	if (g_atomic_int_get(&playlist->pending) && frame == playlist->switch_frame)
+	{
+		PlaylistSwitch entry;
+		guint64 now = gst_util_get_timestamp();
+
+		entry.index = playlist->pending_index;
+		entry.first_frame_ms = (now - playlist->switch_start) / 1e6;
+		entry.decoder_ms = playlist->decoder_ready > playlist->switch_start ?
+			(playlist->decoder_ready - playlist->switch_start) / 1e6 : 0.0;
+		g_array_append_val(playlist->switches, entry);
+		g_atomic_int_set(&playlist->pending, FALSE);
+	}
+	return GST_PAD_PROBE_OK;
+}
+
+/* Takes over the ends of the files at head, the first element after the decoder */
+void playlist_attach(Playlist *playlist, GstElement *pipeline, GstElement *source,
+	GstElement *head, GstElement *videosink)
+{
+	playlist->pipeline = pipeline;
+	playlist->source = source;
+	playlist->head_pad = gst_element_get_static_pad(head, "sink");
+	playlist->sink_pad = gst_element_get_static_pad(videosink, "sink");
+
+	gst_pad_add_probe(playlist->head_pad,
+		(GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM),
+		head_probe, playlist, NULL);
+	gst_pad_add_probe(playlist->sink_pad, GST_PAD_PROBE_TYPE_BUFFER, sink_probe, playlist, NULL);
+	g_signal_connect(source, "pad-added", G_CALLBACK(playlist_pad_added), playlist);
+}
+
+/* Starts timing the first file, call right before the pipeline is started */
+void playlist_start(Playlist *playlist)
+{
+	playlist->switch_start = gst_util_get_timestamp();
+	playlist->switch_frame = 0;
+	playlist->pending_index = 0;
+	g_atomic_int_set(&playlist->pending, TRUE);
+}
+
+/* Times the list was played, the last one counted when it was started */
+guint playlist_loops_played(Playlist *playlist)
+{
+	return playlist->loop + 1;
+}
+
+/* Prints the time to first frame of every file, call once the pipeline has stopped */
+void playlist_report(Playlist *playlist)
+{
+	double switch_sum = 0.0;
+	guint n_switches = 0;
+
+	if (playlist->switches->len == 0)
+		return;
+
+	g_print("\nPlaylist of %u files, time to first frame\n", playlist->uris->len);
+	g_print("  %-32s %12s %15s\n", "file", "decoder ms", "first frame ms");
+	for (guint i = 0; i < playlist->switches->len; i++)
+	{
+		PlaylistSwitch *entry = &g_array_index(playlist->switches, PlaylistSwitch, i);
+		gchar *name = display_name((const gchar *)g_ptr_array_index(playlist->uris, entry->index));
+
+		g_print("  %-32s %12.2f %15.2f%s\n", name, entry->decoder_ms, entry->first_frame_ms,
+			i == 0 ? "  (pipeline start)" : "");
+		g_free(name);
+		if (i > 0)
+		{
+			switch_sum += entry->first_frame_ms;
+			n_switches++;
+		}
+	}
+
+	/* The first file pays for starting the whole pipeline, every other one only for its decoder */
+	if (n_switches > 0)
+		g_print("  Mean time to first frame after a switch %.2f ms, against %.2f ms for the first file\n",
+			switch_sum / n_switches, g_array_index(playlist->switches, PlaylistSwitch, 0).first_frame_ms);
+}
+
+void playlist_free(Playlist *playlist)
+{
+	/* A switch may still be waiting for the main loop */
+	while (g_idle_remove_by_data(playlist))
+		;
+	if (playlist->head_pad != NULL)
+		gst_object_unref(playlist->head_pad);
+	if (playlist->sink_pad != NULL)
+		gst_object_unref(playlist->sink_pad);
+	if (playlist->source != NULL)
+		g_signal_handlers_disconnect_by_data(playlist->source, playlist);
+	g_ptr_array_free(playlist->uris, TRUE);
+	g_array_free(playlist->switches, TRUE);
+	g_free(playlist);
+}
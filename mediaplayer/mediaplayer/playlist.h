@@ -0,0 +1,22 @@
+/*
+ * GStreamer Media Player
+ * Playing a list of videos through one pipeline, switching the decoder's URI.
+ */
+
+#ifndef _PLAYLIST_H_
+#define _PLAYLIST_H_
+
+#include <gst/gst.h>
+
+typedef struct _Playlist Playlist;
+
+Playlist *playlist_new(GPtrArray *uris, guint loops);
+const gchar *playlist_first_uri(Playlist *playlist);
+void playlist_attach(Playlist *playlist, GstElement *pipeline, GstElement *source,
+	GstElement *head, GstElement *videosink);
+void playlist_start(Playlist *playlist);
+guint playlist_loops_played(Playlist *playlist);
+void playlist_report(Playlist *playlist);
+void playlist_free(Playlist *playlist);
+
+#endif
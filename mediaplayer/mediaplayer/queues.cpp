@@ -0,0 +1,149 @@
+/*
+ * GStreamer Media Player
+ * Queues between the stages of the pipeline, and what they cost in latency.
+ *
+ * Without queues every element after the decoder runs on the decoder's
+ * streaming thread, so decoding, conversion, filtering and rendering of
+ * consecutive frames take turns. A queue hands its buffers to a streaming
+ * thread of its own, so with queues between the stages they overlap on
+ * separate cores, at the price of a frame waiting in each queue behind the
+ * frames already in it.
+ *
+ * The monitor reads the level of every queue when a frame enters it, which
+ * is the wait that frame is going to see, and counts how often a queue was
+ * full, blocking upstream or, when leaky, dropping its oldest frame.
+ */
+
+#include <gst/gst.h>
+#include "queues.h"
+
+typedef struct _QueueEntry
+{
+	GstElement *queue;
+	guint64 frames;
+	guint64 buffers_sum;
+	guint max_buffers;
+	guint64 time_sum;
+	guint64 max_time;
+	guint64 overruns;
+} QueueEntry;
+
+struct _QueueMonitor
+{
+	GPtrArray *entries;
+};
+
+/* Creates a queue holding at most max_buffers frames, a leaky one drops the oldest when full */
+GstElement *queues_make(const gchar *name, guint max_buffers, gboolean leaky)
+{
+	GstElement *queue = gst_element_factory_make("queue", name);
+
+	if (queue == NULL)
+		return NULL;
+
+	/* Only the number of frames limits the queue, whatever their size or duration */
+	g_object_set(queue, "max-size-buffers", max_buffers, "max-size-bytes", 0u,
+		"max-size-time", (guint64)0, NULL);
+	if (leaky)
+		gst_util_set_object_arg(G_OBJECT(queue), "leaky", "downstream");
+	return queue;
+}
+
+/* Samples the level ahead of a frame entering the queue, on the upstream thread */
+static GstPadProbeReturn queue_monitor_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	QueueEntry *entry = (QueueEntry *)user_data;
+	guint buffers;
+	guint64 time;
+
+	g_object_get(entry->queue, "current-level-buffers", &buffers, "current-level-time", &time, NULL);
+	entry->frames++;
+	entry->buffers_sum += buffers;
+	entry->max_buffers = MAX(entry->max_buffers, buffers);
+	entry->time_sum += time;
+	entry->max_time = MAX(entry->max_time, time);
+	return GST_PAD_PROBE_OK;
+}
+
+static void queue_monitor_overrun(GstElement *queue, QueueEntry *entry)
+{
+	entry->overruns++;
+}
+
+QueueMonitor *queue_monitor_new(void)
+{
+	QueueMonitor *monitor = g_new0(QueueMonitor, 1);
+
+	monitor->entries = g_ptr_array_new();
+	return monitor;
+}
+
+void queue_monitor_add(QueueMonitor *monitor, GstElement *queue)
+{
+	QueueEntry *entry = g_new0(QueueEntry, 1);
+	GstPad *pad = gst_element_get_static_pad(queue, "sink");
+
+	entry->queue = GST_ELEMENT(gst_object_ref(queue));
+	gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, queue_monitor_probe, entry, NULL);
+	gst_object_unref(pad);
+	g_signal_connect(queue, "overrun", G_CALLBACK(queue_monitor_overrun), entry);
+	g_ptr_array_add(monitor->entries, entry);
+}
+
+/* Prints the levels the frames found in every queue, call once the pipeline has stopped */
+void queue_monitor_report(QueueMonitor *monitor)
+{
+	if (monitor->entries->len == 0)
+		return;
+
+	g_print("\nQueues, level ahead of each frame as it entered\n");
+	g_print("  %-14s %8s %12s %8s %12s %10s %8s\n",
+		"queue", "frames", "mean frames", "max", "mean ms", "max ms", "full");
+	for (guint i = 0; i < monitor->entries->len; i++)
+	{
+		QueueEntry *entry = (QueueEntry *)g_ptr_array_index(monitor->entries, i);
+		double n = entry->frames > 0 ? (double)entry->frames : 1.0;
+
+		g_print("  %-14s %8" G_GUINT64_FORMAT " %12.2f %8u %12.3f %10.3f %8" G_GUINT64_FORMAT "\n",
+			GST_ELEMENT_NAME(entry->queue), entry->frames, entry->buffers_sum / n, entry->max_buffers,
+			entry->time_sum / n / 1e6, entry->max_time / 1e6, entry->overruns);
+	}
+}
+
+void queue_monitor_free(QueueMonitor *monitor)
+{
+	for (guint i = 0; i < monitor->entries->len; i++)
+	{
+		QueueEntry *entry = (QueueEntry *)g_ptr_array_index(monitor->entries, i);
+
+		g_signal_handlers_disconnect_by_data(entry->queue, entry);
+		gst_object_unref(entry->queue);
+		g_free(entry);
+	}
+	g_ptr_array_free(monitor->entries, TRUE);
+	g_free(monitor);
+}
+
+/* Prints the latency the pipeline reports for itself, queues included */
+void queues_report_latency(GstElement *pipeline)
+{
+	GstQuery *query = gst_query_new_latency();
+	gboolean live;
+	GstClockTime min_latency, max_latency;
+
+	if (gst_element_query(pipeline, query))
+	{
+		gst_query_parse_latency(query, &live, &min_latency, &max_latency);
+		if (GST_CLOCK_TIME_IS_VALID(max_latency))
+			g_print("Pipeline latency (%s): min %.3f ms, max %.3f ms\n", live ? "live" : "not live",
+				min_latency / 1e6, max_latency / 1e6);
+		else
+			g_print("Pipeline latency (%s): min %.3f ms, max unlimited\n", live ? "live" : "not live",
+				min_latency / 1e6);
+	}
+	else
+	{
+		g_print("Pipeline latency could not be queried.\n");
+	}
+	gst_query_unref(query);
+}
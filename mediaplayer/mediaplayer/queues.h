@@ -0,0 +1,22 @@
+/*
+ * GStreamer Media Player
+ * Queues between the stages of the pipeline, and what they cost in latency.
+ */
+
+#ifndef _QUEUES_H_
+#define _QUEUES_H_
+
+#include <gst/gst.h>
+
+typedef struct _QueueMonitor QueueMonitor;
+
+GstElement *queues_make(const gchar *name, guint max_buffers, gboolean leaky);
+
+QueueMonitor *queue_monitor_new(void);
+void queue_monitor_add(QueueMonitor *monitor, GstElement *queue);
+void queue_monitor_report(QueueMonitor *monitor);
+void queue_monitor_free(QueueMonitor *monitor);
+
+void queues_report_latency(GstElement *pipeline);
+
+#endif
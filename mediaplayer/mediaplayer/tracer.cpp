@@ -0,0 +1,564 @@
+/*
+ * GStreamer Media Player
+ * Per-hop latency tracing of every link in the pipeline.
+ *
+ * A buffer probe on every pad records when each buffer crosses it, on which
+ * thread, and with which timestamp, and pads that never see a buffer are
+ * left out of the report. Pads appearing later, like the source pads of
+ * uridecodebin, are traced as soon as they are linked, together with the
+ * pad they are linked to.
+ *
+ * The pads are put in pipeline order by following the links from the pad
+ * the first frame crossed first, from a source pad to its peer and from a
+ * sink pad to the source pads of its element. An element with several, like
+ * the tee in front of the export and ring branches, starts a chain for each,
+ * and every chain is reported on its own. A frame is followed from pad to
+ * pad by its PTS, so frames dropped or flushed on the way are left out
+ * instead of shifting the rest. Between two consecutive pads a frame spends
+ * its time either
+ *
+ *   element  from the sink pad to the source pad of an element, processing
+ *   queue    the same, but for a queue, waiting for the downstream thread
+ *   link     from a source pad to the sink pad it is linked to
+ *
+ * and queueing time is the sum of the link and queue hops.
+ */
+
+#include <gst/gst.h>
+#include <string.h>
+#include "tracer.h"
+#include "benchmark.h"
+
+/* How far ahead in the records of a pad the next frame is looked for */
+#define TRACE_MATCH_WINDOW 16
+
+typedef struct _TraceEntry
+{
+	GstClockTime pts;
+	guint64 time;
+	GThread *thread;
+} TraceEntry;
+
+typedef struct _TracePoint
+{
+	GstPad *pad;
+	/* What the pad was linked to when the first buffer crossed it, dynamic pads are gone by the report */
+	GstPad *peer;
+	gulong probe;
+	gchar *element;
+	gchar *name;
+	gboolean queue;
+	GArray *entries;
+} TracePoint;
+
+struct _Tracer
+{
+	/* Protects points and pads, pads can be added from a streaming thread */
+	GMutex lock;
+	GPtrArray *points;
+	/* The pads traced, each one once */
+	GHashTable *pads;
+};
+
+/* Records a buffer crossing a pad, a pad only ever sees one thread at a time */
+static GstPadProbeReturn tracer_probe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+	TracePoint *point = (TracePoint *)user_data;
+	TraceEntry entry;
+
+	entry.time = gst_util_get_timestamp();
+	entry.pts = GST_BUFFER_PTS(GST_PAD_PROBE_INFO_BUFFER(info));
+	entry.thread = g_thread_self();
+	if (point->entries->len == 0)
+		point->peer = gst_pad_get_peer(pad);
+	g_array_append_val(point->entries, entry);
+	return GST_PAD_PROBE_OK;
+}
+
+static void tracer_add_pad(Tracer *tracer, GstPad *pad)
+{
+	GstElement *element;
+	TracePoint *point;
+	const gchar *factory;
+	gboolean traced;
+
+	element = gst_pad_get_parent_element(pad);
+	if (element == NULL)
+		return;
+
+	g_mutex_lock(&tracer->lock);
+	traced = !g_hash_table_add(tracer->pads, pad);
+	g_mutex_unlock(&tracer->lock);
+	if (traced)
+	{
+		gst_object_unref(element);
+		return;
+	}
+
+	point = g_new0(TracePoint, 1);
+	point->pad = GST_PAD(gst_object_ref(pad));
+	point->element = gst_element_get_name(element);
+	point->name = g_strdup_printf("%s.%s", point->element, GST_PAD_NAME(pad));
+	point->entries = g_array_new(FALSE, FALSE, sizeof(TraceEntry));
+	factory = gst_plugin_feature_get_name(GST_PLUGIN_FEATURE(gst_element_get_factory(element)));
+	point->queue = g_str_has_prefix(factory, "queue") || g_strcmp0(factory, "multiqueue") == 0;
+	gst_object_unref(element);
+
+	g_mutex_lock(&tracer->lock);
+	g_ptr_array_add(tracer->points, point);
+	g_mutex_unlock(&tracer->lock);
+
+	point->probe = gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, tracer_probe, point, NULL);
+}
+
+/*
+ *	Runs after the application's handler, so the pad is linked by now. Its
+ *	peer is traced as well, in case the peer was added after the tracer was
+ *	attached, otherwise the time spent in the element it belongs to would
+ *	count as part of the link.
+ */
+static void tracer_pad_added(GstElement *element, GstPad *pad, Tracer *tracer)
+{
+	GstPad *peer = gst_pad_get_peer(pad);
+
+	tracer_add_pad(tracer, pad);
+	if (peer != NULL)
+	{
+		tracer_add_pad(tracer, peer);
+		gst_object_unref(peer);
+	}
+}
+
+Tracer *tracer_new(void)
+{
+	Tracer *tracer = g_new0(Tracer, 1);
+
+	g_mutex_init(&tracer->lock);
+	tracer->points = g_ptr_array_new();
+	tracer->pads = g_hash_table_new(g_direct_hash, g_direct_equal);
+	return tracer;
+}
+
+/* Traces every pad of the elements in the pipeline, linked or not yet, call before playing */
+void tracer_attach(Tracer *tracer, GstElement *pipeline)
+{
+	GstIterator *elements = gst_bin_iterate_elements(GST_BIN(pipeline));
+	GValue item = G_VALUE_INIT;
+
+	while (gst_iterator_next(elements, &item) == GST_ITERATOR_OK)
+	{
+		GstElement *element = GST_ELEMENT(g_value_get_object(&item));
+		GstIterator *pads = gst_element_iterate_pads(element);
+		GValue pad = G_VALUE_INIT;
+
+		while (gst_iterator_next(pads, &pad) == GST_ITERATOR_OK)
+		{
+			tracer_add_pad(tracer, GST_PAD(g_value_get_object(&pad)));
+			g_value_reset(&pad);
+		}
+		g_value_unset(&pad);
+		gst_iterator_free(pads);
+
+		g_signal_connect_after(element, "pad-added", G_CALLBACK(tracer_pad_added), tracer);
+		g_value_reset(&item);
+	}
+	g_value_unset(&item);
+	gst_iterator_free(elements);
+}
+
+static gint compare_first_entry(gconstpointer a, gconstpointer b)
+{
+	const TracePoint *x = *(const TracePoint * const *)a;
+	const TracePoint *y = *(const TracePoint * const *)b;
+	guint64 tx = g_array_index(x->entries, TraceEntry, 0).time;
+	guint64 ty = g_array_index(y->entries, TraceEntry, 0).time;
+
+	return tx < ty ? -1 : tx > ty;
+}
+
+/* Frames per second at which buffers crossed a pad */
+static double point_fps(const TracePoint *point)
+{
+	guint n = point->entries->len;
+	guint64 span;
+
+	if (n < 2)
+		return 0.0;
+	span = g_array_index(point->entries, TraceEntry, n - 1).time - g_array_index(point->entries, TraceEntry, 0).time;
+	return span > 0 ? (n - 1) / (span / 1e9) : 0.0;
+}
+
+/* Small numbers for the threads, in the order they were first seen */
+static guint thread_id(GHashTable *threads, GThread *thread)
+{
+	guint id = GPOINTER_TO_UINT(g_hash_table_lookup(threads, thread));
+
+	if (id == 0)
+	{
+		id = g_hash_table_size(threads) + 1;
+		g_hash_table_insert(threads, thread, GUINT_TO_POINTER(id));
+	}
+	return id;
+}
+
+static void print_row(const gchar *label, const gchar *kind, double *ms, guint n)
+{
+	double mean = 0.0;
+	LatencyStats stats;
+
+	for (guint i = 0; i < n; i++)
+		mean += ms[i];
+	mean /= n;
+	stats = benchmark_summarize(ms, n);
+	g_print("  %-36s %-8s %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+		label, kind, mean, stats.p50, stats.p90, stats.p99, stats.max);
+}
+
+/*
+ *	Writes the frames as a Chrome trace, viewable in chrome://tracing or
+ *	Perfetto. Elements are complete events on the thread that ran them, links
+ *	and queues overlap other work and are async events, as are the frames.
+ */
+static void write_chrome_trace(const gchar *path, TracePoint **chain, guint n_points,
+	const guint64 *times, GThread **threads, const GstClockTime *pts, guint frames)
+{
+	GString *json = g_string_new("{\n\"displayTimeUnit\": \"ms\",\n\"traceEvents\": [\n");
+	GHashTable *ids = g_hash_table_new(g_direct_hash, g_direct_equal);
+	guint64 t0 = times[0];
+	GHashTableIter iter;
+	gpointer key, value;
+	GError *err = NULL;
+
+	g_string_append(json, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"mediaplayer\"}}");
+	for (guint f = 0; f < frames; f++)
+	{
+		const guint64 *t = times + (gsize)f * n_points;
+		GThread **th = threads + (gsize)f * n_points;
+		double ms_pts = GST_CLOCK_TIME_IS_VALID(pts[f]) ? pts[f] / 1e6 : -1.0;
+
+		g_string_append_printf(json,
+			",\n{\"name\": \"frame\", \"cat\": \"frame\", \"ph\": \"b\", \"id\": %u, \"ts\": %.3f, \"pid\": 1, \"tid\": %u, \"args\": {\"pts_ms\": %.3f}}"
+			",\n{\"name\": \"frame\", \"cat\": \"frame\", \"ph\": \"e\", \"id\": %u, \"ts\": %.3f, \"pid\": 1, \"tid\": %u}",
+			f, (t[0] - t0) / 1e3, thread_id(ids, th[0]), ms_pts,
+			f, (t[n_points - 1] - t0) / 1e3, thread_id(ids, th[n_points - 1]));
+
+		for (guint k = 0; k + 1 < n_points; k++)
+		{
+			TracePoint *from = chain[k];
+			TracePoint *to = chain[k + 1];
+			double ts = (t[k] - t0) / 1e3;
+			double dur = (t[k + 1] - t[k]) / 1e3;
+			gboolean element = strcmp(from->element, to->element) == 0;
+
+			if (element && !from->queue)
+			{
+				g_string_append_printf(json,
+					",\n{\"name\": \"%s\", \"cat\": \"element\", \"ph\": \"X\", \"ts\": %.3f, \"dur\": %.3f, \"pid\": 1, \"tid\": %u, \"args\": {\"frame\": %u}}",
+					from->element, ts, dur, thread_id(ids, th[k]), f);
+			}
+			else
+			{
+				const gchar *cat = element ? "queue" : "link";
+				guint id = f * n_points + k;
+
+				g_string_append_printf(json,
+					",\n{\"name\": \"%s -> %s\", \"cat\": \"%s\", \"ph\": \"b\", \"id\": %u, \"ts\": %.3f, \"pid\": 1, \"tid\": %u, \"args\": {\"frame\": %u}}"
+					",\n{\"name\": \"%s -> %s\", \"cat\": \"%s\", \"ph\": \"e\", \"id\": %u, \"ts\": %.3f, \"pid\": 1, \"tid\": %u}",
+					from->name, to->name, cat, id, ts, thread_id(ids, th[k]), f,
+					from->name, to->name, cat, id, ts + dur, thread_id(ids, th[k + 1]));
+			}
+		}
+	}
+
+	/* Name the threads, now that all of them have an id */
+	g_hash_table_iter_init(&iter, ids);
+	while (g_hash_table_iter_next(&iter, &key, &value))
+	{
+		g_string_append_printf(json,
+			",\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"streaming thread %u\"}}",
+			GPOINTER_TO_UINT(value), GPOINTER_TO_UINT(value));
+	}
+	g_string_append(json, "\n]\n}\n");
+
+	if (!g_file_set_contents(path, json->str, json->len, &err))
+	{
+		g_printerr("Could not write %s: %s\n", path, err->message);
+		g_clear_error(&err);
+	}
+	else
+	{
+		g_print("Wrote Chrome trace of %u frames to %s\n", frames, path);
+	}
+
+	g_hash_table_destroy(ids);
+	g_string_free(json, TRUE);
+}
+
+/* The traced point of a pad that saw buffers, NULL when there is none */
+static TracePoint *find_point(GPtrArray *points, GstPad *pad)
+{
+	for (guint i = 0; i < points->len; i++)
+	{
+		TracePoint *point = (TracePoint *)g_ptr_array_index(points, i);
+		if (point->pad == pad)
+			return point;
+	}
+	return NULL;
+}
+
+/* Extends path by the pads a frame can go to next, adding every path that ends, at a sink or an untraced pad, to chains */
+static void collect_chains(GPtrArray *points, GPtrArray *path, GPtrArray *chains)
+{
+	TracePoint *tail = (TracePoint *)g_ptr_array_index(path, path->len - 1);
+	GPtrArray *next = g_ptr_array_new();
+
+	if (GST_PAD_DIRECTION(tail->pad) == GST_PAD_SRC)
+	{
+		TracePoint *peer = tail->peer != NULL ? find_point(points, tail->peer) : NULL;
+		if (peer != NULL)
+			g_ptr_array_add(next, peer);
+	}
+	else
+	{
+		for (guint i = 0; i < points->len; i++)
+		{
+			TracePoint *point = (TracePoint *)g_ptr_array_index(points, i);
+			if (GST_PAD_DIRECTION(point->pad) == GST_PAD_SRC && GST_PAD_PARENT(point->pad) == GST_PAD_PARENT(tail->pad))
+				g_ptr_array_add(next, point);
+		}
+	}
+
+	for (guint i = 0; i < next->len; i++)
+	{
+		TracePoint *point = (TracePoint *)g_ptr_array_index(next, i);
+		guint index;
+
+		/* A link back to a pad already on the path would never end */
+		if (g_ptr_array_find(path, point, &index))
+			continue;
+		g_ptr_array_add(path, point);
+		collect_chains(points, path, chains);
+		g_ptr_array_remove_index(path, path->len - 1);
+	}
+	if (next->len == 0)
+	{
+		GPtrArray *chain = g_ptr_array_new();
+		for (guint i = 0; i < path->len; i++)
+			g_ptr_array_add(chain, g_ptr_array_index(path, i));
+		g_ptr_array_add(chains, chain);
+	}
+	g_ptr_array_free(next, TRUE);
+}
+
+/* Prints the per-hop latencies of one chain of pads, in the order frames cross them, and writes its Chrome trace */
+static void report_chain(GPtrArray *chain, const gchar *trace_path)
+{
+	TracePoint *first, *last;
+	guint n_points, n_frames, frames = 0;
+	guint64 *times;
+	GThread **threads;
+	GstClockTime *pts;
+	guint *cursor;
+	double *ms, *queueing;
+	gchar *slowest = NULL;
+	double slowest_mean = 0.0, total_mean = 0.0;
+
+	if (chain->len < 2)
+	{
+		g_printerr("Trace: too few pads on the chain to report (%u).\n", chain->len);
+		return;
+	}
+
+	n_points = chain->len;
+	first = (TracePoint *)g_ptr_array_index(chain, 0);
+	last = (TracePoint *)g_ptr_array_index(chain, n_points - 1);
+	n_frames = first->entries->len;
+
+	/* Follow every frame leaving the first pad through the others, keeping only complete ones */
+	times = g_new(guint64, (gsize)n_frames * n_points);
+	threads = g_new(GThread *, (gsize)n_frames * n_points);
+	pts = g_new(GstClockTime, n_frames);
+	cursor = g_new0(guint, n_points);
+	for (guint j = 0; j < n_frames; j++)
+	{
+		TraceEntry *origin = &g_array_index(first->entries, TraceEntry, j);
+		guint64 *t = times + (gsize)frames * n_points;
+		GThread **th = threads + (gsize)frames * n_points;
+		gboolean complete = TRUE;
+
+		t[0] = origin->time;
+		th[0] = origin->thread;
+		for (guint k = 1; k < n_points && complete; k++)
+		{
+			TracePoint *point = (TracePoint *)g_ptr_array_index(chain, k);
+			guint end = MIN(cursor[k] + TRACE_MATCH_WINDOW, point->entries->len);
+			guint i;
+
+			for (i = cursor[k]; i < end; i++)
+			{
+				TraceEntry *entry = &g_array_index(point->entries, TraceEntry, i);
+				if (entry->pts == origin->pts && entry->time >= t[k - 1])
+					break;
+			}
+			if (i == end)
+			{
+				complete = FALSE;
+				break;
+			}
+			cursor[k] = i + 1;
+			t[k] = g_array_index(point->entries, TraceEntry, i).time;
+			th[k] = g_array_index(point->entries, TraceEntry, i).thread;
+		}
+		if (complete)
+			pts[frames++] = origin->pts;
+	}
+
+	if (frames == 0)
+	{
+		g_printerr("Trace: no frame made it from %s to %s.\n", first->name, last->name);
+	}
+	else
+	{
+		ms = g_new(double, frames);
+		queueing = g_new0(double, frames);
+
+		g_print("\nPipeline trace of %u frames across %u pads, %u incomplete\n", frames, n_points, n_frames - frames);
+		g_print("  %-36s %-8s %9s %9s %9s %9s %9s\n", "hop", "kind", "mean ms", "p50", "p90", "p99", "max");
+		for (guint k = 0; k + 1 < n_points; k++)
+		{
+			TracePoint *from = (TracePoint *)g_ptr_array_index(chain, k);
+			TracePoint *to = (TracePoint *)g_ptr_array_index(chain, k + 1);
+			gboolean element = strcmp(from->element, to->element) == 0;
+			const gchar *kind = !element ? "link" : from->queue ? "queue" : "element";
+			gchar *label = element ? g_strdup(from->element) : g_strdup_printf("%s -> %s", from->name, to->name);
+			double mean = 0.0;
+
+			for (guint f = 0; f < frames; f++)
+			{
+				const guint64 *t = times + (gsize)f * n_points;
+				ms[f] = (t[k + 1] - t[k]) / 1e6;
+				mean += ms[f];
+				if (!element || from->queue)
+					queueing[f] += ms[f];
+			}
+			mean /= frames;
+
+			print_row(label, kind, ms, frames);
+			if (slowest == NULL || mean > slowest_mean)
+			{
+				g_free(slowest);
+				slowest = label;
+				slowest_mean = mean;
+			}
+			else
+			{
+				g_free(label);
+			}
+		}
+
+		for (guint f = 0; f < frames; f++)
+		{
+			const guint64 *t = times + (gsize)f * n_points;
+			ms[f] = (t[n_points - 1] - t[0]) / 1e6;
+			total_mean += ms[f];
+		}
+		total_mean /= frames;
+		print_row("end to end", "", ms, frames);
+		print_row("queueing", "", queueing, frames);
+
+		g_print("  %s at %.1f fps, %s at %.1f fps\n", first->name, point_fps(first), last->name, point_fps(last));
+		g_print("  slowest hop %s, %.0f%% of the end to end latency\n",
+			slowest, total_mean > 0 ? 100.0 * slowest_mean / total_mean : 0.0);
+
+		if (trace_path != NULL)
+			write_chrome_trace(trace_path, (TracePoint **)chain->pdata, n_points, times, threads, pts, frames);
+
+		g_free(slowest);
+		g_free(ms);
+		g_free(queueing);
+	}
+
+	g_free(times);
+	g_free(threads);
+	g_free(pts);
+	g_free(cursor);
+}
+
+/* Prints the per-hop latencies of every chain, and writes a Chrome trace to trace_path unless it is NULL */
+void tracer_report(Tracer *tracer, const gchar *trace_path)
+{
+	GPtrArray *points = g_ptr_array_new();
+	GPtrArray *path = g_ptr_array_new();
+	GPtrArray *chains = g_ptr_array_new();
+
+	g_mutex_lock(&tracer->lock);
+	for (guint i = 0; i < tracer->points->len; i++)
+	{
+		TracePoint *point = (TracePoint *)g_ptr_array_index(tracer->points, i);
+		if (point->entries->len > 0)
+			g_ptr_array_add(points, point);
+	}
+	g_mutex_unlock(&tracer->lock);
+
+	if (points->len < 2)
+	{
+		g_printerr("Trace: too few pads saw buffers to report (%u).\n", points->len);
+		g_ptr_array_free(points, TRUE);
+		g_ptr_array_free(path, TRUE);
+		g_ptr_array_free(chains, TRUE);
+		return;
+	}
+
+	/* The chains start where the first frame entered the pipeline */
+	g_ptr_array_sort(points, compare_first_entry);
+	g_ptr_array_add(path, g_ptr_array_index(points, 0));
+	collect_chains(points, path, chains);
+
+	for (guint i = 0; i < chains->len; i++)
+	{
+		GPtrArray *chain = (GPtrArray *)g_ptr_array_index(chains, i);
+		TracePoint *last = (TracePoint *)g_ptr_array_index(chain, chain->len - 1);
+		gchar *chain_trace = NULL;
+
+		/* Each branch after a tee gets a trace of its own, named after the pad it ends at */
+		if (trace_path != NULL && chains->len > 1)
+		{
+			const gchar *dot = strrchr(trace_path, '.');
+			const gchar *sep = MAX(strrchr(trace_path, '/'), strrchr(trace_path, '\\'));
+
+			if (dot == NULL || dot < sep)
+				dot = trace_path + strlen(trace_path);
+			chain_trace = g_strdup_printf("%.*s-%s%s", (int)(dot - trace_path), trace_path, last->element, dot);
+		}
+		if (chains->len > 1)
+			g_print("\nChain %u of %u, ending at %s\n", i + 1, chains->len, last->name);
+		report_chain(chain, chain_trace != NULL ? chain_trace : trace_path);
+		g_free(chain_trace);
+		g_ptr_array_free(chain, TRUE);
+	}
+
+	g_ptr_array_free(points, TRUE);
+	g_ptr_array_free(path, TRUE);
+	g_ptr_array_free(chains, TRUE);
+}
+
+void tracer_free(Tracer *tracer)
+{
+	for (guint i = 0; i < tracer->points->len; i++)
+	{
+		TracePoint *point = (TracePoint *)g_ptr_array_index(tracer->points, i);
+
+		gst_pad_remove_probe(point->pad, point->probe);
+		gst_object_unref(point->pad);
+		if (point->peer != NULL)
+			gst_object_unref(point->peer);
+		g_free(point->element);
+		g_free(point->name);
+		g_array_free(point->entries, TRUE);
+		g_free(point);
+	}
+	g_ptr_array_free(tracer->points, TRUE);
+	g_hash_table_destroy(tracer->pads);
+	g_mutex_clear(&tracer->lock);
+	g_free(tracer);
+}
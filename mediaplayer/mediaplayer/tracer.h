@@ -0,0 +1,18 @@
+/*
+ * GStreamer Media Player
+ * Per-hop latency tracing of every link in the pipeline.
+ */
+
+#ifndef _TRACER_H_
+#define _TRACER_H_
+
+#include <gst/gst.h>
+
+typedef struct _Tracer Tracer;
+
+Tracer *tracer_new(void);
+void tracer_attach(Tracer *tracer, GstElement *pipeline);
+void tracer_report(Tracer *tracer, const gchar *trace_path);
+void tracer_free(Tracer *tracer);
+
+#endif
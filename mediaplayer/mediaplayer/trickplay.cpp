@@ -0,0 +1,251 @@
+/*
+ * GStreamer Media Player
+ * Playback speed, direction and keyframe seeks typed on the console.
+ *
+ * The commands are read line by line from stdin on the main loop, so they
+ * run between the bus messages. A change of rate is a flushing seek from
+ * the current position at the new rate; rates above 1 and reverse playback
+ * also ask for a trick mode, which lets the decoder leave frames out and
+ * makes the filters show the frames as previews instead of filtering them
+ * in full, see their trickmode property. Jumps are key unit seeks, which
+ * land on the nearest keyframe in the direction of the jump and only have
+ * to decode that one frame, so stepping through a long study stays quick.
+ *
+ * The filters preview the keyframe a key unit seek lands on. While playing
+ * the frames after it are filtered in full right away, while paused the
+ * preview would stay on screen, so once the jumps stop for a moment the
+ * position is sought again accurately and the frame filtered in full.
+ */
+
+#include <gst/gst.h>
+#include <stdio.h>
+#include "trickplay.h"
+
+/* Fastest and slowest rate, in either direction */
+#define MAX_RATE 32.0
+#define MIN_RATE 0.125
+/* Seconds a jump without a number moves */
+#define DEFAULT_JUMP 10.0
+/* Milliseconds without jumps before a paused frame is filtered in full */
+#define REFINE_DELAY 300
+
+struct _TrickPlay
+{
+	GstElement *pipeline;
+	GMainLoop *loop;
+	GIOChannel *channel;
+	guint watch;
+	gdouble rate;
+	gboolean paused;
+	/* Seek flags of the player's loops, kept by every seek so looping goes on */
+	GstSeekFlags loop_flags;
+	/* Accurate seek pending after jumps while paused */
+	guint refine;
+	gint64 refine_position;
+};
+
+/* Trick mode flags for the rate, the filters follow them as well as the rate */
+static GstSeekFlags rate_flags(gdouble rate)
+{
+	return rate > 1.0 || rate < 0.0 ? GST_SEEK_FLAG_TRICKMODE : GST_SEEK_FLAG_NONE;
+}
+
+/* Seeks to position at the current rate, backwards playback ends at the position instead of starting there */
+static gboolean trick_play_seek(TrickPlay *trick, gint64 position, GstSeekFlags flags)
+{
+	flags = (GstSeekFlags)(flags | GST_SEEK_FLAG_FLUSH | trick->loop_flags | rate_flags(trick->rate));
+	if (trick->rate > 0)
+		return gst_element_seek(trick->pipeline, trick->rate, GST_FORMAT_TIME, flags,
+			GST_SEEK_TYPE_SET, position, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+	return gst_element_seek(trick->pipeline, trick->rate, GST_FORMAT_TIME, flags,
+		GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, position);
+}
+
+static gboolean trick_play_refine(gpointer user_data)
+{
+	TrickPlay *trick = (TrickPlay *)user_data;
+
+	trick->refine = 0;
+	if (trick->paused && !trick_play_seek(trick, trick->refine_position, GST_SEEK_FLAG_ACCURATE))
+		g_print("Seek failed!\n");
+	return G_SOURCE_REMOVE;
+}
+
+/* Plays on from the current position at a new rate */
+static void trick_play_set_rate(TrickPlay *trick, gdouble rate)
+{
+	gint64 position;
+	gdouble old_rate = trick->rate;
+
+	if (!gst_element_query_position(trick->pipeline, GST_FORMAT_TIME, &position))
+	{
+		g_print("Position unknown, rate not changed.\n");
+		return;
+	}
+	trick->rate = rate;
+	if (!trick_play_seek(trick, position, GST_SEEK_FLAG_ACCURATE))
+	{
+		g_print("Seek failed!\n");
+		trick->rate = old_rate;
+		return;
+	}
+	g_print("Rate %gx%s\n", rate, rate_flags(rate) != GST_SEEK_FLAG_NONE ? ", trick mode" : "");
+}
+
+/* Key unit seek to position, snapping to the keyframe in the direction of the jump */
+static void trick_play_jump(TrickPlay *trick, gint64 position, gboolean forward)
+{
+	GstSeekFlags flags = (GstSeekFlags)(GST_SEEK_FLAG_KEY_UNIT |
+		(forward ? GST_SEEK_FLAG_SNAP_AFTER : GST_SEEK_FLAG_SNAP_BEFORE));
+
+	position = MAX(position, 0);
+	if (!trick_play_seek(trick, position, flags))
+	{
+		g_print("Seek failed!\n");
+		return;
+	}
+	g_print("Jumped to the keyframe %s %" GST_TIME_FORMAT "\n", forward ? "after" : "before",
+		GST_TIME_ARGS(position));
+
+	if (trick->refine != 0)
+		g_source_remove(trick->refine);
+	trick->refine = trick->paused ? g_timeout_add(REFINE_DELAY, trick_play_refine, trick) : 0;
+	trick->refine_position = position;
+}
+
+/* Runs one command line */
+static void trick_play_command(TrickPlay *trick, gchar *line)
+{
+	gchar *argument = g_strstrip(line) + 1;
+	gint64 position = 0;
+	gdouble seconds;
+
+	switch (line[0])
+	{
+	case 'f':
+		if (ABS(trick->rate) < MAX_RATE)
+			trick_play_set_rate(trick, trick->rate * 2);
+		break;
+	case 's':
+		if (ABS(trick->rate) > MIN_RATE)
+			trick_play_set_rate(trick, trick->rate / 2);
+		break;
+	case 'r':
+		trick_play_set_rate(trick, -trick->rate);
+		break;
+	case 'n':
+		trick_play_set_rate(trick, 1.0);
+		break;
+	case 'j':
+	case 'g':
+		seconds = g_ascii_strtod(argument, NULL);
+		if (line[0] == 'j')
+		{
+			if (*g_strstrip(argument) == '\0')
+				seconds = DEFAULT_JUMP;
+			if (!gst_element_query_position(trick->pipeline, GST_FORMAT_TIME, &position))
+			{
+				g_print("Position unknown, not jumping.\n");
+				break;
+			}
+			trick_play_jump(trick, position + (gint64)(seconds * GST_SECOND), seconds >= 0);
+		}
+		else
+		{
+			gst_element_query_position(trick->pipeline, GST_FORMAT_TIME, &position);
+			trick_play_jump(trick, (gint64)(seconds * GST_SECOND), seconds * GST_SECOND >= position);
+		}
+		break;
+	case 'p':
+		trick->paused = !trick->paused;
+		gst_element_set_state(trick->pipeline, trick->paused ? GST_STATE_PAUSED : GST_STATE_PLAYING);
+		g_print("%s\n", trick->paused ? "Paused" : "Playing");
+		break;
+	case '.':
+		if (trick->paused)
+			gst_element_send_event(trick->pipeline, gst_event_new_step(GST_FORMAT_BUFFERS, 1, 1.0, TRUE, FALSE));
+		else
+			g_print("Pause first to step frame by frame.\n");
+		break;
+	case 'q':
+		g_main_loop_quit(trick->loop);
+		break;
+	case '\0':
+		break;
+	default:
+		trick_play_print_help();
+		break;
+	}
+}
+
+/* Reads the commands typed on the console, from the main loop */
+static gboolean trick_play_read(GIOChannel *channel, GIOCondition condition, gpointer user_data)
+{
+	TrickPlay *trick = (TrickPlay *)user_data;
+	gchar *line = NULL;
+	GIOStatus status = g_io_channel_read_line(channel, &line, NULL, NULL, NULL);
+
+	if (status == G_IO_STATUS_NORMAL)
+		trick_play_command(trick, line);
+	g_free(line);
+	if (status == G_IO_STATUS_EOF || status == G_IO_STATUS_ERROR)
+	{
+		trick->watch = 0;
+		return G_SOURCE_REMOVE;
+	}
+	return G_SOURCE_CONTINUE;
+}
+
+/* Reads commands from the console, with segments the seeks loop the video like the player does */
+TrickPlay *trick_play_new(GstElement *pipeline, GMainLoop *loop, gboolean segments)
+{
+	TrickPlay *trick = g_new0(TrickPlay, 1);
+
+	trick->pipeline = pipeline;
+	trick->loop = loop;
+	trick->rate = 1.0;
+	trick->loop_flags = segments ? GST_SEEK_FLAG_SEGMENT : GST_SEEK_FLAG_NONE;
+#ifdef G_OS_WIN32
+	trick->channel = g_io_channel_win32_new_fd(_fileno(stdin));
+#else
+	trick->channel = g_io_channel_unix_new(fileno(stdin));
+#endif
+	trick->watch = g_io_add_watch(trick->channel, (GIOCondition)(G_IO_IN | G_IO_HUP), trick_play_read, trick);
+	return trick;
+}
+
+void trick_play_print_help(void)
+{
+	g_print("Commands, followed by enter:\n"
+		"  f  faster          s  slower       r  reverse      n  normal speed\n"
+		"  j [SECONDS]  jump by keyframes, back when negative (default 10)\n"
+		"  g SECONDS    go to the keyframe nearest the time\n"
+		"  p  pause or play   .  next frame   q  quit\n");
+}
+
+gdouble trick_play_get_rate(TrickPlay *trick)
+{
+	return trick->rate;
+}
+
+/* Trick mode flags the player's own seeks need to keep the current rate a trick mode */
+GstSeekFlags trick_play_seek_flags(TrickPlay *trick)
+{
+	return rate_flags(trick->rate);
+}
+
+/* Whether the pipeline was paused on the console and should not be set playing */
+gboolean trick_play_is_paused(TrickPlay *trick)
+{
+	return trick->paused;
+}
+
+void trick_play_free(TrickPlay *trick)
+{
+	if (trick->refine != 0)
+		g_source_remove(trick->refine);
+	if (trick->watch != 0)
+		g_source_remove(trick->watch);
+	g_io_channel_unref(trick->channel);
+	g_free(trick);
+}
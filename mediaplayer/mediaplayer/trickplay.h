@@ -0,0 +1,20 @@
+/*
+ * GStreamer Media Player
+ * Playback speed, direction and keyframe seeks typed on the console.
+ */
+
+#ifndef _TRICKPLAY_H_
+#define _TRICKPLAY_H_
+
+#include <gst/gst.h>
+
+typedef struct _TrickPlay TrickPlay;
+
+TrickPlay *trick_play_new(GstElement *pipeline, GMainLoop *loop, gboolean segments);
+void trick_play_print_help(void);
+gdouble trick_play_get_rate(TrickPlay *trick);
+GstSeekFlags trick_play_seek_flags(TrickPlay *trick);
+gboolean trick_play_is_paused(TrickPlay *trick);
+void trick_play_free(TrickPlay *trick);
+
+#endif
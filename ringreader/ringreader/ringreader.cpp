@@ -0,0 +1,242 @@
+/*
+ * ringreader
+ * Reads the frames the ringsink element publishes in shared memory, from
+ * another process, and reports how many arrive and how late.
+ *
+ * Every frame is read in place in the ring, its luma is summed to touch
+ * every pixel like a consumer would, and the frame counts only if the writer
+ * did not overwrite it meanwhile. Once a second it prints the frames per
+ * second delivered, the latency from the writer publishing a frame to the
+ * reader having it, and the frames skipped because the reader was behind.
+ * At exit it prints the totals with latency percentiles.
+ *
+ * With --write it is the writer instead and publishes synthetic frames at a
+ * fixed rate, so a ring can be tried without a pipeline.
+ */
+
+#include <glib.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cvring.h"
+
+#define DEFAULT_RING_NAME "cvring"
+/* How long to wait for a frame, or for the writer to come back, before giving up */
+#define DEFAULT_TIMEOUT 5
+
+/* Command line options */
+static gchar *opt_ring = NULL;
+static gint opt_seconds = 0;
+static gint opt_frames = 0;
+static gint opt_hold = 0;
+static gint opt_timeout = DEFAULT_TIMEOUT;
+static gboolean opt_write = FALSE;
+static gchar *opt_size = NULL;
+static gdouble opt_fps = 60.0;
+static gint opt_slots = 4;
+
+static GOptionEntry entries[] =
+{
+	{ "ring", 'r', 0, G_OPTION_ARG_STRING, &opt_ring, "Name of the ring (default " DEFAULT_RING_NAME ")", "NAME" },
+	{ "seconds", 's', 0, G_OPTION_ARG_INT, &opt_seconds, "Stop after SECONDS (default until the writer is gone)", "SECONDS" },
+	{ "frames", 'n', 0, G_OPTION_ARG_INT, &opt_frames, "Stop after N frames (default until the writer is gone)", "N" },
+	{ "hold", 0, 0, G_OPTION_ARG_INT, &opt_hold, "Milliseconds spent on every frame, to play a slow consumer", "MS" },
+	{ "timeout", 't', 0, G_OPTION_ARG_INT, &opt_timeout, "Seconds to wait for a frame or for the writer (default 5)", "SECONDS" },
+	{ "write", 'w', 0, G_OPTION_ARG_NONE, &opt_write, "Publish synthetic frames instead of reading them", NULL },
+	{ "size", 0, 0, G_OPTION_ARG_STRING, &opt_size, "Frame size to write (default 1280x720)", "WIDTHxHEIGHT" },
+	{ "fps", 0, 0, G_OPTION_ARG_DOUBLE, &opt_fps, "Frames per second to write (default 60)", "FPS" },
+	{ "slots", 0, 0, G_OPTION_ARG_INT, &opt_slots, "Frames in the written ring (default 4)", "N" },
+	{ NULL }
+};
+
+/* Parses WIDTHxHEIGHT */
+static gboolean parse_size(const gchar *size, gint *width, gint *height)
+{
+	return size != NULL && sscanf(size, "%dx%d", width, height) == 2 && *width > 0 && *height > 0;
+}
+
+static int compare_doubles(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y ? 1 : 0;
+}
+
+/* Sums the luma of the frame in place, the work a consumer would at least do */
+static guint64 touch_frame(const CvRingFrame *frame)
+{
+	const guint8 *row = frame->data + frame->offsets[0];
+	guint64 sum = 0;
+
+	for (gint y = 0; y < frame->height; y++, row += frame->strides[0])
+		for (gint x = 0; x < frame->width; x++)
+			sum += row[x];
+	return sum;
+}
+
+/* Publishes moving gradients at opt_fps until the time or frame limit */
+static int run_writer(const gchar *name)
+{
+	gint width = 1280, height = 720;
+	gint strides[3];
+	gsize offsets[3];
+	CvRing *ring;
+	gint64 start, interval;
+
+	if (opt_size != NULL && !parse_size(opt_size, &width, &height))
+	{
+		g_printerr("Invalid size %s, expected WIDTHxHEIGHT.\n", opt_size);
+		return -1;
+	}
+	ring = cv_ring_create(name, opt_slots, width, height);
+	if (ring == NULL)
+		return -1;
+	cv_ring_get_layout(ring, strides, offsets);
+	g_print("Writing %dx%d frames at %.1f fps to ring %s.\n", width, height, opt_fps, name);
+
+	interval = (gint64)(G_USEC_PER_SEC / MAX(opt_fps, 0.1));
+	start = g_get_monotonic_time();
+	for (guint64 n = 0; opt_frames <= 0 || n < (guint64)opt_frames; n++)
+	{
+		gint64 due = start + (gint64)n * interval;
+		guint8 *slot;
+
+		if (opt_seconds > 0 && due - start >= (gint64)opt_seconds * G_USEC_PER_SEC)
+			break;
+		if (due > g_get_monotonic_time())
+			g_usleep((gulong)(due - g_get_monotonic_time()));
+
+		slot = cv_ring_write_begin(ring);
+		for (gint y = 0; y < height; y++)
+			memset(slot + offsets[0] + (gsize)y * strides[0], (guint8)(y + n), width);
+		memset(slot + offsets[1], 128, offsets[2] - offsets[1]);
+		memset(slot + offsets[2], 128, (gsize)strides[2] * ((height + 1) / 2));
+		cv_ring_write_end(ring, (guint64)(due - start) * 1000);
+	}
+	cv_ring_close(ring);
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	GOptionContext *context;
+	GError *error = NULL;
+	const gchar *name;
+	CvRing *ring = NULL;
+	GArray *latencies;
+	gint64 start, last_report, timeout;
+	guint64 frames = 0, skipped = 0, luma = 0;
+	guint64 second_frames = 0, second_skipped = 0;
+	double second_latency = 0.0, second_max = 0.0;
+	gboolean done = FALSE;
+
+	context = g_option_context_new("- read the frames of a ringsink from another process");
+	g_option_context_add_main_entries(context, entries, NULL);
+	if (!g_option_context_parse(context, &argc, &argv, &error))
+	{
+		g_printerr("Option parsing failed: %s\n", error->message);
+		g_clear_error(&error);
+		g_option_context_free(context);
+		return -1;
+	}
+	g_option_context_free(context);
+
+	name = opt_ring != NULL ? opt_ring : DEFAULT_RING_NAME;
+	if (opt_write)
+		return run_writer(name);
+
+	timeout = (gint64)MAX(opt_timeout, 1) * G_USEC_PER_SEC;
+	latencies = g_array_new(FALSE, FALSE, sizeof(double));
+	start = last_report = g_get_monotonic_time();
+	while (!done)
+	{
+		CvRingFrame frame;
+		CvRingReadResult result;
+		gint64 now;
+
+		/* The writer may not be there yet, or be restarting; a new frame size the ring follows itself */
+		if (ring == NULL)
+		{
+			gint64 waited = g_get_monotonic_time();
+
+			while ((ring = cv_ring_open(name)) == NULL && g_get_monotonic_time() - waited < timeout)
+				g_usleep(10000);
+			if (ring == NULL)
+			{
+				g_printerr("No ring %s to read.\n", name);
+				break;
+			}
+			g_print("Reading ring %s.\n", name);
+		}
+
+		result = cv_ring_read_begin(ring, &frame, timeout);
+		now = g_get_monotonic_time();
+		if (result == CV_RING_READ_OK)
+		{
+			double latency = (now - frame.publish_time) / 1000.0;
+			guint64 sum = touch_frame(&frame);
+
+			if (opt_hold > 0)
+				g_usleep((gulong)opt_hold * 1000);
+			if (cv_ring_read_end(ring, &frame))
+			{
+				luma += sum / ((guint64)frame.width * frame.height);
+				g_array_append_val(latencies, latency);
+				second_latency += latency;
+				second_max = MAX(second_max, latency);
+				second_frames++;
+				frames++;
+			}
+		}
+		else if (result == CV_RING_READ_CLOSED)
+		{
+			skipped += cv_ring_get_skipped(ring);
+			cv_ring_close(ring);
+			ring = NULL;
+			g_print("Writer closed ring %s.\n", name);
+		}
+		else
+		{
+			g_print("No frame for %d seconds, stopping.\n", opt_timeout);
+			done = TRUE;
+		}
+
+		now = g_get_monotonic_time();
+		if (now - last_report >= G_USEC_PER_SEC || done)
+		{
+			guint64 total_skipped = skipped + (ring != NULL ? cv_ring_get_skipped(ring) : 0);
+
+			if (second_frames > 0)
+				g_print("%8.1f fps, latency mean %7.3f ms, max %7.3f ms, skipped %" G_GUINT64_FORMAT "\n",
+					second_frames * (double)G_USEC_PER_SEC / (now - last_report),
+					second_latency / second_frames, second_max, total_skipped - second_skipped);
+			second_frames = 0;
+			second_latency = second_max = 0.0;
+			second_skipped = total_skipped;
+			last_report = now;
+		}
+		if ((opt_frames > 0 && frames >= (guint64)opt_frames) ||
+			(opt_seconds > 0 && now - start >= (gint64)opt_seconds * G_USEC_PER_SEC))
+			done = TRUE;
+	}
+
+	if (ring != NULL)
+	{
+		skipped += cv_ring_get_skipped(ring);
+		cv_ring_close(ring);
+	}
+
+	if (frames > 0)
+	{
+		double seconds = (g_get_monotonic_time() - start) / (double)G_USEC_PER_SEC;
+		double *l = (double *)latencies->data;
+
+		qsort(l, latencies->len, sizeof(double), compare_doubles);
+		g_print("\nRead %" G_GUINT64_FORMAT " frames in %.1f s, %.1f fps, skipped %" G_GUINT64_FORMAT
+			", mean luma %.1f\n", frames, seconds, frames / seconds, skipped, (double)luma / frames);
+		g_print("Latency p50 %.3f ms, p90 %.3f ms, p99 %.3f ms, max %.3f ms\n",
+			l[latencies->len / 2], l[latencies->len * 9 / 10], l[latencies->len * 99 / 100], l[latencies->len - 1]);
+	}
+	g_array_free(latencies, TRUE);
+	return frames > 0 ? 0 : -1;
+}
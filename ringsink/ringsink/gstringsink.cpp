@@ -0,0 +1,327 @@
+/* GStreamer
+* Copyright (C) 2019 Jakob 
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin Street, Suite 500,
+* Boston, MA 02110-1335, USA.
+*/
+/**
+* SECTION:element-gstringsink
+*
+* The ringsink element publishes every I420 frame it receives in a ring of
+* frames in shared memory, which other processes map to read the frames in
+* place. The ring is named by the ring-name property and holds slots frames,
+* see common/cvring.cpp for its layout. A reader that falls behind skips to
+* the newest frame, the sink never waits for its readers.
+*
+* gst-launch-1.0 videotestsrc ! video/x-raw,format=I420 ! blurfilter sigma=2 filtering=-1 ! ringsink ring-name=cvring
+*/
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+#include <gst/video/video.h>
+#include "gstringsink.h"
+#include "cvring.h"
+#include <cstring>
+
+
+GST_DEBUG_CATEGORY_STATIC(gst_ring_sink_debug_category);
+#define GST_CAT_DEFAULT gst_ring_sink_debug_category
+
+#define DEFAULT_RING_NAME "cvring"
+#define DEFAULT_SLOTS 4
+
+/* Quick fix to make GParamFlags enums cooperate with | */
+inline GParamFlags operator | (GParamFlags lhs, GParamFlags rhs)
+{
+	return static_cast<GParamFlags>(static_cast<int>(lhs) | static_cast<int>(rhs));
+}
+
+
+static void gst_ring_sink_set_property(GObject * object,
+	guint property_id, const GValue * value, GParamSpec * pspec);
+static void gst_ring_sink_get_property(GObject * object,
+	guint property_id, GValue * value, GParamSpec * pspec);
+static void gst_ring_sink_finalize(GObject * object);
+static gboolean gst_ring_sink_set_caps(GstBaseSink * sink, GstCaps * caps);
+static gboolean gst_ring_sink_stop(GstBaseSink * sink);
+static GstFlowReturn gst_ring_sink_render(GstBaseSink * sink, GstBuffer * buffer);
+
+enum
+{
+	PROP_0,
+	PROP_RING_NAME,
+	PROP_SLOTS,
+	PROP_FRAMES
+};
+
+/* The ring holds I420 frames in GStreamer's default layout */
+#define VIDEO_SINK_CAPS \
+    GST_VIDEO_CAPS_MAKE("{ I420 }")
+
+
+/* class initialization */
+G_DEFINE_TYPE_WITH_CODE(GstRingSink, gst_ring_sink, GST_TYPE_BASE_SINK,
+	GST_DEBUG_CATEGORY_INIT(gst_ring_sink_debug_category, "ringsink", 0,
+		"debug category for ringsink element"));
+
+
+static void
+gst_ring_sink_class_init(GstRingSinkClass * klass)
+{
+	GObjectClass *gobject_class = G_OBJECT_CLASS(klass);
+	GstBaseSinkClass *base_sink_class = GST_BASE_SINK_CLASS(klass);
+
+	gst_element_class_add_pad_template(GST_ELEMENT_CLASS(klass),
+		gst_pad_template_new("sink", GST_PAD_SINK, GST_PAD_ALWAYS,
+			gst_caps_from_string(VIDEO_SINK_CAPS)));
+
+	gst_element_class_set_static_metadata(GST_ELEMENT_CLASS(klass),
+		"Ring sink", "Sink/Video", "Publishes frames in a shared memory ring read by other processes",
+		"Jakob");
+
+	gobject_class->set_property = gst_ring_sink_set_property;
+	gobject_class->get_property = gst_ring_sink_get_property;
+	gobject_class->finalize = gst_ring_sink_finalize;
+	base_sink_class->set_caps = GST_DEBUG_FUNCPTR(gst_ring_sink_set_caps);
+	base_sink_class->stop = GST_DEBUG_FUNCPTR(gst_ring_sink_stop);
+	base_sink_class->render = GST_DEBUG_FUNCPTR(gst_ring_sink_render);
+
+	g_object_class_install_property(gobject_class, PROP_RING_NAME,
+		g_param_spec_string("ring-name", "Ring name", "Name of the shared memory the readers open",
+			DEFAULT_RING_NAME, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_SLOTS,
+		g_param_spec_uint("slots", "Slots",
+			"Frames the ring holds, the more the further readers can fall behind without skipping",
+			2, 64, DEFAULT_SLOTS, G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS));
+	g_object_class_install_property(gobject_class, PROP_FRAMES,
+		g_param_spec_uint64("frames", "Frames", "Frames published in the ring",
+			0, G_MAXUINT64, 0, G_PARAM_READABLE | G_PARAM_STATIC_STRINGS));
+}
+
+static void
+gst_ring_sink_init(GstRingSink *ringsink)
+{
+	ringsink->ring_name = g_strdup(DEFAULT_RING_NAME);
+	ringsink->slots = DEFAULT_SLOTS;
+	ringsink->ring = NULL;
+	ringsink->frames = 0;
+	gst_video_info_init(&ringsink->info);
+
+	/* Frames are published as soon as they come, readers get them with the least latency */
+	gst_base_sink_set_sync(GST_BASE_SINK(ringsink), FALSE);
+}
+
+void
+gst_ring_sink_set_property(GObject * object, guint property_id,
+	const GValue * value, GParamSpec * pspec)
+{
+	GstRingSink *ringsink = GST_RING_SINK(object);
+
+	/* A new name or size takes effect with the next caps */
+	GST_OBJECT_LOCK(ringsink);
+	switch (property_id) {
+	case PROP_RING_NAME:
+		g_free(ringsink->ring_name);
+		ringsink->ring_name = g_value_dup_string(value);
+		break;
+	case PROP_SLOTS:
+		ringsink->slots = g_value_get_uint(value);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+		break;
+	}
+	GST_OBJECT_UNLOCK(ringsink);
+}
+
+void
+gst_ring_sink_get_property(GObject * object, guint property_id,
+	GValue * value, GParamSpec * pspec)
+{
+	GstRingSink *ringsink = GST_RING_SINK(object);
+
+	GST_OBJECT_LOCK(ringsink);
+	switch (property_id) {
+	case PROP_RING_NAME:
+		g_value_set_string(value, ringsink->ring_name);
+		break;
+	case PROP_SLOTS:
+		g_value_set_uint(value, ringsink->slots);
+		break;
+	case PROP_FRAMES:
+		g_value_set_uint64(value, ringsink->frames);
+		break;
+	default:
+		G_OBJECT_WARN_INVALID_PROPERTY_ID(object, property_id, pspec);
+		break;
+	}
+	GST_OBJECT_UNLOCK(ringsink);
+}
+
+static void
+gst_ring_sink_finalize(GObject * object)
+{
+	GstRingSink *ringsink = GST_RING_SINK(object);
+
+	if (ringsink->ring != NULL)
+		cv_ring_close(ringsink->ring);
+	g_free(ringsink->ring_name);
+
+	G_OBJECT_CLASS(gst_ring_sink_parent_class)->finalize(object);
+}
+
+/* Creates the ring for the negotiated frame size, or moves it to a new one, which readers follow */
+static gboolean
+gst_ring_sink_set_caps(GstBaseSink * sink, GstCaps * caps)
+{
+	GstRingSink *ringsink = GST_RING_SINK(sink);
+	GstVideoInfo info;
+	gchar *name;
+	guint slots;
+
+	if (!gst_video_info_from_caps(&info, caps))
+		return FALSE;
+
+	if (ringsink->ring != NULL)
+	{
+		if (GST_VIDEO_INFO_WIDTH(&info) == GST_VIDEO_INFO_WIDTH(&ringsink->info) &&
+			GST_VIDEO_INFO_HEIGHT(&info) == GST_VIDEO_INFO_HEIGHT(&ringsink->info))
+		{
+			ringsink->info = info;
+			return TRUE;
+		}
+		if (!cv_ring_resize(ringsink->ring, GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info)))
+		{
+			GST_ELEMENT_ERROR(ringsink, RESOURCE, OPEN_WRITE, (NULL),
+				("could not resize the shared memory ring to %dx%d",
+				GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info)));
+			return FALSE;
+		}
+		GST_INFO_OBJECT(ringsink, "publishing %dx%d frames from now on",
+			GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info));
+		ringsink->info = info;
+		return TRUE;
+	}
+
+	GST_OBJECT_LOCK(ringsink);
+	name = g_strdup(ringsink->ring_name);
+	slots = ringsink->slots;
+	GST_OBJECT_UNLOCK(ringsink);
+
+	ringsink->ring = cv_ring_create(name, slots, GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info));
+	if (ringsink->ring == NULL)
+	{
+		GST_ELEMENT_ERROR(ringsink, RESOURCE, OPEN_WRITE, (NULL),
+			("could not create the shared memory ring %s", name));
+		g_free(name);
+		return FALSE;
+	}
+	GST_INFO_OBJECT(ringsink, "publishing %dx%d frames in ring %s of %u slots",
+		GST_VIDEO_INFO_WIDTH(&info), GST_VIDEO_INFO_HEIGHT(&info), name, slots);
+	g_free(name);
+	ringsink->info = info;
+	return TRUE;
+}
+
+static gboolean
+gst_ring_sink_stop(GstBaseSink * sink)
+{
+	GstRingSink *ringsink = GST_RING_SINK(sink);
+
+	if (ringsink->ring != NULL)
+	{
+		cv_ring_close(ringsink->ring);
+		ringsink->ring = NULL;
+	}
+	return TRUE;
+}
+
+/* Copies the frame into the next slot of the ring and publishes it */
+static GstFlowReturn
+gst_ring_sink_render(GstBaseSink * sink, GstBuffer * buffer)
+{
+	GstRingSink *ringsink = GST_RING_SINK(sink);
+	GstVideoFrame frame;
+	gint strides[3];
+	gsize offsets[3];
+	guint8 *slot;
+
+	if (ringsink->ring == NULL)
+		return GST_FLOW_NOT_NEGOTIATED;
+	if (!gst_video_frame_map(&frame, &ringsink->info, buffer, GST_MAP_READ))
+	{
+		GST_ELEMENT_ERROR(ringsink, STREAM, FAILED, (NULL), ("could not map the frame"));
+		return GST_FLOW_ERROR;
+	}
+
+	cv_ring_get_layout(ringsink->ring, strides, offsets);
+	slot = cv_ring_write_begin(ringsink->ring);
+	for (guint plane = 0; plane < 3; plane++)
+	{
+		const guint8 *s = (const guint8 *)GST_VIDEO_FRAME_PLANE_DATA(&frame, plane);
+		guint8 *d = slot + offsets[plane];
+		gint src_stride = GST_VIDEO_FRAME_PLANE_STRIDE(&frame, plane);
+		gint width = GST_VIDEO_FRAME_COMP_WIDTH(&frame, plane);
+		gint height = GST_VIDEO_FRAME_COMP_HEIGHT(&frame, plane);
+
+		/* Same layout on both sides, as with a default pool, is one copy of the plane */
+		if (src_stride == strides[plane])
+			memcpy(d, s, (gsize)src_stride * height);
+		else
+			for (gint y = 0; y < height; y++)
+				memcpy(d + (gsize)y * strides[plane], s + (gsize)y * src_stride, width);
+	}
+	cv_ring_write_end(ringsink->ring, GST_BUFFER_PTS(buffer));
+	gst_video_frame_unmap(&frame);
+
+	GST_OBJECT_LOCK(ringsink);
+	ringsink->frames++;
+	GST_OBJECT_UNLOCK(ringsink);
+	return GST_FLOW_OK;
+}
+
+
+/* Boilerplate plugin initialization */
+static gboolean
+plugin_init(GstPlugin * plugin)
+{
+	return gst_element_register(plugin, "ringsink", GST_RANK_NONE,
+		GST_TYPE_RING_SINK);
+}
+
+
+/* Plugin definitions */
+#ifndef VERSION
+#define VERSION "0.1.0"
+#endif
+#ifndef PACKAGE
+#define PACKAGE "SimplePackage"
+#endif
+#ifndef PACKAGE_NAME
+#define PACKAGE_NAME "Package name"
+#endif
+#ifndef GST_PACKAGE_ORIGIN
+#define GST_PACKAGE_ORIGIN "http://origin.org/"
+#endif
+
+GST_PLUGIN_DEFINE(GST_VERSION_MAJOR,
+	GST_VERSION_MINOR,
+	ringsink,
+	"Shared memory ring of frames for other processes",
+	plugin_init, VERSION, "LGPL", PACKAGE_NAME, GST_PACKAGE_ORIGIN)
@@ -0,0 +1,59 @@
+/* GStreamer
+* Copyright (C) 2019 FIXME <fixme@example.com>
+*
+* This library is free software; you can redistribute it and/or
+* modify it under the terms of the GNU Library General Public
+* License as published by the Free Software Foundation; either
+* version 2 of the License, or (at your option) any later version.
+*
+* This library is distributed in the hope that it will be useful,
+* but WITHOUT ANY WARRANTY; without even the implied warranty of
+* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+* Library General Public License for more details.
+*
+* You should have received a copy of the GNU Library General Public
+* License along with this library; if not, write to the
+* Free Software Foundation, Inc., 51 Franklin St, Fifth Floor,
+* Boston, MA 02110-1301, USA.
+*/
+
+#ifndef _GST_RING_SINK_H_
+#define _GST_RING_SINK_H_
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+#include <gst/video/video.h>
+#include "cvring.h"
+
+G_BEGIN_DECLS
+
+#define GST_TYPE_RING_SINK   (gst_ring_sink_get_type())
+#define GST_RING_SINK(obj)   (G_TYPE_CHECK_INSTANCE_CAST((obj),GST_TYPE_RING_SINK,GstRingSink))
+#define GST_RING_SINK_CLASS(klass)   (G_TYPE_CHECK_CLASS_CAST((klass),GST_TYPE_RING_SINK,GstRingSinkClass))
+#define GST_IS_RING_SINK(obj)   (G_TYPE_CHECK_INSTANCE_TYPE((obj),GST_TYPE_RING_SINK))
+#define GST_IS_RING_SINK_CLASS(obj)   (G_TYPE_CHECK_CLASS_TYPE((klass),GST_TYPE_RING_SINK))
+
+typedef struct _GstRingSink GstRingSink;
+typedef struct _GstRingSinkClass GstRingSinkClass;
+
+struct _GstRingSink
+{
+	GstBaseSink base_ringsink;
+	gchar *ring_name;
+	guint slots;
+	/* Created for the negotiated frame size, again when it changes */
+	CvRing *ring;
+	GstVideoInfo info;
+	guint64 frames;
+};
+
+struct _GstRingSinkClass
+{
+	GstBaseSinkClass base_ringsink_class;
+};
+
+GType gst_ring_sink_get_type(void);
+
+G_END_DECLS
+
+#endif